@@ -9,6 +9,7 @@
 #include <nvm_util.h>
 #include <nvm_queue.h>
 #include <nvm_cmd.h>
+#include <nvm_pool.h>
 #include <stdexcept>
 #include <vector>
 #include <memory>
@@ -295,11 +296,14 @@ int main(int argc, char** argv)
 
 
 
-static Time sendWindow(QueuePtr& queue, TransferPtr& from, const TransferPtr& to, const BufferPtr& buffer, uint32_t ns, Barrier* barrier)
+static Time sendWindow(QueuePtr& queue, TransferPtr& from, const TransferPtr& to, const BufferPtr& buffer, uint32_t ns, Barrier* barrier, std::vector<nvm_cpl_t>& cpls)
 {
     size_t numCommands = 0;
     size_t numBlocks = 0;
 
+    std::vector<void*> prpLists;
+    prpLists.reserve(queue->depth);
+
     // Fill up to queue depth with commands
     for (numCommands = 0; numCommands < queue->depth && from != to; ++numCommands, ++from)
     {
@@ -310,12 +314,20 @@ static Time sendWindow(QueuePtr& queue, TransferPtr& from, const TransferPtr& to
         }
 
         const Transfer& t = *from;
-        void* prpListPtr = NVM_DMA_OFFSET(queue->sq_mem, 1 + numCommands);
-        uint64_t prpListAddr = queue->sq_mem->ioaddrs[1 + numCommands];
         
         nvm_cmd_header(cmd, t.write ? NVM_IO_WRITE : NVM_IO_READ, ns);
         nvm_cmd_rw_blks(cmd, t.startBlock, t.numBlocks);
-        nvm_cmd_data(cmd, buffer->page_size, t.numPages, prpListPtr, prpListAddr, &buffer->ioaddrs[t.startPage]);
+
+        void* prpList = nullptr;
+        if (nvm_prp_pool_cmd_data(queue->prpPool.get(), cmd, t.numPages, &buffer->ioaddrs[t.startPage], &prpList) != 0)
+        {
+            throw runtime_error(string("Out of PRP lists, should not happen!"));
+        }
+
+        if (prpList != nullptr)
+        {
+            prpLists.push_back(prpList);
+        }
 
         numBlocks += t.numBlocks;
     }
@@ -329,27 +341,35 @@ static Time sendWindow(QueuePtr& queue, TransferPtr& from, const TransferPtr& to
     std::this_thread::yield();
 
     // Wait for all completions
-    for (size_t i = 0; i < numCommands; ++i)
+    size_t numCpls = 0;
+    while (numCpls < numCommands)
     {
-        nvm_cpl_t* cpl;
-        while ((cpl = nvm_cq_dequeue(&queue->cq)) == nullptr)
+        size_t n = nvm_cq_dequeue_batch(&queue->cq, &queue->sq, &cpls[numCpls], numCommands - numCpls);
+        if (n == 0)
         {
             std::this_thread::yield();
+            continue;
         }
 
-        nvm_sq_update(&queue->sq);
-
-        if (!NVM_ERR_OK(cpl))
+        for (size_t i = numCpls; i < numCpls + n; ++i)
         {
-            fprintf(stderr, "%u: %s\n", queue->no, nvm_strerror(NVM_ERR_STATUS(cpl)));
+            if (!NVM_ERR_OK(&cpls[i]))
+            {
+                fprintf(stderr, "%u: %s\n", queue->no, nvm_strerror(NVM_ERR_STATUS(&cpls[i])));
+            }
         }
 
-        nvm_cq_update(&queue->cq);
+        numCpls += n;
     }
 
     // Get current time after all commands completed
     auto after = std::chrono::high_resolution_clock::now();
 
+    for (void* prpList: prpLists)
+    {
+        nvm_prp_pool_put(queue->prpPool.get(), prpList);
+    }
+
     return Time(numCommands, numBlocks, after - before);
 }
 
@@ -380,6 +400,9 @@ static void flush(QueuePtr& queue, uint32_t ns)
 
 static void measure(QueuePtr queue, const BufferPtr buffer, Times* times, const Settings& settings, Barrier* barrier)
 {
+    // Completion buffer is allocated up front, so it is not part of the measured latency
+    std::vector<nvm_cpl_t> cpls(queue->depth);
+
     for (size_t i = 0; i < settings.repetitions; ++i)
     {
         const TransferPtr transferEnd = queue->transfers.cend();
@@ -387,7 +410,7 @@ static void measure(QueuePtr queue, const BufferPtr buffer, Times* times, const
         
         while (transferPtr != transferEnd)
         {
-            auto time = sendWindow(queue, transferPtr, transferEnd, buffer, settings.nvmNamespace, barrier);
+            auto time = sendWindow(queue, transferPtr, transferEnd, buffer, settings.nvmNamespace, barrier, cpls);
 
             times->push_back(time);
         }
@@ -5,6 +5,7 @@
 #include <nvm_types.h>
 #include <nvm_util.h>
 #include <nvm_error.h>
+#include <nvm_pool.h>
 #include <stdexcept>
 #include <string>
 #include <cstring>
@@ -19,45 +20,47 @@ using error = std::runtime_error;
 
 Queue::Queue(const Controller& ctrl, uint32_t adapter, uint32_t segmentId, uint16_t no, size_t depth, bool remote)
     : no(no)
-    , depth(std::min(depth, ctrl.ctrl->page_size / sizeof(nvm_cmd_t)))
+    , depth(std::min(depth, (size_t) ctrl.ctrl->max_entries - 1))
 {
-    void* sqPtr = nullptr;
-    void* cqPtr = nullptr;
-    uint64_t sqAddr = 0;
-    uint64_t cqAddr = 0;
+    // Queues hold one more entry than the number of outstanding commands,
+    // reserve an extra page after each queue in case it needs a PRP list
+    const size_t qs = this->depth + 1;
+    const size_t sqPages = NVM_CTRL_PAGES(ctrl.ctrl, qs * sizeof(nvm_cmd_t)) + 1;
+    const size_t cqPages = NVM_CTRL_PAGES(ctrl.ctrl, qs * sizeof(nvm_cpl_t)) + 1;
+    size_t cqOffset = 0;
 
     if (remote)
     {
         // Allocate submission queue and PRP lists on side closest to disk
-        cq_mem = createBuffer(ctrl.ctrl, adapter, segmentId, ctrl.ctrl->page_size);
-        cqPtr = cq_mem->vaddr;
-        cqAddr = cq_mem->ioaddrs[0];
-
-        sq_mem = createRemoteBuffer(ctrl.ctrl, adapter, no, ctrl.ctrl->page_size * (this->depth + 1));
-        sqPtr = sq_mem->vaddr;
-        sqAddr = sq_mem->ioaddrs[0];
+        cq_mem = createBuffer(ctrl.ctrl, adapter, segmentId, ctrl.ctrl->page_size * cqPages);
+        sq_mem = createRemoteBuffer(ctrl.ctrl, adapter, no, ctrl.ctrl->page_size * (sqPages + this->depth));
     }
     else
     {
         // Allocate local submission queue and PRP lists
-        sq_mem = createBuffer(ctrl.ctrl, adapter, segmentId, ctrl.ctrl->page_size * (this->depth + 2));
-        sqPtr = sq_mem->vaddr;
-        sqAddr = sq_mem->ioaddrs[0];
-    
-        cqPtr = NVM_DMA_OFFSET(sq_mem, 1 + this->depth);
-        cqAddr = sq_mem->ioaddrs[1 + this->depth];
+        sq_mem = createBuffer(ctrl.ctrl, adapter, segmentId, ctrl.ctrl->page_size * (sqPages + this->depth + cqPages));
+        cq_mem = sq_mem;
+        cqOffset = sqPages + this->depth;
     }
 
+    // Pages following the SQ are used as PRP lists
+    nvm_prp_pool* pool = nullptr;
+    int status = nvm_prp_pool_create(&pool, sq_mem.get(), sqPages, this->depth);
+    if (status != 0)
+    {
+        throw error(string("Failed to create PRP list pool: ") + std::strerror(status));
+    }
+    prpPool = PrpPoolPtr(pool, [](nvm_prp_pool* p) { nvm_prp_pool_free(p); });
 
-    memset(cqPtr, 0, ctrl.ctrl->page_size);
-    int status = nvm_admin_cq_create(ctrl.aq_ref, &cq, no, cqPtr, cqAddr);
+    memset(NVM_DMA_OFFSET(cq_mem, cqOffset), 0, ctrl.ctrl->page_size * (cqPages - 1));
+    status = nvm_admin_cq_create(ctrl.aq_ref, &cq, no, cq_mem.get(), cqOffset, qs);
     if (!nvm_ok(status))
     {
         throw error(nvm_strerror(status));
     }
 
-    memset(sqPtr, 0, ctrl.ctrl->page_size);
-    status = nvm_admin_sq_create(ctrl.aq_ref, &sq, &cq, no, sqPtr, sqAddr);
+    memset(sq_mem->vaddr, 0, ctrl.ctrl->page_size * (sqPages - 1));
+    status = nvm_admin_sq_create(ctrl.aq_ref, &sq, &cq, no, sq_mem.get(), 0, qs);
     if (!nvm_ok(status))
     {
         throw error(nvm_strerror(status));
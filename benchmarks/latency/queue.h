@@ -2,6 +2,7 @@
 #define __QUEUE_H__
 
 #include <nvm_types.h>
+#include <nvm_pool.h>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -11,6 +12,9 @@
 #include "ctrl.h"
 
 
+typedef std::shared_ptr<nvm_prp_pool> PrpPoolPtr;
+
+
 struct Queue
 {
     uint16_t                no;
@@ -19,6 +23,7 @@ struct Queue
     nvm_queue_t             sq;
     nvm_queue_t             cq;
     size_t                  depth;
+    PrpPoolPtr              prpPool;
     TransferList            warmups;
     TransferList            transfers;
 
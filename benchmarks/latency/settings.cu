@@ -286,9 +286,9 @@ void Settings::parseArguments(int argc, char** argv)
 
             case 'd':
                 queueDepth = (size_t) parseNumber(optarg);
-                if (queueDepth < 1 || queueDepth >= 64)
+                if (queueDepth < 1 || queueDepth >= 0xffff)
                 {
-                    throw string("Invalid queue depth, must be in range 1-63");
+                    throw string("Invalid queue depth, must be in range 1-65534");
                 }
                 break;
 
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <nvm_types.h>
+#include <nvm_dma.h>
+#include <nvm_aq.h>
+#include <nvm_admin.h>
+#include <nvm_queue.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include "emulate.h"
+
+
+/* Number of queue pairs created in one batch */
+#define BATCH_QUEUES    4
+
+/* Number of entries in batch queues (one page each) */
+#define BATCH_QS        64
+
+/* Number of commands in flight with nvm_admin_submit() */
+#define N_SUBMIT        8
+
+
+
+/*
+ * Read a block through every queue pair in the batch.
+ */
+static int read_through(nvm_queue_t* sqs, nvm_queue_t* cqs, const nvm_dma_t* dma, size_t data_page,
+        const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns)
+{
+    for (uint16_t i = 0; i < BATCH_QUEUES; ++i)
+    {
+        nvm_cmd_t* cmd = nvm_sq_enqueue(&sqs[i]);
+        if (cmd == NULL)
+        {
+            return EAGAIN;
+        }
+
+        nvm_cmd_header(cmd, NVM_IO_READ, ns->ns_id);
+        *NVM_CMD_CID(cmd) = i;
+        nvm_cmd_rw_blks(cmd, i, 1);
+        nvm_cmd_data_ptr(cmd, dma->ioaddrs[data_page], 0);
+        nvm_sq_submit(&sqs[i]);
+
+        nvm_cpl_t* cpl = nvm_cq_dequeue_block(&cqs[i], ctrl->timeout);
+        if (cpl == NULL)
+        {
+            fprintf(stderr, "Read on queue %u timed out\n", sqs[i].no);
+            return ETIME;
+        }
+
+        int status = NVM_ERR_STATUS(cpl);
+        nvm_sq_update(&sqs[i]);
+        nvm_cq_update(&cqs[i]);
+
+        if (status != 0 || *NVM_CPL_CID(cpl) != i)
+        {
+            fprintf(stderr, "Read on queue %u failed: %s\n", sqs[i].no, nvm_strerror(status));
+            return status != 0 ? status : EIO;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Create and delete a batch of queue pairs, and read through each of them.
+ */
+static int run_batch(nvm_aq_ref ref, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns, const nvm_dma_t* dbbuf)
+{
+    int status;
+    void* ptr;
+    nvm_dma_t* dma;
+    nvm_queue_t cqs[BATCH_QUEUES];
+    nvm_queue_t sqs[BATCH_QUEUES];
+
+    // CQs, SQs and a data page
+    size_t size = (2 * BATCH_QUEUES + 1) * ctrl->page_size;
+
+    status = posix_memalign(&ptr, ctrl->page_size, size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate queue memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_dma_map_host(&dma, ctrl, ptr, size);
+    if (status != 0)
+    {
+        free(ptr);
+        fprintf(stderr, "Failed to map queue memory: %s\n", strerror(status));
+        return status;
+    }
+
+    memset(ptr, 0, size);
+
+    // The workload uses queue pair 1
+    status = nvm_admin_set_num_queues(ref, BATCH_QUEUES + 1, BATCH_QUEUES + 1);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to set number of queues: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    status = nvm_admin_cq_create_batch(ref, BATCH_QUEUES, cqs, 2, dma, 0, 1, BATCH_QS);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to create batch of CQs: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    status = nvm_admin_sq_create_batch(ref, BATCH_QUEUES, sqs, cqs, 2, dma, BATCH_QUEUES, 1, BATCH_QS);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to create batch of SQs: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    // The controller reads shadow doorbells of all IO queues once configured
+    for (size_t i = 0; i < BATCH_QUEUES && dbbuf != NULL && status == 0; ++i)
+    {
+        status = nvm_queue_dbbuf(&cqs[i], ctrl, dbbuf, 0);
+        if (status == 0)
+        {
+            status = nvm_queue_dbbuf(&sqs[i], ctrl, dbbuf, 0);
+        }
+    }
+
+    if (status == 0)
+    {
+        status = read_through(sqs, cqs, dma, 2 * BATCH_QUEUES, ctrl, ns);
+    }
+
+    for (size_t i = 0; i < BATCH_QUEUES; ++i)
+    {
+        int err = nvm_admin_qp_delete(ref, &sqs[i], &cqs[i]);
+        if (!nvm_ok(err))
+        {
+            fprintf(stderr, "Failed to delete queue pair %u: %s\n", sqs[i].no, nvm_strerror(err));
+            status = status != 0 ? status : err;
+        }
+    }
+
+out:
+    nvm_dma_unmap(dma);
+    free(ptr);
+    return status;
+}
+
+
+
+/*
+ * Submit an admin command, retrying while the ASQ is full.
+ */
+static int submit(nvm_aq_ref ref, const nvm_ctrl_t* ctrl, const nvm_cmd_t* cmd, uint16_t* cid)
+{
+    uint64_t deadline = current_time_ns() + ctrl->timeout * 1000000UL;
+    int status;
+
+    while ((status = nvm_admin_submit(ref, cmd, cid)) == EAGAIN && current_time_ns() < deadline)
+    {
+        sched_yield();
+    }
+
+    return status;
+}
+
+
+
+/*
+ * Keep several commands in flight with nvm_admin_submit(), collect them out
+ * of order with nvm_admin_poll(), and check that cancelled commands release
+ * their command identifiers.
+ */
+static int run_submit(nvm_aq_ref ref, const nvm_ctrl_t* ctrl)
+{
+    int status;
+    nvm_cmd_t cmd;
+    nvm_cpl_t cpl;
+    uint16_t cids[N_SUBMIT];
+    size_t n_cancelled = 0;
+
+    // Get number of queues
+    memset(&cmd, 0, sizeof(cmd));
+    nvm_cmd_header(&cmd, NVM_ADMIN_GET_FEATURES, 0);
+    cmd.dword[10] = 0x07;
+
+    for (size_t i = 0; i < N_SUBMIT; ++i)
+    {
+        status = submit(ref, ctrl, &cmd, &cids[i]);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to submit admin command: %s\n", nvm_strerror(status));
+            return status;
+        }
+
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (cids[j] == cids[i])
+            {
+                fprintf(stderr, "Command identifier %u is assigned twice\n", cids[i]);
+                return EIO;
+            }
+        }
+    }
+
+    // Collect in reverse order, first without blocking
+    for (size_t i = N_SUBMIT; i > 0; --i)
+    {
+        while ((status = nvm_admin_poll(ref, cids[i - 1], &cpl, 0)) == EAGAIN)
+        {
+            sched_yield();
+        }
+
+        if (status == 0 && nvm_admin_poll(ref, cids[i - 1], &cpl, 0) != EINVAL)
+        {
+            fprintf(stderr, "Completion was collected twice\n");
+            status = EIO;
+        }
+
+        if (status != 0)
+        {
+            fprintf(stderr, "Admin command failed: %s\n", nvm_strerror(status));
+            return status;
+        }
+    }
+
+    // Cancel more commands than there are command identifiers (the ASQ is one page)
+    for (size_t i = 0; i < 4 * ctrl->page_size / sizeof(nvm_cmd_t); ++i)
+    {
+        status = submit(ref, ctrl, &cmd, &cids[0]);
+        if (status != 0)
+        {
+            fprintf(stderr, "Command identifiers are not released after cancel: %s\n", nvm_strerror(status));
+            return status;
+        }
+
+        status = nvm_admin_cancel(ref, cids[0]);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to cancel admin command: %s\n", nvm_strerror(status));
+            return status;
+        }
+
+        if (nvm_admin_poll(ref, cids[0], &cpl, 0) != EINVAL || nvm_admin_cancel(ref, cids[0]) != EINVAL)
+        {
+            fprintf(stderr, "Cancelled command is still outstanding\n");
+            return EIO;
+        }
+
+        ++n_cancelled;
+    }
+
+    // The ASQ must still work for blocking commands
+    status = nvm_admin_get_num_queues(ref, &cids[0], &cids[1]);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Admin command failed after cancel: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    fprintf(stdout, "admin: submitted=%d cancelled=%zu\n", N_SUBMIT, n_cancelled);
+    return 0;
+}
+
+
+
+/*
+ * Commands of another user of the ASQ, collected after a while.
+ */
+struct other_user
+{
+    nvm_aq_ref      ref;
+    size_t          n_cmds;
+    uint16_t        cids[BATCH_QS];
+    int             status;
+};
+
+
+
+static void* collect_later(struct other_user* other)
+{
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(other->ref);
+    struct timespec delay = { 0, 2000000 };
+    nvm_cpl_t cpl;
+
+    nanosleep(&delay, NULL);
+
+    other->status = 0;
+    for (size_t i = 0; i < other->n_cmds; ++i)
+    {
+        int status = nvm_admin_poll(other->ref, other->cids[i], &cpl, ctrl->timeout);
+        if (status != 0 && other->status == 0)
+        {
+            other->status = status;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Occupy every command identifier from another thread, and check that a
+ * batch waits for them to be released rather than failing.
+ */
+static int run_contended(nvm_aq_ref ref, const nvm_ctrl_t* ctrl)
+{
+    int status;
+    void* ptr;
+    nvm_dma_t* dma;
+    nvm_cmd_t cmd;
+    nvm_queue_t cq;
+    pthread_t thread;
+    struct other_user other;
+
+    status = posix_memalign(&ptr, ctrl->page_size, ctrl->page_size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate queue memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_dma_map_host(&dma, ctrl, ptr, ctrl->page_size);
+    if (status != 0)
+    {
+        free(ptr);
+        fprintf(stderr, "Failed to map queue memory: %s\n", strerror(status));
+        return status;
+    }
+
+    memset(ptr, 0, ctrl->page_size);
+
+    memset(&cmd, 0, sizeof(cmd));
+    nvm_cmd_header(&cmd, NVM_ADMIN_GET_FEATURES, 0);
+    cmd.dword[10] = 0x07;
+
+    other.ref = ref;
+    other.n_cmds = 0;
+    while (other.n_cmds < BATCH_QS && nvm_admin_submit(ref, &cmd, &other.cids[other.n_cmds]) == 0)
+    {
+        ++other.n_cmds;
+    }
+
+    if (other.n_cmds == BATCH_QS)
+    {
+        fprintf(stderr, "ASQ did not fill up\n");
+        status = EIO;
+        for (size_t i = 0; i < other.n_cmds; ++i)
+        {
+            nvm_admin_cancel(ref, other.cids[i]);
+        }
+        goto out;
+    }
+
+    status = pthread_create(&thread, NULL, (void* (*)(void*)) collect_later, &other);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to start thread: %s\n", strerror(status));
+        for (size_t i = 0; i < other.n_cmds; ++i)
+        {
+            nvm_admin_cancel(ref, other.cids[i]);
+        }
+        goto out;
+    }
+
+    status = nvm_admin_cq_create_batch(ref, 1, &cq, 2, dma, 0, 1, BATCH_QS);
+    pthread_join(thread, NULL);
+
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Batch failed while the ASQ was full: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    status = nvm_admin_cq_delete(ref, &cq);
+    if (status == 0 && other.status != 0)
+    {
+        status = other.status;
+    }
+
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Admin command failed after contention: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    fprintf(stdout, "admin: contended=%zu\n", other.n_cmds);
+
+out:
+    nvm_dma_unmap(dma);
+    free(ptr);
+    return status;
+}
+
+
+
+int run_admin(nvm_aq_ref ref, const struct nvm_ns_info* ns, const nvm_dma_t* dbbuf)
+{
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+
+    int status = run_batch(ref, ctrl, ns, dbbuf);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    status = run_submit(ref, ctrl);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    return run_contended(ref, ctrl);
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <nvm_types.h>
+#include <nvm_dma.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include "emulate.h"
+
+
+/* Number of data pages written and partially deallocated */
+#define DSM_PAGES       4
+
+
+
+/*
+ * Check that nvm_dsm_range_append() merges adjacent blocks, splits blocks
+ * that exceed the maximum range length and stops when the list is full.
+ */
+static int check_append(nvm_dsm_range_t* list)
+{
+    size_t n_ranges = 0;
+
+    // Adjacent blocks are merged with the last range
+    if (nvm_dsm_range_append(list, &n_ranges, 0, 8) != 8
+            || nvm_dsm_range_append(list, &n_ranges, 8, 8) != 8
+            || n_ranges != 1 || list[0].start_lba != 0 || list[0].n_blocks != 16)
+    {
+        fprintf(stderr, "Adjacent blocks were not merged\n");
+        return EIO;
+    }
+
+    // Blocks beyond the maximum range length go in a new range
+    if (nvm_dsm_range_append(list, &n_ranges, 100, NVM_DSM_MAX_RANGE_BLOCKS + 10) != NVM_DSM_MAX_RANGE_BLOCKS + 10
+            || n_ranges != 3 || list[1].start_lba != 100 || list[1].n_blocks != NVM_DSM_MAX_RANGE_BLOCKS
+            || list[2].start_lba != 100 + NVM_DSM_MAX_RANGE_BLOCKS || list[2].n_blocks != 10)
+    {
+        fprintf(stderr, "Blocks exceeding the maximum range length were not split\n");
+        return EIO;
+    }
+
+    // A full range is not extended, even if the blocks are adjacent
+    n_ranges = 0;
+    nvm_dsm_range_append(list, &n_ranges, 0, NVM_DSM_MAX_RANGE_BLOCKS);
+    if (nvm_dsm_range_append(list, &n_ranges, NVM_DSM_MAX_RANGE_BLOCKS, 1) != 1
+            || n_ranges != 2 || list[1].start_lba != NVM_DSM_MAX_RANGE_BLOCKS || list[1].n_blocks != 1)
+    {
+        fprintf(stderr, "Full range was extended\n");
+        return EIO;
+    }
+
+    // Only adjacent blocks can be added to a full list
+    n_ranges = 0;
+    for (size_t i = 0; i < NVM_DSM_MAX_RANGES; ++i)
+    {
+        nvm_dsm_range_append(list, &n_ranges, 2 * i, 1);
+    }
+
+    if (n_ranges != NVM_DSM_MAX_RANGES
+            || nvm_dsm_range_append(list, &n_ranges, 2 * NVM_DSM_MAX_RANGES, 1) != 0
+            || nvm_dsm_range_append(list, &n_ranges, 2 * NVM_DSM_MAX_RANGES - 1, 4) != 4
+            || n_ranges != NVM_DSM_MAX_RANGES || list[NVM_DSM_MAX_RANGES - 1].n_blocks != 5)
+    {
+        fprintf(stderr, "Blocks were not appended correctly to a full list\n");
+        return EIO;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Issue a dataset management command for the range list and wait for it.
+ */
+static int dataset_mgmt(struct queue_pair* qp, uint32_t ns_id, uint64_t list_ioaddr, size_t n_ranges, uint32_t attributes)
+{
+    nvm_cpl_t cpl;
+
+    nvm_cmd_t* cmd = start_command(qp);
+    if (cmd == NULL)
+    {
+        return EAGAIN;
+    }
+
+    nvm_cmd_dataset_mgmt(cmd, ns_id, list_ioaddr, n_ranges, attributes);
+
+    int status = wait_commands(qp, &cpl, 1);
+    if (status == 0 && !NVM_ERR_OK(&cpl))
+    {
+        status = NVM_ERR_STATUS(&cpl);
+    }
+
+    return status;
+}
+
+
+
+/*
+ * Check that blocks in the ranges read as zeroes and that the others
+ * still hold the written pattern.
+ */
+static int check_blocks(const uint32_t* data, size_t n_blks, size_t block_size, bool (*trimmed)(size_t))
+{
+    size_t n_words = block_size / sizeof(uint32_t);
+
+    for (size_t blk = 0; blk < n_blks; ++blk)
+    {
+        for (size_t j = 0; j < n_words; ++j)
+        {
+            uint32_t expected = trimmed != NULL && trimmed(blk) ? 0 : (uint32_t) ~(blk * n_words + j);
+
+            if (data[blk * n_words + j] != expected)
+            {
+                fprintf(stderr, "Block %zu holds unexpected data at offset %zu\n", blk, j * sizeof(uint32_t));
+                return EIO;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Deallocate the middle two blocks of every four.
+ */
+static bool is_trimmed(size_t blk)
+{
+    return blk % 4 == 1 || blk % 4 == 2;
+}
+
+
+
+int run_dsm(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns)
+{
+    int status;
+    void* ptr;
+    nvm_dma_t* dma;
+    size_t n_ranges = 0;
+
+    // Range list followed by data pages
+    size_t size = (1 + DSM_PAGES) * ctrl->page_size;
+    size_t n_blks = DSM_PAGES * ctrl->page_size / ns->lba_data_size;
+
+    status = posix_memalign(&ptr, ctrl->page_size, size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate range list memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_dma_map_host(&dma, ctrl, ptr, size);
+    if (status != 0)
+    {
+        free(ptr);
+        fprintf(stderr, "Failed to map range list memory: %s\n", strerror(status));
+        return status;
+    }
+
+    nvm_dsm_range_t* list = (nvm_dsm_range_t*) dma->vaddr;
+    uint32_t* data = (uint32_t*) NVM_DMA_OFFSET(dma, 1);
+
+    status = check_append(list);
+    if (status != 0)
+    {
+        goto out;
+    }
+
+    for (size_t i = 0; i < n_blks * ns->lba_data_size / sizeof(uint32_t); ++i)
+    {
+        data[i] = (uint32_t) ~i;
+    }
+
+    status = transfer(qp, &dma->ioaddrs[1], NVM_IO_WRITE, ns->ns_id, 0, n_blks, DSM_PAGES, NULL);
+    if (status != 0)
+    {
+        fprintf(stderr, "Write command failed: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    // Append one block at a time, so that every other block is merged
+    memset(list, 0, ctrl->page_size);
+    for (size_t blk = 0; blk < n_blks; ++blk)
+    {
+        if (is_trimmed(blk))
+        {
+            nvm_dsm_range_append(list, &n_ranges, blk, 1);
+        }
+    }
+
+    if (n_ranges != (n_blks + 2) / 4)
+    {
+        fprintf(stderr, "Range list has %zu ranges, expected %zu\n", n_ranges, (n_blks + 2) / 4);
+        status = EIO;
+        goto out;
+    }
+
+    // Access hints alone leave the data in place
+    status = dataset_mgmt(qp, ns->ns_id, dma->ioaddrs[0], n_ranges, NVM_DSM_INTEGRAL_READ);
+    if (status == 0)
+    {
+        memset(data, 0xff, DSM_PAGES * ctrl->page_size);
+        status = transfer(qp, &dma->ioaddrs[1], NVM_IO_READ, ns->ns_id, 0, n_blks, DSM_PAGES, NULL);
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Dataset management without deallocate failed: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    status = check_blocks(data, n_blks, ns->lba_data_size, NULL);
+    if (status != 0)
+    {
+        goto out;
+    }
+
+    status = dataset_mgmt(qp, ns->ns_id, dma->ioaddrs[0], n_ranges, NVM_DSM_DEALLOCATE);
+    if (status == 0)
+    {
+        memset(data, 0xff, DSM_PAGES * ctrl->page_size);
+        status = transfer(qp, &dma->ioaddrs[1], NVM_IO_READ, ns->ns_id, 0, n_blks, DSM_PAGES, NULL);
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Deallocate failed: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    status = check_blocks(data, n_blks, ns->lba_data_size, is_trimmed);
+    if (status == 0)
+    {
+        fprintf(stdout, "dsm: blocks=%zu ranges=%zu\n", n_blks, n_ranges);
+    }
+
+out:
+    nvm_dma_unmap(dma);
+    free(ptr);
+    return status;
+}
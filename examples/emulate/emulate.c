@@ -0,0 +1,1041 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <nvm_types.h>
+#include <nvm_ctrl.h>
+#include <nvm_dma.h>
+#include <nvm_aq.h>
+#include <nvm_admin.h>
+#include <nvm_queue.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include <nvm_emu.h>
+#include <nvm_pool.h>
+#include "emulate.h"
+
+
+
+struct producer
+{
+    pthread_t           thread;
+    nvm_sq_mp_t*        sq;
+    uint32_t            ns_id;
+    uint64_t            ioaddr;         // Bus address of the page to read into
+    uint64_t            start_lba;
+    uint16_t            n_blks;
+    size_t              n_cmds;
+};
+
+
+
+/*
+ * Attach the shadow doorbells to a newly created queue pair, if configured.
+ */
+static int attach_dbbuf(nvm_aq_ref ref, struct queue_pair* qp)
+{
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+    int status = 0;
+
+    if (qp->dbbuf != NULL)
+    {
+        status = nvm_queue_dbbuf(&qp->cq, ctrl, qp->dbbuf, 0);
+        if (status == 0)
+        {
+            status = nvm_queue_dbbuf(&qp->sq, ctrl, qp->dbbuf, 0);
+        }
+
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to attach shadow doorbells: %s\n", strerror(status));
+        }
+    }
+
+    return status;
+}
+
+
+
+/*
+ * Create the IO queue pair. If allocate is set, the admin queue owner picks
+ * the queue identifier without being told the number of queues first.
+ */
+static int create_queue_pair(nvm_aq_ref ref, struct queue_pair* qp, const nvm_dma_t* mem, bool allocate)
+{
+    int status;
+
+    memset(mem->vaddr, 0, mem->page_size);
+    memset(NVM_DMA_OFFSET(qp->sq_mem, qp->sq_page), 0, qp->sq_mem->page_size);
+
+    if (allocate)
+    {
+        status = nvm_admin_qp_create(ref, &qp->cq, mem, 0, &qp->sq, qp->sq_mem, qp->sq_page, 0);
+        if (!nvm_ok(status))
+        {
+            fprintf(stderr, "Failed to create queue pair: %s\n", nvm_strerror(status));
+            return status;
+        }
+
+        return attach_dbbuf(ref, qp);
+    }
+
+    status = nvm_admin_set_num_queues(ref, 1, 1);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to set number of queues: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    status = nvm_admin_cq_create(ref, &qp->cq, 1, mem, 0, 0);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to create completion queue: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    status = nvm_admin_sq_create(ref, &qp->sq, &qp->cq, 1, qp->sq_mem, qp->sq_page, 0);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to create submission queue: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    return attach_dbbuf(ref, qp);
+}
+
+
+
+nvm_cmd_t* start_command(struct queue_pair* qp)
+{
+    nvm_cmd_t* cmd;
+    uint16_t cid;
+
+    if (!nvm_cid_alloc(qp->cids, qp, &cid))
+    {
+        return NULL;
+    }
+
+    cmd = nvm_sq_enqueue(&qp->sq);
+    if (cmd == NULL)
+    {
+        nvm_cid_complete(qp->cids, cid);
+        return NULL;
+    }
+
+    *NVM_CMD_CID(cmd) = cid;
+    return cmd;
+}
+
+
+
+int wait_commands(struct queue_pair* qp, nvm_cpl_t* cpls, size_t n)
+{
+    size_t n_cpls = 0;
+    int status = 0;
+
+    nvm_sq_submit(&qp->sq);
+
+    while (n_cpls < n)
+    {
+        size_t n_new = nvm_cq_dequeue_batch(&qp->cq, &qp->sq, &cpls[n_cpls], n - n_cpls);
+        if (n_new == 0)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // Match completions to commands that were submitted
+        for (size_t i = n_cpls; i < n_cpls + n_new; ++i)
+        {
+            if (nvm_cid_complete(qp->cids, *NVM_CPL_CID(&cpls[i])) != qp)
+            {
+                fprintf(stderr, "Unexpected completion with CID %u\n", *NVM_CPL_CID(&cpls[i]));
+                status = EIO;
+            }
+        }
+
+        n_cpls += n_new;
+    }
+
+    return status;
+}
+
+
+
+int transfer(struct queue_pair* qp, const uint64_t* data_ioaddrs, uint8_t opcode, uint32_t ns_id,
+        uint64_t start_lba, uint16_t n_blks, size_t n_pages, uint64_t* elapsed)
+{
+    nvm_cmd_t* cmd;
+    nvm_cpl_t cpl;
+    uint64_t start;
+    void* prp_list;
+
+    cmd = start_command(qp);
+    if (cmd == NULL)
+    {
+        return EAGAIN;
+    }
+
+    nvm_cmd_header(cmd, opcode, ns_id);
+    nvm_cmd_rw_blks(cmd, start_lba, n_blks);
+    if (qp->sgl_length > 0)
+    {
+        nvm_cmd_data_sgl_block(cmd, data_ioaddrs[0], qp->sgl_length);
+        prp_list = NULL;
+    }
+    else if (nvm_prp_pool_cmd_data(qp->prp_pool, cmd, n_pages, data_ioaddrs, &prp_list) != 0)
+    {
+        // Turn the slot into a flush, as it is already enqueued
+        nvm_cmd_header(cmd, NVM_IO_FLUSH, ns_id);
+        nvm_cmd_data_ptr(cmd, 0, 0);
+        wait_commands(qp, &cpl, 1);
+        return ENOMEM;
+    }
+
+    start = current_time_ns();
+
+    int status = wait_commands(qp, &cpl, 1);
+
+    if (prp_list != NULL)
+    {
+        nvm_prp_pool_put(qp->prp_pool, prp_list);
+    }
+
+    if (status != 0)
+    {
+        return status;
+    }
+
+    if (elapsed != NULL)
+    {
+        *elapsed = current_time_ns() - start;
+    }
+
+    if (!NVM_ERR_OK(&cpl))
+    {
+        return NVM_ERR_STATUS(&cpl);
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Issue read commands to a shared SQ.
+ */
+static struct producer* produce_commands(struct producer* p)
+{
+    nvm_cmd_t* cmd;
+    uint64_t ticket;
+
+    for (size_t i = 0; i < p->n_cmds; )
+    {
+        cmd = nvm_sq_mp_enqueue(p->sq, &ticket);
+        if (cmd == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+
+        nvm_cmd_header(cmd, NVM_IO_READ, p->ns_id);
+        nvm_cmd_rw_blks(cmd, p->start_lba + i * p->n_blks, p->n_blks);
+        nvm_cmd_data_ptr(cmd, p->ioaddr, 0);
+
+        nvm_sq_mp_submit(p->sq, ticket);
+        ++i;
+    }
+
+    return p;
+}
+
+
+
+/*
+ * Run several producer threads sharing a single SQ and consume completions
+ * in the calling thread.
+ */
+static int run_shared_sq(struct queue_pair* qp, const nvm_dma_t* mem, size_t page_offset,
+        const struct nvm_ns_info* ns, const struct options* args)
+{
+    int status;
+    nvm_sq_mp_t* sq;
+    nvm_cpl_t cpls[64];
+    size_t n_cpls = 0;
+    size_t n_errors = 0;
+
+    uint16_t n_blks = mem->page_size / ns->lba_data_size;
+    if (n_blks == 0 || args->n_threads * args->n_cmds * n_blks > ns->size)
+    {
+        fprintf(stderr, "Namespace is too small for shared SQ workload\n");
+        return EINVAL;
+    }
+
+    status = nvm_sq_mp_create(&sq, &qp->sq);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to create multi-producer SQ: %s\n", strerror(status));
+        return status;
+    }
+
+    struct producer* producers = calloc(args->n_threads, sizeof(struct producer));
+    if (producers == NULL)
+    {
+        nvm_sq_mp_free(sq);
+        fprintf(stderr, "Failed to allocate thread descriptors\n");
+        return ENOMEM;
+    }
+
+    uint64_t start = current_time_ns();
+
+    for (size_t i = 0; i < args->n_threads; ++i)
+    {
+        producers[i].sq = sq;
+        producers[i].ns_id = ns->ns_id;
+        producers[i].ioaddr = mem->ioaddrs[page_offset + i];
+        producers[i].start_lba = i * args->n_cmds * n_blks;
+        producers[i].n_blks = n_blks;
+        producers[i].n_cmds = args->n_cmds;
+        pthread_create(&producers[i].thread, NULL, (void *(*)(void*)) produce_commands, &producers[i]);
+    }
+
+    while (n_cpls < args->n_threads * args->n_cmds)
+    {
+        size_t n = nvm_cq_dequeue_batch(&qp->cq, &qp->sq, cpls, sizeof(cpls) / sizeof(nvm_cpl_t));
+        if (n == 0)
+        {
+            sched_yield();
+            continue;
+        }
+
+        nvm_sq_mp_update(sq);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            n_errors += !NVM_ERR_OK(&cpls[i]);
+        }
+
+        n_cpls += n;
+    }
+
+    uint64_t elapsed = current_time_ns() - start;
+
+    for (size_t i = 0; i < args->n_threads; ++i)
+    {
+        pthread_join(producers[i].thread, NULL);
+    }
+
+    fprintf(stdout, "shared: threads=%zu count=%zu errors=%zu iops=%.0f\n",
+            args->n_threads, n_cpls, n_errors, n_cpls / (elapsed / 1e9));
+
+    free(producers);
+    nvm_sq_mp_free(sq);
+    return n_errors == 0 ? 0 : EIO;
+}
+
+
+
+static void print_stats(const char* name, const uint64_t* times, size_t n)
+{
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        min = times[i] < min ? times[i] : min;
+        max = times[i] > max ? times[i] : max;
+        sum += times[i];
+    }
+
+    fprintf(stdout, "%-6s: count=%zu min=%.2f us avg=%.2f us max=%.2f us\n",
+            name, n, min / 1e3, (sum / (double) n) / 1e3, max / 1e3);
+}
+
+
+
+/*
+ * Delete and recreate the IO queue pair a few times, letting the admin
+ * queue owner pick the queue identifier, and check that IO still works.
+ */
+static int recycle_queue_pair(nvm_aq_ref ref, struct queue_pair* qp, const nvm_dma_t* mem, size_t data_page,
+        const struct nvm_ns_info* ns, size_t n_pages, size_t n_blks)
+{
+    int status;
+    uint32_t* data = (uint32_t*) NVM_DMA_OFFSET(mem, data_page);
+    size_t n_words = n_pages * mem->page_size / sizeof(uint32_t);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        uint16_t no = qp->sq.no;
+
+        status = nvm_admin_qp_delete(ref, &qp->sq, &qp->cq);
+        if (!nvm_ok(status))
+        {
+            fprintf(stderr, "Failed to delete queue pair %u: %s\n", no, nvm_strerror(status));
+            return status;
+        }
+
+        memset(mem->vaddr, 0, mem->page_size);
+        memset(NVM_DMA_OFFSET(qp->sq_mem, qp->sq_page), 0, qp->sq_mem->page_size);
+
+        status = nvm_admin_qp_create(ref, &qp->cq, mem, 0, &qp->sq, qp->sq_mem, qp->sq_page, 0);
+        if (!nvm_ok(status))
+        {
+            fprintf(stderr, "Failed to recreate queue pair: %s\n", nvm_strerror(status));
+            return status;
+        }
+
+        status = attach_dbbuf(ref, qp);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        // The identifier of the deleted pair is the lowest one available
+        if (qp->sq.no != no || qp->cq.no != no)
+        {
+            fprintf(stderr, "Queue pair got identifier %u, expected %u\n", qp->sq.no, no);
+            return EIO;
+        }
+
+        for (size_t j = 0; j < n_words; ++j)
+        {
+            data[j] = (uint32_t) ~(i * n_words + j);
+        }
+
+        status = transfer(qp, &mem->ioaddrs[data_page], NVM_IO_WRITE, ns->ns_id, 0, n_blks, n_pages, NULL);
+        if (status == 0)
+        {
+            memset(data, 0, n_pages * mem->page_size);
+            status = transfer(qp, &mem->ioaddrs[data_page], NVM_IO_READ, ns->ns_id, 0, n_blks, n_pages, NULL);
+        }
+
+        if (status != 0)
+        {
+            fprintf(stderr, "IO on recreated queue pair failed: %s\n", nvm_strerror(status));
+            return status;
+        }
+
+        for (size_t j = 0; j < n_words; ++j)
+        {
+            if (data[j] != (uint32_t) ~(i * n_words + j))
+            {
+                fprintf(stderr, "Data mismatch on recreated queue pair at offset %zu\n", j * sizeof(uint32_t));
+                return EIO;
+            }
+        }
+    }
+
+    fprintf(stdout, "recycle: queue=%u count=3\n", qp->sq.no);
+    return 0;
+}
+
+
+
+static int run_workload(nvm_aq_ref ref, const nvm_dma_t* mem, const nvm_dma_t* dbbuf, const struct options* args)
+{
+    int status;
+    struct queue_pair qp;
+    struct nvm_ctrl_info ctrl_info;
+    struct nvm_ns_info ns_info;
+
+    // Data pages follow the queue memory and the PRP list pages
+    size_t data_page = 2 + args->prp_pages;
+
+    status = nvm_admin_ctrl_info(ref, &ctrl_info, NVM_DMA_OFFSET(mem, data_page), mem->ioaddrs[data_page]);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to identify controller: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    status = nvm_admin_ns_info(ref, &ns_info, 1, NVM_DMA_OFFSET(mem, data_page), mem->ioaddrs[data_page]);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to identify namespace: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    fprintf(stderr, "Namespace %u: %zu blocks of %zu bytes, max data transfer size %zu\n",
+            ns_info.ns_id, ns_info.size, ns_info.lba_data_size, ctrl_info.max_data_size);
+
+    size_t chunk_size = args->chunk_pages * mem->page_size;
+    if (chunk_size > ctrl_info.max_data_size)
+    {
+        chunk_size = ctrl_info.max_data_size;
+    }
+
+    size_t n_pages = chunk_size / mem->page_size;
+    size_t n_blks = chunk_size / ns_info.lba_data_size;
+    if (n_blks == 0 || n_blks * args->n_cmds > ns_info.size)
+    {
+        fprintf(stderr, "Namespace is too small for workload\n");
+        return EINVAL;
+    }
+
+    // A single data block requires the data pages to be contiguous
+    qp.sgl_length = 0;
+    if (args->sgl)
+    {
+        if (!ctrl_info.sgl_support)
+        {
+            fprintf(stderr, "Controller does not support SGLs\n");
+            return EINVAL;
+        }
+
+        for (size_t i = 1; i < n_pages; ++i)
+        {
+            if (mem->ioaddrs[data_page + i] != mem->ioaddrs[data_page] + i * mem->page_size)
+            {
+                fprintf(stderr, "Data memory is not contiguous\n");
+                return EINVAL;
+            }
+        }
+
+        qp.sgl_length = chunk_size;
+    }
+
+    // The SQ and PRP lists are either placed in host memory or in the CMB
+    nvm_dma_t* cmb = NULL;
+    const nvm_dma_t* prp_mem = mem;
+    size_t prp_page = 2;
+
+    qp.sq_mem = mem;
+    qp.sq_page = 1;
+    qp.dbbuf = dbbuf;
+
+    if (args->cmb)
+    {
+        status = nvm_dma_alloc_cmb(&cmb, nvm_ctrl_from_aq_ref(ref), (1 + args->prp_pages) * mem->page_size);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to allocate controller memory buffer: %s\n", strerror(status));
+            return status;
+        }
+
+        qp.sq_mem = cmb;
+        qp.sq_page = 0;
+        prp_mem = cmb;
+        prp_page = 1;
+    }
+
+    status = create_queue_pair(ref, &qp, mem, args->recycle);
+    if (status != 0)
+    {
+        nvm_dma_unmap(cmb);
+        return status;
+    }
+
+    status = nvm_cid_table_create(&qp.cids, qp.cq.max_entries);
+    if (status != 0)
+    {
+        nvm_dma_unmap(cmb);
+        fprintf(stderr, "Failed to create CID table: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_prp_pool_create(&qp.prp_pool, prp_mem, prp_page, args->prp_pages);
+    if (status != 0)
+    {
+        nvm_cid_table_free(qp.cids);
+        nvm_dma_unmap(cmb);
+        fprintf(stderr, "Failed to create PRP list pool: %s\n", strerror(status));
+        return status;
+    }
+
+    uint64_t* times = calloc(2 * args->n_cmds, sizeof(uint64_t));
+    if (times == NULL)
+    {
+        nvm_prp_pool_free(qp.prp_pool);
+        nvm_cid_table_free(qp.cids);
+        nvm_dma_unmap(cmb);
+        fprintf(stderr, "Failed to allocate memory: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    uint32_t* data = (uint32_t*) NVM_DMA_OFFSET(mem, data_page);
+    size_t n_words = chunk_size / sizeof(uint32_t);
+
+    for (size_t i = 0; i < args->n_cmds; ++i)
+    {
+        for (size_t j = 0; j < n_words; ++j)
+        {
+            data[j] = (uint32_t) (i * n_words + j);
+        }
+
+        status = transfer(&qp, &mem->ioaddrs[data_page], NVM_IO_WRITE, ns_info.ns_id, i * n_blks, n_blks, n_pages, &times[i]);
+        if (status != 0)
+        {
+            fprintf(stderr, "Write command failed: %s\n", nvm_strerror(status));
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < args->n_cmds; ++i)
+    {
+        memset(data, 0xff, chunk_size);
+
+        status = transfer(&qp, &mem->ioaddrs[data_page], NVM_IO_READ, ns_info.ns_id, i * n_blks, n_blks, n_pages, &times[args->n_cmds + i]);
+        if (status != 0)
+        {
+            fprintf(stderr, "Read command failed: %s\n", nvm_strerror(status));
+            goto out;
+        }
+
+        for (size_t j = 0; j < n_words; ++j)
+        {
+            if (data[j] != (uint32_t) (i * n_words + j))
+            {
+                fprintf(stderr, "Data mismatch in command %zu at offset %zu\n", i, j * sizeof(uint32_t));
+                status = EIO;
+                goto out;
+            }
+        }
+    }
+
+    fprintf(stdout, "Verified %zu commands of %zu bytes\n", args->n_cmds, chunk_size);
+    print_stats("write", times, args->n_cmds);
+    print_stats("read", times + args->n_cmds, args->n_cmds);
+
+    if (cmb != NULL)
+    {
+        fprintf(stdout, "cmb: sq=%#" PRIx64 " lists=%zu\n", cmb->ioaddrs[0], args->prp_pages);
+    }
+
+    if (dbbuf != NULL)
+    {
+        fprintf(stdout, "dbbuf: sq=%u event_idx=%u\n", *qp.sq.shadow, *qp.sq.event_idx);
+    }
+
+    if (args->n_threads > 0)
+    {
+        status = run_shared_sq(&qp, mem, data_page + args->chunk_pages, &ns_info, args);
+    }
+
+    if (status == 0 && args->extents)
+    {
+        if (n_pages != args->chunk_pages)
+        {
+            fprintf(stderr, "Number of pages exceeds maximum data transfer size\n");
+            status = EINVAL;
+            goto out;
+        }
+
+        status = run_extents(&qp, nvm_ctrl_from_aq_ref(ref), mem, data_page, &ns_info, args);
+    }
+
+    if (status == 0 && args->dsm)
+    {
+        status = run_dsm(&qp, nvm_ctrl_from_aq_ref(ref), &ns_info);
+    }
+
+    if (status == 0 && args->fused)
+    {
+        status = run_fused(&qp, nvm_ctrl_from_aq_ref(ref), &ns_info, args->n_cmds);
+    }
+
+    if (status == 0 && args->pi)
+    {
+        status = run_pi(&qp, nvm_ctrl_from_aq_ref(ref), &ns_info, args->n_cmds);
+    }
+
+    if (status == 0 && args->recycle)
+    {
+        status = recycle_queue_pair(ref, &qp, mem, data_page, &ns_info, n_pages, n_blks);
+    }
+
+    if (status == 0 && args->admin)
+    {
+        status = run_admin(ref, &ns_info, dbbuf);
+    }
+
+    if (status == 0 && args->rpc)
+    {
+        status = run_rpc(ref, args);
+    }
+
+out:
+    free(times);
+    nvm_prp_pool_free(qp.prp_pool);
+    nvm_cid_table_free(qp.cids);
+    nvm_dma_unmap(cmb);
+    return status;
+}
+
+
+
+/*
+ * Allocate data memory backed by hugepages, and expand it into a regular
+ * descriptor of controller pages.
+ */
+static int alloc_huge(nvm_dma_t** mem, nvm_dma_ext_t** huge, const nvm_ctrl_t* ctrl, size_t size)
+{
+    int status;
+
+    status = nvm_dma_ext_alloc_huge(huge, ctrl, size, 0);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate hugepage memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_dma_ext_expand(mem, ctrl, *huge, 0, size / ctrl->page_size);
+    if (status != 0)
+    {
+        nvm_dma_ext_unmap(*huge);
+        *huge = NULL;
+        fprintf(stderr, "Failed to expand hugepage descriptor: %s\n", strerror(status));
+        return status;
+    }
+
+    fprintf(stderr, "Using %zu bytes of hugepage memory in %zu extent(s)\n",
+            (*huge)->n_pages * (*huge)->page_size, (*huge)->n_extents);
+    return 0;
+}
+
+
+
+static void parse_args(int argc, char** argv, struct options* args);
+
+
+
+int main(int argc, char** argv)
+{
+    int status;
+    int exit_code = 2;
+    struct nvm_emu* emu;
+    nvm_ctrl_t* ctrl;
+    nvm_aq_ref ref;
+    nvm_dma_t* aq_mem;
+    nvm_dma_t* mem;
+    nvm_dma_ext_t* huge = NULL;
+    nvm_dma_t* dbbuf = NULL;
+    void* aq_ptr;
+    void* ptr = NULL;
+    void* dbbuf_ptr = NULL;
+
+    struct options args;
+    parse_args(argc, argv, &args);
+
+    status = nvm_emu_create_pi(&emu, args.path, args.n_blocks, args.block_size, args.pi ? 1 : 0);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to create emulated controller: %s\n", strerror(status));
+        exit(1);
+    }
+
+    status = nvm_emu_ctrl_init(&ctrl, emu);
+    if (status != 0)
+    {
+        nvm_emu_destroy(emu);
+        fprintf(stderr, "Failed to get controller reference: %s\n", strerror(status));
+        exit(1);
+    }
+
+    // IO queues, PRP lists, data pages and one page per thread
+    args.prp_pages = nvm_prp_num_lists(ctrl->page_size, args.chunk_pages);
+    if (args.prp_pages == 0)
+    {
+        args.prp_pages = 1;
+    }
+
+    size_t aq_size = 2 * ctrl->page_size;
+    size_t size = (2 + args.prp_pages + args.chunk_pages + args.n_threads) * ctrl->page_size;
+
+    status = posix_memalign(&aq_ptr, ctrl->page_size, aq_size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate queue memory: %s\n", strerror(status));
+        goto free_ctrl;
+    }
+
+    status = nvm_dma_map_host(&aq_mem, ctrl, aq_ptr, aq_size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to map queue memory: %s\n", strerror(status));
+        goto free_aq_ptr;
+    }
+
+    if (args.huge)
+    {
+        status = alloc_huge(&mem, &huge, ctrl, size);
+        if (status != 0)
+        {
+            // Let test drivers skip the run if no hugepages are reserved
+            exit_code = status == ENOMEM ? 77 : exit_code;
+            goto unmap_aq;
+        }
+    }
+    else
+    {
+        status = posix_memalign(&ptr, ctrl->page_size, size);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to allocate data memory: %s\n", strerror(status));
+            goto unmap_aq;
+        }
+
+        status = nvm_dma_map_host(&mem, ctrl, ptr, size);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to map data memory: %s\n", strerror(status));
+            goto free_ptr;
+        }
+    }
+
+    // Shadow doorbell buffers must be kept until the controller is reset
+    if (args.dbbuf)
+    {
+        status = posix_memalign(&dbbuf_ptr, ctrl->page_size, 2 * ctrl->page_size);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to allocate doorbell buffer memory: %s\n", strerror(status));
+            goto unmap;
+        }
+
+        memset(dbbuf_ptr, 0, 2 * ctrl->page_size);
+
+        status = nvm_dma_map_host(&dbbuf, ctrl, dbbuf_ptr, 2 * ctrl->page_size);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to map doorbell buffer memory: %s\n", strerror(status));
+            goto free_dbbuf;
+        }
+    }
+
+    status = nvm_aq_create(&ref, ctrl, aq_mem);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to reset controller: %s\n", strerror(status));
+        goto unmap_dbbuf;
+    }
+
+    if (dbbuf != NULL)
+    {
+        status = nvm_admin_dbbuf_config(ref, dbbuf, 0);
+        if (!nvm_ok(status))
+        {
+            fprintf(stderr, "Failed to configure doorbell buffer: %s\n", nvm_strerror(status));
+            goto destroy_aq;
+        }
+    }
+
+    status = run_workload(ref, mem, dbbuf, &args);
+
+destroy_aq:
+    nvm_aq_destroy(ref);
+unmap_dbbuf:
+    nvm_dma_unmap(dbbuf);
+free_dbbuf:
+    free(dbbuf_ptr);
+unmap:
+    nvm_dma_unmap(mem);
+free_ptr:
+    nvm_dma_ext_unmap(huge);
+    free(ptr);
+unmap_aq:
+    nvm_dma_unmap(aq_mem);
+free_aq_ptr:
+    free(aq_ptr);
+free_ctrl:
+    nvm_ctrl_free(ctrl);
+    nvm_emu_destroy(emu);
+    exit(status == 0 ? 0 : exit_code);
+}
+
+
+
+static void give_usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [--file=<path>] [--blocks=<count>] [--block-size=<bytes>] [--count=<commands>] [--pages=<pages>] [--threads=<count>] [--sgl] [--extents] [--huge] [--admin] [--rpc] [--recycle] [--cmb] [--dbbuf] [--dsm] [--fused] [--pi]\n", name);
+}
+
+
+
+static void show_help(const char* name)
+{
+    give_usage(name);
+    fprintf(stderr, "    Run a write-read-verify workload against an emulated controller.\n\n"
+            "    --file         <path>      Use file as namespace backing storage (default is RAM).\n"
+            "    --blocks       <count>     Number of blocks in namespace (default is 65536).\n"
+            "    --block-size   <bytes>     Logical block size (default is 512).\n"
+            "    --count        <commands>  Number of commands to issue (default is 1000).\n"
+            "    --pages        <pages>     Number of pages per command (default is 4).\n"
+            "    --threads      <count>     Number of threads sharing one SQ (default is 4, 0 to disable).\n"
+            "    --sgl                      Describe data with an SGL data block rather than PRPs.\n"
+            "    --extents                  Also transfer through scattered extents of an extent-based descriptor.\n"
+            "    --huge                     Allocate data memory from hugepages.\n"
+            "    --admin                    Also run batched and asynchronous admin commands.\n"
+            "    --rpc                      Also relay admin commands over sockets and shared memory.\n"
+            "    --recycle                  Also delete and recreate the queue pair between transfers.\n"
+            "    --cmb                      Place the SQ and PRP lists in the controller memory buffer.\n"
+            "    --dbbuf                    Configure shadow doorbells and use them for IO queues.\n"
+            "    --dsm                      Also deallocate block ranges with dataset management.\n"
+            "    --fused                    Also issue fused compare-and-write commands.\n"
+            "    --pi                       Format the namespace with protection information and check it.\n"
+            "    --help                     Show this information.\n");
+}
+
+
+
+static size_t parse_number(const char* str, const char* name, const char* arg)
+{
+    char* endptr = NULL;
+    size_t value = strtoul(arg, &endptr, 0);
+
+    if (endptr == NULL || *endptr != '\0' || value == 0)
+    {
+        fprintf(stderr, "Invalid %s: `%s'\n", name, arg);
+        give_usage(str);
+        exit(1);
+    }
+
+    return value;
+}
+
+
+
+static void parse_args(int argc, char** argv, struct options* args)
+{
+    // Command line options
+    static struct option opts[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "file", required_argument, NULL, 'f' },
+        { "blocks", required_argument, NULL, 'b' },
+        { "block-size", required_argument, NULL, 's' },
+        { "count", required_argument, NULL, 'c' },
+        { "pages", required_argument, NULL, 'p' },
+        { "threads", required_argument, NULL, 't' },
+        { "sgl", no_argument, NULL, 'g' },
+        { "extents", no_argument, NULL, 'e' },
+        { "huge", no_argument, NULL, 'u' },
+        { "admin", no_argument, NULL, 'a' },
+        { "rpc", no_argument, NULL, 'r' },
+        { "recycle", no_argument, NULL, 'y' },
+        { "cmb", no_argument, NULL, 'm' },
+        { "dbbuf", no_argument, NULL, 'd' },
+        { "dsm", no_argument, NULL, 'x' },
+        { "fused", no_argument, NULL, 'w' },
+        { "pi", no_argument, NULL, 'i' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    int idx;
+
+    args->path = NULL;
+    args->n_blocks = 65536;
+    args->block_size = 512;
+    args->n_cmds = 1000;
+    args->chunk_pages = 4;
+    args->n_threads = 4;
+    args->sgl = false;
+    args->extents = false;
+    args->huge = false;
+    args->admin = false;
+    args->rpc = false;
+    args->recycle = false;
+    args->cmb = false;
+    args->dbbuf = false;
+    args->dsm = false;
+    args->fused = false;
+    args->pi = false;
+
+    while ((opt = getopt_long(argc, argv, ":hf:b:s:c:p:t:geuarymdxwi", opts, &idx)) != -1)
+    {
+        switch (opt)
+        {
+            case '?': // unknown option
+                fprintf(stderr, "Unknown option: `%s'\n", argv[optind - 1]);
+                give_usage(argv[0]);
+                exit('?');
+
+            case ':': // missing option argument
+                fprintf(stderr, "Missing argument for option: `%s'\n", argv[optind - 1]);
+                give_usage(argv[0]);
+                exit(':');
+
+            case 'f':
+                args->path = optarg;
+                break;
+
+            case 'b':
+                args->n_blocks = parse_number(argv[0], "number of blocks", optarg);
+                break;
+
+            case 's':
+                args->block_size = parse_number(argv[0], "block size", optarg);
+                break;
+
+            case 'c':
+                args->n_cmds = parse_number(argv[0], "command count", optarg);
+                break;
+
+            case 'p':
+                args->chunk_pages = parse_number(argv[0], "number of pages", optarg);
+                break;
+
+            case 't':
+                args->n_threads = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'g':
+                args->sgl = true;
+                break;
+
+            case 'e':
+                args->extents = true;
+                break;
+
+            case 'u':
+                args->huge = true;
+                break;
+
+            case 'a':
+                args->admin = true;
+                break;
+
+            case 'r':
+                args->rpc = true;
+                break;
+
+            case 'y':
+                args->recycle = true;
+                break;
+
+            case 'm':
+                args->cmb = true;
+                break;
+
+            case 'd':
+                args->dbbuf = true;
+                break;
+
+            case 'x':
+                args->dsm = true;
+                break;
+
+            case 'w':
+                args->fused = true;
+                break;
+
+            case 'i':
+                args->pi = true;
+                break;
+
+            case 'h':
+                show_help(argv[0]);
+                exit(0);
+        }
+    }
+}
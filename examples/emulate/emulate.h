@@ -0,0 +1,136 @@
+#ifndef __LIBNVM_SAMPLES_EMULATE_H__
+#define __LIBNVM_SAMPLES_EMULATE_H__
+
+#include <nvm_types.h>
+#include <nvm_pool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+
+
+/* Command line options */
+struct options
+{
+    const char*     path;           // Backing file (NULL for RAM)
+    size_t          n_blocks;       // Number of blocks in namespace
+    size_t          block_size;     // Logical block size
+    size_t          n_cmds;         // Number of commands to issue
+    size_t          chunk_pages;    // Number of pages per command
+    size_t          n_threads;      // Number of threads sharing the SQ
+    size_t          prp_pages;      // Number of PRP list pages
+    bool            sgl;            // Use SGLs rather than PRPs
+    bool            extents;        // Transfer through an extent-based descriptor
+    bool            huge;           // Allocate data memory from hugepages
+    bool            admin;          // Exercise batched and asynchronous admin commands
+    bool            rpc;            // Relay admin commands over sockets and shared memory
+    bool            recycle;        // Delete and recreate the IO queue pair
+    bool            cmb;            // Place the SQ and PRP lists in the controller memory buffer
+    bool            dbbuf;          // Use shadow doorbells for IO queues
+    bool            dsm;            // Deallocate block ranges with dataset management
+    bool            fused;          // Issue fused compare-and-write commands
+    bool            pi;             // Format the namespace with protection information
+};
+
+
+
+/* IO queue pair and per-command resources */
+struct queue_pair
+{
+    nvm_queue_t     cq;
+    nvm_queue_t     sq;
+    nvm_cid_table_t* cids;
+    struct nvm_prp_pool* prp_pool;
+    const nvm_dma_t* sq_mem;        // Memory holding the SQ (host memory or CMB)
+    size_t          sq_page;        // Page offset of the SQ in sq_mem
+    const nvm_dma_t* dbbuf;         // Shadow doorbell and EventIdx pages (NULL if not used)
+    uint32_t        sgl_length;     // Length of single SGL data block (0 to use PRPs)
+};
+
+
+
+static inline uint64_t current_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+
+
+/*
+ * Take an SQ slot and a command identifier for a new command.
+ * Returns NULL if the SQ or the CID table is full.
+ */
+nvm_cmd_t* start_command(struct queue_pair* qp);
+
+
+
+/*
+ * Submit enqueued commands and wait until n commands have completed.
+ * Completions are stored in the order they are posted.
+ */
+int wait_commands(struct queue_pair* qp, nvm_cpl_t* cpls, size_t n);
+
+
+
+/*
+ * Issue a single read or write command and wait for its completion.
+ */
+int transfer(struct queue_pair* qp, const uint64_t* data_ioaddrs, uint8_t opcode, uint32_t ns_id,
+        uint64_t start_lba, uint16_t n_blks, size_t n_pages, uint64_t* elapsed);
+
+
+
+/*
+ * Write and read back data through an extent-based descriptor whose
+ * extents are out of order in memory.
+ */
+int run_extents(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const nvm_dma_t* mem, size_t page_offset,
+        const struct nvm_ns_info* ns, const struct options* args);
+
+
+
+/*
+ * Build range lists with nvm_dsm_range_append(), and deallocate every
+ * other pair of blocks of written data with a dataset management command.
+ */
+int run_dsm(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns);
+
+
+
+/*
+ * Issue fused compare-and-write commands where every other compare fails,
+ * and check that the write is only executed if the compare succeeds.
+ */
+int run_fused(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns, size_t n_cmds);
+
+
+
+/*
+ * Write and read back blocks with protection information generated and
+ * verified on the host, check that the controller catches bad tags, and
+ * that reused SQ slots carry no stale protection fields.
+ */
+int run_pi(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns, size_t n_cmds);
+
+
+
+/*
+ * Create and delete a batch of queue pairs, and keep several admin commands
+ * in flight with nvm_admin_submit() and nvm_admin_poll().
+ * If dbbuf is not NULL, the shadow doorbells are attached to the queues.
+ */
+int run_admin(nvm_aq_ref ref, const struct nvm_ns_info* ns, const nvm_dma_t* dbbuf);
+
+
+
+/*
+ * Relay admin commands from several threads over TCP, Unix socket and
+ * shared memory bindings at once.
+ */
+int run_rpc(nvm_aq_ref ref, const struct options* args);
+
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <nvm_types.h>
+#include <nvm_dma.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include <nvm_pool.h>
+#include "emulate.h"
+
+
+
+/*
+ * Describe the pages of a buffer as runs in reverse order, so that
+ * consecutive pages of the descriptor are not consecutive in memory.
+ * Run sizes cycle from 1 to 3 pages, so that extent boundaries fall at
+ * different positions within a transfer and its PRP lists.
+ * The emulated controller uses virtual addresses as bus addresses.
+ */
+static int map_scrambled(nvm_dma_ext_t** ext, const nvm_ctrl_t* ctrl, void* ptr, size_t n_pages)
+{
+    uint64_t* ioaddrs = calloc(n_pages, sizeof(uint64_t));
+    size_t* sizes = calloc(n_pages, sizeof(size_t));
+    size_t n_runs = 0;
+    size_t end = n_pages;
+
+    if (ioaddrs == NULL || sizes == NULL)
+    {
+        free(ioaddrs);
+        free(sizes);
+        return ENOMEM;
+    }
+
+    while (end > 0)
+    {
+        size_t run_pages = 1 + n_runs % 3;
+        run_pages = run_pages < end ? run_pages : end;
+        end -= run_pages;
+
+        ioaddrs[n_runs] = (uint64_t) NVM_PTR_OFFSET(ptr, ctrl->page_size, end);
+        sizes[n_runs] = run_pages * ctrl->page_size;
+        ++n_runs;
+    }
+
+    int status = nvm_dma_ext_map(ext, ctrl, NULL, n_runs, ioaddrs, sizes);
+
+    free(ioaddrs);
+    free(sizes);
+    return status;
+}
+
+
+
+/*
+ * Check that every page is found in the extent that holds it.
+ */
+static int check_lookup(const nvm_dma_ext_t* ext)
+{
+    for (size_t page = 0; page < ext->n_pages; ++page)
+    {
+        size_t i = nvm_dma_ext_find(ext, page);
+
+        if (i >= ext->n_extents || page < ext->extents[i].page
+                || page >= ext->extents[i].page + ext->extents[i].n_pages)
+        {
+            fprintf(stderr, "Page %zu was not found in the right extent\n", page);
+            return EIO;
+        }
+    }
+
+    if (nvm_dma_ext_find(ext, ext->n_pages) != ext->n_extents)
+    {
+        fprintf(stderr, "Page beyond the descriptor was found\n");
+        return EIO;
+    }
+
+    return 0;
+}
+
+
+
+int run_extents(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const nvm_dma_t* mem, size_t page_offset,
+        const struct nvm_ns_info* ns, const struct options* args)
+{
+    int status;
+    void* ptr;
+    nvm_dma_ext_t* ext;
+    nvm_cpl_t cpl;
+
+    size_t page_size = mem->page_size;
+    size_t n_pages = 4 * args->chunk_pages;
+    size_t n_blks = args->chunk_pages * page_size / ns->lba_data_size;
+    size_t n_lists = nvm_prp_num_lists(page_size, args->chunk_pages);
+    size_t n_words = page_size / sizeof(uint32_t);
+
+    void* list_ptrs[n_lists + 1];
+    uint64_t list_ioaddrs[n_lists + 1];
+
+    status = posix_memalign(&ptr, page_size, n_pages * page_size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate extent memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = map_scrambled(&ext, ctrl, ptr, n_pages);
+    if (status != 0)
+    {
+        free(ptr);
+        fprintf(stderr, "Failed to create extent-based descriptor: %s\n", strerror(status));
+        return status;
+    }
+
+    status = check_lookup(ext);
+
+    for (size_t i = 0; i < args->n_cmds && status == 0; ++i)
+    {
+        // Start every command at a different offset into the descriptor
+        size_t offset = (i * 5) % (n_pages - args->chunk_pages + 1);
+
+        for (size_t page = 0; page < args->chunk_pages; ++page)
+        {
+            uint32_t* data = (uint32_t*) nvm_dma_ext_ioaddr(ext, offset + page);
+            for (size_t j = 0; j < n_words; ++j)
+            {
+                data[j] = (uint32_t) ((i * args->chunk_pages + page) * n_words + j);
+            }
+        }
+
+        size_t n_taken = 0;
+        while (n_taken < n_lists && nvm_prp_pool_get(qp->prp_pool, &list_ptrs[n_taken], &list_ioaddrs[n_taken]) == 0)
+        {
+            ++n_taken;
+        }
+
+        nvm_cmd_t* cmd = n_taken == n_lists ? start_command(qp) : NULL;
+        if (cmd != NULL)
+        {
+            nvm_cmd_header(cmd, NVM_IO_WRITE, ns->ns_id);
+            nvm_cmd_rw_blks(cmd, i * n_blks, n_blks);
+            nvm_cmd_data_ext(cmd, ext, offset, args->chunk_pages, n_lists, list_ptrs, list_ioaddrs);
+
+            status = wait_commands(qp, &cpl, 1);
+        }
+        else
+        {
+            status = n_taken == n_lists ? EAGAIN : ENOMEM;
+        }
+
+        while (n_taken > 0)
+        {
+            nvm_prp_pool_put(qp->prp_pool, list_ptrs[--n_taken]);
+        }
+
+        if (status == 0 && !NVM_ERR_OK(&cpl))
+        {
+            status = NVM_ERR_STATUS(&cpl);
+        }
+
+        if (status != 0)
+        {
+            fprintf(stderr, "Write command failed: %s\n", nvm_strerror(status));
+            break;
+        }
+
+        // Read back into regular memory and check the order of the pages
+        uint32_t* data = (uint32_t*) NVM_DMA_OFFSET(mem, page_offset);
+        memset(data, 0xff, args->chunk_pages * page_size);
+
+        status = transfer(qp, &mem->ioaddrs[page_offset], NVM_IO_READ, ns->ns_id, i * n_blks, n_blks, args->chunk_pages, NULL);
+        if (status != 0)
+        {
+            fprintf(stderr, "Read command failed: %s\n", nvm_strerror(status));
+            break;
+        }
+
+        for (size_t j = 0; j < args->chunk_pages * n_words; ++j)
+        {
+            if (data[j] != (uint32_t) (i * args->chunk_pages * n_words + j))
+            {
+                fprintf(stderr, "Data mismatch in command %zu at offset %zu\n", i, j * sizeof(uint32_t));
+                status = EIO;
+                break;
+            }
+        }
+    }
+
+    if (status == 0)
+    {
+        fprintf(stdout, "extents: extents=%zu pages=%zu count=%zu\n", ext->n_extents, ext->n_pages, args->n_cmds);
+    }
+
+    nvm_dma_ext_unmap(ext);
+    free(ptr);
+    return status;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <nvm_types.h>
+#include <nvm_dma.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include "emulate.h"
+
+
+/* Status codes of a failed compare-and-write */
+#define SCT_GENERIC             0x00
+#define SCT_MEDIA               0x02
+#define SC_ABORTED_FUSED_FAIL   0x09
+#define SC_COMPARE_FAILURE      0x85
+
+
+
+/*
+ * Issue a fused compare-and-write of one page, and return the completions
+ * of the compare and the write command, in that order.
+ */
+static int compare_write(struct queue_pair* qp, const nvm_dma_t* dma, size_t compare_page, size_t write_page,
+        const struct nvm_ns_info* ns, uint64_t start_lba, uint16_t n_blks, nvm_cpl_t* cpls)
+{
+    nvm_cpl_t posted[2];
+
+    nvm_cmd_t* compare = start_command(qp);
+    if (compare == NULL)
+    {
+        return EAGAIN;
+    }
+
+    nvm_cmd_header(compare, NVM_IO_COMPARE, ns->ns_id);
+    nvm_cmd_rw_blks(compare, start_lba, n_blks);
+    nvm_cmd_data_ptr(compare, dma->ioaddrs[compare_page], 0);
+
+    // Both commands must be in adjacent slots, so the write is taken right away
+    nvm_cmd_t* write = start_command(qp);
+    if (write == NULL)
+    {
+        // Turn the compare into a flush, as it is already enqueued
+        nvm_cmd_header(compare, NVM_IO_FLUSH, ns->ns_id);
+        nvm_cmd_data_ptr(compare, 0, 0);
+        wait_commands(qp, posted, 1);
+        return EAGAIN;
+    }
+
+    nvm_cmd_header(write, NVM_IO_WRITE, ns->ns_id);
+    nvm_cmd_rw_blks(write, start_lba, n_blks);
+    nvm_cmd_data_ptr(write, dma->ioaddrs[write_page], 0);
+
+    nvm_cmd_compare_write(compare, write);
+
+    uint16_t compare_cid = *NVM_CMD_CID(compare);
+
+    int status = wait_commands(qp, posted, 2);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    bool swap = *NVM_CPL_CID(&posted[0]) != compare_cid;
+    cpls[0] = posted[swap];
+    cpls[1] = posted[!swap];
+    return 0;
+}
+
+
+
+/*
+ * Read the blocks back and compare them with a page.
+ */
+static int check_page(struct queue_pair* qp, const nvm_dma_t* dma, size_t expected_page, size_t read_page,
+        const struct nvm_ns_info* ns, uint64_t start_lba, uint16_t n_blks)
+{
+    memset(NVM_DMA_OFFSET(dma, read_page), 0, dma->page_size);
+
+    int status = transfer(qp, &dma->ioaddrs[read_page], NVM_IO_READ, ns->ns_id, start_lba, n_blks, 1, NULL);
+    if (status != 0)
+    {
+        fprintf(stderr, "Read command failed: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    if (memcmp(NVM_DMA_OFFSET(dma, read_page), NVM_DMA_OFFSET(dma, expected_page), dma->page_size) != 0)
+    {
+        fprintf(stderr, "Blocks do not hold the expected data\n");
+        return EIO;
+    }
+
+    return 0;
+}
+
+
+
+int run_fused(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns, size_t n_cmds)
+{
+    int status;
+    void* ptr;
+    nvm_dma_t* dma;
+    nvm_cpl_t cpls[2];
+    size_t n_failed = 0;
+
+    // Three pages of data to cycle through, and one page to read into
+    size_t size = 4 * ctrl->page_size;
+    uint16_t n_blks = ctrl->page_size / ns->lba_data_size;
+
+    status = posix_memalign(&ptr, ctrl->page_size, size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate data memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_dma_map_host(&dma, ctrl, ptr, size);
+    if (status != 0)
+    {
+        free(ptr);
+        fprintf(stderr, "Failed to map data memory: %s\n", strerror(status));
+        return status;
+    }
+
+    for (size_t page = 0; page < 3; ++page)
+    {
+        memset(NVM_DMA_OFFSET(dma, page), 0x11 * (page + 1), ctrl->page_size);
+    }
+
+    status = transfer(qp, &dma->ioaddrs[0], NVM_IO_WRITE, ns->ns_id, 0, n_blks, 1, NULL);
+    if (status != 0)
+    {
+        fprintf(stderr, "Write command failed: %s\n", nvm_strerror(status));
+        goto out;
+    }
+
+    // Every other compare is made against a page the blocks do not hold
+    size_t current = 0;
+
+    for (size_t i = 0; i < n_cmds; ++i)
+    {
+        bool match = i % 2 == 0;
+        size_t compare_page = match ? current : (current + 1) % 3;
+        size_t write_page = (current + 2) % 3;
+
+        status = compare_write(qp, dma, compare_page, write_page, ns, 0, n_blks, cpls);
+        if (status != 0)
+        {
+            fprintf(stderr, "Compare and write failed: %s\n", nvm_strerror(status));
+            goto out;
+        }
+
+        if (match && (!NVM_ERR_OK(&cpls[0]) || !NVM_ERR_OK(&cpls[1])))
+        {
+            fprintf(stderr, "Matching compare and write failed: %s\n",
+                    nvm_strerror(NVM_ERR_OK(&cpls[0]) ? NVM_ERR_STATUS(&cpls[1]) : NVM_ERR_STATUS(&cpls[0])));
+            status = EIO;
+            goto out;
+        }
+
+        if (!match && (NVM_ERR_SCT(&cpls[0]) != SCT_MEDIA || NVM_ERR_SC(&cpls[0]) != SC_COMPARE_FAILURE
+                    || NVM_ERR_SCT(&cpls[1]) != SCT_GENERIC || NVM_ERR_SC(&cpls[1]) != SC_ABORTED_FUSED_FAIL))
+        {
+            fprintf(stderr, "Mismatching compare and write was not aborted: %s, %s\n",
+                    nvm_strerror(NVM_ERR_STATUS(&cpls[0])), nvm_strerror(NVM_ERR_STATUS(&cpls[1])));
+            status = EIO;
+            goto out;
+        }
+
+        // The write is only executed if the compare succeeds
+        if (match)
+        {
+            current = write_page;
+        }
+        else
+        {
+            ++n_failed;
+        }
+
+        status = check_page(qp, dma, current, 3, ns, 0, n_blks);
+        if (status != 0)
+        {
+            goto out;
+        }
+    }
+
+    fprintf(stdout, "fused: count=%zu compare-failures=%zu\n", n_cmds, n_failed);
+
+out:
+    nvm_dma_unmap(dma);
+    free(ptr);
+    return status;
+}
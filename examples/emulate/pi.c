@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <nvm_types.h>
+#include <nvm_dma.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include <nvm_pi.h>
+#include "emulate.h"
+
+
+/* Status codes of failed end-to-end checks */
+#define SCT_MEDIA               0x02
+#define SC_GUARD_CHECK          0x82
+#define SC_APP_TAG_CHECK        0x83
+#define SC_REF_TAG_CHECK        0x84
+
+/* Application tag of written blocks */
+#define PI_APP_TAG              0xbeef
+
+/* Pages of the buffer */
+#define PAGE_WRITE_DATA         0
+#define PAGE_WRITE_MD           1
+#define PAGE_READ_DATA          2
+#define PAGE_READ_MD            3
+
+/* All checks */
+#define PRINFO_CHECK_ALL        (NVM_PRINFO_CHECK_GUARD | NVM_PRINFO_CHECK_APP | NVM_PRINFO_CHECK_REF)
+
+
+
+/*
+ * Issue a read or write of one page with separate metadata and protection
+ * information checks, and wait for it.
+ */
+static int pi_transfer(struct queue_pair* qp, const nvm_dma_t* dma, uint8_t opcode, size_t data_page, size_t md_page,
+        const struct nvm_ns_info* ns, uint64_t start_lba, uint16_t n_blks, uint8_t prinfo, uint32_t ref_tag, uint16_t app_mask,
+        nvm_cpl_t* cpl)
+{
+    nvm_cmd_t* cmd = start_command(qp);
+    if (cmd == NULL)
+    {
+        return EAGAIN;
+    }
+
+    nvm_cmd_header(cmd, opcode, ns->ns_id);
+    nvm_cmd_rw_blks(cmd, start_lba, n_blks);
+    nvm_cmd_data_ptr(cmd, dma->ioaddrs[data_page], 0);
+    nvm_cmd_metadata_ptr(cmd, dma->ioaddrs[md_page]);
+    nvm_cmd_protection(cmd, prinfo, ref_tag, PI_APP_TAG, app_mask);
+
+    return wait_commands(qp, cpl, 1);
+}
+
+
+
+/*
+ * Issue a command that is expected to fail with a specific status.
+ */
+static int expect_failure(struct queue_pair* qp, const nvm_dma_t* dma, uint8_t opcode, size_t data_page, size_t md_page,
+        const struct nvm_ns_info* ns, uint64_t start_lba, uint16_t n_blks, uint32_t ref_tag, uint8_t sc, const char* what)
+{
+    nvm_cpl_t cpl;
+
+    int status = pi_transfer(qp, dma, opcode, data_page, md_page, ns, start_lba, n_blks, PRINFO_CHECK_ALL, ref_tag, 0xffff, &cpl);
+    if (status != 0)
+    {
+        fprintf(stderr, "Command with %s failed: %s\n", what, nvm_strerror(status));
+        return status;
+    }
+
+    if (NVM_ERR_SCT(&cpl) != SCT_MEDIA || NVM_ERR_SC(&cpl) != sc)
+    {
+        fprintf(stderr, "Command with %s did not fail as expected: %s\n", what, nvm_strerror(NVM_ERR_STATUS(&cpl)));
+        return EIO;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Write blocks with generated protection information, read them back with
+ * all checks enabled and verify them on the host.
+ */
+static int round_trip(struct queue_pair* qp, const nvm_dma_t* dma, const struct nvm_ns_info* ns,
+        uint64_t start_lba, uint16_t n_blks, size_t iteration)
+{
+    nvm_cpl_t cpl;
+    size_t bad_block;
+    uint32_t* data = (uint32_t*) NVM_DMA_OFFSET(dma, PAGE_WRITE_DATA);
+    void* md = NVM_DMA_OFFSET(dma, PAGE_WRITE_MD);
+
+    for (size_t i = 0; i < dma->page_size / sizeof(uint32_t); ++i)
+    {
+        data[i] = (uint32_t) (iteration * 0x9e3779b9 + i);
+    }
+
+    int status = nvm_pi_generate(ns, data, md, n_blks, (uint32_t) start_lba, PI_APP_TAG);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to generate protection information: %s\n", strerror(status));
+        return status;
+    }
+
+    status = pi_transfer(qp, dma, NVM_IO_WRITE, PAGE_WRITE_DATA, PAGE_WRITE_MD, ns, start_lba, n_blks,
+            PRINFO_CHECK_ALL, (uint32_t) start_lba, 0xffff, &cpl);
+    if (status == 0 && !NVM_ERR_OK(&cpl))
+    {
+        status = NVM_ERR_STATUS(&cpl);
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Protected write failed: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    memset(NVM_DMA_OFFSET(dma, PAGE_READ_DATA), 0, dma->page_size);
+    memset(NVM_DMA_OFFSET(dma, PAGE_READ_MD), 0, dma->page_size);
+
+    status = pi_transfer(qp, dma, NVM_IO_READ, PAGE_READ_DATA, PAGE_READ_MD, ns, start_lba, n_blks,
+            PRINFO_CHECK_ALL, (uint32_t) start_lba, 0xffff, &cpl);
+    if (status == 0 && !NVM_ERR_OK(&cpl))
+    {
+        status = NVM_ERR_STATUS(&cpl);
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Protected read failed: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    status = nvm_pi_verify(ns, NVM_DMA_OFFSET(dma, PAGE_READ_DATA), NVM_DMA_OFFSET(dma, PAGE_READ_MD), n_blks,
+            (uint32_t) start_lba, PI_APP_TAG, 0xffff, PRINFO_CHECK_ALL, &bad_block);
+    if (status != 0)
+    {
+        fprintf(stderr, "Read block %zu failed verification on the host: %s\n", bad_block, strerror(status));
+        return status;
+    }
+
+    if (memcmp(NVM_DMA_OFFSET(dma, PAGE_READ_DATA), data, dma->page_size) != 0
+            || memcmp(NVM_DMA_OFFSET(dma, PAGE_READ_MD), md, n_blks * sizeof(nvm_pi_t)) != 0)
+    {
+        fprintf(stderr, "Read blocks do not match written blocks\n");
+        return EIO;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Check that the controller catches corrupted protection information and
+ * tags that do not match, and that masked application tag bits are ignored.
+ */
+static int check_failures(struct queue_pair* qp, const nvm_dma_t* dma, const struct nvm_ns_info* ns, uint16_t n_blks)
+{
+    nvm_cpl_t cpl;
+    nvm_pi_t* md = (nvm_pi_t*) NVM_DMA_OFFSET(dma, PAGE_WRITE_MD);
+
+    // Blocks at LBA 0 were written by the last round trip
+    int status = expect_failure(qp, dma, NVM_IO_READ, PAGE_READ_DATA, PAGE_READ_MD, ns, 0, n_blks, 1, SC_REF_TAG_CHECK,
+            "wrong reference tag");
+    if (status != 0)
+    {
+        return status;
+    }
+
+    status = pi_transfer(qp, dma, NVM_IO_READ, PAGE_READ_DATA, PAGE_READ_MD, ns, 0, n_blks,
+            NVM_PRINFO_CHECK_APP, 0, 0, &cpl);
+    if (status == 0 && !NVM_ERR_OK(&cpl))
+    {
+        status = NVM_ERR_STATUS(&cpl);
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Read with masked application tag failed: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    // Corrupt the metadata of the last block to be written
+    md[n_blks - 1].guard ^= 0x0101;
+    status = expect_failure(qp, dma, NVM_IO_WRITE, PAGE_WRITE_DATA, PAGE_WRITE_MD, ns, 0, n_blks, 0, SC_GUARD_CHECK,
+            "corrupted guard");
+    md[n_blks - 1].guard ^= 0x0101;
+    if (status != 0)
+    {
+        return status;
+    }
+
+    md[0].app_tag ^= 0x0100;
+    status = expect_failure(qp, dma, NVM_IO_WRITE, PAGE_WRITE_DATA, PAGE_WRITE_MD, ns, 0, n_blks, 0, SC_APP_TAG_CHECK,
+            "wrong application tag");
+    md[0].app_tag ^= 0x0100;
+    return status;
+}
+
+
+
+/*
+ * Fill every SQ slot with a protected command, and check that plain reads
+ * and writes issued through the same slots carry no stale protection fields.
+ */
+static int check_stale_fields(struct queue_pair* qp, const nvm_dma_t* dma, const struct nvm_ns_info* ns, uint16_t n_blks)
+{
+    uint32_t* data = (uint32_t*) NVM_DMA_OFFSET(dma, PAGE_WRITE_DATA);
+
+    for (size_t i = 0; i < qp->sq.max_entries; ++i)
+    {
+        int status = round_trip(qp, dma, ns, 0, n_blks, i);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    // The data no longer matches the protection information of the last round trip
+    for (size_t i = 0; i < dma->page_size / sizeof(uint32_t); ++i)
+    {
+        data[i] = ~data[i];
+    }
+
+    for (size_t i = 0; i < qp->sq.max_entries; ++i)
+    {
+        uint8_t opcode = i % 2 == 0 ? NVM_IO_WRITE : NVM_IO_READ;
+        size_t page = opcode == NVM_IO_WRITE ? PAGE_WRITE_DATA : PAGE_READ_DATA;
+
+        int status = transfer(qp, &dma->ioaddrs[page], opcode, ns->ns_id, 0, n_blks, 1, NULL);
+        if (status != 0)
+        {
+            fprintf(stderr, "Unprotected %s failed after protected commands: %s\n",
+                    opcode == NVM_IO_WRITE ? "write" : "read", nvm_strerror(status));
+            return status;
+        }
+    }
+
+    if (memcmp(NVM_DMA_OFFSET(dma, PAGE_READ_DATA), data, dma->page_size) != 0)
+    {
+        fprintf(stderr, "Unprotected read does not match unprotected write\n");
+        return EIO;
+    }
+
+    return 0;
+}
+
+
+
+int run_pi(struct queue_pair* qp, const nvm_ctrl_t* ctrl, const struct nvm_ns_info* ns, size_t n_cmds)
+{
+    int status;
+    void* ptr;
+    nvm_dma_t* dma;
+
+    size_t size = 4 * ctrl->page_size;
+    uint16_t n_blks = ctrl->page_size / ns->lba_data_size;
+
+    if (ns->pi_type == 0 || ns->extended_lba || ns->metadata_size != sizeof(nvm_pi_t))
+    {
+        fprintf(stderr, "Namespace is not formatted with separate protection information\n");
+        return EINVAL;
+    }
+
+    status = posix_memalign(&ptr, ctrl->page_size, size);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to allocate data memory: %s\n", strerror(status));
+        return status;
+    }
+
+    status = nvm_dma_map_host(&dma, ctrl, ptr, size);
+    if (status != 0)
+    {
+        free(ptr);
+        fprintf(stderr, "Failed to map data memory: %s\n", strerror(status));
+        return status;
+    }
+
+    // The reference tag follows the LBA, so write every page at a different offset
+    for (size_t i = 0; i < n_cmds; ++i)
+    {
+        status = round_trip(qp, dma, ns, (i % 16) * n_blks, n_blks, i);
+        if (status != 0)
+        {
+            goto out;
+        }
+    }
+
+    status = round_trip(qp, dma, ns, 0, n_blks, n_cmds);
+    if (status == 0)
+    {
+        status = check_failures(qp, dma, ns, n_blks);
+    }
+
+    if (status == 0)
+    {
+        status = check_stale_fields(qp, dma, ns, n_blks);
+    }
+
+    if (status == 0)
+    {
+        fprintf(stdout, "pi: type=%u count=%zu\n", ns->pi_type, n_cmds);
+    }
+
+out:
+    nvm_dma_unmap(dma);
+    free(ptr);
+    return status;
+}
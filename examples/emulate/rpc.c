@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <nvm_types.h>
+#include <nvm_aq.h>
+#include <nvm_rpc.h>
+#include <nvm_admin.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <nvm_error.h>
+#include "emulate.h"
+
+
+
+/*
+ * Client thread state.
+ */
+struct client
+{
+    pthread_t       thread;
+    nvm_aq_ref      ref;            // Binding shared with other threads
+    size_t          n_cmds;         // Number of commands to issue
+    uint16_t        n_cqs;          // Expected number of CQs
+    uint16_t        n_sqs;          // Expected number of SQs
+    int             status;         // First error
+};
+
+
+
+/*
+ * Server filter, which counts accepted commands and refuses to change
+ * controller features.
+ */
+static bool filter_command(nvm_cmd_t* cmd, void* data)
+{
+    if (_RB(cmd->dword[0], 7, 0) == NVM_ADMIN_SET_FEATURES)
+    {
+        return false;
+    }
+
+    __atomic_fetch_add((size_t*) data, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+
+
+static void* issue_commands(struct client* client)
+{
+    uint16_t n_cqs;
+    uint16_t n_sqs;
+
+    client->status = 0;
+
+    for (size_t i = 0; i < client->n_cmds; ++i)
+    {
+        int status = nvm_admin_get_num_queues(client->ref, &n_cqs, &n_sqs);
+        if (!nvm_ok(status))
+        {
+            client->status = status;
+            break;
+        }
+
+        if (n_cqs != client->n_cqs || n_sqs != client->n_sqs)
+        {
+            client->status = EIO;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Issue commands from several threads through each binding at once.
+ */
+static int run_clients(nvm_aq_ref* bindings, size_t n_bindings, const struct options* args)
+{
+    int status = 0;
+    uint16_t n_cqs;
+    uint16_t n_sqs;
+    size_t n_threads = args->n_threads > 0 ? args->n_threads : 1;
+    size_t n_clients = n_bindings * n_threads;
+    size_t n_started;
+
+    status = nvm_admin_get_num_queues(bindings[0], &n_cqs, &n_sqs);
+    if (!nvm_ok(status))
+    {
+        fprintf(stderr, "Failed to get number of queues: %s\n", nvm_strerror(status));
+        return status;
+    }
+
+    struct client* clients = calloc(n_clients, sizeof(struct client));
+    if (clients == NULL)
+    {
+        return ENOMEM;
+    }
+
+    for (n_started = 0; n_started < n_clients; ++n_started)
+    {
+        struct client* client = &clients[n_started];
+
+        client->ref = bindings[n_started % n_bindings];
+        client->n_cmds = args->n_cmds;
+        client->n_cqs = n_cqs;
+        client->n_sqs = n_sqs;
+
+        status = pthread_create(&client->thread, NULL, (void* (*)(void*)) issue_commands, client);
+        if (status != 0)
+        {
+            fprintf(stderr, "Failed to start client thread: %s\n", strerror(status));
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < n_started; ++i)
+    {
+        pthread_join(clients[i].thread, NULL);
+
+        if (clients[i].status != 0 && status == 0)
+        {
+            fprintf(stderr, "Client thread %zu failed: %s\n", i, nvm_strerror(clients[i].status));
+            status = clients[i].status;
+        }
+    }
+
+    free(clients);
+    return status;
+}
+
+
+
+int run_rpc(nvm_aq_ref ref, const struct options* args)
+{
+    int status;
+    nvm_aq_ref bindings[3] = { NULL, NULL, NULL };
+    size_t n_accepted = 0;
+    char path[64];
+    char name[64];
+
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+    uint16_t port = 49152 + getpid() % 16384;
+    snprintf(path, sizeof(path), "/tmp/nvm-emulate-%d.sock", (int) getpid());
+    snprintf(name, sizeof(name), "/nvm-emulate-%d", (int) getpid());
+
+    // Listening on TCP requires a filter, also on the loopback address
+    const char* addresses[] = { "0.0.0.0", NULL };
+    for (size_t i = 0; i < sizeof(addresses) / sizeof(addresses[0]); ++i)
+    {
+        status = nvm_tcp_rpc_enable(ref, addresses[i], port, NULL, NULL);
+        if (status != EPERM)
+        {
+            fprintf(stderr, "Listening on %s without a filter was not refused\n",
+                    addresses[i] != NULL ? addresses[i] : "loopback");
+            if (status == 0)
+            {
+                nvm_tcp_rpc_disable(ref, port);
+            }
+            return EIO;
+        }
+    }
+
+    status = nvm_tcp_rpc_enable(ref, NULL, port, filter_command, &n_accepted);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to enable TCP RPC on port %u: %s\n", port, strerror(status));
+        return status;
+    }
+
+    status = nvm_unix_rpc_enable(ref, path, NULL, NULL);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to enable Unix socket RPC at %s: %s\n", path, strerror(status));
+        goto disable_tcp;
+    }
+
+    // Only the owner may connect to the socket
+    struct stat st;
+    if (stat(path, &st) != 0 || (st.st_mode & 0777) != 0600)
+    {
+        fprintf(stderr, "Unix socket %s is not restricted to the owner\n", path);
+        status = EIO;
+        goto disable_unix;
+    }
+
+    status = nvm_shm_rpc_enable(ref, name, NULL, NULL);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to enable shared memory RPC at %s: %s\n", name, strerror(status));
+        goto disable_unix;
+    }
+
+    status = nvm_tcp_rpc_bind(&bindings[0], ctrl, "127.0.0.1", port);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to bind over TCP: %s\n", strerror(status));
+        goto disable_shm;
+    }
+
+    status = nvm_unix_rpc_bind(&bindings[1], ctrl, path);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to bind over Unix socket: %s\n", strerror(status));
+        goto unbind;
+    }
+
+    status = nvm_shm_rpc_bind(&bindings[2], ctrl, name);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to bind through shared memory: %s\n", strerror(status));
+        goto unbind;
+    }
+
+    status = run_clients(bindings, 3, args);
+    if (status != 0)
+    {
+        goto unbind;
+    }
+
+    // The filter refuses commands that change features
+    status = nvm_admin_set_num_queues(bindings[0], 1, 1);
+    if (status != EPERM)
+    {
+        fprintf(stderr, "Filtered command was not refused: %s\n", nvm_strerror(status));
+        status = EIO;
+        goto unbind;
+    }
+    status = 0;
+
+    size_t n_expected = 1 + args->n_cmds * (args->n_threads > 0 ? args->n_threads : 1);
+    if (__atomic_load_n(&n_accepted, __ATOMIC_RELAXED) != n_expected)
+    {
+        fprintf(stderr, "Filter accepted %zu commands, expected %zu\n", n_accepted, n_expected);
+        status = EIO;
+        goto unbind;
+    }
+
+    fprintf(stdout, "rpc: threads=%zu count=%zu tcp=%zu\n",
+            3 * (args->n_threads > 0 ? args->n_threads : 1), args->n_cmds, n_accepted);
+
+unbind:
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (bindings[i] != NULL)
+        {
+            nvm_rpc_unbind(bindings[i]);
+        }
+    }
+disable_shm:
+    nvm_shm_rpc_disable(ref, name);
+disable_unix:
+    nvm_unix_rpc_disable(ref, path);
+disable_tcp:
+    nvm_tcp_rpc_disable(ref, port);
+    return status;
+}
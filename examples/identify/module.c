@@ -50,6 +50,8 @@ static void print_ctrl_info(FILE* fp, const struct nvm_ctrl_info* info)
     fprintf(fp, "Max data transfer size  : %zu\n", info->max_data_size);
     fprintf(fp, "Max outstanding commands: %zu\n", info->max_out_cmds);
     fprintf(fp, "Max number of namespaces: %zu\n", info->max_n_ns);
+    fprintf(fp, "Volatile write cache    : %s\n", info->volatile_cache ? "yes" : "no");
+    fprintf(fp, "Atomic write unit       : %zu blocks\n", info->atomic_write);
     fprintf(fp, "--------------------------------------------------\n");
 }
 
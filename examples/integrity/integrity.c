@@ -4,6 +4,8 @@
 #include <nvm_aq.h>
 #include <nvm_admin.h>
 #include <nvm_error.h>
+#include <nvm_util.h>
+#include <nvm_cmd.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -258,7 +260,21 @@ static int identify_namespace(nvm_aq_ref ref, const struct arguments* args, stru
     }
 
     disk->ns_id = info.ns_id;
-    disk->block_size = info.lba_data_size;
+    disk->block_size = NVM_NS_BLOCK_SIZE(&info);
+    disk->prinfo = 0;
+
+    // Let the controller insert and check protection information
+    if (info.pi_type != 0 && info.metadata_size == sizeof(nvm_pi_t))
+    {
+        disk->block_size = info.lba_data_size;
+        disk->prinfo = NVM_PRINFO_ACTION | NVM_PRINFO_CHECK_GUARD;
+        if (info.pi_type != 3)
+        {
+            disk->prinfo |= NVM_PRINFO_CHECK_REF;
+        }
+
+        fprintf(stderr, "Using type %u end-to-end data protection\n", info.pi_type);
+    }
 
     nvm_dma_unmap(window);
     return status;
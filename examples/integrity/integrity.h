@@ -2,6 +2,7 @@
 #define __LIBNVM_SAMPLES_INTEGRITY_H__
 
 #include <nvm_types.h>
+#include <nvm_pool.h>
 #include <stdio.h>
 #include <stdint.h>
 
@@ -20,6 +21,8 @@ struct queue
 {
     struct buffer           qmem;
     nvm_queue_t             queue;
+    struct nvm_prp_pool*    prp_pool;   // PRP lists (SQ only)
+    void**                  prp_lists;  // PRP lists in use, indexed by CID (SQ only)
     size_t                  counter;
 };
 
@@ -31,6 +34,7 @@ struct disk
     size_t      max_data_size;
     uint32_t    ns_id;
     size_t      block_size;
+    uint8_t     prinfo;
 };
 
 
@@ -55,7 +55,15 @@ static struct consumer* consume_completions(struct consumer* c)
             continue;
         }
 
-        sq = &c->queues[*NVM_CPL_SQID(cpl)].queue;
+        struct queue* queue = &c->queues[*NVM_CPL_SQID(cpl)];
+        void** prp_list = &queue->prp_lists[*NVM_CPL_CID(cpl)];
+        if (*prp_list != NULL)
+        {
+            nvm_prp_pool_put(queue->prp_pool, *prp_list);
+            *prp_list = NULL;
+        }
+
+        sq = &queue->queue;
         nvm_sq_update(sq);
 
         if (!NVM_ERR_OK(cpl))
@@ -88,7 +96,6 @@ static struct producer* produce_commands(struct producer* p)
 
     nvm_dma_t* dma = p->buffer->dma;
     struct queue* queue = &p->queues[p->queue_no];
-    nvm_dma_t* prp = queue->qmem.dma;
 
     nvm_queue_t* sq = &queue->queue;
 
@@ -99,22 +106,36 @@ static struct producer* produce_commands(struct producer* p)
             transfer_pages = n_pages - page_offset;
         }
 
-        while ((cmd = nvm_sq_enqueue(sq)) == NULL)
+        // Build the command before taking a slot, so that submitting while
+        // waiting for PRP lists never rings the doorbell for a partial command
+        nvm_cmd_t local;
+        memset(&local, 0, sizeof(local));
+        nvm_cmd_header(&local, p->write ? NVM_IO_WRITE : NVM_IO_READ, ns_id);
+
+        size_t n_blocks = NVM_PAGE_TO_BLOCK(page_size, block_size, transfer_pages);
+        size_t start_block = p->start_block + NVM_PAGE_TO_BLOCK(page_size, block_size, page_offset);
+        nvm_cmd_rw_blks(&local, start_block, n_blocks);
+        nvm_cmd_protection(&local, p->disk->prinfo, start_block, 0, 0);
+
+        void* prp_list;
+        while (nvm_prp_pool_cmd_data(queue->prp_pool, &local, transfer_pages, &dma->ioaddrs[page_base+page_offset], &prp_list) != 0)
         {
+            // Wait for completions to release PRP lists
             nvm_sq_submit(sq);
             pthread_yield();
         }
 
-        nvm_cmd_header(cmd, p->write ? NVM_IO_WRITE : NVM_IO_READ, ns_id);
-
-        size_t n_blocks = NVM_PAGE_TO_BLOCK(page_size, block_size, transfer_pages);
-        size_t start_block = p->start_block + NVM_PAGE_TO_BLOCK(page_size, block_size, page_offset);
-        nvm_cmd_rw_blks(cmd, start_block, n_blocks);
+        while ((cmd = nvm_sq_enqueue(sq)) == NULL)
+        {
+            nvm_sq_submit(sq);
+            pthread_yield();
+        }
 
-        uint16_t prp_no = (*NVM_CMD_CID(cmd) % sq->max_entries) + 1;
+        uint16_t cid = *NVM_CMD_CID(cmd);
+        *cmd = local;
+        *NVM_CMD_CID(cmd) = cid;
 
-        nvm_cmd_data(cmd, page_size, transfer_pages, NVM_DMA_OFFSET(prp, prp_no),
-                prp->ioaddrs[prp_no], &dma->ioaddrs[page_base+page_offset]);
+        queue->prp_lists[cid] = prp_list;
 
         page_offset += transfer_pages;
         queue->counter++;
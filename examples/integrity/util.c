@@ -2,12 +2,14 @@
 #include <nvm_dma.h>
 #include <nvm_admin.h>
 #include <nvm_error.h>
+#include <nvm_pool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include "integrity.h"
 
 
@@ -61,11 +63,11 @@ int create_queue(struct queue* q, nvm_aq_ref ref, const struct queue* cq, uint16
 
     if (cq == NULL)
     {
-        status = nvm_admin_cq_create(ref, &q->queue, qno, NVM_DMA_OFFSET(q->qmem.dma, 0), q->qmem.dma->ioaddrs[0]);
+        status = nvm_admin_cq_create(ref, &q->queue, qno, q->qmem.dma, 0, 0);
     }
     else
     {
-        status = nvm_admin_sq_create(ref, &q->queue, &cq->queue, qno, NVM_DMA_OFFSET(q->qmem.dma, 0), q->qmem.dma->ioaddrs[0]);
+        status = nvm_admin_sq_create(ref, &q->queue, &cq->queue, qno, q->qmem.dma, 0, 0);
     }
 
     if (!nvm_ok(status))
@@ -75,6 +77,30 @@ int create_queue(struct queue* q, nvm_aq_ref ref, const struct queue* cq, uint16
         return status;
     }
 
+    q->prp_pool = NULL;
+    q->prp_lists = NULL;
+
+    if (cq != NULL)
+    {
+        // Pages following the SQ are used as PRP lists
+        status = nvm_prp_pool_create(&q->prp_pool, q->qmem.dma, 1, prp_lists);
+        if (status != 0)
+        {
+            remove_buffer(&q->qmem);
+            fprintf(stderr, "Failed to create PRP list pool: %s\n", strerror(status));
+            return status;
+        }
+
+        q->prp_lists = calloc(2 * q->queue.max_entries, sizeof(void*));
+        if (q->prp_lists == NULL)
+        {
+            nvm_prp_pool_free(q->prp_pool);
+            remove_buffer(&q->qmem);
+            fprintf(stderr, "Failed to allocate PRP list table\n");
+            return ENOMEM;
+        }
+    }
+
     q->counter = 0;
     return 0;
 }
@@ -82,6 +108,8 @@ int create_queue(struct queue* q, nvm_aq_ref ref, const struct queue* cq, uint16
 
 void remove_queue(struct queue* q)
 {
+    free(q->prp_lists);
+    nvm_prp_pool_free(q->prp_pool);
     remove_buffer(&q->qmem);
 }
 
@@ -72,6 +72,7 @@ static int prepare_and_read(nvm_aq_ref ref, const struct disk_info* disk, const
     }
 
     status = read_and_dump(disk, &queues, buffer, args);
+    remove_queue_pair(&queues);
 
 leave:
     nvm_dma_unmap(buffer);
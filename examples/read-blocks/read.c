@@ -6,12 +6,15 @@
 #include <nvm_queue.h>
 #include <nvm_cmd.h>
 #include <nvm_error.h>
+#include <nvm_pool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 
 
 static void print_ctrl_info(FILE* fp, const struct nvm_ctrl_info* info)
@@ -92,22 +95,31 @@ int create_queue_pair(nvm_aq_ref ref, struct queue_pair* qp, nvm_dma_t* cq_mem,
     }
 
     memset(cq_mem->vaddr, 0, cq_mem->page_size);
-    status = nvm_admin_cq_create(ref, &qp->cq, 2, cq_mem->vaddr, cq_mem->ioaddrs[0]);
+    memset(sq_mem->vaddr, 0, cq_mem->page_size);
+
+    status = nvm_admin_qp_create(ref, &qp->cq, cq_mem, 0, &qp->sq, sq_mem, 0, 0);
     if (!nvm_ok(status))
     {
-        fprintf(stderr, "Failed to create completion queue: %s\n", nvm_strerror(status));
+        fprintf(stderr, "Failed to create queue pair: %s\n", nvm_strerror(status));
         return status;
     }
 
-    memset(sq_mem->vaddr, 0, cq_mem->page_size);
-
-    status = nvm_admin_sq_create(ref, &qp->sq, &qp->cq, 2, sq_mem->vaddr, sq_mem->ioaddrs[0]);
-    if (!nvm_ok(status))
+    // Remaining pages of SQ memory are used as PRP lists
+    status = nvm_prp_pool_create(&qp->prp_pool, sq_mem, 1, sq_mem->n_ioaddrs - 1);
+    if (status != 0)
     {
-        fprintf(stderr, "Failed to create submission queue: %s\n", nvm_strerror(status));
+        fprintf(stderr, "Failed to create PRP list pool: %s\n", strerror(status));
         return status;
     }
 
+    qp->prp_lists = calloc(2 * qp->sq.max_entries, sizeof(void*));
+    if (qp->prp_lists == NULL)
+    {
+        nvm_prp_pool_free(qp->prp_pool);
+        fprintf(stderr, "Failed to allocate PRP list table\n");
+        return ENOMEM;
+    }
+
     qp->sq_mem = sq_mem;
     qp->cq_mem = cq_mem;
     qp->stop = false;
@@ -117,25 +129,44 @@ int create_queue_pair(nvm_aq_ref ref, struct queue_pair* qp, nvm_dma_t* cq_mem,
 
 
 
+void remove_queue_pair(struct queue_pair* qp)
+{
+    free(qp->prp_lists);
+    nvm_prp_pool_free(qp->prp_pool);
+}
+
+
+
 static void consume_completions(struct queue_pair* qp)
 {
-    nvm_cpl_t* cpl;
+    nvm_cpl_t cpls[64];
+    size_t n_cpls;
 
     while (!qp->stop)
     {
-        if ((cpl = nvm_cq_dequeue_block(&qp->cq, 100)) == NULL)
+        n_cpls = nvm_cq_dequeue_batch(&qp->cq, &qp->sq, cpls, sizeof(cpls) / sizeof(nvm_cpl_t));
+        if (n_cpls == 0)
         {
+            sched_yield();
             continue;
         }
-        nvm_sq_update(&qp->sq);
 
-        if (!NVM_ERR_OK(cpl))
+        for (size_t i = 0; i < n_cpls; ++i)
         {
-            fprintf(stderr, "%s\n", nvm_strerror(NVM_ERR_STATUS(cpl)));
+            uint16_t cid = *NVM_CPL_CID(&cpls[i]);
+            if (qp->prp_lists[cid] != NULL)
+            {
+                nvm_prp_pool_put(qp->prp_pool, qp->prp_lists[cid]);
+                qp->prp_lists[cid] = NULL;
+            }
+
+            if (!NVM_ERR_OK(&cpls[i]))
+            {
+                fprintf(stderr, "%s\n", nvm_strerror(NVM_ERR_STATUS(&cpls[i])));
+            }
         }
 
-        nvm_cq_update(&qp->cq);
-        qp->num_cpls++;
+        qp->num_cpls += n_cpls;
     }
 }
 
@@ -197,9 +228,6 @@ int read_and_dump(const struct disk_info* disk, struct queue_pair* qp, const nvm
         return status;
     }
 
-    // Clear all PRP lists
-    memset(NVM_DMA_OFFSET(qp->sq_mem, 1), 0, qp->sq_mem->page_size * (qp->sq_mem->n_ioaddrs - 1));
-
     // Read blocks
     size_t page = 0;
     size_t num_cmds = 0;
@@ -211,22 +239,35 @@ int read_and_dump(const struct disk_info* disk, struct queue_pair* qp, const nvm
             num_pages = buffer->n_ioaddrs - page;
         }
     
+        size_t num_blocks = NVM_PAGE_TO_BLOCK(disk->page_size, disk->block_size, num_pages);
+        size_t start_block = args->offset + NVM_PAGE_TO_BLOCK(disk->page_size, disk->block_size, page);
+
+        // Build the command before taking a slot, so that submitting while
+        // waiting for PRP lists never rings the doorbell for a partial command
+        nvm_cmd_t local;
+        memset(&local, 0, sizeof(local));
+        nvm_cmd_header(&local, NVM_IO_READ, disk->ns_id);
+        nvm_cmd_rw_blks(&local, start_block, num_blocks);
+
+        void* prp_list;
+        while (nvm_prp_pool_cmd_data(qp->prp_pool, &local, num_pages, &buffer->ioaddrs[page], &prp_list) != 0)
+        {
+            // Wait for completions to release PRP lists
+            nvm_sq_submit(&qp->sq);
+        }
+
         nvm_cmd_t* cmd;
         while ((cmd = nvm_sq_enqueue(&qp->sq)) == NULL)
         {
             nvm_sq_submit(&qp->sq);
         }
 
-        uint16_t prp_list = (*NVM_CMD_CID(cmd) % qp->sq.max_entries) + 1;
-        size_t num_blocks = NVM_PAGE_TO_BLOCK(disk->page_size, disk->block_size, num_pages);
-        size_t start_block = args->offset + NVM_PAGE_TO_BLOCK(disk->page_size, disk->block_size, page);
-
-        nvm_cmd_header(cmd, NVM_IO_READ, disk->ns_id);
-
-        page += nvm_cmd_data(cmd, disk->page_size, num_pages, NVM_DMA_OFFSET(qp->sq_mem, prp_list),
-                qp->sq_mem->ioaddrs[prp_list], &buffer->ioaddrs[page]);
+        uint16_t cid = *NVM_CMD_CID(cmd);
+        *cmd = local;
+        *NVM_CMD_CID(cmd) = cid;
 
-        nvm_cmd_rw_blks(cmd, start_block, num_blocks);
+        qp->prp_lists[cid] = prp_list;
+        page += num_pages;
 
         ++num_cmds;
     }
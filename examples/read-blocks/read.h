@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <nvm_types.h>
+#include <nvm_pool.h>
 #include "args.h"
 
 
@@ -25,6 +26,8 @@ struct queue_pair
     nvm_dma_t*  cq_mem;
     nvm_queue_t sq;
     nvm_queue_t cq;
+    struct nvm_prp_pool* prp_pool;
+    void**      prp_lists;  // PRP lists in use, indexed by CID
     bool        stop;
     size_t      num_cpls;
 };
@@ -37,6 +40,9 @@ int get_disk_info(nvm_aq_ref ref, struct disk_info* info, uint32_t ns_id, void*
 int create_queue_pair(nvm_aq_ref ref, struct queue_pair* qp, nvm_dma_t* cq_mem, nvm_dma_t* sq_mem);
 
 
+void remove_queue_pair(struct queue_pair* qp);
+
+
 int read_and_dump(const struct disk_info* disk, struct queue_pair* qp, const nvm_dma_t* buffer, const struct options* args);
 
 
@@ -111,6 +111,7 @@ int main(int argc, char** argv)
     }
 
     status = read_and_dump(&info, &queues, buffer, &args);
+    remove_queue_pair(&queues);
 
 leave:
     nvm_dma_unmap(cq_mem);
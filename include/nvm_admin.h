@@ -11,6 +11,11 @@ extern "C" {
 
 
 
+/* Maximum number of identifiers in an active namespace list */
+#define NVM_NS_LIST_MAX     1024
+
+
+
 /*
  * Get controller information.
  */
@@ -32,6 +37,24 @@ int nvm_admin_ns_info(nvm_aq_ref ref,                 // AQ pair reference
 
 
 
+/*
+ * Get active namespace list.
+ *
+ * Retrieve active namespace identifiers greater than ns_id, in increasing
+ * order. A single list holds up to NVM_NS_LIST_MAX identifiers; call again
+ * with the last identifier retrieved to continue.
+ * n_ns is the number of identifiers ns_ids can hold, and is set to the 
+ * number of identifiers retrieved.
+ */
+int nvm_admin_ns_list(nvm_aq_ref ref,                 // AQ pair reference
+                      uint32_t ns_id,                 // List identifiers greater than this
+                      uint32_t* ns_ids,               // Namespace identifiers
+                      size_t* n_ns,                   // Number of namespace identifiers
+                      void* buffer,                   // Temporary buffer (must be at least 4 KB)
+                      uint64_t ioaddr);               // Bus address of buffer as seen by controller
+
+
+
 /*
  * Make controller allocate and reserve queues.
  */
@@ -53,24 +76,218 @@ int nvm_admin_request_num_queues(nvm_aq_ref ref, uint16_t* n_cqs, uint16_t* n_sq
 /*
  * Create IO completion queue (CQ)
  * Caller must set queue memory to zero manually.
+ *
+ * The queue occupies NVM_CTRL_PAGES(ctrl, qs * sizeof(nvm_cpl_t)) pages of
+ * the DMA descriptor, starting at page_offset. If these pages are not
+ * physically contiguous, the page following the queue memory is used as a
+ * PRP list and must be kept intact for the lifetime of the queue. The PRP
+ * list is a single page, so such a queue can span at most page_size / 8 pages.
+ * Controllers that require contiguous queues (CAP.CQR) do not support this.
+ *
+ * If qs is 0, the queue is one controller page. The queue size is limited
+ * to the maximum number of entries supported by the controller (MQES).
  */
 int nvm_admin_cq_create(nvm_aq_ref ref,               // AQ pair reference
                         nvm_queue_t* cq,              // CQ descriptor
                         uint16_t id,                  // Queue identifier
-                        void* qmem,                   // Queue memory (virtual memory)
-                        uint64_t ioaddr);             // Bus address to queue memory as seen by controller
+                        const nvm_dma_t* dma,         // Queue memory
+                        size_t page_offset,           // Offset into queue memory (in pages)
+                        size_t qs);                   // Number of queue entries
+
 
 
 /*
  * Create IO submission queue (SQ)
  * Caller must set queue memory to zero manually.
+ *
+ * Memory layout is the same as for nvm_admin_cq_create(), except that the
+ * queue occupies NVM_CTRL_PAGES(ctrl, qs * sizeof(nvm_cmd_t)) pages.
+ * Note that an SQ with qs entries can hold at most qs - 1 commands.
  */
 int nvm_admin_sq_create(nvm_aq_ref ref,               // AQ pair reference
                         nvm_queue_t* sq,              // SQ descriptor
                         const nvm_queue_t* cq,        // Descriptor to paired CQ
                         uint16_t id,                  // Queue identifier
-                        void* qmem,                   // Queue memory (virtual)
-                        uint64_t ioaddr);             // Bus address to queue as seen by controller
+                        const nvm_dma_t* dma,         // Queue memory
+                        size_t page_offset,           // Offset into queue memory (in pages)
+                        size_t qs);                   // Number of queue entries
+
+
+
+/*
+ * Delete IO submission queue (SQ).
+ * Outstanding commands in the SQ are aborted by the controller. Queue
+ * memory can be reused once this function returns.
+ */
+int nvm_admin_sq_delete(nvm_aq_ref ref, const nvm_queue_t* sq);
+
+
+
+/*
+ * Delete IO completion queue (CQ).
+ * All SQs paired with the CQ must be deleted first.
+ */
+int nvm_admin_cq_delete(nvm_aq_ref ref, const nvm_queue_t* cq);
+
+
+
+/*
+ * Abort a command.
+ * Request the controller to abort the command with the specified command
+ * identifier in the SQ with the specified queue identifier (0 for the ASQ).
+ * Aborting is best effort; if aborted is not NULL, it is set to indicate
+ * whether the command was actually aborted or had already completed.
+ */
+int nvm_admin_abort(nvm_aq_ref ref, uint16_t sq_no, uint16_t cid, bool* aborted);
+
+
+
+/*
+ * Configure shadow doorbell buffer (NVMe 1.3).
+ *
+ * Register two controller pages of the DMA descriptor, starting at 
+ * page_offset, with the controller. The first page is the shadow doorbell
+ * buffer and the second page is the EventIdx buffer, both laid out the same
+ * way as the doorbell registers. The caller must set the memory to zero
+ * manually, and the memory must be kept for the lifetime of the controller.
+ *
+ * IO queues use the buffer once attached with nvm_queue_dbbuf(). The admin
+ * queues always use the doorbell registers.
+ */
+int nvm_admin_dbbuf_config(nvm_aq_ref ref, const nvm_dma_t* dma, size_t page_offset);
+
+
+
+/*
+ * Allocate and create an IO queue pair.
+ * Caller must set queue memory to zero manually.
+ *
+ * Instead of picking a queue identifier, the caller asks the admin queue
+ * owner (the process that called nvm_aq_create()) for one. The owner hands
+ * out the lowest identifier that is not in use, among the queue pairs
+ * granted by the controller (see nvm_admin_request_num_queues()), and the
+ * CQ and SQ both get this identifier. This allows several processes to
+ * share a controller through RPC without coordinating queue numbers.
+ *
+ * Memory layout of each queue is the same as for nvm_admin_cq_create() and
+ * nvm_admin_sq_create(). Returns ENOSPC (packed) if all queue pairs are in
+ * use. Use nvm_admin_qp_delete() to delete the queues and give the 
+ * identifier back.
+ */
+int nvm_admin_qp_create(nvm_aq_ref ref,               // AQ pair reference
+                        nvm_queue_t* cq,              // CQ descriptor
+                        const nvm_dma_t* cq_dma,      // CQ memory
+                        size_t cq_offset,             // Offset into CQ memory (in pages)
+                        nvm_queue_t* sq,              // SQ descriptor
+                        const nvm_dma_t* sq_dma,      // SQ memory
+                        size_t sq_offset,             // Offset into SQ memory (in pages)
+                        size_t qs);                   // Number of queue entries
+
+
+
+/*
+ * Delete an IO queue pair.
+ * Deletes the SQ and then the CQ, and releases the queue identifier if the
+ * queues were allocated with nvm_admin_qp_create().
+ */
+int nvm_admin_qp_delete(nvm_aq_ref ref, const nvm_queue_t* sq, const nvm_queue_t* cq);
+
+
+
+/*
+ * Create a batch of IO completion queues (CQs).
+ * Caller must set queue memory to zero manually.
+ *
+ * Queue i gets identifier first_id + i and starts at page 
+ * page_offset + i * stride of the DMA descriptor. If stride is 0, queues 
+ * are placed back to back. Otherwise, stride must leave room for the
+ * PRP list page if queue memory is not physically contiguous (see
+ * nvm_admin_cq_create()).
+ *
+ * All create commands are in flight at once when using a local AQ pair
+ * reference. If a command fails, the error of the first failed command is
+ * returned, but the remaining queues are still created. The cqs entries of
+ * failed queues are left untouched.
+ */
+int nvm_admin_cq_create_batch(nvm_aq_ref ref,         // AQ pair reference
+                              size_t n_queues,        // Number of queues
+                              nvm_queue_t* cqs,       // Array of CQ descriptors
+                              uint16_t first_id,      // Identifier of first queue
+                              const nvm_dma_t* dma,   // Queue memory
+                              size_t page_offset,     // Offset to first queue (in pages)
+                              size_t stride,          // Distance between queues (in pages)
+                              size_t qs);             // Number of queue entries
+
+
+
+/*
+ * Create a batch of IO submission queues (SQs).
+ * Caller must set queue memory to zero manually.
+ *
+ * Same as nvm_admin_cq_create_batch(), except that SQ i is paired with 
+ * the CQ cqs[i].
+ */
+int nvm_admin_sq_create_batch(nvm_aq_ref ref,         // AQ pair reference
+                              size_t n_queues,        // Number of queues
+                              nvm_queue_t* sqs,       // Array of SQ descriptors
+                              const nvm_queue_t* cqs, // Array of paired CQ descriptors
+                              uint16_t first_id,      // Identifier of first queue
+                              const nvm_dma_t* dma,   // Queue memory
+                              size_t page_offset,     // Offset to first queue (in pages)
+                              size_t stride,          // Distance between queues (in pages)
+                              size_t qs);             // Number of queue entries
+
+
+
+/*
+ * Submit an admin command without waiting for completion.
+ *
+ * Enqueue a command in the ASQ and ring the doorbell. The command 
+ * identifier assigned to the command is returned in cid, and must be 
+ * passed to nvm_admin_poll() in order to collect the completion. Several 
+ * commands may be in flight at once; completions are matched with their 
+ * commands by command identifier, regardless of the order they arrive in.
+ *
+ * Only local AQ pair references (see nvm_aq_create()) are supported.
+ * Returns EAGAIN (packed) if the ASQ is full.
+ */
+int nvm_admin_submit(nvm_aq_ref ref,                  // AQ pair reference
+                     const nvm_cmd_t* cmd,            // Command (the CID is replaced)
+                     uint16_t* cid);                  // Assigned command identifier
+
+
+
+/*
+ * Poll for completion of an admin command.
+ *
+ * Wait for up to timeout milliseconds for the command with the specified 
+ * command identifier to complete. If timeout is 0, this function does not
+ * block. The reference is only locked while checking the ACQ, so other 
+ * threads may submit commands in the meantime.
+ *
+ * Returns EAGAIN (packed) if the command is not completed yet and timeout
+ * is 0, ETIME if the timeout expires, or the status of the completion.
+ * The command identifier is released once the completion is returned.
+ * If the timeout expires, the command is cancelled (see nvm_admin_cancel())
+ * and can not be polled again.
+ */
+int nvm_admin_poll(nvm_aq_ref ref,                    // AQ pair reference
+                   uint16_t cid,                      // Command identifier
+                   nvm_cpl_t* cpl,                    // Completion
+                   uint64_t timeout);                 // Timeout in milliseconds
+
+
+
+/*
+ * Stop waiting for an admin command.
+ *
+ * Give up on a command submitted with nvm_admin_submit() without collecting
+ * its completion. The command is not aborted, but its command identifier is
+ * released once the controller completes it, so that it can be reused.
+ * Returns EINVAL (packed) if the command is not outstanding.
+ */
+int nvm_admin_cancel(nvm_aq_ref ref, uint16_t cid);
+
 
 
 #ifdef __cplusplus
@@ -35,8 +35,88 @@ void nvm_aq_destroy(nvm_aq_ref ref);
 
 
 
-//int nvm_tcp_rpc_enable(nvm_aq_ref ref, uint16_t port, nvm_rpc_cb_t filter, void* data);
-//int nvm_tcp_rpc_disable(nvm_aq_ref ref, uint16_t port);
+/*
+ * Callback function invoked whenever a remote NVM admin command is received
+ * over a socket. Should indicate whether or not the command is accepted and
+ * can be enqueued by using the return value.
+ *
+ * The remote command can also be modified if necessary.
+ */
+typedef bool (*nvm_rpc_cb_t)(nvm_cmd_t* cmd, void* data);
+
+
+
+/*
+ * Enable remote admin commands over TCP.
+ * Allows other processes to relay NVM admin commands to the local process
+ * by connecting to the specified port (see nvm_tcp_rpc_bind()). 
+ * Several commands may be outstanding per connection.
+ *
+ * The server listens on the IPv4 address given in dotted notation, or on
+ * the loopback address if address is NULL. Use "0.0.0.0" to listen on all
+ * interfaces. Any local user can connect to the loopback address, and any
+ * host that can reach other addresses, so admin commands (such as Format
+ * NVM, or commands with data pointers to arbitrary memory) are only relayed
+ * if the filter accepts them. The filter is required, EPERM is returned if
+ * it is NULL.
+ */
+int nvm_tcp_rpc_enable(nvm_aq_ref ref,               // NVM admin queue-pair reference
+                       const char* address,          // Address to listen on (NULL for loopback)
+                       uint16_t port,                // Port to listen on
+                       nvm_rpc_cb_t filter,          // Filter callback
+                       void* data);                  // User data passed to filter callback
+
+
+
+/*
+ * Disable remote admin commands over TCP.
+ * Stop accepting connections on the port and close existing connections.
+ */
+void nvm_tcp_rpc_disable(nvm_aq_ref ref, uint16_t port);
+
+
+
+/*
+ * Enable remote admin commands over a Unix domain socket.
+ * Same as nvm_tcp_rpc_enable(), except that the server listens on a socket
+ * file created at the specified path (see nvm_unix_rpc_bind()), and the
+ * filter is optional. The socket file is created with mode 0600, so only
+ * processes running as the same user can connect.
+ */
+int nvm_unix_rpc_enable(nvm_aq_ref ref,              // NVM admin queue-pair reference
+                        const char* path,            // Path to socket file
+                        nvm_rpc_cb_t filter,         // Filter callback (can be NULL)
+                        void* data);                 // User data passed to filter callback
+
+
+
+/*
+ * Disable remote admin commands over a Unix domain socket.
+ * Close existing connections and remove the socket file.
+ */
+void nvm_unix_rpc_disable(nvm_aq_ref ref, const char* path);
+
+
+
+/*
+ * Enable remote admin commands through shared memory.
+ * Creates a POSIX shared memory segment with the specified name (for
+ * example "/nvm-rpc"), which processes on the same host can bind to using
+ * nvm_shm_rpc_bind(). Requests are drained from the segment in batches and
+ * submitted to the admin queue together.
+ */
+int nvm_shm_rpc_enable(nvm_aq_ref ref,               // NVM admin queue-pair reference
+                       const char* name,             // Name of shared memory segment
+                       nvm_rpc_cb_t filter,          // Filter callback (can be NULL)
+                       void* data);                  // User data passed to filter callback
+
+
+
+/*
+ * Disable remote admin commands through shared memory.
+ * Stop processing commands and remove the shared memory segment.
+ */
+void nvm_shm_rpc_disable(nvm_aq_ref ref, const char* name);
 
 
 
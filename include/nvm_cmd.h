@@ -7,8 +7,10 @@
 #endif
 
 #include <nvm_types.h>
+#include <nvm_util.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 
 
@@ -16,13 +18,92 @@
 #define NVM_CMD_NS_ALL                  0xffffffff
 
 
+/* Maximum number of ranges in a dataset management range list */
+#define NVM_DSM_MAX_RANGES              256
+
+
+/* Maximum number of blocks in a dataset management range */
+#define NVM_DSM_MAX_RANGE_BLOCKS        0xffffffffULL
+
+
 /* List of NVM IO command opcodes */
 enum nvm_io_command_set
 {
     NVM_IO_FLUSH                    = (0x00 << 7) | (0x00 << 2) | 0x00, // 00h
     NVM_IO_WRITE                    = (0x00 << 7) | (0x00 << 2) | 0x01, // 01h
     NVM_IO_READ                     = (0x00 << 7) | (0x00 << 2) | 0x02, // 02h
-    NVM_IO_WRITE_ZEROES             = (0x00 << 7) | (0x02 << 2) | 0x00  // 08h
+    NVM_IO_WRITE_UNCORRECTABLE      = (0x00 << 7) | (0x01 << 2) | 0x00, // 04h
+    NVM_IO_COMPARE                  = (0x00 << 7) | (0x01 << 2) | 0x01, // 05h
+    NVM_IO_WRITE_ZEROES             = (0x00 << 7) | (0x02 << 2) | 0x00, // 08h
+    NVM_IO_DATASET_MANAGEMENT       = (0x00 << 7) | (0x02 << 2) | 0x01, // 09h
+    NVM_IO_VERIFY                   = (0x00 << 7) | (0x03 << 2) | 0x00  // 0Ch
+};
+
+
+
+/* Fused operation (FUSE) of a command */
+enum nvm_fuse
+{
+    NVM_FUSE_NONE                   = 0x00, // Normal operation
+    NVM_FUSE_FIRST                  = 0x01, // First command of a fused operation
+    NVM_FUSE_SECOND                 = 0x02  // Second command of a fused operation
+};
+
+
+
+/* Dataset management attributes (DWORD11 of dataset management command) */
+enum nvm_dsm_attributes
+{
+    NVM_DSM_INTEGRAL_READ           = 0x01, // Optimize for integral dataset for read (IDR)
+    NVM_DSM_INTEGRAL_WRITE          = 0x02, // Optimize for integral dataset for write (IDW)
+    NVM_DSM_DEALLOCATE              = 0x04  // Deallocate ranges (AD)
+};
+
+
+
+/* Access latency hint (DWORD13 of read and write commands) */
+enum nvm_dsm_latency
+{
+    NVM_DSM_LATENCY_NONE            = 0x00, // No latency information provided
+    NVM_DSM_LATENCY_IDLE            = 0x01, // Longer latency is acceptable
+    NVM_DSM_LATENCY_NORMAL          = 0x02, // Typical latency
+    NVM_DSM_LATENCY_LOW             = 0x03  // Smallest possible latency
+};
+
+
+
+/* Access frequency hint (DWORD13 of read and write commands) */
+enum nvm_dsm_frequency
+{
+    NVM_DSM_FREQ_NONE               = 0x00, // No frequency information provided
+    NVM_DSM_FREQ_TYPICAL            = 0x01, // Typical number of reads and writes
+    NVM_DSM_FREQ_INFREQUENT         = 0x02, // Infrequent writes and infrequent reads
+    NVM_DSM_FREQ_READ_RARE          = 0x03, // Infrequent writes and frequent reads
+    NVM_DSM_FREQ_WRITE_RARE         = 0x04, // Frequent writes and infrequent reads
+    NVM_DSM_FREQ_FREQUENT           = 0x05, // Frequent writes and frequent reads
+    NVM_DSM_FREQ_ONCE               = 0x06  // One time read
+};
+
+
+
+/* Protection information action and check (PRINFO) of read and write commands */
+enum nvm_prinfo
+{
+    NVM_PRINFO_CHECK_REF            = 0x01, // Check reference tag
+    NVM_PRINFO_CHECK_APP            = 0x02, // Check application tag
+    NVM_PRINFO_CHECK_GUARD          = 0x04, // Check guard field
+    NVM_PRINFO_ACTION               = 0x08  // Controller inserts and strips protection information (PRACT)
+};
+
+
+
+/* List of SGL descriptor types */
+enum nvm_sgl_type
+{
+    NVM_SGL_DATA_BLOCK              = 0x00,
+    NVM_SGL_BIT_BUCKET              = 0x01,
+    NVM_SGL_SEGMENT                 = 0x02,
+    NVM_SGL_LAST_SEGMENT            = 0x03
 };
 
 
@@ -37,7 +118,8 @@ enum nvm_admin_command_set
     NVM_ADMIN_IDENTIFY                  = (0x00 << 7) | (0x01 << 2) | 0x02,
     NVM_ADMIN_ABORT                     = (0x00 << 7) | (0x02 << 2) | 0x00,
     NVM_ADMIN_SET_FEATURES              = (0x00 << 7) | (0x02 << 2) | 0x01,
-    NVM_ADMIN_GET_FEATURES              = (0x00 << 7) | (0x02 << 2) | 0x02
+    NVM_ADMIN_GET_FEATURES              = (0x00 << 7) | (0x02 << 2) | 0x02,
+    NVM_ADMIN_DOORBELL_BUFFER_CONFIG    = (0x00 << 7) | (0x1f << 2) | 0x00
 };
 
 
@@ -45,7 +127,11 @@ enum nvm_admin_command_set
 
 
 /*
- * Set command's DWORD0 and DWORD1
+ * Set command's DWORD0 and DWORD1.
+ * Commands are often built in place in reused queue slots, so the metadata
+ * pointer (DWORD4-5) and command specific fields (DWORD10-15), such as
+ * PRINFO and the protection tags, are cleared. The command identifier is
+ * kept, and the data pointer is set by the data pointer functions.
  */
 __device__ __host__ static inline
 void nvm_cmd_header(nvm_cmd_t* cmd, uint8_t opcode, uint32_t ns_id)
@@ -53,6 +139,16 @@ void nvm_cmd_header(nvm_cmd_t* cmd, uint8_t opcode, uint32_t ns_id)
     cmd->dword[0] &= 0xffff0000;
     cmd->dword[0] |= (0x00 << 14) | (0x00 << 8) | (opcode & 0x7f);
     cmd->dword[1] = ns_id;
+    cmd->dword[2] = 0;
+    cmd->dword[3] = 0;
+    cmd->dword[4] = 0;
+    cmd->dword[5] = 0;
+    cmd->dword[10] = 0;
+    cmd->dword[11] = 0;
+    cmd->dword[12] = 0;
+    cmd->dword[13] = 0;
+    cmd->dword[14] = 0;
+    cmd->dword[15] = 0;
 }
 
 
@@ -87,14 +183,301 @@ void nvm_cmd_rw_blks(nvm_cmd_t* cmd, uint64_t start_lba, uint16_t n_blks)
 
 
 /*
- * Set command's dataset management (DSM) field (DWORD13)
+ * Set command's dataset management (DSM) field (DWORD13).
+ * Access hints for read and write commands; sequential indicates that the 
+ * command is part of a sequential read or write.
+ */
+__device__ __host__ static inline
+void nvm_cmd_dataset(nvm_cmd_t* cmd, bool sequential, uint8_t latency, uint8_t frequency)
+{
+    cmd->dword[13] = (cmd->dword[13] & 0xffffff00) 
+        | (((uint32_t) !!sequential) << 6) 
+        | ((latency & 0x03) << 4) 
+        | (frequency & 0x0f);
+}
+
+
+
+/*
+ * Set command's metadata pointer (MPTR, DWORD4-5).
+ * Used when the namespace is formatted with metadata transferred as a
+ * separate buffer, the buffer must be physically contiguous.
+ */
+__device__ __host__ static inline
+void nvm_cmd_metadata_ptr(nvm_cmd_t* cmd, uint64_t mptr)
+{
+    cmd->dword[4] = (uint32_t) mptr;
+    cmd->dword[5] = (uint32_t) (mptr >> 32UL);
+}
+
+
+
+/*
+ * Set command's end-to-end protection fields (PRINFO in DWORD12 and
+ * DWORD14-15). ref_tag is the expected initial reference tag, which for
+ * type 1 protection must be the lower 32 bits of the starting LBA. Only
+ * application tag bits set in app_mask are checked.
+ */
+__device__ __host__ static inline
+void nvm_cmd_protection(nvm_cmd_t* cmd, uint8_t prinfo, uint32_t ref_tag, uint16_t app_tag, uint16_t app_mask)
+{
+    cmd->dword[12] = (cmd->dword[12] & ~(0x0f << 26)) | ((prinfo & 0x0f) << 26);
+    cmd->dword[14] = ref_tag;
+    cmd->dword[15] = (((uint32_t) app_mask) << 16) | app_tag;
+}
+
+
+
+/*
+ * Set command's fused operation field (FUSE).
+ * Must be set after the data pointer, as setting it clears the field.
+ */
+__device__ __host__ static inline
+void nvm_cmd_fuse(nvm_cmd_t* cmd, uint8_t fuse)
+{
+    cmd->dword[0] = (cmd->dword[0] & ~(0x03 << 8)) | ((fuse & 0x03) << 8);
+}
+
+
+
+/*
+ * Fuse a compare command and a write command into an atomic 
+ * compare-and-write operation. The write is only executed if the compare
+ * succeeds. Both commands must be fully prepared and be enqueued in 
+ * adjacent slots of the same SQ, and be submitted together.
+ */
+__device__ __host__ static inline
+void nvm_cmd_compare_write(nvm_cmd_t* compare, nvm_cmd_t* write)
+{
+    nvm_cmd_fuse(compare, NVM_FUSE_FIRST);
+    nvm_cmd_fuse(write, NVM_FUSE_SECOND);
+}
+
+
+
+/*
+ * Build a write uncorrectable command, marking blocks as invalid so that
+ * reading them fails until they are written.
+ */
+__device__ __host__ static inline
+void nvm_cmd_write_uncorrectable(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t start_lba, uint16_t n_blks)
+{
+    nvm_cmd_header(cmd, NVM_IO_WRITE_UNCORRECTABLE, ns_id);
+    nvm_cmd_data_ptr(cmd, 0, 0);
+    nvm_cmd_rw_blks(cmd, start_lba, n_blks);
+}
+
+
+
+/*
+ * Build a verify command, checking the integrity of stored data without
+ * transferring it to the host.
+ */
+__device__ __host__ static inline
+void nvm_cmd_verify(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t start_lba, uint16_t n_blks)
+{
+    nvm_cmd_header(cmd, NVM_IO_VERIFY, ns_id);
+    nvm_cmd_data_ptr(cmd, 0, 0);
+    nvm_cmd_rw_blks(cmd, start_lba, n_blks);
+}
+
+
+
+/*
+ * Build a dataset management command for a range list.
+ * The range list must be in a single page, see nvm_dsm_range_append().
+ */
+__device__ __host__ static inline
+void nvm_cmd_dataset_mgmt(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t list_ioaddr, size_t n_ranges, uint32_t attributes)
+{
+    nvm_cmd_header(cmd, NVM_IO_DATASET_MANAGEMENT, ns_id);
+    nvm_cmd_data_ptr(cmd, list_ioaddr, 0);
+
+    cmd->dword[10] = (n_ranges - 1) & 0xff;
+    cmd->dword[11] = attributes & 0x07;
+}
+
+
+
+/*
+ * Build a dataset management command that deallocates (trims) the ranges
+ * in a range list.
  */
-//__device__ __host__ static inline
-//void nvm_cmd_dataset(nvm_cmd_t* cmd, bool sequential, bool low_latency)
-//{
-//    cmd->dword[13] = 0; // not supported yet
-//}
+__device__ __host__ static inline
+void nvm_cmd_deallocate(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t list_ioaddr, size_t n_ranges)
+{
+    nvm_cmd_dataset_mgmt(cmd, ns_id, list_ioaddr, n_ranges, NVM_DSM_DEALLOCATE);
+}
+
+
 
+/*
+ * Set a dataset management range.
+ */
+__device__ __host__ static inline
+void nvm_dsm_range(nvm_dsm_range_t* range, uint64_t start_lba, uint32_t n_blocks, uint32_t attributes)
+{
+    range->attributes = attributes;
+    range->n_blocks = n_blocks;
+    range->start_lba = start_lba;
+}
+
+
+
+/*
+ * Append blocks to a dataset management range list.
+ *
+ * Blocks that exceed the maximum range length are split into several 
+ * ranges, and blocks that directly follow the last range in the list are 
+ * merged with it. n_ranges is the number of ranges in the list and is 
+ * updated. Returns the number of blocks appended, which is less than 
+ * n_blocks if the list is full (NVM_DSM_MAX_RANGES).
+ */
+__device__ __host__ static inline
+uint64_t nvm_dsm_range_append(nvm_dsm_range_t* list, size_t* n_ranges, uint64_t start_lba, uint64_t n_blocks)
+{
+    uint64_t n_added = 0;
+    uint64_t n;
+
+    if (*n_ranges > 0 && n_blocks > 0)
+    {
+        nvm_dsm_range_t* last = &list[*n_ranges - 1];
+
+        if (last->start_lba + last->n_blocks == start_lba && last->n_blocks < NVM_DSM_MAX_RANGE_BLOCKS)
+        {
+            n = NVM_DSM_MAX_RANGE_BLOCKS - last->n_blocks;
+            n = n < n_blocks ? n : n_blocks;
+
+            last->n_blocks += (uint32_t) n;
+            n_added += n;
+        }
+    }
+
+    while (n_added < n_blocks && *n_ranges < NVM_DSM_MAX_RANGES)
+    {
+        n = n_blocks - n_added;
+        n = n < NVM_DSM_MAX_RANGE_BLOCKS ? n : NVM_DSM_MAX_RANGE_BLOCKS;
+
+        nvm_dsm_range(&list[(*n_ranges)++], start_lba + n_added, (uint32_t) n, 0);
+        n_added += n;
+    }
+
+    return n_added;
+}
+
+
+
+
+/*
+ * Get the number of PRP list pages required for a transfer.
+ *
+ * The first data page is always pointed to by PRP1. If there are more than
+ * two pages, PRP2 points to a PRP list. When a transfer does not fit in a
+ * single list page, the last entry of each list page points to the next
+ * list page (chained PRP lists).
+ */
+__host__ __device__ static inline
+size_t nvm_prp_num_lists(size_t page_size, size_t n_pages)
+{
+    size_t prps_per_page = page_size / sizeof(uint64_t);
+
+    if (n_pages <= 2)
+    {
+        return 0;
+    }
+
+    return (n_pages - 2 + prps_per_page - 2) / (prps_per_page - 1);
+}
+
+
+
+/*
+ * Get the IO address of the current page of an extent-based DMA descriptor,
+ * and advance to the next page.
+ */
+__host__ __device__ static inline
+uint64_t _nvm_dma_ext_next(const nvm_dma_ext_t* dma, size_t* i_ext, size_t* i_page)
+{
+    const nvm_dma_extent_t* ext = &dma->extents[*i_ext];
+    uint64_t ioaddr = ext->ioaddr + (*i_page) * dma->page_size;
+
+    if (++(*i_page) == ext->n_pages)
+    {
+        ++(*i_ext);
+        *i_page = 0;
+    }
+
+    return ioaddr;
+}
+
+
+
+/*
+ * Build chained PRP lists, taking data page addresses either from an array
+ * or, if dma is not NULL, from an extent-based DMA descriptor starting at
+ * extent i_ext and page i_page within it.
+ */
+__host__ __device__ static inline
+size_t _nvm_prp_list_chain(size_t page_size,
+                           size_t n_pages,
+                           size_t n_lists,
+                           void* const* list_ptrs,
+                           const uint64_t* list_ioaddrs,
+                           const uint64_t* data_ioaddrs,
+                           const nvm_dma_ext_t* dma,
+                           size_t* i_ext,
+                           size_t* i_page)
+{
+    size_t prps_per_page = page_size / sizeof(uint64_t);
+    size_t i_prp = 0;
+    size_t i_list;
+    size_t i_entry;
+    uint64_t* list;
+
+    for (i_list = 0; i_list < n_lists && i_prp < n_pages; ++i_list)
+    {
+        list = (uint64_t*) list_ptrs[i_list];
+
+        for (i_entry = 0; i_entry < prps_per_page && i_prp < n_pages; ++i_entry)
+        {
+            // Last entry points to next list if there is more than one page left
+            if (i_entry == prps_per_page - 1 && n_pages - i_prp > 1)
+            {
+                if (i_list + 1 < n_lists)
+                {
+                    list[i_entry] = list_ioaddrs[i_list + 1];
+                }
+                break;
+            }
+
+            list[i_entry] = dma != NULL ? _nvm_dma_ext_next(dma, i_ext, i_page) : data_ioaddrs[i_prp];
+            ++i_prp;
+        }
+    }
+
+    return i_prp;
+}
+
+
+
+/*
+ * Build chained PRP lists consisting of PRP entries.
+ *
+ * Populate list pages with PRP entries required for a transfer. If the
+ * entries do not fit in a single list page, the last entry of a list page 
+ * points to the next list page. Returns the number of PRP entries used,
+ * which is less than n_pages if there are not enough list pages.
+ */
+__host__ __device__ static inline
+size_t nvm_prp_list_chain(size_t page_size, 
+                          size_t n_pages, 
+                          size_t n_lists,
+                          void* const* list_ptrs,
+                          const uint64_t* list_ioaddrs,
+                          const uint64_t* data_ioaddrs)
+{
+    return _nvm_prp_list_chain(page_size, n_pages, n_lists, list_ptrs, list_ioaddrs, data_ioaddrs, NULL, NULL, NULL);
+}
 
 
 
@@ -105,7 +488,8 @@ void nvm_cmd_rw_blks(nvm_cmd_t* cmd, uint64_t start_lba, uint16_t n_blks)
  * Returns the number of PRP entries used. Number of pages should 
  * always be max_data_size (MDTS) for IO commands.
  *
- * Note: currently, only a PRP lists can only be a single page
+ * Note: transfers that do not fit in a single list page are truncated,
+ *       use nvm_prp_list_chain() for those.
  */
 __host__ __device__ static inline
 size_t nvm_prp_list(size_t page_size, size_t n_pages, void* list_ptr, const uint64_t* data_ioaddrs)
@@ -130,8 +514,54 @@ size_t nvm_prp_list(size_t page_size, size_t n_pages, void* list_ptr, const uint
 
 
 
+/*
+ * Helper function to build chained PRP lists and set a command's data 
+ * pointer fields. At least nvm_prp_num_lists() list pages are required
+ * to describe the entire transfer.
+ *
+ * Returns the number of data pages described by the command.
+ */
+__host__ __device__ static inline
+size_t nvm_cmd_data_chain(nvm_cmd_t* cmd,
+                          size_t page_size,
+                          size_t n_pages,
+                          size_t n_lists,
+                          void* const* list_ptrs,
+                          const uint64_t* list_ioaddrs,
+                          const uint64_t* data_ioaddrs)
+{
+    size_t prp = 0;
+    uint64_t dptr0 = 0;
+    uint64_t dptr1 = 0;
+
+#ifndef NDEBUG
+    if (n_pages == 0)
+    {
+        return 0;
+    }
+#endif
+
+    dptr0 = data_ioaddrs[prp++];
+
+    if (n_pages > 2 && n_lists > 0)
+    {
+        dptr1 = list_ioaddrs[0];
+        prp += nvm_prp_list_chain(page_size, n_pages - 1, n_lists, list_ptrs, list_ioaddrs, &data_ioaddrs[prp]);
+    }
+    else if (n_pages >= 2)
+    {
+        dptr1 = data_ioaddrs[prp++];
+    }
+    
+    nvm_cmd_data_ptr(cmd, dptr0, dptr1);
+    return prp;
+}
+
+
+
 /*
  * Helper function to build a PRP list and set a command's data pointer fields.
+ * This is the single list page case of nvm_cmd_data_chain().
  */
 __host__ __device__ static inline
 size_t nvm_cmd_data(nvm_cmd_t* cmd, 
@@ -140,36 +570,243 @@ size_t nvm_cmd_data(nvm_cmd_t* cmd,
                     void* list_ptr, 
                     uint64_t list_ioaddr, 
                     const uint64_t* data_ioaddrs)
+{
+    return nvm_cmd_data_chain(cmd, page_size, n_pages, list_ptr != NULL, &list_ptr, &list_ioaddr, data_ioaddrs);
+}
+
+
+
+/*
+ * Helper function to build chained PRP lists directly from an extent-based
+ * DMA descriptor and set a command's data pointer fields. Describes n_pages
+ * pages starting at page_offset, without expanding the descriptor to a list 
+ * of page addresses. At least nvm_prp_num_lists() list pages are required 
+ * to describe the entire transfer.
+ *
+ * Returns the number of data pages described by the command.
+ */
+__host__ __device__ static inline
+size_t nvm_cmd_data_ext(nvm_cmd_t* cmd,
+                        const nvm_dma_ext_t* dma,
+                        size_t page_offset,
+                        size_t n_pages,
+                        size_t n_lists,
+                        void* const* list_ptrs,
+                        const uint64_t* list_ioaddrs)
 {
     size_t prp = 0;
+    size_t i_ext;
+    size_t i_page;
     uint64_t dptr0 = 0;
     uint64_t dptr1 = 0;
 
-#ifndef NDEBUG
-    if (n_pages == 0)
+    if (n_pages == 0 || page_offset + n_pages > dma->n_pages)
     {
         return 0;
     }
-#endif
 
-    dptr0 = data_ioaddrs[prp++];
+    i_ext = nvm_dma_ext_find(dma, page_offset);
+    i_page = page_offset - dma->extents[i_ext].page;
+
+    dptr0 = _nvm_dma_ext_next(dma, &i_ext, &i_page);
+    ++prp;
 
-    if (n_pages > 2 && list_ptr != NULL)
+    if (n_pages > 2 && n_lists > 0)
     {
-        dptr1 = list_ioaddr;
-        prp += nvm_prp_list(page_size, n_pages - 1, list_ptr, &data_ioaddrs[prp]);
+        dptr1 = list_ioaddrs[0];
+        prp += _nvm_prp_list_chain(dma->page_size, n_pages - 1, n_lists, list_ptrs, list_ioaddrs, NULL, dma, &i_ext, &i_page);
     }
     else if (n_pages >= 2)
     {
-        dptr1 = data_ioaddrs[prp++];
+        dptr1 = _nvm_dma_ext_next(dma, &i_ext, &i_page);
+        ++prp;
     }
-    
+
     nvm_cmd_data_ptr(cmd, dptr0, dptr1);
     return prp;
 }
 
 
 
+/*
+ * Set an SGL descriptor.
+ * The descriptor subtype is always address.
+ */
+__host__ __device__ static inline
+void nvm_sgl_desc(nvm_sgl_t* desc, uint8_t type, uint64_t address, uint32_t length)
+{
+    desc->dword[0] = (uint32_t) address;
+    desc->dword[1] = (uint32_t) (address >> 32UL);
+    desc->dword[2] = length;
+    desc->dword[3] = ((uint32_t) (type & 0x0f)) << 28;
+}
+
+
+
+/*
+ * Set an SGL data block descriptor, describing a contiguous data buffer.
+ */
+__host__ __device__ static inline
+void nvm_sgl_data_block(nvm_sgl_t* desc, uint64_t address, uint32_t length)
+{
+    nvm_sgl_desc(desc, NVM_SGL_DATA_BLOCK, address, length);
+}
+
+
+
+/*
+ * Set an SGL segment descriptor, pointing to a segment of n_descs 
+ * descriptors where the last descriptor points to the next segment.
+ */
+__host__ __device__ static inline
+void nvm_sgl_segment(nvm_sgl_t* desc, uint64_t seg_ioaddr, size_t n_descs)
+{
+    nvm_sgl_desc(desc, NVM_SGL_SEGMENT, seg_ioaddr, (uint32_t) (n_descs * sizeof(nvm_sgl_t)));
+}
+
+
+
+/*
+ * Set an SGL last segment descriptor, pointing to a segment of n_descs
+ * data block descriptors.
+ */
+__host__ __device__ static inline
+void nvm_sgl_last_segment(nvm_sgl_t* desc, uint64_t seg_ioaddr, size_t n_descs)
+{
+    nvm_sgl_desc(desc, NVM_SGL_LAST_SEGMENT, seg_ioaddr, (uint32_t) (n_descs * sizeof(nvm_sgl_t)));
+}
+
+
+
+/*
+ * Set command's DPTR field (DWORD6-9) to an SGL descriptor and
+ * indicate that SGLs are used for the data transfer (PSDT).
+ */
+__host__ __device__ static inline
+void nvm_cmd_data_sgl(nvm_cmd_t* cmd, const nvm_sgl_t* sgl1)
+{
+    cmd->dword[0] &= ~( (0x03 << 14) | (0x03 << 8) );
+    cmd->dword[0] |= (0x01 << 14);
+
+    cmd->dword[6] = sgl1->dword[0];
+    cmd->dword[7] = sgl1->dword[1];
+    cmd->dword[8] = sgl1->dword[2];
+    cmd->dword[9] = sgl1->dword[3];
+}
+
+
+
+/*
+ * Helper function to describe a contiguous data buffer with a single
+ * SGL data block descriptor. The buffer does not need to be page-aligned.
+ */
+__host__ __device__ static inline
+void nvm_cmd_data_sgl_block(nvm_cmd_t* cmd, uint64_t ioaddr, uint32_t length)
+{
+    nvm_sgl_t desc;
+
+    nvm_sgl_data_block(&desc, ioaddr, length);
+    nvm_cmd_data_sgl(cmd, &desc);
+}
+
+
+
+/*
+ * Get the number of SGL segments required to describe n_blocks data blocks,
+ * assuming every segment is a page.
+ */
+__host__ __device__ static inline
+size_t nvm_sgl_num_segments(size_t page_size, size_t n_blocks)
+{
+    size_t descs_per_seg = page_size / sizeof(nvm_sgl_t);
+
+    if (n_blocks <= 1)
+    {
+        return 0;
+    }
+
+    return (n_blocks - 1 + descs_per_seg - 2) / (descs_per_seg - 1);
+}
+
+
+
+/*
+ * Helper function to build SGL segments and set a command's data pointer 
+ * fields. A single data block is placed directly in the command. Otherwise 
+ * data block descriptors are written to the segment pages, and the last 
+ * descriptor of a full segment points to the next segment.
+ *
+ * Returns the number of data blocks described by the command, which is less
+ * than n_blocks if there are not enough segment pages.
+ */
+__host__ __device__ static inline
+size_t nvm_cmd_data_sgl_chain(nvm_cmd_t* cmd,
+                              size_t page_size,
+                              size_t n_blocks,
+                              const uint64_t* block_ioaddrs,
+                              const uint32_t* block_lengths,
+                              size_t n_segs,
+                              void* const* seg_ptrs,
+                              const uint64_t* seg_ioaddrs)
+{
+    size_t descs_per_seg = page_size / sizeof(nvm_sgl_t);
+    size_t i_block = 0;
+    size_t i_seg;
+    size_t n_descs;
+    nvm_sgl_t desc;
+    nvm_sgl_t* seg;
+
+    if (n_blocks == 0)
+    {
+        return 0;
+    }
+
+    if (n_blocks == 1 || n_segs == 0)
+    {
+        nvm_cmd_data_sgl_block(cmd, block_ioaddrs[0], block_lengths[0]);
+        return 1;
+    }
+
+    // Limit to what fits in the provided segments
+    if (n_blocks > n_segs * (descs_per_seg - 1) + 1)
+    {
+        n_blocks = n_segs * (descs_per_seg - 1) + 1;
+    }
+
+    n_descs = n_blocks <= descs_per_seg ? n_blocks : descs_per_seg;
+    nvm_sgl_desc(&desc, n_blocks <= descs_per_seg ? NVM_SGL_LAST_SEGMENT : NVM_SGL_SEGMENT, 
+            seg_ioaddrs[0], (uint32_t) (n_descs * sizeof(nvm_sgl_t)));
+    nvm_cmd_data_sgl(cmd, &desc);
+
+    for (i_seg = 0; i_block < n_blocks; ++i_seg)
+    {
+        seg = (nvm_sgl_t*) seg_ptrs[i_seg];
+
+        // Last segment only holds data blocks
+        n_descs = n_blocks - i_block <= descs_per_seg ? n_blocks - i_block : descs_per_seg - 1;
+        for (size_t i_desc = 0; i_desc < n_descs; ++i_desc, ++i_block)
+        {
+            nvm_sgl_data_block(&seg[i_desc], block_ioaddrs[i_block], block_lengths[i_block]);
+        }
+
+        if (i_block < n_blocks)
+        {
+            if (n_blocks - i_block <= descs_per_seg)
+            {
+                nvm_sgl_last_segment(&seg[n_descs], seg_ioaddrs[i_seg + 1], n_blocks - i_block);
+            }
+            else
+            {
+                nvm_sgl_segment(&seg[n_descs], seg_ioaddrs[i_seg + 1], descs_per_seg);
+            }
+        }
+    }
+
+    return i_block;
+}
+
+
+
 #ifndef __CUDACC__
 #undef __device__
 #undef __host__
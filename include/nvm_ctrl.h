@@ -50,6 +50,22 @@ int nvm_raw_ctrl_init(nvm_ctrl_t** ctrl, volatile void* mm_ptr, size_t mm_size);
 
 
 
+/*
+ * Initialize NVM controller handle using VFIO.
+ *
+ * Open the controller's IOMMU group, attach it to a VFIO container and map
+ * BAR0. DMA mappings created for this controller handle are placed in the
+ * container's IO address space, so the kernel module is not required and
+ * the controller can only access memory explicitly mapped for it.
+ *
+ * Note: pci_addr is the device's PCI address (e.g. "0000:05:00.0"), and the
+ *       device and all other devices in its IOMMU group must be bound to
+ *       the vfio-pci driver.
+ */
+int nvm_vfio_ctrl_init(nvm_ctrl_t** ctrl, const char* pci_addr);
+
+
+
 /*
  * Release controller handle.
  */
@@ -73,6 +89,20 @@ int nvm_raw_ctrl_reset(const nvm_ctrl_t* ctrl, uint64_t acq_ioaddr, uint64_t asq
 
 
 
+/*
+ * Shut down NVM controller.
+ *
+ * Notify the controller of a normal shutdown (CC.SHN) and wait until it
+ * reports that shutdown processing is complete, so that cached data is 
+ * flushed to non-volatile media. The controller must be reset with
+ * nvm_raw_ctrl_reset() before it can be used again.
+ *
+ * Note: This function is implicitly called by nvm_aq_destroy().
+ */
+int nvm_raw_ctrl_shutdown(const nvm_ctrl_t* ctrl);
+
+
+
 #ifdef __DIS_CLUSTER__
 /* 
  * Initialize NVM controller handle.
@@ -61,6 +61,26 @@ int nvm_dma_map_host(nvm_dma_t** map, const nvm_ctrl_t* ctrl, void* vaddr, size_
 
 
 
+/*
+ * Allocate memory from the controller memory buffer (CMB).
+ *
+ * Allocate at least size bytes of the controller's CMB and create a DMA 
+ * mapping descriptor for it. Placing submission queues and PRP lists in the
+ * CMB lets the controller fetch commands without reading across PCIe.
+ * The memory is IO memory and is released when the descriptor is removed.
+ *
+ * Returns ENOTSUP if the controller does not have a CMB that supports 
+ * submission queues or PRP lists, or if the CMB could not be mapped. 
+ * The CMB is discovered for controllers created with nvm_ctrl_init() 
+ * (through the kernel module or a sysfs resource file), nvm_vfio_ctrl_init()
+ * and emulated controllers, but not for nvm_raw_ctrl_init().
+ *
+ * Note: The CMB may only hold submission queues and PRP lists.
+ */
+int nvm_dma_alloc_cmb(nvm_dma_t** map, const nvm_ctrl_t* ctrl, size_t size);
+
+
+
 #if ( defined( __CUDA__ ) || defined( __CUDACC__ ) )
 
 /*
@@ -79,6 +99,95 @@ int nvm_dma_map_device(nvm_dma_t** map, const nvm_ctrl_t* ctrl, void* devptr, si
 
 
 
+/*
+ * Create extent-based DMA mapping descriptor from runs of contiguous memory.
+ *
+ * Similar to nvm_dma_map, except the caller supplies physical/bus addresses 
+ * and sizes of contiguous memory runs rather than one address per page.
+ * Runs that are contiguous with the preceding run are merged into a single
+ * extent. Extents must be aligned to the controller's page size.
+ *
+ * Note: vaddr can be NULL.
+ */
+int nvm_dma_ext_map(nvm_dma_ext_t** map,            // Mapping descriptor reference
+                    const nvm_ctrl_t* ctrl,         // NVM controller reference
+                    void* vaddr,                    // Pointer to userspace memory (can be NULL if not required)
+                    size_t n_runs,                  // Number of contiguous runs
+                    const uint64_t* run_addrs,      // Physical/bus addresses of the runs
+                    const size_t* run_sizes);       // Size of each run (in bytes)
+
+
+
+/*
+ * Create extent-based DMA mapping descriptor from virtual address using the
+ * kernel module. This function is similar to nvm_dma_map_host, but the
+ * resulting descriptor stores contiguous pages as extents.
+ *
+ * Note: vaddr can not be NULL, and must be aligned to system page size.
+ */
+int nvm_dma_ext_map_host(nvm_dma_ext_t** map, const nvm_ctrl_t* ctrl, void* vaddr, size_t size);
+
+
+
+#if ( defined( __CUDA__ ) || defined( __CUDACC__ ) )
+
+/*
+ * Create extent-based DMA mapping descriptor from CUDA device pointer using
+ * the kernel module. See nvm_dma_map_device.
+ */
+int nvm_dma_ext_map_device(nvm_dma_ext_t** map, const nvm_ctrl_t* ctrl, void* devptr, size_t size);
+
+#endif /* __CUDA__ */
+
+
+
+/*
+ * Allocate hugepage memory and create extent-based DMA mapping descriptor.
+ *
+ * Allocate at least size bytes of memory backed by hugepages using 
+ * mmap(MAP_HUGETLB), and map every hugepage once for the controller rather
+ * than every system page. If huge_page_size is 0, the system's default
+ * hugepage size is used, otherwise it must be a supported hugepage size
+ * (for example 1 GiB). Hugepages must be reserved by the system beforehand.
+ *
+ * Controllers using the kernel module map hugepages through the module. 
+ * Manually mapped controllers use physical addresses read from 
+ * /proc/self/pagemap, which requires CAP_SYS_ADMIN. 
+ *
+ * The memory is released when the descriptor is removed.
+ */
+int nvm_dma_ext_alloc_huge(nvm_dma_ext_t** map,         // Mapping descriptor reference
+                           const nvm_ctrl_t* ctrl,      // NVM controller reference
+                           size_t size,                 // Size of memory (rounded up to hugepage size)
+                           size_t huge_page_size);      // Hugepage size (0 for system default)
+
+
+
+/*
+ * Create DMA mapping descriptor for a range of an extent-based descriptor.
+ *
+ * Expand n_pages controller pages, starting at page_offset, into a regular
+ * DMA mapping descriptor, for use with functions that require one. The new
+ * descriptor does not own the memory, and must be removed before the 
+ * extent-based descriptor.
+ */
+int nvm_dma_ext_expand(nvm_dma_t** map, 
+                       const nvm_ctrl_t* ctrl, 
+                       const nvm_dma_ext_t* ext, 
+                       size_t page_offset, 
+                       size_t n_pages);
+
+
+
+/*
+ * Remove extent-based DMA mapping descriptor.
+ *
+ * Unmap DMA mappings (if necessary) and remove the descriptor.
+ */
+void nvm_dma_ext_unmap(nvm_dma_ext_t* map);
+
+
+
 #if defined( __DIS_CLUSTER__ )
 
 /*
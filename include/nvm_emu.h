@@ -0,0 +1,95 @@
+#ifndef __NVM_EMU_H__
+#define __NVM_EMU_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nvm_types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+ * Emulated NVM controller handle.
+ *
+ * An emulated controller lives entirely inside the calling process. It
+ * exposes a fake BAR0 in host memory and runs a service thread that
+ * processes admin and IO submission queues and posts completions, just like
+ * a physical controller would.
+ *
+ * Bus addresses given to the emulated controller are interpreted as
+ * virtual addresses in the calling process.
+ */
+struct nvm_emu;
+
+
+
+/*
+ * Create an emulated controller.
+ *
+ * The controller exposes a single namespace (identifier 1). If path is NULL,
+ * the namespace is backed by RAM, otherwise it is backed by the specified
+ * file. If n_blocks is 0, the namespace size is derived from the file size.
+ */
+int nvm_emu_create(struct nvm_emu** emu,        // Emulator handle reference
+                   const char* path,            // Path to backing file (can be NULL)
+                   size_t n_blocks,             // Number of logical blocks in the namespace
+                   size_t block_size);          // Logical block size (must be a power of two)
+
+
+
+/*
+ * Create an emulated controller with end-to-end data protection.
+ *
+ * Same as nvm_emu_create(), except that the namespace is formatted with
+ * 8 bytes of metadata per block, transferred as a separate buffer (MPTR) and
+ * holding protection information of the specified type (1 to 3, or 0 to
+ * disable). Metadata is kept in RAM, also for file-backed namespaces.
+ * Protection information is checked as requested by PRINFO, but the
+ * controller does not insert and strip it (PRACT).
+ */
+int nvm_emu_create_pi(struct nvm_emu** emu,     // Emulator handle reference
+                      const char* path,         // Path to backing file (can be NULL)
+                      size_t n_blocks,          // Number of logical blocks in the namespace
+                      size_t block_size,        // Logical block size (must be a power of two)
+                      uint8_t pi_type);         // Protection information type
+
+
+
+/*
+ * Stop the service thread and remove the emulated controller.
+ *
+ * Note: Controller handles created for the emulator are invalid after
+ *       calling this and must be freed first.
+ */
+void nvm_emu_destroy(struct nvm_emu* emu);
+
+
+
+/*
+ * Get pointer to the emulated controller's BAR0.
+ *
+ * The returned pointer may be passed to nvm_raw_ctrl_init().
+ */
+volatile void* nvm_emu_bar(const struct nvm_emu* emu, size_t* size);
+
+
+
+/*
+ * Initialize NVM controller handle for an emulated controller.
+ *
+ * Similar to nvm_raw_ctrl_init(), except that the library knows the
+ * controller is emulated, so nvm_dma_map_host() can be used to map memory.
+ *
+ * Note: The handle must be released with nvm_ctrl_free() before the
+ *       emulator is destroyed.
+ */
+int nvm_emu_ctrl_init(nvm_ctrl_t** ctrl, struct nvm_emu* emu);
+
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __NVM_EMU_H__ */
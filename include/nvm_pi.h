@@ -0,0 +1,66 @@
+#ifndef __NVM_PI_H__
+#define __NVM_PI_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nvm_types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+ * Calculate CRC16 T10-DIF (polynomial 0x8bb7) of a buffer.
+ * The initial value is 0; pass the previous result as crc to continue a
+ * calculation over several buffers.
+ */
+uint16_t nvm_crc16_t10dif(uint16_t crc, const void* data, size_t size);
+
+
+
+/*
+ * Generate end-to-end protection information for a range of blocks.
+ *
+ * If the namespace uses an extended LBA format, metadata is interleaved with
+ * the data and the metadata argument is ignored, otherwise metadata points
+ * to the separate metadata buffer. The reference tag is incremented for
+ * every block, except for type 3 protection.
+ * Returns EINVAL if the namespace is not formatted with protection
+ * information.
+ */
+int nvm_pi_generate(const struct nvm_ns_info* ns,     // Namespace information
+                    void* data,                       // Logical block data
+                    void* metadata,                   // Separate metadata buffer
+                    size_t n_blocks,                  // Number of logical blocks
+                    uint32_t ref_tag,                 // Initial reference tag
+                    uint16_t app_tag);                // Application tag
+
+
+
+/*
+ * Check end-to-end protection information for a range of blocks.
+ *
+ * The checks performed are selected by prinfo (see enum nvm_prinfo), and
+ * only application tag bits set in app_mask are compared. Blocks with the
+ * escape application tag (and escape reference tag for type 3) are not
+ * checked. Returns EIO and sets bad_block to the index of the first block
+ * that fails a check, or EINVAL if the namespace is not formatted with
+ * protection information.
+ */
+int nvm_pi_verify(const struct nvm_ns_info* ns,       // Namespace information
+                  const void* data,                   // Logical block data
+                  const void* metadata,               // Separate metadata buffer
+                  size_t n_blocks,                    // Number of logical blocks
+                  uint32_t ref_tag,                   // Expected initial reference tag
+                  uint16_t app_tag,                   // Expected application tag
+                  uint16_t app_mask,                  // Application tag mask
+                  uint8_t prinfo,                     // Checks to perform
+                  size_t* bad_block);                 // First block that failed (may be NULL)
+
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __NVM_PI_H__ */
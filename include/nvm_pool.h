@@ -0,0 +1,85 @@
+#ifndef __NVM_POOL_H__
+#define __NVM_POOL_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nvm_types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+ * PRP list pool.
+ *
+ * Manages a set of controller pages used as PRP lists, so that PRP list
+ * memory is allocated per command rather than being tied to SQ slots.
+ * Pool operations are thread-safe.
+ */
+struct nvm_prp_pool;
+
+
+
+/*
+ * Create a PRP list pool.
+ *
+ * Use n_pages pages of the DMA descriptor, starting at page_offset, as PRP
+ * lists. The DMA descriptor must have a valid virtual address and must not
+ * be unmapped before the pool is freed.
+ */
+int nvm_prp_pool_create(struct nvm_prp_pool** pool,     // Pool handle reference
+                        const nvm_dma_t* dma,           // PRP list memory
+                        size_t page_offset,             // Offset into PRP list memory (in pages)
+                        size_t n_pages);                // Number of PRP list pages
+
+
+
+/*
+ * Free a PRP list pool.
+ */
+void nvm_prp_pool_free(struct nvm_prp_pool* pool);
+
+
+
+/*
+ * Get a PRP list page from the pool.
+ *
+ * Returns 0 on success, or EAGAIN if all pages are in use.
+ */
+int nvm_prp_pool_get(struct nvm_prp_pool* pool, void** list_ptr, uint64_t* list_ioaddr);
+
+
+
+/*
+ * Return a PRP list page to the pool.
+ * If the page is the first page of a chain, the entire chain is returned.
+ */
+void nvm_prp_pool_put(struct nvm_prp_pool* pool, void* list_ptr);
+
+
+
+/*
+ * Set command's data pointer, taking a PRP list from the pool if needed.
+ *
+ * Transfers of one or two pages do not use a PRP list. Otherwise a PRP list
+ * is taken from the pool and returned through list_ptr; the caller must
+ * return it using nvm_prp_pool_put() once the command has completed.
+ * Transfers that do not fit in a single list page use a chain of list pages.
+ * list_ptr is set to NULL if no PRP list is used.
+ *
+ * Returns 0 on success, EAGAIN if the pool is exhausted, or EINVAL if
+ * the transfer requires more list pages than the pool holds.
+ */
+int nvm_prp_pool_cmd_data(struct nvm_prp_pool* pool,    // Pool handle
+                          nvm_cmd_t* cmd,               // Command to set data pointer for
+                          size_t n_pages,               // Number of data pages
+                          const uint64_t* data_ioaddrs, // Bus addresses of data pages
+                          void** list_ptr);             // PRP list used (NULL if none)
+
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __NVM_POOL_H__ */
@@ -12,13 +12,25 @@
 #include <stdbool.h>
 
 
+/* Full memory barrier, ordering shadow doorbell writes and EventIdx reads */
+#ifdef __CUDA_ARCH__
+#define _nvm_mb()   __threadfence_system()
+#else
+#define _nvm_mb()   __sync_synchronize()
+#endif
+
+
 /*
  * Clear queue descriptor.
  *
  * Initialize an empty queue descriptor. 
  * The user must clear the queue memory manually before using the handle.
  *
- * Note: vaddr must be page-aligned and at least one page.
+ * If qs is 0, the queue size is the number of entries that fit in a single
+ * controller page. The queue size is limited to the maximum number of
+ * entries supported by the controller (MQES).
+ *
+ * Note: vaddr must be page-aligned and large enough to hold qs entries.
  */
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +40,7 @@ void nvm_queue_clear(nvm_queue_t* q,            // NVM queue descriptor
                      const nvm_ctrl_t* ctrl,    // NVM controller handle
                      bool cq,                   // Is this a completion queue or submission queue?
                      uint16_t no,               // Queue number
+                     uint16_t qs,               // Number of queue entries (0 means one page)
                      void* vaddr,               // Virtual address to queue memory
                      uint64_t ioaddr);          // Bus address to queue memory (as seen from the controller)
 #ifdef __cplusplus
@@ -36,6 +49,62 @@ void nvm_queue_clear(nvm_queue_t* q,            // NVM queue descriptor
 
 
 
+/*
+ * Attach shadow doorbell buffer to an IO queue.
+ *
+ * Use the shadow doorbell buffer registered with nvm_admin_dbbuf_config()
+ * (page_offset must be the same) for the queue. Doorbell updates are then
+ * written to the shadow doorbell, and the doorbell register is only written
+ * when the controller's EventIdx indicates that it needs to be notified.
+ *
+ * This must be called after the queue is created and before it is used.
+ * Note: The memory must be accessible by the thread(s) using the queue.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+int nvm_queue_dbbuf(nvm_queue_t* q,                 // NVM queue descriptor
+                    const nvm_ctrl_t* ctrl,         // NVM controller handle
+                    const nvm_dma_t* dma,           // Doorbell buffer memory
+                    size_t page_offset);            // Offset to shadow doorbell buffer (in pages)
+#ifdef __cplusplus
+}
+#endif
+
+
+
+/*
+ * Write queue doorbell.
+ *
+ * If the queue has a shadow doorbell, the new value is written there and
+ * the doorbell register is only written if the new value passes the 
+ * controller's EventIdx, using the same 16-bit wrap-around comparison as
+ * the NVM Express specification.
+ */
+__host__ __device__ static inline
+void _nvm_queue_db_write(nvm_queue_t* q, uint32_t value)
+{
+    if (q->shadow != NULL)
+    {
+        uint16_t old_value = (uint16_t) q->last;
+
+        *q->shadow = value;
+
+        // Shadow doorbell must be visible before we read EventIdx
+        _nvm_mb();
+
+        if ((uint16_t) (value - *q->event_idx - 1) >= (uint16_t) (value - old_value))
+        {
+            return;
+        }
+    }
+
+    *((volatile uint32_t*) q->db) = value;
+}
+
+
+
 /* 
  * Enqueue a submission command.
  * 
@@ -48,7 +117,7 @@ __host__ __device__ static inline
 nvm_cmd_t* nvm_sq_enqueue(nvm_queue_t* sq)
 {
     // Check if queue is full
-    if ((uint16_t) ((sq->tail - sq->head) % sq->max_entries) == sq->max_entries - 1)
+    if ((sq->tail + 1) % sq->max_entries == sq->head)
     {
         return NULL;
     }
@@ -131,7 +200,8 @@ nvm_cpl_t* nvm_cq_dequeue(nvm_queue_t* cq)
  *
  * Dequeue a completion entry from the completion queue. If none are ready
  * at the time, this function will block until a controller timeout interval
- * or a ready completion. 
+ * or a ready completion. Waiting follows the wait policy set with 
+ * nvm_wait_policy_set().
  *
  * Returns a pointer to the completion entry, or NULL if the queue is empty or
  * on timeout.
@@ -147,6 +217,42 @@ nvm_cpl_t* nvm_cq_dequeue_block(nvm_queue_t* cq, uint64_t timeout);
 
 
 
+
+/*
+ * Set wait policy.
+ *
+ * Set the policy used by all blocking library functions, such as
+ * nvm_cq_dequeue_block(), nvm_raw_ctrl_reset() and nvm_raw_rpc(). 
+ * If policy is NULL, the default policy is restored.
+ *
+ * Note: The policy is global. It may be changed while other threads are
+ *       waiting; waits that have already started keep the previous policy.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+int nvm_wait_policy_set(const nvm_wait_policy_t* policy);
+#ifdef __cplusplus
+}
+#endif
+
+
+
+/*
+ * Get the current wait policy.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+void nvm_wait_policy_get(nvm_wait_policy_t* policy);
+#ifdef __cplusplus
+}
+#endif
+
+
+
 /* 
  * Update SQ tail pointer.
  *
@@ -159,7 +265,7 @@ void nvm_sq_submit(nvm_queue_t* sq)
 {
     if (sq->last != sq->tail)
     {
-        *((volatile uint32_t*) sq->db) = sq->tail;
+        _nvm_queue_db_write(sq, sq->tail);
         sq->last = sq->tail;
     }
 }
@@ -193,12 +299,283 @@ void nvm_cq_update(nvm_queue_t* cq)
 {
     if (cq->last != cq->head)
     {
-        *((volatile uint32_t*) cq->db) = cq->head;
+        _nvm_queue_db_write(cq, cq->head);
         cq->last = cq->head;
     }
 }
 
 
+
+/*
+ * Dequeue a batch of completion queue entries.
+ *
+ * Copy up to max_cpls ready completions into the cpls array, advance the
+ * SQ head pointer using the SQ head pointer reported by the controller
+ * (SQHD), and ring the CQ head doorbell once for the entire batch.
+ *
+ * sq may be NULL if the caller tracks SQ head pointers itself, or if
+ * completions belong to several SQs. Only completions where the SQ
+ * identifier matches sq->no update the SQ head pointer.
+ *
+ * Returns the number of completions dequeued, or 0 if the queue is empty.
+ */
+__host__ __device__ static inline
+size_t nvm_cq_dequeue_batch(nvm_queue_t* cq, nvm_queue_t* sq, nvm_cpl_t* cpls, size_t max_cpls)
+{
+    size_t n_cpls = 0;
+    nvm_cpl_t* cpl;
+
+    while (n_cpls < max_cpls && (cpl = nvm_cq_dequeue(cq)) != NULL)
+    {
+        cpls[n_cpls] = *cpl;
+
+        if (sq != NULL && *NVM_CPL_SQID(&cpls[n_cpls]) == sq->no)
+        {
+            sq->head = *NVM_CPL_SQHD(&cpls[n_cpls]);
+        }
+
+        ++n_cpls;
+    }
+
+    if (n_cpls > 0)
+    {
+        nvm_cq_update(cq);
+    }
+
+    return n_cpls;
+}
+
+
+
+/*
+ * Create multi-producer submission queue descriptor.
+ *
+ * Wrap an SQ so that several threads may enqueue commands concurrently.
+ * The SQ must be empty and must not be used directly while the descriptor
+ * exists. Completions are still expected to be consumed by a single thread,
+ * which must call nvm_sq_mp_update() after updating the SQ head pointer.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+int nvm_sq_mp_create(nvm_sq_mp_t** mp, nvm_queue_t* sq);
+#ifdef __cplusplus
+}
+#endif
+
+
+
+/*
+ * Free multi-producer submission queue descriptor.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+void nvm_sq_mp_free(nvm_sq_mp_t* mp);
+#ifdef __cplusplus
+}
+#endif
+
+
+
+/*
+ * Reserve a slot in a multi-producer SQ.
+ *
+ * Reserve the next free queue slot and return a pointer to it in order to
+ * build the command inline in queue memory. The reserved ticket must be
+ * passed to nvm_sq_mp_submit() once the command is prepared. The command
+ * identifier is set to the lower 16 bits of the ticket.
+ *
+ * Returns a pointer to the queue entry, or NULL if the queue is full.
+ */
+__host__ static inline
+nvm_cmd_t* nvm_sq_mp_enqueue(nvm_sq_mp_t* mp, uint64_t* ticket)
+{
+    nvm_queue_t* sq = mp->sq;
+    uint64_t t = __atomic_load_n(&mp->reserved, __ATOMIC_RELAXED);
+
+    // Only take a ticket if the slot is free, so a full queue never
+    // leaves a reservation that can not be submitted
+    do
+    {
+        if (t - __atomic_load_n(&mp->head, __ATOMIC_ACQUIRE) >= (uint64_t) sq->max_entries - 1)
+        {
+            return NULL;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&mp->reserved, &t, t + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    nvm_cmd_t* cmd = (nvm_cmd_t*) (((unsigned char*) sq->vaddr) + sq->entry_size * (t % sq->max_entries));
+
+    *NVM_CMD_CID(cmd) = (uint16_t) t;
+    *ticket = t;
+    return cmd;
+}
+
+
+
+/*
+ * Publish a prepared command in a multi-producer SQ.
+ *
+ * Mark the slot as published and ring the doorbell for the longest run of
+ * published slots following the previous doorbell write. Only one thread
+ * writes the doorbell at a time; if another thread holds the doorbell lock,
+ * that thread is responsible for covering this slot.
+ */
+__host__ static inline
+void nvm_sq_mp_submit(nvm_sq_mp_t* mp, uint64_t ticket)
+{
+    nvm_queue_t* sq = mp->sq;
+    uint64_t t;
+
+    __atomic_store_n(&mp->seq[ticket % sq->max_entries], ticket + 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_exchange_n(&mp->lock, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        // Find contiguous run of published slots
+        t = mp->submitted;
+        while (__atomic_load_n(&mp->seq[t % sq->max_entries], __ATOMIC_ACQUIRE) == t + 1)
+        {
+            ++t;
+        }
+
+        if (t != mp->submitted)
+        {
+            sq->tail = t % sq->max_entries;
+            _nvm_queue_db_write(sq, sq->tail);
+            sq->last = sq->tail;
+            __atomic_store_n(&mp->submitted, t, __ATOMIC_RELEASE);
+        }
+
+        __atomic_store_n(&mp->lock, 0, __ATOMIC_SEQ_CST);
+
+        // Slots published while we held the lock are not covered by anyone else
+        if (__atomic_load_n(&mp->seq[t % sq->max_entries], __ATOMIC_SEQ_CST) != t + 1)
+        {
+            break;
+        }
+    }
+}
+
+
+
+/*
+ * Update head of a multi-producer SQ.
+ *
+ * Release slots consumed by the controller, according to the SQ head
+ * pointer (see nvm_cq_dequeue_batch()). Must only be called by the thread
+ * consuming completions.
+ */
+__host__ static inline
+void nvm_sq_mp_update(nvm_sq_mp_t* mp)
+{
+    nvm_queue_t* sq = mp->sq;
+    uint64_t head = __atomic_load_n(&mp->head, __ATOMIC_RELAXED);
+    uint64_t consumed = (sq->head + sq->max_entries - (head % sq->max_entries)) % sq->max_entries;
+
+    __atomic_store_n(&mp->head, head + consumed, __ATOMIC_RELEASE);
+}
+
+
+
+
+/*
+ * Create command identifier table.
+ *
+ * Create a table with the specified number of command identifiers (at most
+ * 65536). To allow more outstanding commands than there are SQ slots, the
+ * table should be sized after the CQ.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+int nvm_cid_table_create(nvm_cid_table_t** table, size_t size);
+#ifdef __cplusplus
+}
+#endif
+
+
+
+/*
+ * Free command identifier table.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+__host__
+void nvm_cid_table_free(nvm_cid_table_t* table);
+#ifdef __cplusplus
+}
+#endif
+
+
+
+/*
+ * Allocate a command identifier and associate a context with it.
+ * The caller must set the CID of the command (see NVM_CMD_CID).
+ *
+ * Returns true on success, or false if all CIDs are outstanding.
+ */
+__host__ __device__ static inline
+bool nvm_cid_alloc(nvm_cid_table_t* table, void* context, uint16_t* cid)
+{
+    if (table->n_free == 0)
+    {
+        return false;
+    }
+
+    *cid = table->free_cids[--table->n_free];
+    table->contexts[*cid] = context;
+    table->busy[*cid] = 1;
+    return true;
+}
+
+
+
+/*
+ * Look up the context of an outstanding command.
+ *
+ * Returns the context, or NULL if the CID is not outstanding.
+ */
+__host__ __device__ static inline
+void* nvm_cid_lookup(const nvm_cid_table_t* table, uint16_t cid)
+{
+    if (cid >= table->size || !table->busy[cid])
+    {
+        return NULL;
+    }
+
+    return table->contexts[cid];
+}
+
+
+
+/*
+ * Release the CID of a completed command and return its context.
+ *
+ * Returns the context, or NULL if the CID is not outstanding (for example
+ * a duplicate or unexpected completion), in which case nothing is released.
+ */
+__host__ __device__ static inline
+void* nvm_cid_complete(nvm_cid_table_t* table, uint16_t cid)
+{
+    void* context = nvm_cid_lookup(table, cid);
+
+    if (cid < table->size && table->busy[cid])
+    {
+        table->busy[cid] = 0;
+        table->contexts[cid] = NULL;
+        table->free_cids[table->n_free++] = cid;
+    }
+
+    return context;
+}
+
+
+
 #ifndef __CUDACC__
 #undef __device__
 #undef __host__
@@ -8,7 +8,33 @@ extern "C" {
 #include <stdint.h>
 
 
-//int nvm_tcp_rpc_bind(nvm_aq_ref* ref, const char* hostname, uint16_t port);
+/*
+ * Bind admin queue-pair reference to a remote process over TCP.
+ * The remote process must have enabled remote admin commands using
+ * nvm_tcp_rpc_enable(). Several threads may use the reference at once,
+ * in which case their commands are outstanding at the same time.
+ * The user should call nvm_rpc_unbind() to remove binding.
+ */
+int nvm_tcp_rpc_bind(nvm_aq_ref* ref, const nvm_ctrl_t* ctrl, const char* hostname, uint16_t port);
+
+
+
+/*
+ * Bind admin queue-pair reference to a local process over a Unix domain 
+ * socket. Same as nvm_tcp_rpc_bind(), except that the remote process must
+ * have used nvm_unix_rpc_enable().
+ */
+int nvm_unix_rpc_bind(nvm_aq_ref* ref, const nvm_ctrl_t* ctrl, const char* path);
+
+
+
+/*
+ * Bind admin queue-pair reference to a local process through shared memory.
+ * The admin queue owner must have used nvm_shm_rpc_enable() with the same
+ * name. Commands are passed through a ring in the shared memory segment
+ * without any system calls, unless either side has to sleep.
+ */
+int nvm_shm_rpc_bind(nvm_aq_ref* ref, const nvm_ctrl_t* ctrl, const char* name);
 
 
 
@@ -29,6 +29,24 @@ typedef struct
 
 
 
+/*
+ * Wait policy.
+ *
+ * Describes how blocking library functions wait for the controller, for 
+ * example when waiting for completions or for a controller reset. The
+ * caller busy-polls for spin_ns nanoseconds, and then sleeps between polls,
+ * starting at min_sleep_ns and doubling the interval up to max_sleep_ns.
+ * Timeouts are measured using CLOCK_MONOTONIC.
+ */
+typedef struct
+{
+    uint64_t                spin_ns;        // Busy-poll window in nanoseconds (0 to sleep right away)
+    uint64_t                min_sleep_ns;   // Initial sleep interval in nanoseconds
+    uint64_t                max_sleep_ns;   // Maximum sleep interval in nanoseconds
+} nvm_wait_policy_t;
+
+
+
 /*
  * NVM admin queue-pair reference handle.
  *
@@ -66,13 +84,45 @@ typedef struct __align__(32)
 
 
 
+/*
+ * DMA extent.
+ *
+ * Describes a run of controller pages that are contiguous in IO address space.
+ */
+typedef struct
+{
+    uint64_t                ioaddr;         // IO address of the first page in the run
+    size_t                  page;           // Index of the first page in the run
+    size_t                  n_pages;        // Number of MPS-sized pages in the run
+} nvm_dma_extent_t;
+
+
+
+/*
+ * Extent-based DMA mapping descriptor.
+ *
+ * Same as nvm_dma_t, except that IO addresses are stored as runs of
+ * contiguous pages rather than one address per page. This saves memory for
+ * large mappings with few discontinuities, such as hugepages or GPU memory.
+ * Extents are sorted by page index and cover all pages of the mapping.
+ */
+typedef struct __align__(32)
+{
+    void*                   vaddr;          // Virtual address to start of region (NB! can be NULL)
+    size_t                  page_size;      // Controller's page size (MPS)
+    size_t                  n_pages;        // Number of MPS-sized pages
+    size_t                  n_extents;      // Number of extents
+    nvm_dma_extent_t        extents[];      // Runs of contiguous pages
+} __attribute__((aligned (32))) nvm_dma_ext_t;
+
+
+
 /* 
  * NVM queue descriptor.
  *
  * This structure represents an NVM IO queue and holds information 
  * about memory addresses, queue entries as well as a memory mapped pointer to 
- * the device doorbell register. Maximum queue size is limited to a single 
- * page.
+ * the device doorbell register.
  *
  * Note: This descriptor represents both completion and submission queues.
  */
@@ -85,13 +135,63 @@ typedef struct __align__(64)
     uint32_t                tail;           // Queue's tail pointer
     int16_t                 phase;          // Current phase bit
     uint32_t                last;           // Used internally to check db writes
+    uint8_t                 contiguous;     // Queue memory is physically contiguous (ioaddr is a PRP list otherwise)
     volatile uint32_t*      db;             // Pointer to doorbell register (NB! write only)
     volatile void*          vaddr;          // Virtual address to start of queue memory
     uint64_t                ioaddr;         // Physical/IO address of the memory page
+    volatile uint32_t*      shadow;         // Pointer to shadow doorbell (NULL if not used)
+    volatile uint32_t*      event_idx;      // Pointer to controller's EventIdx (NULL if not used)
 } __attribute__((aligned (64))) nvm_queue_t;
 
 
 
+/*
+ * Multi-producer submission queue descriptor.
+ *
+ * Wraps an SQ so that several threads can enqueue commands concurrently.
+ * Slots are reserved using tickets, where a ticket is a monotonically
+ * increasing slot counter (slot index is ticket modulo queue size).
+ * A slot is published by writing its ticket + 1 to the slot's sequence
+ * number, and the doorbell is rung for contiguous runs of published slots.
+ *
+ * Note: This descriptor is variably sized and must be allocated using
+ *       nvm_sq_mp_create().
+ */
+typedef struct __align__(64)
+{
+    nvm_queue_t*            sq;             // Underlying submission queue
+    uint64_t                reserved;       // Next ticket to reserve
+    uint64_t                head;           // Ticket of SQ head (oldest slot not yet consumed by the controller)
+    uint64_t                submitted;      // Tickets below this have been written to the doorbell
+    uint32_t                lock;           // Doorbell lock
+    uint64_t                seq[];          // Per-slot sequence numbers
+} __attribute__((aligned (64))) nvm_sq_mp_t;
+
+
+
+/*
+ * Command identifier (CID) table.
+ *
+ * Allocates command identifiers and associates a user context with every
+ * outstanding command, so that completions can be matched to requests
+ * regardless of the order they complete in. The table size is independent
+ * of the SQ size; as SQ slots are released when the controller fetches a
+ * command, the number of outstanding commands is only bounded by the CQ.
+ *
+ * Note: This descriptor must be allocated using nvm_cid_table_create().
+ *       The table is not thread-safe.
+ */
+typedef struct __align__(64)
+{
+    void**                  contexts;       // User contexts indexed by CID (cache-line aligned)
+    uint16_t*               free_cids;      // Stack of free CIDs
+    uint8_t*                busy;           // Indicates whether a CID is outstanding
+    uint32_t                size;           // Number of CIDs in table
+    uint32_t                n_free;         // Number of free CIDs
+} __attribute__((aligned (64))) nvm_cid_table_t;
+
+
+
 /* 
  * NVM completion queue entry type (16 bytes) 
  */
@@ -112,6 +212,41 @@ typedef struct __align__(64)
 
 
 
+/*
+ * NVM scatter-gather list (SGL) descriptor type (16 bytes)
+ */
+typedef struct __align__(16)
+{
+    uint32_t                dword[4];
+} __attribute__((aligned (16))) nvm_sgl_t;
+
+
+
+/*
+ * NVM dataset management (DSM) range type (16 bytes)
+ */
+typedef struct __align__(16)
+{
+    uint32_t                attributes;     // Context attributes
+    uint32_t                n_blocks;       // Length in logical blocks
+    uint64_t                start_lba;      // Starting LBA
+} __attribute__((aligned (16))) nvm_dsm_range_t;
+
+
+
+/*
+ * NVM end-to-end protection information (PI) tuple (8 bytes).
+ * All fields are stored big-endian, see nvm_pi_generate().
+ */
+typedef struct __align__(8)
+{
+    uint16_t                guard;          // CRC16 T10-DIF of logical block data
+    uint16_t                app_tag;        // Application tag
+    uint32_t                ref_tag;        // Reference tag
+} __attribute__((aligned (8))) nvm_pi_t;
+
+
+
 /*
  * Controller information structure.
  *
@@ -136,6 +271,33 @@ struct nvm_ctrl_info
     size_t                  sq_entry_size;  // SQ entry size (SQES)
     size_t                  max_out_cmds;   // Maximum outstanding commands (MAXCMD)
     size_t                  max_n_ns;       // Maximum number of namespaces (NN)
+    int                     sgl_support;    // SGLs supported for IO commands (SGLS)
+    int                     sgl_dword_align;// SGL data blocks must be DWORD aligned (SGLS)
+    uint16_t                ctrl_id;        // Controller identifier (CNTLID)
+    uint16_t                admin_cmds;     // Optional admin commands supported (OACS)
+    uint16_t                nvm_cmds;       // Optional NVM commands supported (ONCS)
+    uint16_t                fused_ops;      // Fused operations supported (FUSES)
+    size_t                  abort_limit;    // Maximum outstanding abort commands (ACL)
+    size_t                  max_sq_entry_size;  // Maximum SQ entry size (SQES)
+    size_t                  max_cq_entry_size;  // Maximum CQ entry size (CQES)
+    int                     volatile_cache; // Volatile write cache is present (VWC)
+    size_t                  atomic_write;   // Atomic write unit in logical blocks (AWUN)
+    size_t                  atomic_write_pf;// Atomic write unit during power fail in logical blocks (AWUPF)
+    size_t                  atomic_cmp_write;   // Atomic compare and write unit in logical blocks (ACWU)
+};
+
+
+
+/*
+ * LBA format structure.
+ *
+ * Describes one of the LBA formats supported by a namespace.
+ */
+struct nvm_lba_format
+{
+    size_t                  lba_data_size;  // Logical block size (LBADS)
+    size_t                  metadata_size;  // Metadata size (MS)
+    uint8_t                 performance;    // Relative performance, 0 is best (RP)
 };
 
 
@@ -153,6 +315,25 @@ struct nvm_ns_info
     size_t                  utilization;    // Utilization in logical blocks (NUSE)
     size_t                  lba_data_size;  // Logical block size (LBADS)
     size_t                  metadata_size;  // Metadata size (MS)
+    int                     extended_lba;   // Metadata is transferred at the end of each block (FLBAS)
+    uint8_t                 pi_type;        // Protection information type, 0 if disabled (DPS)
+    int                     pi_first;       // Protection information is first in metadata (DPS)
+    uint8_t                 pi_caps;        // End-to-end data protection capabilities (DPC)
+    uint8_t                 features;       // Namespace features (NSFEAT)
+    size_t                  atomic_write;   // Atomic write unit in logical blocks, 0 if controller value applies (NAWUN)
+    size_t                  atomic_write_pf;// Atomic write unit during power fail, 0 if controller value applies (NAWUPF)
+    size_t                  atomic_cmp_write;   // Atomic compare and write unit, 0 if controller value applies (NACWU)
+    size_t                  io_boundary;    // Optimal IO boundary in logical blocks, 0 if not reported (NOIOB)
+    size_t                  write_granularity;  // Preferred write granularity in logical blocks, 0 if not reported (NPWG)
+    size_t                  write_alignment;    // Preferred write alignment in logical blocks, 0 if not reported (NPWA)
+    size_t                  dealloc_granularity;// Preferred deallocate granularity in logical blocks, 0 if not reported (NPDG)
+    size_t                  dealloc_alignment;  // Preferred deallocate alignment in logical blocks, 0 if not reported (NPDA)
+    size_t                  optimal_write_size; // Optimal write size in logical blocks, 0 if not reported (NOWS)
+    uint8_t                 nguid[16];      // Namespace globally unique identifier (NGUID)
+    uint8_t                 eui64[8];       // IEEE extended unique identifier (EUI64)
+    size_t                  format_idx;     // Index of the LBA format in use (FLBAS)
+    size_t                  n_lba_formats;  // Number of supported LBA formats (NLBAF)
+    struct nvm_lba_format   lba_formats[16];// Supported LBA formats (LBAF0-LBAF15)
 };
 
 
@@ -54,6 +54,15 @@ uint64_t _nvm_bitmask(int hi, int lo)
     (((block_size) * (blockno)) / (page_size))
 
 
+/*
+ * Size of a logical block in host memory. For extended LBA formats, the
+ * metadata is transferred at the end of each block and must be included
+ * when converting between pages and blocks.
+ */
+#define NVM_NS_BLOCK_SIZE(ns_info_ptr)              \
+    ((ns_info_ptr)->lba_data_size + ((ns_info_ptr)->extended_lba ? (ns_info_ptr)->metadata_size : 0))
+
+
 /*
  * Create mask to clear away address offset.
  */
@@ -119,6 +128,52 @@ uint64_t _nvm_bitmask(int hi, int lo)
 
 
 
+/*
+ * Find the extent holding a page of an extent-based DMA descriptor.
+ * Returns the extent index, or n_extents if the page is out of range.
+ */
+static inline __device__ __host__
+size_t nvm_dma_ext_find(const nvm_dma_ext_t* dma, size_t pageno)
+{
+    size_t lo = 0;
+    size_t hi = dma->n_extents;
+
+    if (pageno >= dma->n_pages)
+    {
+        return dma->n_extents;
+    }
+
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (dma->extents[mid].page <= pageno)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/*
+ * Look up the IO address of a page of an extent-based DMA descriptor.
+ * The page must be within the mapping.
+ */
+static inline __device__ __host__
+uint64_t nvm_dma_ext_ioaddr(const nvm_dma_ext_t* dma, size_t pageno)
+{
+    const nvm_dma_extent_t* ext = &dma->extents[nvm_dma_ext_find(dma, pageno)];
+    return ext->ioaddr + (pageno - ext->page) * dma->page_size;
+}
+
+
+
 
 /* Standard fields in a command */
 #define NVM_CMD_CID(p)              _REG(p, 2, 16)
@@ -22,6 +22,8 @@ void ctrl_dev_reset(struct ctrl_dev* dev,
     dev->rdev = MKDEV(MAJOR(first), MINOR(first) + num);
     dev->cls = cls;
     dev->chrdev = NULL;
+    mutex_init(&dev->lock);
+    INIT_LIST_HEAD(&dev->refs);
 }
 
 
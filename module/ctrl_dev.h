@@ -5,11 +5,15 @@
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <linux/device.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
 
 struct ctrl_dev
 {
     unsigned long               in_use;         /* Indicates if this struct is used */
     struct pci_dev*             pdev;           /* Reference to physical PCI device */
+    struct mutex                lock;           /* Protects list of references */
+    struct list_head            refs;           /* References to this controller */
     char                        name[64];       /* Device name */
     dev_t                       rdev;           /* Device register */
     struct class*               cls;            /* Device class */
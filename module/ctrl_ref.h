@@ -1,10 +1,12 @@
 #ifndef __DIS_NVM_MODULE_CTRL_REF_H__
 #define __DIS_NVM_MODULE_CTRL_REF_H__
 
-#include "list.h"
+#include "tree.h"
 #include <linux/types.h>
 #include <linux/sched.h>
 #include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
 
 struct ctrl_dev;
 
@@ -14,26 +16,41 @@ struct ctrl_dev;
  *
  * A userspace process will typically acquire a reference to the actual
  * NVMe controller, in order to read and write to registers.
+ * A reference is created when the device file is opened and is stored in
+ * the file's private data, so it is shared by every thread and forked
+ * process using the same file descriptor.
  */
 struct ctrl_ref
 {
-    unsigned long               flags;          /* 0=slot is free, 1=slot is taken */
+    struct list_head            list;           /* Linked list of references to the same controller */
+    struct mutex                lock;           /* Serialize access to mappings */
     struct ctrl_dev*            ctrl;           /* Controller device */
-    pid_t                       owner;          /* Userspace process that owns this reference */
-    struct map_list_head        user_page_maps; /* Linked list of user pages */
-    struct map_list_head        gpu_page_maps;  /* Linked list of mapped GPU memory */
+    bool                        removed;        /* Indicates that the controller has been removed */
+    pid_t                       owner;          /* Userspace process that opened the reference */
+    struct map_tree             user_page_maps; /* Index of mapped user pages */
+    struct map_tree             gpu_page_maps;  /* Index of mapped GPU memory */
 };
 
 
 
 /*
- * Acquire a controller reference.
+ * Allocate a controller reference and add it to the controller's list
+ * of references.
  */
-struct ctrl_ref* ctrl_ref_get(struct ctrl_ref* ref, struct ctrl_dev* dev);
+struct ctrl_ref* ctrl_ref_get(struct ctrl_dev* dev);
 
 
 /*
- * Release a controller reference.
+ * Release all mappings of a reference and mark it as removed.
+ * Used when the controller goes away while the reference is still in use.
+ * The caller must hold the controller lock and remove the reference from
+ * the controller's list.
+ */
+void ctrl_ref_detach(struct ctrl_ref* ref);
+
+
+/*
+ * Release a controller reference, its mappings, and free it.
  */
 void ctrl_ref_put(struct ctrl_ref* ref);
 
@@ -1,12 +1,16 @@
 #include "map.h"
-#include "list.h"
+#include "tree.h"
+#include "ioctl.h"
 #include "ctrl_ref.h"
 #include "ctrl_dev.h"
 #include <linux/types.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/mm_types.h>
 #include <linux/mm.h>
+#include <linux/hugetlb.h>
+#include <linux/scatterlist.h>
 #include <linux/pci.h>
 #include <linux/device.h>
 #include <asm/uaccess.h>
@@ -23,48 +27,105 @@
 #define GPU_PAGE_SHIFT          16
 #define GPU_PAGE_SIZE           (1UL << GPU_PAGE_SHIFT)
 #define GPU_PAGE_MASK           ~(GPU_PAGE_SIZE - 1)
-#define IN_USE_BIT              1
 
 
-struct ctrl_ref* ctrl_ref_get(struct ctrl_ref* ref, struct ctrl_dev* dev)
+struct ctrl_ref* ctrl_ref_get(struct ctrl_dev* dev)
 {
-    if (test_and_set_bit(IN_USE_BIT, &ref->flags) == 1)
+    struct ctrl_ref* ref;
+
+    ref = kzalloc(sizeof(struct ctrl_ref), GFP_KERNEL);
+    if (ref == NULL)
     {
-        // This slot is already taken
+        printk(KERN_ERR "Failed to allocate controller reference\n");
         return NULL;
     }
 
+    mutex_init(&ref->lock);
     ref->ctrl = dev;
+    ref->removed = false;
     ref->owner = current->pid;
-    list_init(&ref->user_page_maps, 0);
-    list_init(&ref->gpu_page_maps, 0);
+    map_tree_init(&ref->user_page_maps);
+    map_tree_init(&ref->gpu_page_maps);
+
+    mutex_lock(&dev->lock);
+    list_add_tail(&ref->list, &dev->refs);
+    mutex_unlock(&dev->lock);
 
     return ref;
 }
 
 
-void ctrl_ref_put(struct ctrl_ref* ref)
+static void release_maps(struct ctrl_ref* ref)
 {
     struct map_descriptor* map;
 
 #ifdef _CUDA
-    while (ref->gpu_page_maps.next != NULL)
+    while ((map = map_tree_first(&ref->gpu_page_maps)) != NULL)
     {
-        map = (struct map_descriptor*) ((void*) ref->gpu_page_maps.next);
         unmap_gpu_memory(map);
     }
 #endif
 
-    while (ref->user_page_maps.next != NULL)
+    while ((map = map_tree_first(&ref->user_page_maps)) != NULL)
     {
-        map = (struct map_descriptor*) ((void*) ref->user_page_maps.next);
         unmap_user_pages(map);
     }
+}
+
+
+void ctrl_ref_detach(struct ctrl_ref* ref)
+{
+    mutex_lock(&ref->lock);
+    release_maps(ref);
+    ref->removed = true;
+    mutex_unlock(&ref->lock);
+}
+
+
+void ctrl_ref_put(struct ctrl_ref* ref)
+{
+    // Lock order is controller before reference, same as on removal
+    mutex_lock(&ref->ctrl->lock);
+    list_del_init(&ref->list);
+
+    mutex_lock(&ref->lock);
+    if (!ref->removed)
+    {
+        release_maps(ref);
+    }
+    mutex_unlock(&ref->lock);
 
-    ref->owner = 0;
-    ref->ctrl = NULL;
+    mutex_unlock(&ref->ctrl->lock);
 
-    test_and_clear_bit(IN_USE_BIT, &ref->flags);
+    kfree(ref);
+}
+
+
+/*
+ * Allocate the array of pinned pages. Large mappings need more than
+ * kmalloc can provide, so fall back to vmalloc.
+ */
+static struct page** alloc_page_array(unsigned long n_pages)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0))
+    return (struct page**) kvcalloc(n_pages, sizeof(struct page*), GFP_KERNEL);
+#else
+    if (n_pages > ULONG_MAX / sizeof(struct page*))
+    {
+        return NULL;
+    }
+    return (struct page**) vzalloc(n_pages * sizeof(struct page*));
+#endif
+}
+
+
+static void put_user_page_array(struct page** pages, unsigned long n_pages)
+{
+    while (n_pages > 0)
+    {
+        put_page(pages[--n_pages]);
+    }
+    kvfree(pages);
 }
 
 
@@ -74,7 +135,7 @@ static long lock_user_pages(struct map_descriptor* map, struct task_struct* task
     struct page** pages;
 
     // Allocate page array
-    pages = (struct page**) kcalloc(n_pages, sizeof(struct page*), GFP_KERNEL);
+    pages = alloc_page_array(n_pages);
     if (pages == NULL)
     {
         printk(KERN_ERR "Failed to allocate user page array\n");
@@ -92,12 +153,82 @@ static long lock_user_pages(struct map_descriptor* map, struct task_struct* task
 
     if (retval <= 0)
     {
-        kfree(pages);
+        kvfree(pages);
         printk(KERN_ERR "get_user_pages() failed: %ld\n", retval);
-        return retval;
+        return retval < 0 ? retval : -EFAULT;
+    }
+
+    // The entire range must be pinned, a partial mapping is never returned
+    if (retval < n_pages)
+    {
+        put_user_page_array(pages, retval);
+        printk(KERN_ERR "get_user_pages() pinned %ld of %lu pages\n", retval, n_pages);
+        return -EFAULT;
     }
 
-    map->n_pages = retval;
+    map->n_pages = n_pages;
+    map->pages = (void*) pages;
+
+    return 0;
+}
+
+
+static long lock_user_hugepages(struct map_descriptor* map, struct task_struct* task, u64 vaddr, unsigned long n_pages)
+{
+    long retval = 0;
+    unsigned long i;
+    struct page** pages;
+    struct vm_area_struct* vma;
+
+    pages = alloc_page_array(n_pages);
+    if (pages == NULL)
+    {
+        printk(KERN_ERR "Failed to allocate user page array\n");
+        return -ENOMEM;
+    }
+
+    down_read(&task->mm->mmap_sem);
+
+    // The entire range must be backed by hugepages of the same size
+    vma = find_vma(task->mm, vaddr);
+    if (vma == NULL || vma->vm_start > vaddr || !is_vm_hugetlb_page(vma)
+            || vaddr & (vma_kernel_pagesize(vma) - 1)
+            || vaddr + n_pages * vma_kernel_pagesize(vma) > vma->vm_end)
+    {
+        up_read(&task->mm->mmap_sem);
+        kvfree(pages);
+        printk(KERN_ERR "Address range is not backed by hugepages\n");
+        return -EINVAL;
+    }
+
+    map->page_size = vma_kernel_pagesize(vma);
+
+    // Pin only the head page of every hugepage
+    for (i = 0; i < n_pages; ++i)
+    {
+#if (LINUX_VERSION_CODE <= KERNEL_VERSION(4, 9, 0))
+        retval = get_user_pages(task, task->mm, vaddr + i * map->page_size, 1, 1, 0, &pages[i], NULL);
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
+        retval = get_user_pages(vaddr + i * map->page_size, 1, FOLL_WRITE, &pages[i], NULL);
+#else
+#error "Unsupported get_user_pages() symbol"
+#endif
+        if (retval != 1)
+        {
+            break;
+        }
+    }
+
+    up_read(&task->mm->mmap_sem);
+
+    if (i != n_pages)
+    {
+        put_user_page_array(pages, i);
+        printk(KERN_ERR "get_user_pages() failed: %ld\n", retval);
+        return retval < 0 ? retval : -ENOMEM;
+    }
+
+    map->n_pages = n_pages;
     map->pages = (void*) pages;
 
     return 0;
@@ -152,7 +283,7 @@ long map_gpu_memory(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, stru
     md->pdev = ref->ctrl->pdev;
     //dev = &md->pdev->dev;
 
-    list_init(md, vaddr);
+    map_tree_node_init(md, vaddr, 0);
 
     err = nvidia_p2p_get_pages(0, 0, vaddr, GPU_PAGE_SIZE * n_pages, 
             (nvidia_p2p_page_table_t**) &md->pages, (void (*)(void*)) free_callback, md);
@@ -203,7 +334,14 @@ long map_gpu_memory(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, stru
         md->n_addrs++;
     }
 
-    list_insert(&ref->gpu_page_maps, md);
+    md->tree_node.size = md->n_pages * GPU_PAGE_SIZE;
+    err = map_tree_insert(&ref->gpu_page_maps, md);
+    if (err != 0)
+    {
+        printk(KERN_WARNING "GPU memory range is already mapped: %llx\n", vaddr);
+        unmap_gpu_memory(md);
+        return err;
+    }
 
     *map = md;
     printk(KERN_INFO "Mapped %lu GPU pages (pid %d)\n", md->n_addrs, current->pid);
@@ -218,7 +356,7 @@ void unmap_gpu_memory(struct map_descriptor* map)
     unsigned long i;
     //struct device* dev = NULL;
 
-    list_remove(map);
+    map_tree_remove(map);
     i = map->n_pages;
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0))
@@ -237,7 +375,7 @@ void unmap_gpu_memory(struct map_descriptor* map)
     if (map->pages != NULL)
     {
         printk(KERN_DEBUG "GPU pages were already removed\n");
-        nvidia_p2p_put_pages(0, 0, map->list_head.vaddr, (nvidia_p2p_page_table_t*) map->pages);
+        nvidia_p2p_put_pages(0, 0, map->tree_node.vaddr, (nvidia_p2p_page_table_t*) map->pages);
     }
     kfree(map);
 
@@ -246,13 +384,75 @@ void unmap_gpu_memory(struct map_descriptor* map)
 #endif
 
 
-long map_user_pages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, struct map_descriptor** map)
+/*
+ * Build a scatter-gather table from pinned pages, coalescing physically 
+ * contiguous pages, and map it for the controller with a single call. 
+ * Then insert the descriptor into the tree of user page mappings.
+ */
+static long map_pages(struct ctrl_ref* ref, struct map_descriptor* md)
 {
     unsigned long i;
     long err;
-    struct map_descriptor* md;
+    int nents;
     struct page** pages;
-    struct device* dev;
+    struct scatterlist* sg;
+
+    md->pdev = ref->ctrl->pdev;
+    md->n_addrs = 0;
+    pages = (struct page**) md->pages;
+
+    if (md->page_size == PAGE_SIZE)
+    {
+        err = sg_alloc_table_from_pages(&md->sg_table, pages, md->n_pages, 0, md->n_pages * PAGE_SIZE, GFP_KERNEL);
+    }
+    else
+    {
+        // Pages are hugepages, use one entry per hugepage
+        err = sg_alloc_table(&md->sg_table, md->n_pages, GFP_KERNEL);
+        if (err == 0)
+        {
+            for_each_sg(md->sg_table.sgl, sg, md->n_pages, i)
+            {
+                sg_set_page(sg, pages[i], md->page_size, 0);
+            }
+        }
+    }
+
+    if (err != 0)
+    {
+        printk(KERN_ERR "Failed to allocate scatter-gather table: %ld\n", err);
+        unmap_user_pages(md);
+        return err;
+    }
+
+    // Map all pages for controller at once
+    nents = dma_map_sg(&md->pdev->dev, md->sg_table.sgl, md->sg_table.nents, DMA_BIDIRECTIONAL);
+    if (nents == 0)
+    {
+        printk(KERN_ERR "Failed to map scatter-gather table\n");
+        unmap_user_pages(md);
+        return -EIO;
+    }
+    md->n_addrs = nents;
+
+    // Insert into tree
+    md->tree_node.size = md->n_pages * md->page_size;
+    err = map_tree_insert(&ref->user_page_maps, md);
+    if (err != 0)
+    {
+        printk(KERN_WARNING "Memory range is already mapped: %llx\n", md->tree_node.vaddr);
+        unmap_user_pages(md);
+        return err;
+    }
+
+    return 0;
+}
+
+
+long map_user_pages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, struct map_descriptor** map)
+{
+    long err;
+    struct map_descriptor* md;
 
     *map = NULL;
 
@@ -261,8 +461,8 @@ long map_user_pages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, stru
         return -EINVAL;
     }
 
-    // Allocate map descriptor
-    md = kmalloc(sizeof(struct map_descriptor) + (n_pages - 1) * sizeof(dma_addr_t), GFP_KERNEL);
+    // Allocate map descriptor, bus addresses are kept in the scatter-gather table
+    md = kzalloc(sizeof(struct map_descriptor), GFP_KERNEL);
     if (md == NULL)
     {
         printk(KERN_ERR "Failed to allocate map descriptor\n");
@@ -272,8 +472,8 @@ long map_user_pages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, stru
     vaddr &= PAGE_MASK;
     md->page_size = PAGE_SIZE;
 
-    // Initialize list header
-    list_init(md, vaddr);
+    // Initialize tree node
+    map_tree_node_init(md, vaddr, 0);
     
     // Pin pages to memory
     err = lock_user_pages(md, /*ref->owner*/ current, vaddr, n_pages);
@@ -283,72 +483,121 @@ long map_user_pages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, stru
         return err;
     }
 
-    // Traverse pages and map them for controller
-    md->pdev = ref->ctrl->pdev;
-    dev = &md->pdev->dev;
-    pages = (struct page**) md->pages;
-    for (i = 0; i < md->n_pages; ++i)
+    err = map_pages(ref, md);
+    if (err != 0)
     {
-        md->addrs[i] = dma_map_page(dev, pages[i], 0, PAGE_SIZE, DMA_BIDIRECTIONAL);
+        return err;
+    }
 
-        err = dma_mapping_error(dev, md->addrs[i]);
-        if (err != 0)
-        {
-            printk(KERN_ERR "Failed to map page for some reason\n");
-            break;
-        }
+    *map = md;
+    printk(KERN_INFO "Mapped %lu host pages as %lu extents (pid %d)\n", md->n_pages, md->n_addrs, current->pid);
+    return 0;
+}
+
+
+long map_user_hugepages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, struct map_descriptor** map)
+{
+    long err;
+    struct map_descriptor* md;
+
+    *map = NULL;
+
+    if (n_pages < 1)
+    {
+        return -EINVAL;
     }
-    md->n_addrs = i;
 
-    // Insert into linked list
-    list_insert(&ref->user_page_maps, md);
+    md = kzalloc(sizeof(struct map_descriptor), GFP_KERNEL);
+    if (md == NULL)
+    {
+        printk(KERN_ERR "Failed to allocate map descriptor\n");
+        return -ENOMEM;
+    }
+
+    map_tree_node_init(md, vaddr, 0);
+
+    // Pin hugepages to memory, this also sets the page size
+    err = lock_user_hugepages(md, current, vaddr, n_pages);
+    if (err != 0)
+    {
+        kfree(md);
+        return err;
+    }
+
+    err = map_pages(ref, md);
+    if (err != 0)
+    {
+        return err;
+    }
 
     *map = md;
-    printk(KERN_INFO "Mapped %lu host pages (pid %d)\n", md->n_addrs, current->pid);
+    printk(KERN_INFO "Mapped %lu hugepages of %lu bytes as %lu extents (pid %d)\n", 
+            md->n_pages, md->page_size, md->n_addrs, current->pid);
     return 0;
 }
 
 
 void unmap_user_pages(struct map_descriptor* map)
 {
-    unsigned long i;
+    unsigned long n_pages;
     struct page** pages;
     struct device* dev;
 
-    // Remove from linked list
-    list_remove(map);
+    // Remove from tree
+    map_tree_remove(map);
 
     // Unmap pages for controller
     dev = &map->pdev->dev;
-    for (i = 0; i < map->n_addrs; ++i)
+    if (map->n_addrs > 0)
     {
-        dma_unmap_page(dev, map->addrs[i], PAGE_SIZE, DMA_BIDIRECTIONAL);
+        dma_unmap_sg(dev, map->sg_table.sgl, map->sg_table.nents, DMA_BIDIRECTIONAL);
     }
+    sg_free_table(&map->sg_table);
 
     // Unpin pages
     pages = (struct page**) map->pages;
-    for (i = 0; i < map->n_pages; ++i)
+    n_pages = map->n_pages;
+    put_user_page_array(pages, n_pages);
+    kfree(map);
+
+    printk(KERN_DEBUG "Unmapped %lu host pages (pid %d)\n", n_pages, current->pid);
+}
+
+
+long copy_map_extents(const struct map_descriptor* map, struct nvm_ioctl_extent __user* extents, size_t max_extents)
+{
+    unsigned long i;
+    struct scatterlist* sg;
+    struct nvm_ioctl_extent extent;
+
+    if (map->n_addrs > max_extents)
     {
-        put_page(pages[i]);
+        return -ENOSPC;
     }
 
-    kfree(map->pages);
-    kfree(map);
+    for_each_sg(map->sg_table.sgl, sg, map->n_addrs, i)
+    {
+        extent.ioaddr = sg_dma_address(sg);
+        extent.size = sg_dma_len(sg);
+
+        if (copy_to_user(&extents[i], &extent, sizeof(extent)) != 0)
+        {
+            return -EFAULT;
+        }
+    }
 
-    printk(KERN_DEBUG "Unmapped %lu host pages (pid %d)\n", i, current->pid);
+    return 0;
 }
 
 
 struct map_descriptor* find_user_page_map(struct ctrl_ref* ref, u64 vaddr)
 {
-    vaddr &= PAGE_MASK;
-    return (struct map_descriptor*) list_find(&ref->user_page_maps, vaddr);
+    return (struct map_descriptor*) map_tree_find(&ref->user_page_maps, vaddr);
 }
 
 
 struct map_descriptor* find_gpu_map(struct ctrl_ref* ref, u64 vaddr)
 {
-    vaddr &= GPU_PAGE_MASK;
-    return (struct map_descriptor*) list_find(&ref->gpu_page_maps, vaddr);
+    return (struct map_descriptor*) map_tree_find(&ref->gpu_page_maps, vaddr);
 }
 
@@ -1,12 +1,14 @@
 #ifndef __DIS_NVM_MODULE_MAP_H__
 #define __DIS_NVM_MODULE_MAP_H__
 
-#include "list.h"
+#include "tree.h"
 #include <linux/types.h>
 #include <linux/mm_types.h>
+#include <linux/scatterlist.h>
 
 struct device;
 struct ctrl_ref;
+struct nvm_ioctl_extent;
 
 
 /*
@@ -16,14 +18,15 @@ struct ctrl_ref;
  */
 struct map_descriptor
 {
-    struct map_list_head        list_head;      /* Linked list header */
+    struct map_tree_node        tree_node;      /* Mapping index node */
     struct pci_dev*             pdev;           /* PCI device mappings are mapped for */
     unsigned long               page_size;      /* Virtual/logical page size */
     unsigned long               n_pages;        /* Number of pages pinned (should equal n_addrs) */
     void*                       pages;          /* Reference to the pinned pages */
     void*                       mappings;       /* Reference to mappings */
-    unsigned long               n_addrs;        /* Number of bus addresses */
-    dma_addr_t                  addrs[1];       /* Mapped bus addresses */
+    struct sg_table             sg_table;       /* Mapped user pages */
+    unsigned long               n_addrs;        /* Number of bus addresses (mapped extents for user pages) */
+    dma_addr_t                  addrs[1];       /* Mapped bus addresses (GPU memory only) */
 };
 
 
@@ -31,10 +34,20 @@ struct map_descriptor
  * Map user pages.
  *
  * Map n_pages of memory starting at virtual address vaddr for the controller.
+ * Physically contiguous pages are coalesced into extents.
  */
 long map_user_pages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, struct map_descriptor** map);
 
 
+/*
+ * Map user hugepages.
+ *
+ * Map n_pages hugepages starting at virtual address vaddr for the controller,
+ * using a single scatter-gather entry per hugepage.
+ */
+long map_user_hugepages(struct ctrl_ref* ref, u64 vaddr, unsigned long n_pages, struct map_descriptor** map);
+
+
 void unmap_user_pages(struct map_descriptor* map);
 
 
@@ -47,13 +60,20 @@ void unmap_gpu_memory(struct map_descriptor* map);
 
 
 /*
- * Look up a map from the list of user page mappings.
+ * Copy bus address extents of a user page mapping to userspace.
+ * Returns -ENOSPC if there are more than max_extents extents.
+ */
+long copy_map_extents(const struct map_descriptor* map, struct nvm_ioctl_extent __user* extents, size_t max_extents);
+
+
+/*
+ * Look up the user page mapping containing an address.
  */
 struct map_descriptor* find_user_page_map(struct ctrl_ref* ref, u64 vaddr);
 
 
 /*
- * Look up a map from the list of GPU mappings.
+ * Look up the GPU mapping containing an address.
  */
 struct map_descriptor* find_gpu_map(struct ctrl_ref* ref, u64 vaddr);
 
@@ -45,72 +45,27 @@ static struct class* dev_class;
 static struct ctrl_dev* ctrl_devs = NULL;
 
 
-/* Array of controller references */
-static struct ctrl_ref* ctrl_refs = NULL;
-
-
 /* Number of devices */
 static int num_ctrl_devs = 8;
 module_param(num_ctrl_devs, int, 0);
 MODULE_PARM_DESC(num_ctrl_devs, "Number of controller device slots");
 
-/* Number of controller references */
-static long num_ctrl_refs = 48;
-module_param(num_ctrl_refs, long, 0);
-MODULE_PARM_DESC(num_ctrl_refs, "Number of controller reference slots");
-
-/* Number of pages per mapping */
-static long max_pages_per_map = 0x8000;
+/* Number of pages per mapping (64 GiB of 4 KiB pages) */
+static long max_pages_per_map = 0x1000000;
 module_param(max_pages_per_map, long, 0);
-MODULE_PARM_DESC(max_pages_per_map, "Maximum number of pages per mapping");
-
-
-
-static struct ctrl_ref* find_ref(struct ctrl_dev* dev, struct task_struct* owner)
-{
-    long i;
-    struct ctrl_ref* ref;
-
-    for (i = 0; i < num_ctrl_refs; ++i)
-    {
-        ref = &ctrl_refs[i];
-
-        if (ref->ctrl == dev && (owner == NULL || ref->owner == owner->pid))
-        {
-            if (dev->pdev == NULL)
-            {
-                printk(KERN_ERR "PCI device is removed but reference still exists!\n");
-            }
-
-            return ref;
-        }
-    }
+MODULE_PARM_DESC(max_pages_per_map, "Maximum number of pages per mapping (0 for no limit)");
 
-    return NULL;
-}
 
 
 static struct ctrl_dev* find_dev_by_inode(struct inode* inode)
 {
-    int i;
-    struct ctrl_dev* dev;
-
-    for (i = 0; i < num_ctrl_devs; ++i)
+    if (inode->i_cdev == NULL)
     {
-        dev = &ctrl_devs[i];
-
-        if (inode->i_cdev == &dev->cdev)
-        {
-            if (ctrl_devs[i].pdev == NULL)
-            {
-                printk(KERN_ERR "Controller device exists but PCI device is removed!\n");
-            }
-
-            return dev;
-        }
+        return NULL;
     }
 
-    return NULL;
+    // Character device is embedded in the controller device handle
+    return container_of(inode->i_cdev, struct ctrl_dev, cdev);
 }
 
 
@@ -135,7 +90,6 @@ static struct ctrl_dev* find_dev_by_pdev(const struct pci_dev* pdev)
 
 static int ref_get(struct inode* inode, struct file* file)
 {
-    long i;
     struct ctrl_dev* dev;
     struct ctrl_ref* ref = NULL;
 
@@ -154,46 +108,116 @@ static int ref_get(struct inode* inode, struct file* file)
         return -EBADF;
     }
 
-    // Find available controller reference
-    for (i = 0; i  < num_ctrl_refs; ++i)
+    ref = ctrl_ref_get(dev);
+    if (ref == NULL)
     {
-        ref = ctrl_ref_get(&ctrl_refs[i], dev);
-        if (ref != NULL)
-        {
-            printk(KERN_DEBUG "Controller reference %ld created for pid %d\n", 
-                    i, current->pid);
-            return 0;
-        }
+        return -ENOMEM;
     }
 
-    printk(KERN_WARNING "No available controller reference slots\n");
-    return -ENOSPC;
+    file->private_data = ref;
+    printk(KERN_DEBUG "Controller reference created for pid %d\n", current->pid);
+    return 0;
 }
 
 
 static int ref_put(struct inode* inode, struct file* file)
 {
-    struct ctrl_dev* dev;
-    struct ctrl_ref* ref;
+    struct ctrl_ref* ref = file->private_data;
 
-    dev = find_dev_by_inode(inode);
-    if (dev == NULL)
-    {
-        printk(KERN_CRIT "Unknown controller device!\n");
-        return -EBADF;
-    }
-    
-    ref = find_ref(dev, current);
     if (ref == NULL)
     {
-        // TODO: Find a way to look up reference anyway in order to remove it,
-        //       e.g. by finding out which pid we are acting on behalf of
-        printk(KERN_WARNING "No controller references found for pid %d\n", current->pid);
+        printk(KERN_CRIT "Controller reference not found!\n");
         return -EBADF;
     }
 
+    file->private_data = NULL;
+    printk(KERN_DEBUG "Controller reference for pid %d removed\n", ref->owner);
     ctrl_ref_put(ref);
-    printk(KERN_DEBUG "Controller reference %ld removed\n", ref - ctrl_refs);
+    return 0;
+}
+
+
+/*
+ * Map host memory and return mapped extents to userspace.
+ */
+static long map_host_memory(struct ctrl_ref* ref, unsigned long arg, bool hugepages)
+{
+    long retval;
+    struct nvm_ioctl_map_host request;
+    struct map_descriptor* map = NULL;
+    struct nvm_ioctl_map_host __user* user_request = (struct nvm_ioctl_map_host __user*) arg;
+
+    if (copy_from_user(&request, user_request, sizeof(request)) != 0)
+    {
+        return -EFAULT;
+    }
+
+    if (max_pages_per_map > 0 && request.n_pages > max_pages_per_map)
+    {
+        printk(KERN_DEBUG "Requested more pages than available\n");
+        return -EINVAL;
+    }
+
+    if (hugepages)
+    {
+        retval = map_user_hugepages(ref, request.vaddr_start, request.n_pages, &map);
+    }
+    else
+    {
+        retval = map_user_pages(ref, request.vaddr_start, request.n_pages, &map);
+    }
+
+    if (retval != 0)
+    {
+        return retval;
+    }
+
+    retval = copy_map_extents(map, request.extents, request.n_extents);
+
+    // Report number of extents, even if the list is too short
+    request.n_extents = map->n_addrs;
+    if ((retval == 0 || retval == -ENOSPC) 
+            && copy_to_user(&user_request->n_extents, &request.n_extents, sizeof(request.n_extents)) != 0)
+    {
+        retval = -EFAULT;
+    }
+
+    if (retval != 0)
+    {
+        unmap_user_pages(map);
+    }
+
+    return retval;
+}
+
+
+/*
+ * Report the bus address and size of a memory BAR, so that userspace can
+ * find memory on the controller (such as the controller memory buffer).
+ */
+static long get_bar(struct ctrl_ref* ref, unsigned long arg)
+{
+    struct nvm_ioctl_bar request;
+    struct pci_dev* pdev = ref->ctrl->pdev;
+
+    if (copy_from_user(&request, (void __user*) arg, sizeof(request)) != 0)
+    {
+        return -EFAULT;
+    }
+
+    if (pdev == NULL || request.bir > 5 || !(pci_resource_flags(pdev, request.bir) & IORESOURCE_MEM))
+    {
+        return -EINVAL;
+    }
+
+    request.ioaddr = pci_resource_start(pdev, request.bir);
+    request.size = pci_resource_len(pdev, request.bir);
+
+    if (copy_to_user((void __user*) arg, &request, sizeof(request)) != 0)
+    {
+        return -EFAULT;
+    }
+
     return 0;
 }
 
@@ -201,52 +225,47 @@ static int ref_put(struct inode* inode, struct file* file)
 static long ref_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
 {
     long retval = 0;
-    struct ctrl_dev* dev;
-    struct ctrl_ref* ref;
+    struct ctrl_ref* ref = file->private_data;
+#ifdef _CUDA
     struct nvm_ioctl_map request;
-    struct map_descriptor* map = NULL;
     size_t max_pages = max_pages_per_map;
+#endif
+    struct map_descriptor* map = NULL;
     u64 addr;
 
-    dev = find_dev_by_inode(file->f_inode);
-    if (dev == NULL)
+    if (ref == NULL)
     {
-        printk(KERN_CRIT "Unknown controller device!\n");
+        printk(KERN_CRIT "Controller reference not found!\n");
         return -EBADF;
     }
 
-    ref = find_ref(dev, current);
-    if (ref == NULL)
+    mutex_lock(&ref->lock);
+    if (ref->removed)
     {
-        printk(KERN_CRIT "Controller reference not found!\n");
+        mutex_unlock(&ref->lock);
+        printk(KERN_WARNING "Controller device is removed\n");
         return -EBADF;
     }
 
     switch (cmd)
     {
         case NVM_MAP_HOST_MEMORY:
-            copy_from_user(&request, (void __user*) arg, sizeof(request));
-            
-            if (request.n_pages >= max_pages)
-            {
-                printk(KERN_DEBUG "Requested more pages than available\n");
-                retval = -EINVAL;
-                break;
-            }
+            retval = map_host_memory(ref, arg, false);
+            break;
 
-            retval = map_user_pages(ref, request.vaddr_start, request.n_pages, &map);
+        case NVM_MAP_HOST_HUGEPAGES:
+            retval = map_host_memory(ref, arg, true);
+            break;
 
-            if (retval == 0 && map != NULL)
-            {
-                copy_to_user((void __user*) request.ioaddrs, map->addrs, map->n_addrs * sizeof(uint64_t));
-            }
+        case NVM_GET_BAR:
+            retval = get_bar(ref, arg);
             break;
 
 #ifdef _CUDA
         case NVM_MAP_DEVICE_MEMORY:
             copy_from_user(&request, (void __user*) arg, sizeof(request));
 
-            if (request.n_pages >= max_pages)
+            if (max_pages > 0 && request.n_pages > max_pages)
             {
                 printk(KERN_DEBUG "Requested more pages than available\n");
                 retval = -EINVAL;
@@ -291,35 +310,51 @@ static long ref_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
             break;
     }
 
+    mutex_unlock(&ref->lock);
     return retval;
 }
 
 
 static int ref_mmap(struct file* file, struct vm_area_struct* vma)
 {
+    struct ctrl_ref* ref = file->private_data;
     struct ctrl_dev* dev;
+    unsigned long bir;
+    unsigned long offset;
+    unsigned long size = vma->vm_end - vma->vm_start;
 
-    dev = find_dev_by_inode(file->f_inode);
-    if (dev == NULL)
+    if (ref == NULL)
     {
-        printk(KERN_CRIT "Unknown controller device!\n");
+        printk(KERN_CRIT "Controller reference not found!\n");
         return -EBADF;
     }
 
-    if (dev->pdev == NULL)
+    dev = ref->ctrl;
+    if (ref->removed || dev->pdev == NULL)
     {
         printk(KERN_CRIT "Controller device exists but PCI device is removed\n");
         return -EAGAIN;
     }
 
-    if (vma->vm_end - vma->vm_start > pci_resource_len(dev->pdev, 0))
+    // The file offset selects the BAR and the offset within it
+    bir = vma->vm_pgoff >> (NVM_IOCTL_BAR_SHIFT - PAGE_SHIFT);
+    offset = (vma->vm_pgoff & ((1UL << (NVM_IOCTL_BAR_SHIFT - PAGE_SHIFT)) - 1)) << PAGE_SHIFT;
+
+    if (bir > 5 || !(pci_resource_flags(dev->pdev, bir) & IORESOURCE_MEM))
+    {
+        printk(KERN_WARNING "Invalid BAR %lu\n", bir);
+        return -EINVAL;
+    }
+
+    if (offset + size > pci_resource_len(dev->pdev, bir))
     {
         printk(KERN_WARNING "Invalid range size\n");
         return -EINVAL;
     }
 
+    vma->vm_pgoff = offset >> PAGE_SHIFT;
     vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
-    return vm_iomap_memory(vma, pci_resource_start(dev->pdev, 0), vma->vm_end - vma->vm_start);
+    return vm_iomap_memory(vma, pci_resource_start(dev->pdev, bir), pci_resource_len(dev->pdev, bir));
 }
 
 
@@ -395,6 +430,7 @@ static int add_pci_dev(struct pci_dev* pdev, const struct pci_device_id* id)
 static void remove_pci_dev(struct pci_dev* pdev)
 {
     struct ctrl_ref* ref;
+    struct ctrl_ref* next;
     struct ctrl_dev* dev;
 
     if (pdev == NULL)
@@ -417,13 +453,17 @@ static void remove_pci_dev(struct pci_dev* pdev)
         return;
     }
 
-    while ((ref = find_ref(dev, NULL)) != NULL)
+    // Release mappings of references that are still open, they are freed when the file is closed
+    mutex_lock(&dev->lock);
+    list_for_each_entry_safe(ref, next, &dev->refs, list)
     {
         printk(KERN_CRIT "Controller device is still referenced by pid %d: %02x:%02x.%1x\n", 
                 ref->owner, pdev->bus->number, PCI_SLOT(pdev->devfn), PCI_FUNC(pdev->devfn));
 
-        ctrl_ref_put(ref);
+        list_del_init(&ref->list);
+        ctrl_ref_detach(ref);
     }
+    mutex_unlock(&dev->lock);
 
     // Remove character device
     ctrl_dev_put(dev);
@@ -456,20 +496,10 @@ static int __init disnvme_entry(void)
         return -ENOMEM;
     }
 
-    // Allocate array of controller reference pointers
-    ctrl_refs = kcalloc(num_ctrl_refs, sizeof(struct ctrl_ref), GFP_KERNEL);
-    if (ctrl_refs == NULL)
-    {
-        kfree(ctrl_devs);
-        printk(KERN_CRIT "Failed to allocate controller reference slots\n");
-        return -ENOMEM;
-    }
-
     // Set up character device creation
     err = alloc_chrdev_region(&dev_first, 0, num_ctrl_devs, DRIVER_NAME);
     if (err < 0)
     {
-        kfree(ctrl_refs);
         kfree(ctrl_devs);
         printk(KERN_CRIT "Failed to allocate chrdev region\n");
         return err;
@@ -479,7 +509,6 @@ static int __init disnvme_entry(void)
     if (IS_ERR(dev_class))
     {
         unregister_chrdev_region(dev_first, num_ctrl_devs);
-        kfree(ctrl_refs);
         kfree(ctrl_devs);
         printk(KERN_CRIT "Failed to create chrdev class\n");
         return PTR_ERR(dev_class);
@@ -497,14 +526,13 @@ static int __init disnvme_entry(void)
     {
         class_destroy(dev_class);
         unregister_chrdev_region(dev_first, num_ctrl_devs);
-        kfree(ctrl_refs);
         kfree(ctrl_devs);
         printk(KERN_CRIT "Failed to register as PCI driver\n");
         return err;
     }
 
-    printk(KERN_DEBUG KBUILD_MODNAME " loaded (num_ctrl_devs=%d num_ctrl_refs=%ld max_pages_per_map=%ld)\n",
-            num_ctrl_devs, num_ctrl_refs, max_pages_per_map);
+    printk(KERN_DEBUG KBUILD_MODNAME " loaded (num_ctrl_devs=%d max_pages_per_map=%ld)\n",
+            num_ctrl_devs, max_pages_per_map);
 
     return 0;
 }
@@ -519,7 +547,6 @@ static void __exit disnvme_exit(void)
 
     // FIXME: Should we loop through devs and refs here?
 
-    kfree(ctrl_refs);
     kfree(ctrl_devs);
 
     printk(KERN_DEBUG KBUILD_MODNAME " unloaded\n");
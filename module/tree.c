@@ -0,0 +1,115 @@
+#include "tree.h"
+#include <linux/types.h>
+#include <linux/rbtree.h>
+#include <asm/errno.h>
+
+
+#define to_node(rb)     rb_entry((rb), struct map_tree_node, rb_node)
+
+
+void map_tree_init(struct map_tree* tree)
+{
+    tree->root = RB_ROOT;
+    tree->count = 0;
+}
+
+
+void map_tree_node_init(void* node, u64 vaddr, u64 size)
+{
+    struct map_tree_node* ptr = (struct map_tree_node*) node;
+
+    RB_CLEAR_NODE(&ptr->rb_node);
+    ptr->tree = NULL;
+    ptr->vaddr = vaddr;
+    ptr->size = size;
+}
+
+
+long map_tree_insert(struct map_tree* tree, void* node)
+{
+    struct map_tree_node* insert = (struct map_tree_node*) node;
+    struct rb_node** link = &tree->root.rb_node;
+    struct rb_node* parent = NULL;
+    struct map_tree_node* curr;
+
+    // Descend to a leaf, rejecting ranges that overlap
+    while (*link != NULL)
+    {
+        parent = *link;
+        curr = to_node(parent);
+
+        if (insert->vaddr + insert->size <= curr->vaddr)
+        {
+            link = &parent->rb_left;
+        }
+        else if (curr->vaddr + curr->size <= insert->vaddr)
+        {
+            link = &parent->rb_right;
+        }
+        else
+        {
+            return -EEXIST;
+        }
+    }
+
+    rb_link_node(&insert->rb_node, parent, link);
+    rb_insert_color(&insert->rb_node, &tree->root);
+    insert->tree = tree;
+    tree->count++;
+
+    return 0;
+}
+
+
+void* map_tree_find(struct map_tree* tree, u64 vaddr)
+{
+    struct rb_node* ptr = tree->root.rb_node;
+    struct map_tree_node* curr;
+
+    while (ptr != NULL)
+    {
+        curr = to_node(ptr);
+
+        if (vaddr < curr->vaddr)
+        {
+            ptr = ptr->rb_left;
+        }
+        else if (vaddr >= curr->vaddr + curr->size)
+        {
+            ptr = ptr->rb_right;
+        }
+        else
+        {
+            return curr;
+        }
+    }
+
+    return NULL;
+}
+
+
+void* map_tree_first(struct map_tree* tree)
+{
+    struct rb_node* first = rb_first(&tree->root);
+
+    if (first == NULL)
+    {
+        return NULL;
+    }
+
+    return to_node(first);
+}
+
+
+void map_tree_remove(void* node)
+{
+    struct map_tree_node* ptr = (struct map_tree_node*) node;
+
+    if (ptr->tree != NULL)
+    {
+        rb_erase(&ptr->rb_node, &ptr->tree->root);
+        RB_CLEAR_NODE(&ptr->rb_node);
+        ptr->tree->count--;
+        ptr->tree = NULL;
+    }
+}
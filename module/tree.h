@@ -0,0 +1,72 @@
+#ifndef __DIS_NVM_MODULE_TREE_H__
+#define __DIS_NVM_MODULE_TREE_H__
+
+#include <linux/types.h>
+#include <linux/rbtree.h>
+
+
+/*
+ * Index of non-overlapping virtual address ranges.
+ *
+ * Ranges are kept in a red-black tree sorted by start address, so that
+ * insertion, removal and lookup by any address within a range is O(log n).
+ * Only depends on the kernel's rbtree implementation, so that it can also
+ * be built in userspace.
+ */
+struct map_tree
+{
+    struct rb_root                  root;           /* Root of the tree */
+    unsigned long                   count;          /* Number of ranges in the tree */
+};
+
+
+/*
+ * Put this in the top of a struct.
+ */
+struct map_tree_node
+{
+    struct rb_node                  rb_node;        /* Red-black tree node */
+    struct map_tree*                tree;           /* Tree the node is inserted into (NULL if not inserted) */
+    u64                             vaddr;          /* Start of virtual address range */
+    u64                             size;           /* Size of virtual address range */
+};
+
+
+/*
+ * Initialize an empty tree.
+ */
+void map_tree_init(struct map_tree* tree);
+
+
+/*
+ * Initialize the tree portion of the node.
+ */
+void map_tree_node_init(void* node, u64 vaddr, u64 size);
+
+
+/*
+ * Insert the node into the tree.
+ * Returns -EEXIST if the range overlaps with a range already in the tree.
+ */
+long map_tree_insert(struct map_tree* tree, void* node);
+
+
+/*
+ * Find the node whose range contains the address and return it.
+ */
+void* map_tree_find(struct map_tree* tree, u64 vaddr);
+
+
+/*
+ * Get the node with the lowest address, or NULL if the tree is empty.
+ */
+void* map_tree_first(struct map_tree* tree);
+
+
+/*
+ * Remove the node from the tree it is inserted into.
+ */
+void map_tree_remove(void* node);
+
+
+#endif /* __DIS_NVM_MODULE_TREE_H__ */
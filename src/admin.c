@@ -8,12 +8,15 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include "admin.h"
+#include "identify.h"
 #include "rpc.h"
 #include "regs.h"
 #include "util.h"
+#include "wait.h"
 #include "dprintf.h"
 
 
@@ -24,7 +27,7 @@ void _nvm_admin_cq_create(nvm_cmd_t* cmd, const nvm_queue_t* cq)
     nvm_cmd_data_ptr(cmd, cq->ioaddr, 0);
 
     cmd->dword[10] = (((uint32_t) cq->max_entries - 1) << 16) | cq->no;
-    cmd->dword[11] = (0x0000 << 16) | (0x00 << 1) | 0x01;
+    cmd->dword[11] = (0x0000 << 16) | (0x00 << 1) | !!cq->contiguous;
 }
 
 
@@ -35,7 +38,45 @@ void _nvm_admin_sq_create(nvm_cmd_t* cmd, const nvm_queue_t* sq, const nvm_queue
     nvm_cmd_data_ptr(cmd, sq->ioaddr, 0);
 
     cmd->dword[10] = (((uint32_t) sq->max_entries - 1) << 16) | sq->no;
-    cmd->dword[11] = (((uint32_t) cq->no) << 16) | (0x00 << 1) | 0x01;
+    cmd->dword[11] = (((uint32_t) cq->no) << 16) | (0x00 << 1) | !!sq->contiguous;
+}
+
+
+
+void _nvm_admin_sq_delete(nvm_cmd_t* cmd, const nvm_queue_t* sq)
+{
+    nvm_cmd_header(cmd, NVM_ADMIN_DELETE_SUBMISSION_QUEUE, 0);
+    nvm_cmd_data_ptr(cmd, 0, 0);
+
+    cmd->dword[10] = sq->no;
+}
+
+
+
+void _nvm_admin_cq_delete(nvm_cmd_t* cmd, const nvm_queue_t* cq)
+{
+    nvm_cmd_header(cmd, NVM_ADMIN_DELETE_COMPLETION_QUEUE, 0);
+    nvm_cmd_data_ptr(cmd, 0, 0);
+
+    cmd->dword[10] = cq->no;
+}
+
+
+
+void _nvm_admin_abort(nvm_cmd_t* cmd, uint16_t sq_no, uint16_t cid)
+{
+    nvm_cmd_header(cmd, NVM_ADMIN_ABORT, 0);
+    nvm_cmd_data_ptr(cmd, 0, 0);
+
+    cmd->dword[10] = (((uint32_t) cid) << 16) | sq_no;
+}
+
+
+
+void _nvm_admin_dbbuf_config(nvm_cmd_t* cmd, uint64_t shadow_ioaddr, uint64_t event_ioaddr)
+{
+    nvm_cmd_header(cmd, NVM_ADMIN_DOORBELL_BUFFER_CONFIG, 0);
+    nvm_cmd_data_ptr(cmd, shadow_ioaddr, event_ioaddr);
 }
 
 
@@ -73,6 +114,17 @@ void _nvm_admin_identify_ns(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t ioaddr)
 
 
 
+void _nvm_admin_identify_ns_list(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t ioaddr)
+{
+    nvm_cmd_header(cmd, NVM_ADMIN_IDENTIFY, ns_id);
+    nvm_cmd_data_ptr(cmd, ioaddr, 0);
+
+    cmd->dword[10] = (0 << 16) | 0x02;
+    cmd->dword[11] = 0;
+}
+
+
+
 int nvm_admin_ctrl_info(nvm_aq_ref ref, struct nvm_ctrl_info* info, void* ptr, uint64_t ioaddr)
 {
     nvm_cmd_t command;
@@ -106,18 +158,17 @@ int nvm_admin_ctrl_info(nvm_aq_ref ref, struct nvm_ctrl_info* info, void* ptr, u
         return err;
     }
 
-    const unsigned char* bytes = (const unsigned char*) ptr;
-    memcpy(info->pci_vendor, bytes, 4);
-    memcpy(info->serial_no, bytes + 4, 20);
-    memcpy(info->model_no, bytes + 24, 40);
-    memcpy(info->firmware, bytes + 64, 8);
+    _nvm_identify_ctrl(info, ptr);
 
+    const unsigned char* bytes = (const unsigned char*) ptr;
     info->max_data_size = (1UL << bytes[77]) * (1UL << (12 + CAP$MPSMIN(ctrl->mm_ptr)));
     info->max_data_pages = info->max_data_size / info->page_size;
-    info->sq_entry_size = 1 << _RB(bytes[512], 3, 0);
-    info->cq_entry_size = 1 << _RB(bytes[513], 3, 0);
-    info->max_out_cmds = *((uint16_t*) (bytes + 514));
-    info->max_n_ns = *((uint32_t*) (bytes + 516));
+
+    // MAXCMD is optional, the limit is then what a single queue can hold
+    if (info->max_out_cmds == 0)
+    {
+        info->max_out_cmds = ctrl->max_entries - 1;
+    }
 
     return NVM_ERR_PACK(NULL, 0);
 }
@@ -150,23 +201,124 @@ int nvm_admin_ns_info(nvm_aq_ref ref, struct nvm_ns_info* info, uint32_t ns_id,
         return err;
     }
     
-    const unsigned char* bytes = (const unsigned char*) ptr;
-    info->size = *((uint64_t*) ptr);
-    info->capacity = *((uint64_t*) (ptr + 8));
-    info->utilization = *((uint64_t*) (ptr + 16));
+    _nvm_identify_ns(info, ptr);
+
+    return NVM_ERR_PACK(NULL, 0);
+}
+
+
+
+int nvm_admin_ns_list(nvm_aq_ref ref, uint32_t ns_id, uint32_t* ns_ids, size_t* n_ns, void* ptr, uint64_t ioaddr)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+
+    if (ns_ids == NULL || n_ns == NULL || ptr == NULL || ioaddr == 0)
+    {
+        return NVM_ERR_PACK(NULL, EINVAL);
+    }
+
+    memset(&command, 0, sizeof(command));
+    memset(&completion, 0, sizeof(completion));
+    memset(ptr, 0, 0x1000);
 
-    uint8_t format_idx = _RB(bytes[26], 3, 0);
+    _nvm_admin_identify_ns_list(&command, ns_id, ioaddr);
+
+    int err = nvm_raw_rpc(ref, &command, &completion);
+    if (!nvm_ok(err))
+    {
+        dprintf("Identify active namespace list failed: %s\n", nvm_strerror(err));
+        *n_ns = 0;
+        return err;
+    }
 
-    uint32_t lba_format = *((uint32_t*) (bytes + 128 + sizeof(uint32_t) * format_idx));
-    info->lba_data_size = 1 << _RB(lba_format, 23, 16);
-    info->metadata_size = _RB(lba_format, 15, 0);
+    *n_ns = _nvm_identify_ns_list(ns_ids, *n_ns, ptr);
 
     return NVM_ERR_PACK(NULL, 0);
 }
 
 
 
-int nvm_admin_cq_create(nvm_aq_ref ref, nvm_queue_t* cq, uint16_t id, void* vaddr, uint64_t ioaddr)
+/*
+ * Helper function to set up a queue descriptor for queue memory described
+ * by a DMA descriptor. If the queue pages are not physically contiguous,
+ * a PRP list describing the queue is written to the page following the
+ * queue memory. The list is not chained, so it must fit in that page.
+ */
+static int prepare_queue(nvm_queue_t* queue, const nvm_ctrl_t* ctrl, bool cq, uint16_t id, const nvm_dma_t* dma, size_t page_offset, size_t qs)
+{
+    size_t entry_size = cq ? sizeof(nvm_cpl_t) : sizeof(nvm_cmd_t);
+
+    if (dma == NULL || dma->page_size != ctrl->page_size)
+    {
+        return EINVAL;
+    }
+
+    if (qs == 0)
+    {
+        qs = ctrl->page_size / entry_size;
+    }
+
+    qs = _MIN(qs, ctrl->max_entries);
+    if (qs < 2)
+    {
+        return EINVAL;
+    }
+
+    size_t n_pages = NVM_CTRL_PAGES(ctrl, qs * entry_size);
+    if (page_offset + n_pages > dma->n_ioaddrs)
+    {
+        dprintf("Queue memory is too small for %zu entries\n", qs);
+        return EINVAL;
+    }
+
+    bool contiguous = true;
+    for (size_t i_page = 1; i_page < n_pages && contiguous; ++i_page)
+    {
+        contiguous = dma->ioaddrs[page_offset + i_page] == dma->ioaddrs[page_offset + i_page - 1] + dma->page_size;
+    }
+
+    void* vaddr = dma->vaddr != NULL ? NVM_DMA_OFFSET(dma, page_offset) : NULL;
+    uint64_t ioaddr = dma->ioaddrs[page_offset];
+
+    if (!contiguous)
+    {
+        if (CAP$CQR(ctrl->mm_ptr))
+        {
+            dprintf("Controller requires physically contiguous queue memory\n");
+            return EINVAL;
+        }
+
+        if (dma->vaddr == NULL || page_offset + n_pages >= dma->n_ioaddrs)
+        {
+            dprintf("Queue memory is not physically contiguous and no PRP list page is available\n");
+            return EINVAL;
+        }
+
+        if (n_pages > dma->page_size / sizeof(uint64_t))
+        {
+            dprintf("Queue memory is not physically contiguous and too large for a single PRP list page\n");
+            return EINVAL;
+        }
+
+        uint64_t* list = (uint64_t*) NVM_DMA_OFFSET(dma, page_offset + n_pages);
+        memset(list, 0, dma->page_size);
+        for (size_t i_page = 0; i_page < n_pages; ++i_page)
+        {
+            list[i_page] = dma->ioaddrs[page_offset + i_page];
+        }
+
+        ioaddr = dma->ioaddrs[page_offset + n_pages];
+    }
+
+    nvm_queue_clear(queue, ctrl, cq, id, qs, vaddr, ioaddr);
+    queue->contiguous = contiguous;
+    return 0;
+}
+
+
+
+int nvm_admin_cq_create(nvm_aq_ref ref, nvm_queue_t* cq, uint16_t id, const nvm_dma_t* dma, size_t page_offset, size_t qs)
 {
     nvm_cmd_t command;
     nvm_cpl_t completion;
@@ -176,16 +328,20 @@ int nvm_admin_cq_create(nvm_aq_ref ref, nvm_queue_t* cq, uint16_t id, void* vadd
 
     if (id == 0)
     {
-        return EINVAL;
+        return NVM_ERR_PACK(NULL, EINVAL);
     }
 
-    nvm_queue_clear(&queue, ctrl, true, id, vaddr, ioaddr);
+    int err = prepare_queue(&queue, ctrl, true, id, dma, page_offset, qs);
+    if (err != 0)
+    {
+        return err;
+    }
 
     memset(&command, 0, sizeof(command));
     memset(&completion, 0, sizeof(completion));
     _nvm_admin_cq_create(&command, &queue);
 
-    int err = nvm_raw_rpc(ref, &command, &completion);
+    err = nvm_raw_rpc(ref, &command, &completion);
     if (!nvm_ok(err))
     {
         dprintf("Creating completion queue failed: %s\n", nvm_strerror(err));
@@ -198,7 +354,7 @@ int nvm_admin_cq_create(nvm_aq_ref ref, nvm_queue_t* cq, uint16_t id, void* vadd
 
 
 
-int nvm_admin_sq_create(nvm_aq_ref ref, nvm_queue_t* sq, const nvm_queue_t* cq, uint16_t id, void* vaddr, uint64_t ioaddr)
+int nvm_admin_sq_create(nvm_aq_ref ref, nvm_queue_t* sq, const nvm_queue_t* cq, uint16_t id, const nvm_dma_t* dma, size_t page_offset, size_t qs)
 {
     nvm_cmd_t command;
     nvm_cpl_t completion;
@@ -208,16 +364,20 @@ int nvm_admin_sq_create(nvm_aq_ref ref, nvm_queue_t* sq, const nvm_queue_t* cq,
 
     if (id == 0)
     {
-        return EINVAL;
+        return NVM_ERR_PACK(NULL, EINVAL);
     }
 
-    nvm_queue_clear(&queue, ctrl, false, id, vaddr, ioaddr);
+    int err = prepare_queue(&queue, ctrl, false, id, dma, page_offset, qs);
+    if (err != 0)
+    {
+        return err;
+    }
 
     memset(&command, 0, sizeof(command));
     memset(&completion, 0, sizeof(completion));
     _nvm_admin_sq_create(&command, &queue, cq);
 
-    int err = nvm_raw_rpc(ref, &command, &completion);
+    err = nvm_raw_rpc(ref, &command, &completion);
     if (!nvm_ok(err))
     {
         dprintf("Creating submission queue failed: %s\n", nvm_strerror(err));
@@ -230,6 +390,388 @@ int nvm_admin_sq_create(nvm_aq_ref ref, nvm_queue_t* sq, const nvm_queue_t* cq,
 
 
 
+int nvm_admin_qp_create(nvm_aq_ref ref, nvm_queue_t* cq, const nvm_dma_t* cq_dma, size_t cq_offset, nvm_queue_t* sq, const nvm_dma_t* sq_dma, size_t sq_offset, size_t qs)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+    nvm_queue_t cq_queue;
+    nvm_queue_t sq_queue;
+
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+
+    int err = prepare_queue(&cq_queue, ctrl, true, 0, cq_dma, cq_offset, qs);
+    if (err != 0)
+    {
+        return NVM_ERR_PACK(NULL, err);
+    }
+
+    // Queue identifier 0 makes the admin queue owner pick one for us
+    memset(&command, 0, sizeof(command));
+    memset(&completion, 0, sizeof(completion));
+    _nvm_admin_cq_create(&command, &cq_queue);
+
+    err = nvm_raw_rpc(ref, &command, &completion);
+    if (!nvm_ok(err))
+    {
+        dprintf("Allocating completion queue failed: %s\n", nvm_strerror(err));
+        return err;
+    }
+
+    uint16_t id = _RB(completion.dword[0], 15, 0);
+    bool contiguous = cq_queue.contiguous;
+    nvm_queue_clear(&cq_queue, ctrl, true, id, cq_queue.max_entries, (void*) cq_queue.vaddr, cq_queue.ioaddr);
+    cq_queue.contiguous = contiguous;
+
+    err = prepare_queue(&sq_queue, ctrl, false, id, sq_dma, sq_offset, qs);
+    if (err == 0)
+    {
+        memset(&command, 0, sizeof(command));
+        memset(&completion, 0, sizeof(completion));
+        _nvm_admin_sq_create(&command, &sq_queue, &cq_queue);
+
+        err = nvm_raw_rpc(ref, &command, &completion);
+        if (!nvm_ok(err))
+        {
+            dprintf("Creating submission queue failed: %s\n", nvm_strerror(err));
+        }
+    }
+
+    if (!nvm_ok(err))
+    {
+        // Give queue identifier back
+        memset(&command, 0, sizeof(command));
+        memset(&completion, 0, sizeof(completion));
+        _nvm_admin_cq_delete(&command, &cq_queue);
+        nvm_raw_rpc(ref, &command, &completion);
+        return NVM_ERR_PACK(NULL, err);
+    }
+
+    *cq = cq_queue;
+    *sq = sq_queue;
+    return NVM_ERR_PACK(NULL, 0);
+}
+
+
+
+int nvm_admin_qp_delete(nvm_aq_ref ref, const nvm_queue_t* sq, const nvm_queue_t* cq)
+{
+    // SQ must be deleted before the CQ
+    int err = nvm_admin_sq_delete(ref, sq);
+    if (!nvm_ok(err))
+    {
+        return err;
+    }
+
+    return nvm_admin_cq_delete(ref, cq);
+}
+
+
+
+int nvm_admin_sq_delete(nvm_aq_ref ref, const nvm_queue_t* sq)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+
+    if (sq == NULL || sq->no == 0)
+    {
+        return NVM_ERR_PACK(NULL, EINVAL);
+    }
+
+    memset(&command, 0, sizeof(command));
+    memset(&completion, 0, sizeof(completion));
+    _nvm_admin_sq_delete(&command, sq);
+
+    int err = nvm_raw_rpc(ref, &command, &completion);
+    if (!nvm_ok(err))
+    {
+        dprintf("Deleting submission queue failed: %s\n", nvm_strerror(err));
+        return err;
+    }
+
+    return NVM_ERR_PACK(NULL, 0);
+}
+
+
+
+int nvm_admin_cq_delete(nvm_aq_ref ref, const nvm_queue_t* cq)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+
+    if (cq == NULL || cq->no == 0)
+    {
+        return NVM_ERR_PACK(NULL, EINVAL);
+    }
+
+    memset(&command, 0, sizeof(command));
+    memset(&completion, 0, sizeof(completion));
+    _nvm_admin_cq_delete(&command, cq);
+
+    int err = nvm_raw_rpc(ref, &command, &completion);
+    if (!nvm_ok(err))
+    {
+        dprintf("Deleting completion queue failed: %s\n", nvm_strerror(err));
+        return err;
+    }
+
+    return NVM_ERR_PACK(NULL, 0);
+}
+
+
+
+int nvm_admin_abort(nvm_aq_ref ref, uint16_t sq_no, uint16_t cid, bool* aborted)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+
+    memset(&command, 0, sizeof(command));
+    memset(&completion, 0, sizeof(completion));
+    _nvm_admin_abort(&command, sq_no, cid);
+
+    int err = nvm_raw_rpc(ref, &command, &completion);
+    if (!nvm_ok(err))
+    {
+        dprintf("Aborting command failed: %s\n", nvm_strerror(err));
+        return err;
+    }
+
+    // Bit 0 of DWORD 0 is cleared if the command was aborted
+    if (aborted != NULL)
+    {
+        *aborted = !_RB(completion.dword[0], 0, 0);
+    }
+
+    return NVM_ERR_PACK(NULL, 0);
+}
+
+
+
+int nvm_admin_dbbuf_config(nvm_aq_ref ref, const nvm_dma_t* dma, size_t page_offset)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+
+    // Both buffers are one memory page (CC.MPS) large
+    if (dma == NULL || dma->page_size != ctrl->page_size || dma->n_ioaddrs < page_offset + 2)
+    {
+        return NVM_ERR_PACK(NULL, EINVAL);
+    }
+
+    memset(&command, 0, sizeof(command));
+    memset(&completion, 0, sizeof(completion));
+    _nvm_admin_dbbuf_config(&command, dma->ioaddrs[page_offset], dma->ioaddrs[page_offset + 1]);
+
+    int err = nvm_raw_rpc(ref, &command, &completion);
+    if (!nvm_ok(err))
+    {
+        dprintf("Configuring doorbell buffer failed: %s\n", nvm_strerror(err));
+        return err;
+    }
+
+    return NVM_ERR_PACK(NULL, 0);
+}
+
+
+
+/*
+ * Helper function to execute a batch of admin commands, keeping as many 
+ * commands in flight as the ASQ allows. Remote references do not support 
+ * asynchronous commands, so commands are executed one at a time instead.
+ * If the ASQ is full of other users' commands, we wait for slots to free up.
+ * The status of each command is written to results.
+ */
+static int execute_batch(nvm_aq_ref ref, size_t n_cmds, nvm_cmd_t* cmds, int* results)
+{
+    nvm_cpl_t completion;
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+    size_t i_submit = 0;
+    size_t i_done = 0;
+    struct wait_state wait;
+    bool waiting = false;
+
+    uint16_t* cids = (uint16_t*) calloc(n_cmds, sizeof(uint16_t));
+    if (cids == NULL)
+    {
+        dprintf("Failed to allocate command identifiers: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    while (i_done < n_cmds)
+    {
+        // Fill up the ASQ
+        while (i_submit < n_cmds)
+        {
+            int status = nvm_admin_submit(ref, &cmds[i_submit], &cids[i_submit]);
+
+            if (status == EINVAL && i_submit == 0)
+            {
+                free(cids);
+
+                for (size_t i = 0; i < n_cmds; ++i)
+                {
+                    results[i] = nvm_raw_rpc(ref, &cmds[i], &completion);
+                }
+                return 0;
+            }
+
+            if (status == EAGAIN && i_submit == i_done)
+            {
+                // Queue is full of commands that are not ours, wait for their owners to complete them
+                if (!waiting)
+                {
+                    _nvm_wait_start(&wait, ctrl->timeout * 1000000UL);
+                    waiting = true;
+                }
+
+                if (_nvm_wait(&wait))
+                {
+                    continue;
+                }
+
+                status = ETIMEDOUT;
+            }
+            waiting = false;
+
+            if (status == EAGAIN)
+            {
+                break;
+            }
+            else if (status != 0)
+            {
+                results[i_submit++] = status;
+                ++i_done;
+                continue;
+            }
+
+            ++i_submit;
+        }
+
+        // Wait for the oldest outstanding command
+        if (i_done < i_submit)
+        {
+            results[i_done] = nvm_admin_poll(ref, cids[i_done], &completion, ctrl->timeout);
+            ++i_done;
+        }
+    }
+
+    free(cids);
+    return 0;
+}
+
+
+
+/*
+ * Helper function to create a batch of queues.
+ * If cqs is NULL, completion queues are created. Otherwise, submission queues
+ * are created and paired with the completion queues in cqs.
+ */
+static int create_queues(nvm_aq_ref ref, size_t n_queues, nvm_queue_t* queues, const nvm_queue_t* cqs, uint16_t first_id, const nvm_dma_t* dma, size_t page_offset, size_t stride, size_t qs)
+{
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(ref);
+    bool cq = cqs == NULL;
+    size_t entry_size = cq ? sizeof(nvm_cpl_t) : sizeof(nvm_cmd_t);
+    int err;
+
+    if (n_queues == 0 || first_id == 0 || first_id + n_queues - 1 > 0xffff)
+    {
+        return NVM_ERR_PACK(NULL, EINVAL);
+    }
+
+    nvm_queue_t* prepared = (nvm_queue_t*) calloc(n_queues, sizeof(nvm_queue_t));
+    nvm_cmd_t* cmds = (nvm_cmd_t*) calloc(n_queues, sizeof(nvm_cmd_t));
+    int* results = (int*) calloc(n_queues, sizeof(int));
+    if (prepared == NULL || cmds == NULL || results == NULL)
+    {
+        dprintf("Failed to allocate queue descriptors: %s\n", strerror(errno));
+        free(prepared);
+        free(cmds);
+        free(results);
+        return NVM_ERR_PACK(NULL, ENOMEM);
+    }
+
+    size_t offset = page_offset;
+    err = 0;
+    for (size_t i = 0; i < n_queues && err == 0; ++i)
+    {
+        err = prepare_queue(&prepared[i], ctrl, cq, first_id + i, dma, offset, qs);
+        if (err != 0)
+        {
+            break;
+        }
+
+        // Queues must not overlap, including the PRP list page
+        size_t n_pages = NVM_CTRL_PAGES(ctrl, prepared[i].max_entries * entry_size) + !prepared[i].contiguous;
+        if (stride != 0 && stride < n_pages)
+        {
+            dprintf("Queue stride is too small for queue %zu\n", i);
+            err = EINVAL;
+            break;
+        }
+
+        offset += stride != 0 ? stride : n_pages;
+
+        if (cq)
+        {
+            _nvm_admin_cq_create(&cmds[i], &prepared[i]);
+        }
+        else
+        {
+            _nvm_admin_sq_create(&cmds[i], &prepared[i], &cqs[i]);
+        }
+    }
+
+    if (err == 0)
+    {
+        err = execute_batch(ref, n_queues, cmds, results);
+    }
+
+    // Only update descriptors of queues that were actually created
+    for (size_t i = 0; i < n_queues && err == 0; ++i)
+    {
+        if (!nvm_ok(results[i]))
+        {
+            dprintf("Creating %s queue %u failed: %s\n", cq ? "completion" : "submission", 
+                    prepared[i].no, nvm_strerror(results[i]));
+            continue;
+        }
+
+        queues[i] = prepared[i];
+    }
+
+    // Report the first failed command
+    for (size_t i = 0; i < n_queues && err == 0; ++i)
+    {
+        err = results[i];
+    }
+
+    free(prepared);
+    free(cmds);
+    free(results);
+    return err;
+}
+
+
+
+int nvm_admin_cq_create_batch(nvm_aq_ref ref, size_t n_queues, nvm_queue_t* cqs, uint16_t first_id, const nvm_dma_t* dma, size_t page_offset, size_t stride, size_t qs)
+{
+    return create_queues(ref, n_queues, cqs, NULL, first_id, dma, page_offset, stride, qs);
+}
+
+
+
+int nvm_admin_sq_create_batch(nvm_aq_ref ref, size_t n_queues, nvm_queue_t* sqs, const nvm_queue_t* cqs, uint16_t first_id, const nvm_dma_t* dma, size_t page_offset, size_t stride, size_t qs)
+{
+    if (cqs == NULL)
+    {
+        return NVM_ERR_PACK(NULL, EINVAL);
+    }
+
+    return create_queues(ref, n_queues, sqs, cqs, first_id, dma, page_offset, stride, qs);
+}
+
+
+
 int nvm_admin_get_num_queues(nvm_aq_ref ref, uint16_t* n_cqs, uint16_t* n_sqs)
 {
     nvm_cmd_t command;
@@ -247,8 +789,8 @@ int nvm_admin_get_num_queues(nvm_aq_ref ref, uint16_t* n_cqs, uint16_t* n_sqs)
         return err;
     }
 
-    *n_sqs = (completion.dword[0] >> 16) + 1;
-    *n_cqs = (completion.dword[0] & 0xffff) + 1;
+    *n_sqs = (completion.dword[0] & 0xffff) + 1;
+    *n_cqs = (completion.dword[0] >> 16) + 1;
 
     return NVM_ERR_PACK(NULL, 0);
 }
@@ -284,8 +826,8 @@ int nvm_admin_request_num_queues(nvm_aq_ref ref, uint16_t* n_cqs, uint16_t* n_sq
         return err;
     }
 
-    *n_sqs = (completion.dword[0] >> 16) + 1;
-    *n_cqs = (completion.dword[0] & 0xffff) + 1;
+    *n_sqs = (completion.dword[0] & 0xffff) + 1;
+    *n_cqs = (completion.dword[0] >> 16) + 1;
 
     return NVM_ERR_PACK(NULL, 0);
 }
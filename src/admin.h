@@ -27,7 +27,7 @@ void _nvm_admin_sq_create(nvm_cmd_t* cmd, const nvm_queue_t* cq,  const nvm_queu
  *
  * Build an NVM admin command for deleting an SQ.
  */
-void _nvm_admin_sq_delete(nvm_cmd_t* cmd, const nvm_queue_t* cq, const nvm_queue_t* sq);
+void _nvm_admin_sq_delete(nvm_cmd_t* cmd, const nvm_queue_t* sq);
 
 
 
@@ -41,6 +41,26 @@ void _nvm_admin_cq_delete(nvm_cmd_t* cmd, const nvm_queue_t* cq);
 
 
 
+/*
+ * Abort command.
+ *
+ * Build an NVM admin command for aborting the command with the specified
+ * command identifier in the specified SQ.
+ */
+void _nvm_admin_abort(nvm_cmd_t* cmd, uint16_t sq_no, uint16_t cid);
+
+
+
+/*
+ * Doorbell buffer config.
+ *
+ * Build an NVM admin command for setting the shadow doorbell buffer and the
+ * EventIdx buffer.
+ */
+void _nvm_admin_dbbuf_config(nvm_cmd_t* cmd, uint64_t shadow_ioaddr, uint64_t event_ioaddr);
+
+
+
 /* 
  * Identify controller.
  *
@@ -57,6 +77,14 @@ void _nvm_admin_identify_ns(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t ioaddr);
 
 
 
+/*
+ * Identify active namespace list.
+ * Lists active namespace identifiers greater than ns_id.
+ */
+void _nvm_admin_identify_ns_list(nvm_cmd_t* cmd, uint32_t ns_id, uint64_t ioaddr);
+
+
+
 /*
  * Set/get current number of queues.
  */
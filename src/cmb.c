@@ -0,0 +1,121 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "cmb.h"
+#include "iova.h"
+#include "dma.h"
+#include "regs.h"
+#include "dprintf.h"
+
+
+
+int _nvm_cmb_create(struct cmb** handle, volatile void* mm_ptr, volatile void* bar_ptr, size_t bar_size, uint64_t bar_ioaddr)
+{
+    *handle = NULL;
+
+    if (CMBSZ$SZ(mm_ptr) == 0)
+    {
+        return ENOTSUP;
+    }
+
+    uint64_t unit = 0x1000ULL << (4 * CMBSZ$SZU(mm_ptr));
+    uint64_t offset = CMBLOC$OFST(mm_ptr) * unit;
+    uint64_t size = CMBSZ$SZ(mm_ptr) * unit;
+
+    if (bar_ptr == NULL || offset + size > bar_size)
+    {
+        dprintf("Controller memory buffer is outside mapped BAR\n");
+        return ENOTSUP;
+    }
+
+    struct cmb* cmb = (struct cmb*) malloc(sizeof(struct cmb));
+    if (cmb == NULL)
+    {
+        dprintf("Failed to allocate CMB descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    cmb->vaddr = (volatile void*) (((volatile unsigned char*) bar_ptr) + offset);
+    cmb->ioaddr = bar_ioaddr + offset;
+    cmb->size = size;
+    cmb->sqs = !!CMBSZ$SQS(mm_ptr);
+    cmb->lists = !!CMBSZ$LISTS(mm_ptr);
+
+    int err = _nvm_iova_init(&cmb->alloc);
+    if (err != 0)
+    {
+        free(cmb);
+        return err;
+    }
+
+    err = _nvm_iova_add_range(&cmb->alloc, cmb->ioaddr, cmb->size);
+    if (err != 0)
+    {
+        _nvm_iova_destroy(&cmb->alloc);
+        free(cmb);
+        return err;
+    }
+
+    *handle = cmb;
+    return 0;
+}
+
+
+
+void _nvm_cmb_remove(struct cmb* cmb)
+{
+    if (cmb != NULL)
+    {
+        _nvm_iova_destroy(&cmb->alloc);
+        free(cmb);
+    }
+}
+
+
+
+int _nvm_cmb_alloc(struct cmb_mapping** handle, struct cmb* cmb, size_t page_size, size_t n_pages)
+{
+    *handle = NULL;
+
+    if (!cmb->sqs && !cmb->lists)
+    {
+        dprintf("Controller memory buffer can not be used for queues or PRP lists\n");
+        return ENOTSUP;
+    }
+
+    struct cmb_mapping* md = (struct cmb_mapping*) malloc(sizeof(struct cmb_mapping));
+    if (md == NULL)
+    {
+        dprintf("Failed to allocate mapping descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    int err = _nvm_iova_alloc(&cmb->alloc, page_size * n_pages, page_size, &md->ioaddr);
+    if (err != 0)
+    {
+        dprintf("Not enough free controller memory buffer space\n");
+        free(md);
+        return err;
+    }
+
+    md->mapping.vaddr = (void*) (((volatile unsigned char*) cmb->vaddr) + (md->ioaddr - cmb->ioaddr));
+    md->mapping.page_size = page_size;
+    md->mapping.n_pages = n_pages;
+    md->cmb = cmb;
+
+    *handle = md;
+    return 0;
+}
+
+
+
+void _nvm_cmb_free(struct cmb_mapping* md)
+{
+    _nvm_iova_free(&md->cmb->alloc, md->ioaddr, md->mapping.page_size * md->mapping.n_pages);
+    free(md);
+}
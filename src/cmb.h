@@ -0,0 +1,78 @@
+#ifndef __NVM_INTERNAL_CMB_H__
+#define __NVM_INTERNAL_CMB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "iova.h"
+#include "dma.h"
+
+
+
+/*
+ * Controller memory buffer (CMB) descriptor.
+ *
+ * Describes the part of a controller BAR that is reported by CMBLOC and
+ * CMBSZ, and keeps track of which bus address ranges are in use.
+ */
+struct cmb
+{
+    volatile void*          vaddr;      // Mapped controller memory buffer
+    uint64_t                ioaddr;     // Bus address of controller memory buffer
+    size_t                  size;       // Size of controller memory buffer
+    bool                    sqs;        // Submission queues are supported
+    bool                    lists;      // PRP lists are supported
+    struct iova_allocator   alloc;      // Allocator of bus address ranges
+};
+
+
+
+/*
+ * CMB mapping descriptor.
+ * Describes memory allocated from a controller memory buffer.
+ */
+struct cmb_mapping
+{
+    struct dma_map          mapping;    // DMA mapping descriptor
+    struct cmb*             cmb;        // Controller memory buffer memory is allocated from
+    uint64_t                ioaddr;     // Bus address of the first page
+};
+
+
+
+/*
+ * Discover controller memory buffer from the controller registers.
+ *
+ * mm_ptr points to the controller registers, while bar_ptr and bar_ioaddr
+ * are the mapped address and bus address of the BAR indicated by CMBLOC.BIR.
+ * Returns ENOTSUP if the controller does not have a CMB, or if the CMB does
+ * not fit within the mapped BAR.
+ */
+int _nvm_cmb_create(struct cmb** cmb, volatile void* mm_ptr, volatile void* bar_ptr, size_t bar_size, uint64_t bar_ioaddr);
+
+
+
+/*
+ * Release controller memory buffer descriptor.
+ * All CMB mappings must be removed before calling this.
+ */
+void _nvm_cmb_remove(struct cmb* cmb);
+
+
+
+/*
+ * Allocate memory from the controller memory buffer.
+ * Memory is allocated as one contiguous range aligned to page_size.
+ */
+int _nvm_cmb_alloc(struct cmb_mapping** md, struct cmb* cmb, size_t page_size, size_t n_pages);
+
+
+
+/*
+ * Release memory allocated from the controller memory buffer.
+ */
+void _nvm_cmb_free(struct cmb_mapping* md);
+
+
+
+#endif /* __NVM_INTERNAL_CMB_H__ */
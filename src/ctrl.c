@@ -17,12 +17,19 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <stdio.h>
 #include "dis/device.h"
 #include "dis/map.h"
 #include "ctrl.h"
+#include "vfio.h"
+#include "cmb.h"
+#include "ioctl.h"
 #include "util.h"
+#include "wait.h"
 #include "regs.h"
 #include "dprintf.h"
 
@@ -40,7 +47,9 @@ enum device_type
 {
     _DEVICE_TYPE_UNKNOWN        = 0x00, // Device is mapped manually by the user
     _DEVICE_TYPE_SYSFS          = 0x01, // Device is mapped through file descriptor
-    _DEVICE_TYPE_SMARTIO        = 0x04  // Device is mapped by SISCI SmartIO API
+    _DEVICE_TYPE_EMULATED       = 0x02, // Device is emulated in process memory
+    _DEVICE_TYPE_SMARTIO        = 0x04, // Device is mapped by SISCI SmartIO API
+    _DEVICE_TYPE_VFIO           = 0x08  // Device is mapped through VFIO
 };
 
 
@@ -53,6 +62,10 @@ struct controller
     enum device_type            type;   // Device type
     struct memory_reference*    ref;    // Reference to mapped BAR0
     int                         fd;     // File descriptor to memory mapping
+    struct vfio_device*         vfio;   // VFIO device (NULL if not used)
+    struct cmb*                 cmb;    // Controller memory buffer (NULL if not used)
+    volatile void*              cmb_bar;// Mapped BAR holding the CMB (NULL if not mapped by us)
+    size_t                      cmb_bar_size; // Size of mapped BAR holding the CMB
     nvm_ctrl_t                  handle; // User handle
 };
 
@@ -101,6 +114,52 @@ int _nvm_fd_from_ctrl(const nvm_ctrl_t* ctrl)
 
 
 
+/*
+ * Check if controller handle refers to an emulated controller.
+ */
+bool _nvm_ctrl_emulated(const nvm_ctrl_t* ctrl)
+{
+    return const_container(ctrl)->type == _DEVICE_TYPE_EMULATED;
+}
+
+
+/*
+ * Check if controller handle refers to a manually mapped controller.
+ */
+bool _nvm_ctrl_raw(const nvm_ctrl_t* ctrl)
+{
+    return const_container(ctrl)->type == _DEVICE_TYPE_UNKNOWN;
+}
+
+
+
+/*
+ * Look up VFIO device from controller handle.
+ */
+struct vfio_device* _nvm_vfio_from_ctrl(const nvm_ctrl_t* ctrl)
+{
+    const struct controller* container = const_container(ctrl);
+
+    if (container->type == _DEVICE_TYPE_VFIO)
+    {
+        return container->vfio;
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Look up controller memory buffer from controller handle.
+ */
+struct cmb* _nvm_cmb_from_ctrl(const nvm_ctrl_t* ctrl)
+{
+    return const_container(ctrl)->cmb;
+}
+
+
+
 #ifdef _SISCI
 /*
  * Look up device from controller handle.
@@ -136,6 +195,10 @@ static struct controller* create_container()
     container->type = _DEVICE_TYPE_UNKNOWN;
     container->fd = -1;
     container->ref = NULL;
+    container->vfio = NULL;
+    container->cmb = NULL;
+    container->cmb_bar = NULL;
+    container->cmb_bar_size = 0;
 
     return container;
 }
@@ -229,7 +292,7 @@ static int initialize_handle(nvm_ctrl_t* ctrl, volatile void* mm_ptr, size_t mm_
     ctrl->page_size = page_size;
     ctrl->dstrd = CAP$DSTRD(mm_ptr);
     ctrl->timeout = CAP$TO(mm_ptr) * 500UL;
-    ctrl->max_entries = CAP$MQES(mm_ptr) + 1; // CAP.MQES is 0's based
+    ctrl->max_entries = _MIN(CAP$MQES(mm_ptr) + 1, 0xffff); // CAP.MQES is 0's based
 
     return 0;
 }
@@ -244,18 +307,17 @@ int nvm_raw_ctrl_reset(const nvm_ctrl_t* ctrl, uint64_t acq_addr, uint64_t asq_a
     *cc = *cc & ~1;
 
     // Wait for CSTS.RDY to transition from 1 to 0
+    struct wait_state wait;
     uint64_t timeout = ctrl->timeout * 1000000UL;
-    uint64_t remaining = _nvm_delay_remain(timeout);
+    _nvm_wait_start(&wait, timeout);
 
     while (CSTS$RDY(ctrl->mm_ptr) != 0)
     {
-        if (remaining == 0)
+        if (!_nvm_wait(&wait))
         {
             dprintf("Timeout exceeded while waiting for controller reset\n");
             return ETIME;
         }
-
-        remaining = _nvm_delay_remain(remaining);
     }
 
     // Set admin queue attributes
@@ -279,17 +341,46 @@ int nvm_raw_ctrl_reset(const nvm_ctrl_t* ctrl, uint64_t acq_addr, uint64_t asq_a
     *cc = CC$IOCQES(cqes) | CC$IOSQES(sqes) | CC$MPS(encode_page_size(ctrl->page_size)) | CC$CSS(0) | CC$EN(1);
 
     // Wait for CSTS.RDY to transition from 0 to 1
-    remaining = _nvm_delay_remain(timeout);
+    _nvm_wait_start(&wait, timeout);
 
     while (CSTS$RDY(ctrl->mm_ptr) != 1)
     {
-        if (remaining == 0)
+        if (!_nvm_wait(&wait))
         {
             dprintf("Timeout exceeded while waiting for controller enable\n");
             return ETIME;
         }
+    }
+
+    return 0;
+}
+
+
+
+int nvm_raw_ctrl_shutdown(const nvm_ctrl_t* ctrl)
+{
+    volatile uint32_t* cc = CC(ctrl->mm_ptr);
+
+    if (CSTS$RDY(ctrl->mm_ptr) == 0)
+    {
+        // Controller is not enabled, nothing to shut down
+        return 0;
+    }
+
+    // Set CC.SHN to 01b (normal shutdown)
+    *cc = (*cc & ~CC$SHN(0x3)) | CC$SHN(0x1);
 
-        remaining = _nvm_delay_remain(remaining);
+    // Wait for CSTS.SHST to report that shutdown processing is complete
+    struct wait_state wait;
+    _nvm_wait_start(&wait, ctrl->timeout * 1000000UL);
+
+    while (CSTS$SHST(ctrl->mm_ptr) != 0x2)
+    {
+        if (!_nvm_wait(&wait))
+        {
+            dprintf("Timeout exceeded while waiting for controller shutdown\n");
+            return ETIME;
+        }
     }
 
     return 0;
@@ -323,6 +414,27 @@ int nvm_raw_ctrl_init(nvm_ctrl_t** ctrl, volatile void* mm_ptr, size_t mm_size)
 
 
 
+int _nvm_ctrl_init_emulated(nvm_ctrl_t** ctrl, volatile void* mm_ptr, size_t mm_size)
+{
+    int err = nvm_raw_ctrl_init(ctrl, mm_ptr, mm_size);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    container(*ctrl)->type = _DEVICE_TYPE_EMULATED;
+
+    // Emulated controllers use virtual addresses as bus addresses
+    if (CMBSZ$SZ(mm_ptr) != 0 && CMBLOC$BIR(mm_ptr) == 0)
+    {
+        _nvm_cmb_create(&container(*ctrl)->cmb, mm_ptr, mm_ptr, mm_size, (uint64_t) mm_ptr);
+    }
+
+    return 0;
+}
+
+
+
 #ifdef _SISCI
 int nvm_dis_ctrl_init(nvm_ctrl_t** ctrl, uint64_t dev_id, uint32_t adapter)
 {
@@ -372,6 +484,135 @@ int nvm_dis_ctrl_init(nvm_ctrl_t** ctrl, uint64_t dev_id, uint32_t adapter)
 
 
 
+/*
+ * Look up the bus address and size of BAR bir in the sysfs resource file of
+ * the PCI device whose resource<N> file fd refers to, and open the
+ * resource file of that BAR.
+ */
+static int sysfs_bar(int fd, uint32_t bir, uint64_t* ioaddr, size_t* size, int* bar_fd)
+{
+    char link[64];
+    char path[PATH_MAX];
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    unsigned long long flags = 0;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t len = readlink(link, path, sizeof(path) - 16);
+    if (len < 0)
+    {
+        return errno;
+    }
+    path[len] = '\0';
+
+    // File descriptor must refer to .../resource<N>
+    char* name = strrchr(path, '/');
+    if (name == NULL || strncmp(name, "/resource", 9) != 0 
+            || name[9] == '\0' || strspn(&name[9], "0123456789") != strlen(&name[9]))
+    {
+        return ENOTSUP;
+    }
+    name[9] = '\0';
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return errno;
+    }
+
+    // One line per resource: start, end and flags
+    for (uint32_t i = 0; i <= bir; ++i)
+    {
+        if (fscanf(fp, "%llx %llx %llx", &start, &end, &flags) != 3)
+        {
+            fclose(fp);
+            return ENOTSUP;
+        }
+    }
+    fclose(fp);
+
+    if (start == 0 || end <= start)
+    {
+        return ENOTSUP;
+    }
+
+    sprintf(&name[9], "%u", bir);
+    *bar_fd = open(path, O_RDWR);
+    if (*bar_fd < 0)
+    {
+        dprintf("Failed to open BAR resource file: %s\n", strerror(errno));
+        return errno;
+    }
+
+    *ioaddr = start;
+    *size = end - start + 1;
+    return 0;
+}
+
+
+
+/*
+ * Map the BAR holding the controller memory buffer of a controller opened
+ * through the kernel module or a sysfs resource file. The kernel module
+ * reports the BAR's bus address and maps it at an offset in the device file,
+ * while sysfs lists it in the device's resource file.
+ * The controller memory buffer is optional, so failing to map it is not an error.
+ */
+static void map_cmb(struct controller* container, int fd)
+{
+    volatile void* mm_ptr = container->handle.mm_ptr;
+    uint32_t bir = CMBLOC$BIR(mm_ptr);
+    struct nvm_ioctl_bar request;
+    uint64_t ioaddr;
+    size_t size;
+    int bar_fd = fd;
+    off_t offset = NVM_IOCTL_BAR_OFFSET(bir);
+
+    if (CMBSZ$SZ(mm_ptr) == 0)
+    {
+        return;
+    }
+
+    request.bir = bir;
+    if (ioctl(fd, NVM_GET_BAR, &request) == 0)
+    {
+        ioaddr = request.ioaddr;
+        size = request.size;
+    }
+    else if (sysfs_bar(fd, bir, &ioaddr, &size, &bar_fd) == 0)
+    {
+        offset = 0;
+    }
+    else
+    {
+        dprintf("Could not find bus address of controller memory buffer\n");
+        return;
+    }
+
+    void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FILE, bar_fd, offset);
+    if (bar_fd != fd)
+    {
+        close(bar_fd);
+    }
+
+    if (ptr == MAP_FAILED)
+    {
+        dprintf("Failed to map controller memory buffer: %s\n", strerror(errno));
+        return;
+    }
+
+    if (_nvm_cmb_create(&container->cmb, mm_ptr, ptr, size, ioaddr) != 0)
+    {
+        munmap(ptr, size);
+        return;
+    }
+
+    container->cmb_bar = ptr;
+    container->cmb_bar_size = size;
+}
+
+
+
 int nvm_ctrl_init(nvm_ctrl_t** ctrl, int filedes)
 {
     int err;
@@ -420,6 +661,55 @@ int nvm_ctrl_init(nvm_ctrl_t** ctrl, int filedes)
 
     container->fd = fd;
 
+    map_cmb(container, fd);
+
+    *ctrl = &container->handle;
+    return 0;
+}
+
+
+
+int nvm_vfio_ctrl_init(nvm_ctrl_t** ctrl, const char* pci_addr)
+{
+    int err;
+    *ctrl = NULL;
+
+    struct controller* container = create_container();
+    if (container == NULL)
+    {
+        return ENOMEM;
+    }
+
+    container->type = _DEVICE_TYPE_VFIO;
+
+    err = _nvm_vfio_open(&container->vfio, pci_addr);
+    if (err != 0)
+    {
+        free(container);
+        return err;
+    }
+
+    err = initialize_handle(&container->handle, container->vfio->bar, container->vfio->bar_size);
+    if (err != 0)
+    {
+        _nvm_vfio_close(container->vfio);
+        free(container);
+        return err;
+    }
+
+    // Controller memory buffer is optional, so failing to map it is not an error
+    if (CMBSZ$SZ(container->vfio->bar) != 0)
+    {
+        volatile void* bar_ptr;
+        size_t bar_size;
+        uint64_t bar_ioaddr;
+
+        if (_nvm_vfio_bar(container->vfio, CMBLOC$BIR(container->vfio->bar), &bar_ptr, &bar_size, &bar_ioaddr) == 0)
+        {
+            _nvm_cmb_create(&container->cmb, container->vfio->bar, bar_ptr, bar_size, bar_ioaddr);
+        }
+    }
+
     *ctrl = &container->handle;
     return 0;
 }
@@ -432,17 +722,28 @@ void nvm_ctrl_free(nvm_ctrl_t* ctrl)
     {
         struct controller* container = container(ctrl);
 
+        _nvm_cmb_remove(container->cmb);
+
         switch (container->type)
         {
             case _DEVICE_TYPE_UNKNOWN:
+            case _DEVICE_TYPE_EMULATED:
                 // Do nothing
                 break;
 
             case _DEVICE_TYPE_SYSFS:
+                if (container->cmb_bar != NULL)
+                {
+                    munmap((void*) container->cmb_bar, container->cmb_bar_size);
+                }
                 munmap((void*) ctrl->mm_ptr, ctrl->mm_size);
                 close(container->fd);
                 break;
 
+            case _DEVICE_TYPE_VFIO:
+                _nvm_vfio_close(container->vfio);
+                break;
+
 #if _SISCI
             case _DEVICE_TYPE_SMARTIO:
                 disconnect_register_memory(container->ref);
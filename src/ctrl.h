@@ -2,10 +2,14 @@
 #define __NVM_INTERNAL_CTRL_H__
 
 #include <nvm_types.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 
-/* Forward declaration */
+/* Forward declarations */
 struct device;
+struct vfio_device;
+struct cmb;
 
 
 
@@ -18,6 +22,47 @@ int _nvm_fd_from_ctrl(const nvm_ctrl_t* ctrl);
 
 
 
+/*
+ * Check if the controller handle refers to an emulated controller.
+ * Bus addresses of emulated controllers are virtual addresses.
+ */
+bool _nvm_ctrl_emulated(const nvm_ctrl_t* ctrl);
+
+
+
+/*
+ * Check if the controller handle refers to a controller mapped manually by
+ * the user, meaning that bus addresses are physical addresses.
+ */
+bool _nvm_ctrl_raw(const nvm_ctrl_t* ctrl);
+
+
+
+/*
+ * Initialize controller handle for an emulated controller.
+ */
+int _nvm_ctrl_init_emulated(nvm_ctrl_t** ctrl, volatile void* mm_ptr, size_t mm_size);
+
+
+
+/*
+ * Look up VFIO device from controller handle.
+ * Returns the VFIO device if the controller is mapped through VFIO, 
+ * or NULL if not used.
+ */
+struct vfio_device* _nvm_vfio_from_ctrl(const nvm_ctrl_t* ctrl);
+
+
+
+/*
+ * Look up controller memory buffer (CMB) from controller handle.
+ * Returns the CMB descriptor, or NULL if the controller does not have a
+ * CMB or it could not be mapped.
+ */
+struct cmb* _nvm_cmb_from_ctrl(const nvm_ctrl_t* ctrl);
+
+
+
 #ifdef _SISCI
 /*
  * Look up device reference from controller handle.
@@ -18,6 +18,8 @@
 #include <fcntl.h>
 #include "ctrl.h"
 #include "dma.h"
+#include "vfio.h"
+#include "cmb.h"
 #include "ioctl.h"
 #include "util.h"
 #include "regs.h"
@@ -68,12 +70,33 @@ struct ioctl_mapping
 
 
 
+/*
+ * Extent-based DMA handle container.
+ *
+ * Note that this structure is of variable size due to the list of extents
+ * at the end of the DMA handle.
+ */
+struct __attribute__((aligned (64))) dma_ext
+{
+    struct dma_map*         map;        // DMA mapping descriptor
+    dma_map_free_t          release;    // Free mapping descriptor
+    nvm_dma_ext_t           handle;     // Extent-based DMA mapping handle
+};
+
+
+
 /* Get handle container */
 #define container(m) \
     ((struct dma*) (((unsigned char*) (m)) - offsetof(struct dma, handle)))
 
 
 
+/* Get extent-based handle container */
+#define ext_container(m) \
+    ((struct dma_ext*) (((unsigned char*) (m)) - offsetof(struct dma_ext, handle)))
+
+
+
 /* Calculate number of controller pages */
 #define n_ctrl_pages(ctrl, page_size, n_pages) \
     (((page_size) * (n_pages)) / (ctrl)->page_size)
@@ -215,23 +238,300 @@ void nvm_dma_unmap(nvm_dma_t* handle)
 
 
 
+/*
+ * Create an extent-based DMA handle container.
+ *
+ * Adjacent runs that are contiguous in IO address space are merged into
+ * a single extent. If sizes is NULL, every run is a page of the mapping.
+ */
+int _nvm_dma_ext_create(nvm_dma_ext_t** handle, 
+                        const nvm_ctrl_t* ctrl, 
+                        struct dma_map* md, 
+                        dma_map_free_t release, 
+                        size_t n_runs, 
+                        const uint64_t* ioaddrs, 
+                        const size_t* sizes)
+{
+    size_t ctrl_page_size = ctrl->page_size;
+    size_t n_extents = 0;
+    uint64_t next = 0;
+    size_t i_run;
+
+    *handle = NULL;
+
+    // Count the number of extents after merging
+    for (i_run = 0; i_run < n_runs; ++i_run)
+    {
+        size_t size = sizes != NULL ? sizes[i_run] : md->page_size;
+
+        if (size == 0)
+        {
+            dprintf("Invalid run size\n");
+            return EINVAL;
+        }
+
+        if (n_extents == 0 || ioaddrs[i_run] != next)
+        {
+            ++n_extents;
+        }
+        next = ioaddrs[i_run] + size;
+    }
+
+    if (n_extents == 0)
+    {
+        return EINVAL;
+    }
+
+    struct dma_ext* container = (struct dma_ext*) malloc(sizeof(struct dma_ext) + n_extents * sizeof(nvm_dma_extent_t));
+    if (container == NULL)
+    {
+        dprintf("Failed to allocate DMA descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    nvm_dma_ext_t* ext = &container->handle;
+    size_t n_bytes = 0;
+    size_t i_ext = 0;
+
+    ext->extents[0].ioaddr = ioaddrs[0];
+    ext->extents[0].page = 0;
+
+    for (i_run = 0; i_run < n_runs; ++i_run)
+    {
+        size_t size = sizes != NULL ? sizes[i_run] : md->page_size;
+
+        if (i_run > 0 && ioaddrs[i_run] != next)
+        {
+            ext->extents[i_ext].n_pages = n_bytes / ctrl_page_size - ext->extents[i_ext].page;
+            ++i_ext;
+            ext->extents[i_ext].ioaddr = ioaddrs[i_run];
+            ext->extents[i_ext].page = n_bytes / ctrl_page_size;
+
+            if (n_bytes % ctrl_page_size != 0)
+            {
+                break;
+            }
+        }
+
+        n_bytes += size;
+        next = ioaddrs[i_run] + size;
+    }
+    ext->extents[i_ext].n_pages = n_bytes / ctrl_page_size - ext->extents[i_ext].page;
+
+    // Every extent must start and end on a controller page boundary
+    if (n_bytes % ctrl_page_size != 0 || i_run != n_runs)
+    {
+        free(container);
+        dprintf("Addresses do not align with controller pages\n");
+        return EINVAL;
+    }
+
+    // Extents must describe the entire mapping, and not a part of it
+    if (n_bytes != md->n_pages * md->page_size)
+    {
+        free(container);
+        dprintf("Extents cover %zu bytes of %zu byte mapping\n", n_bytes, md->n_pages * md->page_size);
+        return EFAULT;
+    }
+
+    for (i_ext = 0; i_ext < n_extents; ++i_ext)
+    {
+        if (ext->extents[i_ext].ioaddr & (ctrl_page_size - 1))
+        {
+            free(container);
+            dprintf("Addresses do not align with controller pages\n");
+            return EINVAL;
+        }
+    }
+
+    container->map = md;
+    container->release = release;
+    ext->vaddr = md->vaddr;
+    ext->page_size = ctrl_page_size;
+    ext->n_pages = n_bytes / ctrl_page_size;
+    ext->n_extents = n_extents;
+
+    *handle = ext;
+    return 0;
+}
+
+
+
+/*
+ * Free extent-based DMA handle.
+ */
+void _nvm_dma_ext_remove(nvm_dma_ext_t* handle)
+{
+    struct dma_ext* dma = ext_container(handle);
+
+    if (dma->release != NULL)
+    {
+        dma->release(dma->map);
+    }
+    free(dma);
+}
+
+
+
+/*
+ * Create extent-based DMA mapping descriptor from runs of contiguous memory.
+ */
+int nvm_dma_ext_map(nvm_dma_ext_t** handle, const nvm_ctrl_t* ctrl, void* vaddr, size_t n_runs, const uint64_t* ioaddrs, const size_t* sizes)
+{
+    int status;
+    size_t size = 0;
+    *handle = NULL;
+
+    if (n_runs == 0 || ioaddrs == NULL || sizes == NULL)
+    {
+        return EINVAL;
+    }
+
+    for (size_t i_run = 0; i_run < n_runs; ++i_run)
+    {
+        size += sizes[i_run];
+    }
+
+    struct dma_map* map = malloc(sizeof(struct dma_map));
+    if (map == NULL)
+    {
+        dprintf("Failed to allocate mapping descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    map->vaddr = vaddr;
+    map->page_size = ctrl->page_size;
+    map->n_pages = size / ctrl->page_size;
+
+    status = _nvm_dma_ext_create(handle, ctrl, map, (dma_map_free_t) free, n_runs, ioaddrs, sizes);
+    if (status != 0)
+    {
+        free(map);
+        return status;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Create DMA mapping descriptor for a range of an extent-based descriptor.
+ */
+int nvm_dma_ext_expand(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, const nvm_dma_ext_t* ext, size_t page_offset, size_t n_pages)
+{
+    *handle = NULL;
+
+    if (n_pages == 0 || page_offset + n_pages > ext->n_pages || ext->page_size != ctrl->page_size)
+    {
+        return EINVAL;
+    }
+
+    uint64_t* ioaddrs = calloc(n_pages, sizeof(uint64_t));
+    if (ioaddrs == NULL)
+    {
+        dprintf("Failed to allocate address list: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    size_t i_ext = nvm_dma_ext_find(ext, page_offset);
+    size_t i_page = page_offset - ext->extents[i_ext].page;
+
+    for (size_t i = 0; i < n_pages; ++i)
+    {
+        ioaddrs[i] = ext->extents[i_ext].ioaddr + i_page * ext->page_size;
+
+        if (++i_page == ext->extents[i_ext].n_pages)
+        {
+            ++i_ext;
+            i_page = 0;
+        }
+    }
+
+    void* vaddr = ext->vaddr != NULL ? NVM_DMA_OFFSET(ext, page_offset) : NULL;
+
+    int err = nvm_dma_map(handle, ctrl, vaddr, ext->page_size, n_pages, ioaddrs);
+    free(ioaddrs);
+    return err;
+}
+
+
+
+/*
+ * Remove extent-based DMA mapping descriptor.
+ */
+void nvm_dma_ext_unmap(nvm_dma_ext_t* handle)
+{
+    if (handle != NULL)
+    {
+        _nvm_dma_ext_remove(handle);
+    }
+}
+
+
+
+
+
+/*
+ * Helper function to lock host pages and retrieve IO address extents for a 
+ * virtual memory range. The kernel module maps the range in one go and 
+ * coalesces pages that are contiguous in IO address space, so the number of 
+ * extents is at most the number of pages.
+ */
+static int map_host_memory(struct ioctl_mapping* md, size_t* n_runs, uint64_t* ioaddrs, size_t* sizes)
+{
+    struct nvm_ioctl_extent* extents = calloc(md->mapping.n_pages, sizeof(struct nvm_ioctl_extent));
+    if (extents == NULL)
+    {
+        dprintf("Failed to allocate extent list: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    struct nvm_ioctl_map_host request = {
+        .vaddr_start = (uint64_t) md->mapping.vaddr,
+        .n_pages = md->mapping.n_pages,
+        .n_extents = md->mapping.n_pages,
+        .extents = extents
+    };
+
+    int err = ioctl(md->ioctl_fd, NVM_MAP_HOST_MEMORY, &request);
+    if (err < 0)
+    {
+        err = errno;
+        free(extents);
+        dprintf("Page mapping kernel request failed: %s\n", strerror(err));
+        return err;
+    }
+
+    md->mapped = true;
+
+    for (size_t i = 0; i < request.n_extents; ++i)
+    {
+        ioaddrs[i] = extents[i].ioaddr;
+        sizes[i] = extents[i].size;
+    }
+
+    *n_runs = request.n_extents;
+    free(extents);
+    return 0;
+}
+
+
+
 /*
  * Helper function to lock pages and retrieve IO addresses for a 
- * virtual memory range.
+ * virtual memory range. Address runs are written to ioaddrs and sizes, 
+ * which must have room for at least one entry per page.
  */
-static int map_memory(struct ioctl_mapping* md, uint64_t* ioaddrs)
+static int map_memory(struct ioctl_mapping* md, size_t* n_runs, uint64_t* ioaddrs, size_t* sizes)
 {
-    enum nvm_ioctl_type type;
-    
     switch (md->type)
     {
         case _MAP_TYPE_HOST:
-            type = NVM_MAP_HOST_MEMORY;
-            break;
+            return map_host_memory(md, n_runs, ioaddrs, sizes);
 
 #ifdef _CUDA
         case _MAP_TYPE_CUDA:
-            type = NVM_MAP_DEVICE_MEMORY;
             break;
 #endif
 
@@ -240,13 +540,14 @@ static int map_memory(struct ioctl_mapping* md, uint64_t* ioaddrs)
             return EINVAL;
     }
 
+#ifdef _CUDA
     struct nvm_ioctl_map request = {
         .vaddr_start = (uint64_t) md->mapping.vaddr,
         .n_pages = md->mapping.n_pages,
         .ioaddrs = ioaddrs
     };
 
-    int err = ioctl(md->ioctl_fd, type, &request);
+    int err = ioctl(md->ioctl_fd, NVM_MAP_DEVICE_MEMORY, &request);
     if (err < 0)
     {
         dprintf("Page mapping kernel request failed: %s\n", strerror(errno));
@@ -254,7 +555,15 @@ static int map_memory(struct ioctl_mapping* md, uint64_t* ioaddrs)
     }
     
     md->mapped = true;
+
+    for (size_t i = 0; i < md->mapping.n_pages; ++i)
+    {
+        sizes[i] = md->mapping.page_size;
+    }
+
+    *n_runs = md->mapping.n_pages;
     return 0;
+#endif
 }
 
 
@@ -347,22 +656,53 @@ static void remove_mapping(struct ioctl_mapping* md)
 
 /*
  * Helper function to map an address range and initialize DMA handle.
+ * Address runs are expanded into one IO address per page.
  */
 static int populate_handle(struct dma* container, const nvm_ctrl_t* ctrl)
 {
-    uint64_t* ioaddrs = calloc(container->map->n_pages, sizeof(uint64_t));
-    if (ioaddrs == NULL)
+    const struct dma_map* map = container->map;
+    size_t n_runs = 0;
+
+    uint64_t* ioaddrs = calloc(map->n_pages, sizeof(uint64_t));
+    size_t* sizes = calloc(map->n_pages, sizeof(size_t));
+    if (ioaddrs == NULL || sizes == NULL)
     {
+        free(ioaddrs);
+        free(sizes);
         return ENOMEM;
     }
 
-    int err = map_memory((struct ioctl_mapping*) container->map, ioaddrs);
+    int err = map_memory((struct ioctl_mapping*) container->map, &n_runs, ioaddrs, sizes);
     if (err != 0)
     {
         free(ioaddrs);
+        free(sizes);
         return err;
     }
 
+    // Expand in place, walking backwards so runs are not overwritten before they are read
+    size_t i_page = map->n_pages;
+    for (size_t i_run = n_runs; i_run > 0 && i_page > 0; --i_run)
+    {
+        uint64_t ioaddr = ioaddrs[i_run - 1];
+        size_t run_pages = sizes[i_run - 1] / map->page_size;
+
+        while (run_pages > 0 && i_page > 0)
+        {
+            --run_pages;
+            ioaddrs[--i_page] = ioaddr + run_pages * map->page_size;
+        }
+    }
+
+    free(sizes);
+
+    if (i_page != 0)
+    {
+        dprintf("Mapped address runs do not cover memory range\n");
+        free(ioaddrs);
+        return EIO;
+    }
+
     _nvm_dma_handle_populate(&container->handle, ctrl, ioaddrs);
     free(ioaddrs);
     
@@ -371,6 +711,84 @@ static int populate_handle(struct dma* container, const nvm_ctrl_t* ctrl)
 
 
 
+/*
+ * Helper function to map memory for an emulated controller.
+ * Emulated controllers use virtual addresses as bus addresses.
+ */
+static int map_emulated(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, void* vaddr, size_t size)
+{
+    size_t page_size = ctrl->page_size;
+    size_t n_pages = NVM_PAGE_ALIGN(size, page_size) / page_size;
+
+    if (vaddr == NULL || ((uint64_t) vaddr) & (page_size - 1))
+    {
+        dprintf("Virtual address is not aligned to controller page size\n");
+        return EINVAL;
+    }
+
+    uint64_t* ioaddrs = calloc(n_pages, sizeof(uint64_t));
+    if (ioaddrs == NULL)
+    {
+        dprintf("Failed to allocate address list: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    for (size_t i_page = 0; i_page < n_pages; ++i_page)
+    {
+        ioaddrs[i_page] = (uint64_t) NVM_PTR_OFFSET(vaddr, page_size, i_page);
+    }
+
+    int err = nvm_dma_map(handle, ctrl, vaddr, page_size, n_pages, ioaddrs);
+    free(ioaddrs);
+    return err;
+}
+
+
+
+/*
+ * Helper function to map memory for a controller mapped through VFIO.
+ * The memory is given a contiguous range in the container's IO address space.
+ */
+static int map_vfio(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, struct vfio_device* dev, void* vaddr, size_t size)
+{
+    struct vfio_mapping* md;
+    size_t page_size = _nvm_host_page_size();
+    size_t n_pages = NVM_PAGE_ALIGN(size, page_size) / page_size;
+
+    int err = _nvm_vfio_map(&md, dev, vaddr, page_size, n_pages);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    uint64_t* ioaddrs = calloc(n_pages, sizeof(uint64_t));
+    if (ioaddrs == NULL)
+    {
+        dprintf("Failed to allocate address list: %s\n", strerror(errno));
+        _nvm_vfio_unmap(md);
+        return ENOMEM;
+    }
+
+    for (size_t i_page = 0; i_page < n_pages; ++i_page)
+    {
+        ioaddrs[i_page] = md->iova + i_page * page_size;
+    }
+
+    err = _nvm_dma_create(handle, ctrl, &md->mapping, (dma_map_free_t) _nvm_vfio_unmap);
+    if (err != 0)
+    {
+        free(ioaddrs);
+        _nvm_vfio_unmap(md);
+        return err;
+    }
+
+    _nvm_dma_handle_populate(*handle, ctrl, ioaddrs);
+    free(ioaddrs);
+    return 0;
+}
+
+
+
 /*
  * Create DMA mapping descriptor from virtual address using kernel module.
  */
@@ -380,6 +798,17 @@ int nvm_dma_map_host(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, void* vaddr, si
 
     *handle = NULL;
 
+    if (_nvm_ctrl_emulated(ctrl))
+    {
+        return map_emulated(handle, ctrl, vaddr, size);
+    }
+
+    struct vfio_device* dev = _nvm_vfio_from_ctrl(ctrl);
+    if (dev != NULL)
+    {
+        return map_vfio(handle, ctrl, dev, vaddr, size);
+    }
+
     int fd = _nvm_fd_from_ctrl(ctrl);
     if (fd < 0)
     {
@@ -414,6 +843,57 @@ int nvm_dma_map_host(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, void* vaddr, si
 
 
 
+/*
+ * Allocate memory from the controller memory buffer.
+ */
+int nvm_dma_alloc_cmb(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, size_t size)
+{
+    struct cmb_mapping* md;
+    size_t page_size = ctrl->page_size;
+    size_t n_pages = NVM_PAGE_ALIGN(size, page_size) / page_size;
+
+    *handle = NULL;
+
+    struct cmb* cmb = _nvm_cmb_from_ctrl(ctrl);
+    if (cmb == NULL)
+    {
+        dprintf("Controller does not have a controller memory buffer\n");
+        return ENOTSUP;
+    }
+
+    if (n_pages == 0)
+    {
+        return EINVAL;
+    }
+
+    int err = _nvm_cmb_alloc(&md, cmb, page_size, n_pages);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    err = _nvm_dma_create(handle, ctrl, &md->mapping, (dma_map_free_t) _nvm_cmb_free);
+    if (err != 0)
+    {
+        _nvm_cmb_free(md);
+        return err;
+    }
+
+    // Memory is allocated in controller pages and is contiguous
+    (*handle)->vaddr = md->mapping.vaddr;
+    (*handle)->page_size = page_size;
+    (*handle)->n_ioaddrs = n_pages;
+
+    for (size_t i_page = 0; i_page < n_pages; ++i_page)
+    {
+        (*handle)->ioaddrs[i_page] = md->ioaddr + i_page * page_size;
+    }
+
+    return 0;
+}
+
+
+
 #ifdef _CUDA
 int nvm_dma_map_device(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, void* devptr, size_t size)
 {
@@ -453,3 +933,113 @@ int nvm_dma_map_device(nvm_dma_t** handle, const nvm_ctrl_t* ctrl, void* devptr,
 }
 #endif
 
+
+
+/*
+ * Helper function to map memory using the kernel module and create an 
+ * extent-based DMA handle. Address runs are merged into extents, so the 
+ * run lists are only needed temporarily.
+ */
+static int map_ext_ioctl(nvm_dma_ext_t** handle, const nvm_ctrl_t* ctrl, enum map_type type, void* vaddr, size_t size)
+{
+    struct ioctl_mapping* md;
+
+    int fd = _nvm_fd_from_ctrl(ctrl);
+    if (fd < 0)
+    {
+        return EBADF;
+    }
+
+    int err = create_mapping(&md, type, fd, vaddr, size);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    size_t n_runs = 0;
+    uint64_t* ioaddrs = calloc(md->mapping.n_pages, sizeof(uint64_t));
+    size_t* sizes = calloc(md->mapping.n_pages, sizeof(size_t));
+    if (ioaddrs == NULL || sizes == NULL)
+    {
+        free(ioaddrs);
+        free(sizes);
+        remove_mapping(md);
+        return ENOMEM;
+    }
+
+    err = map_memory(md, &n_runs, ioaddrs, sizes);
+    if (err == 0)
+    {
+        err = _nvm_dma_ext_create(handle, ctrl, (struct dma_map*) md, (dma_map_free_t) remove_mapping, n_runs, ioaddrs, sizes);
+    }
+
+    free(ioaddrs);
+    free(sizes);
+    if (err != 0)
+    {
+        remove_mapping(md);
+        return err;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Create extent-based DMA mapping descriptor from virtual address.
+ */
+int nvm_dma_ext_map_host(nvm_dma_ext_t** handle, const nvm_ctrl_t* ctrl, void* vaddr, size_t size)
+{
+    *handle = NULL;
+
+    if (_nvm_ctrl_emulated(ctrl))
+    {
+        // Emulated controllers use virtual addresses as bus addresses
+        if (vaddr == NULL || ((uint64_t) vaddr) & (ctrl->page_size - 1))
+        {
+            dprintf("Virtual address is not aligned to controller page size\n");
+            return EINVAL;
+        }
+
+        uint64_t ioaddr = (uint64_t) vaddr;
+        size = NVM_PAGE_ALIGN(size, ctrl->page_size);
+        return nvm_dma_ext_map(handle, ctrl, vaddr, 1, &ioaddr, &size);
+    }
+
+    struct vfio_device* dev = _nvm_vfio_from_ctrl(ctrl);
+    if (dev != NULL)
+    {
+        // Memory is mapped as one contiguous IO address range
+        struct vfio_mapping* md;
+        size_t page_size = _nvm_host_page_size();
+
+        int err = _nvm_vfio_map(&md, dev, vaddr, page_size, NVM_PAGE_ALIGN(size, page_size) / page_size);
+        if (err != 0)
+        {
+            return err;
+        }
+
+        size = md->mapping.page_size * md->mapping.n_pages;
+        err = _nvm_dma_ext_create(handle, ctrl, &md->mapping, (dma_map_free_t) _nvm_vfio_unmap, 1, &md->iova, &size);
+        if (err != 0)
+        {
+            _nvm_vfio_unmap(md);
+            return err;
+        }
+
+        return 0;
+    }
+
+    return map_ext_ioctl(handle, ctrl, _MAP_TYPE_HOST, vaddr, size);
+}
+
+
+
+#ifdef _CUDA
+int nvm_dma_ext_map_device(nvm_dma_ext_t** handle, const nvm_ctrl_t* ctrl, void* devptr, size_t size)
+{
+    *handle = NULL;
+    return map_ext_ioctl(handle, ctrl, _MAP_TYPE_CUDA, devptr, size);
+}
+#endif
@@ -54,4 +54,25 @@ void _nvm_dma_remove(nvm_dma_t* handle);
 
 
 
+/*
+ * Create an extent-based DMA handle container.
+ * If sizes is NULL, every run is a page of the mapping descriptor.
+ */
+int _nvm_dma_ext_create(nvm_dma_ext_t** handle,
+                        const nvm_ctrl_t* ctrl,
+                        struct dma_map* map,
+                        dma_map_free_t release,
+                        size_t n_runs,
+                        const uint64_t* ioaddrs,
+                        const size_t* sizes);
+
+
+
+/*
+ * Invoke release callback and remove an extent-based DMA handle container.
+ */
+void _nvm_dma_ext_remove(nvm_dma_ext_t* handle);
+
+
+
 #endif /* __NVM_INTERNAL_DMA_H__ */
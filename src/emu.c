@@ -0,0 +1,1603 @@
+#include <nvm_types.h>
+#include <nvm_ctrl.h>
+#include <nvm_emu.h>
+#include <nvm_cmd.h>
+#include <nvm_pi.h>
+#include <nvm_util.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "ctrl.h"
+#include "regs.h"
+#include "util.h"
+#include "dprintf.h"
+
+
+
+/* Emulated controller properties */
+#define EMU_MAX_QUEUES          64          // Number of queue pairs, including the admin queues
+#define EMU_MAX_ENTRIES         1024        // Maximum queue entries supported (MQES + 1)
+#define EMU_MPS_MIN             0           // Minimum memory page size (4 KiB)
+#define EMU_MPS_MAX             4           // Maximum memory page size (64 KiB)
+#define EMU_MDTS                10          // Maximum data transfer size (in units of minimum page size)
+#define EMU_TIMEOUT             10          // Controller timeout (in 500 ms units)
+#define EMU_VERSION             0x00010300  // NVM Express version 1.3
+#define EMU_CMB_OFFSET          NVM_CTRL_MEM_MINSIZE    // Controller memory buffer offset in BAR0
+#define EMU_CMB_SIZE            (1UL << 18)             // Controller memory buffer size (256 KiB)
+#define EMU_BAR_SIZE            (EMU_CMB_OFFSET + EMU_CMB_SIZE)
+#define EMU_NS_ID               1           // Namespace identifier of the only namespace
+#define EMU_IDLE_SPINS          10000       // Idle iterations before service thread starts sleeping
+#define EMU_IDLE_SLEEP          10000       // Nanoseconds to sleep when idle
+
+
+/* Build status field from status code type and status code */
+#define STATUS(sct, sc)         ((uint16_t) ((((sct) & 0x7) << 8) | ((sc) & 0xff)))
+
+#define SC_SUCCESS              STATUS(0x00, 0x00)
+#define SC_INVALID_OPCODE       STATUS(0x00, 0x01)
+#define SC_INVALID_FIELD        STATUS(0x00, 0x02)
+#define SC_DATA_TRANSFER_ERROR  STATUS(0x00, 0x04)
+#define SC_INTERNAL_ERROR       STATUS(0x00, 0x06)
+#define SC_ABORTED_FUSED_FAIL   STATUS(0x00, 0x09)
+#define SC_ABORTED_FUSED_MISS   STATUS(0x00, 0x0a)
+#define SC_INVALID_NAMESPACE    STATUS(0x00, 0x0b)
+#define SC_SGL_SEGMENT_INVALID  STATUS(0x00, 0x0d)
+#define SC_SGL_LENGTH_INVALID   STATUS(0x00, 0x0f)
+#define SC_SGL_TYPE_INVALID     STATUS(0x00, 0x11)
+#define SC_PRP_OFFSET_INVALID   STATUS(0x00, 0x13)
+#define SC_LBA_OUT_OF_RANGE     STATUS(0x00, 0x80)
+#define SC_UNRECOVERED_READ     STATUS(0x02, 0x81)
+#define SC_GUARD_CHECK          STATUS(0x02, 0x82)
+#define SC_APP_TAG_CHECK        STATUS(0x02, 0x83)
+#define SC_REF_TAG_CHECK        STATUS(0x02, 0x84)
+#define SC_COMPARE_FAILURE      STATUS(0x02, 0x85)
+#define SC_CQ_INVALID           STATUS(0x01, 0x00)
+#define SC_INVALID_QID          STATUS(0x01, 0x01)
+#define SC_INVALID_QSIZE        STATUS(0x01, 0x02)
+#define SC_INVALID_DELETION     STATUS(0x01, 0x0c)
+
+
+/* Convert bus address to pointer (bus addresses are virtual addresses) */
+#define ptr(ioaddr)             ((void*) ((uintptr_t) (ioaddr)))
+
+
+/* Get 64-bit value from two command DWORDs */
+#define qword(cmd, lo)          (((uint64_t) (cmd)->dword[(lo)]) | (((uint64_t) (cmd)->dword[(lo) + 1]) << 32))
+
+
+
+/*
+ * Emulated queue descriptor.
+ */
+struct emu_queue
+{
+    bool                    enabled;        // Queue is created
+    uint16_t                no;             // Queue identifier
+    uint16_t                cq_no;          // Associated completion queue (SQ only)
+    uint32_t                max_entries;    // Queue size
+    size_t                  entry_size;     // Queue entry size
+    uint64_t                ioaddr;         // Base address or PRP list address
+    bool                    contiguous;     // Physically contiguous (PC)
+    uint32_t                head;           // Head pointer (SQ only)
+    uint32_t                tail;           // Tail pointer (CQ only)
+    int                     phase;          // Phase tag (CQ only)
+    bool                    fused_first;    // Previous command was the first of a fused operation (SQ only)
+    bool                    fused_failed;   // First command of the fused operation failed (SQ only)
+};
+
+
+
+/*
+ * Emulated controller.
+ */
+struct nvm_emu
+{
+    pthread_t               thread;         // Service thread
+    bool                    stop;           // Indicate that the service thread should stop
+    volatile void*          bar;            // Fake BAR0
+    size_t                  bar_size;       // Size of fake BAR0
+    bool                    enabled;        // CC.EN as last seen by the service thread
+    bool                    shutdown;       // CC.SHN has been set, stop processing commands
+    size_t                  page_size;      // Memory page size set in CC.MPS
+    uint16_t                n_sqs;          // Number of IO SQs allocated
+    uint16_t                n_cqs;          // Number of IO CQs allocated
+    volatile uint32_t*      shadow;         // Shadow doorbell buffer (NULL if not configured)
+    volatile uint32_t*      event_idx;      // EventIdx buffer (NULL if not configured)
+    int                     fd;             // Backing file descriptor (-1 if RAM-backed)
+    unsigned char*          ns_mem;         // Backing memory (NULL if file-backed)
+    size_t                  n_blocks;       // Namespace size in logical blocks
+    size_t                  block_size;     // Logical block size
+    uint8_t                 pi_type;        // Protection information type (0 if there is no metadata)
+    nvm_pi_t*               metadata;       // Separate metadata holding protection information (NULL if not used)
+    unsigned char*          bad_blocks;     // Bitmap of blocks marked as uncorrectable
+    struct emu_queue        sqs[EMU_MAX_QUEUES];
+    struct emu_queue        cqs[EMU_MAX_QUEUES];
+};
+
+
+
+/*
+ * Callback for a data segment described by a PRP entry or SGL descriptor.
+ */
+typedef uint16_t (*segment_cb_t)(struct nvm_emu* emu, void* ptr, size_t len, size_t pos, void* arg);
+
+
+
+/*
+ * Namespace access request.
+ */
+struct ns_access
+{
+    size_t                  offset;         // Byte offset into namespace
+    bool                    write;          // Write to namespace
+};
+
+
+
+/*
+ * Get pointer to a queue entry.
+ */
+static void* queue_entry(const struct nvm_emu* emu, const struct emu_queue* q, uint32_t idx)
+{
+    size_t offset = idx * q->entry_size;
+
+    if (q->contiguous)
+    {
+        return ptr(q->ioaddr + offset);
+    }
+
+    const uint64_t* list = (const uint64_t*) ptr(q->ioaddr);
+    return ptr(list[offset / emu->page_size] + (offset % emu->page_size));
+}
+
+
+
+/*
+ * Walk the PRP entries of a command and invoke the callback for every
+ * data segment.
+ */
+static uint16_t walk_prps(struct nvm_emu* emu, const nvm_cmd_t* cmd, size_t size, segment_cb_t cb, void* arg)
+{
+    size_t page_size = emu->page_size;
+    uint64_t prp1 = qword(cmd, 6);
+    uint64_t prp2 = qword(cmd, 8);
+    uint16_t status;
+    size_t pos = 0;
+    size_t len;
+
+    if (size == 0)
+    {
+        return SC_SUCCESS;
+    }
+
+    // First entry may have an offset into the page
+    len = _MIN(size, page_size - (prp1 & (page_size - 1)));
+    status = cb(emu, ptr(prp1), len, pos, arg);
+    pos += len;
+
+    if (status != SC_SUCCESS || pos == size)
+    {
+        return status;
+    }
+
+    // Second entry is either a data pointer or a PRP list pointer
+    if (size - pos <= page_size)
+    {
+        if (prp2 & (page_size - 1))
+        {
+            return SC_PRP_OFFSET_INVALID;
+        }
+
+        return cb(emu, ptr(prp2), size - pos, pos, arg);
+    }
+
+    const uint64_t* list = (const uint64_t*) ptr(prp2);
+    size_t n_entries = (page_size - (prp2 & (page_size - 1))) / sizeof(uint64_t);
+    size_t i_entry = 0;
+
+    while (pos < size)
+    {
+        // Last entry in a list page points to the next list page
+        if (i_entry == n_entries - 1 && size - pos > page_size)
+        {
+            list = (const uint64_t*) ptr(list[i_entry]);
+            n_entries = page_size / sizeof(uint64_t);
+            i_entry = 0;
+            continue;
+        }
+
+        if (list[i_entry] & (page_size - 1))
+        {
+            return SC_PRP_OFFSET_INVALID;
+        }
+
+        len = _MIN(page_size, size - pos);
+        status = cb(emu, ptr(list[i_entry++]), len, pos, arg);
+        if (status != SC_SUCCESS)
+        {
+            return status;
+        }
+
+        pos += len;
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Walk the SGL descriptors of a command and invoke the callback for every
+ * data block.
+ */
+static uint16_t walk_sgl(struct nvm_emu* emu, const nvm_cmd_t* cmd, size_t size, segment_cb_t cb, void* arg)
+{
+    const nvm_sgl_t* seg = NULL;
+    size_t n_descs = 0;
+    bool last = false;
+    uint16_t status;
+    size_t pos = 0;
+    nvm_sgl_t desc;
+
+    memcpy(&desc, &cmd->dword[6], sizeof(desc));
+
+    while (pos < size)
+    {
+        uint64_t ioaddr = ((uint64_t) desc.dword[0]) | (((uint64_t) desc.dword[1]) << 32);
+        uint32_t length = desc.dword[2];
+
+        if (_RB(desc.dword[3], 27, 24) != 0)
+        {
+            return SC_SGL_TYPE_INVALID;
+        }
+
+        switch (_RB(desc.dword[3], 31, 28))
+        {
+            case NVM_SGL_DATA_BLOCK:
+                length = _MIN(length, size - pos);
+                if (length > 0)
+                {
+                    status = cb(emu, ptr(ioaddr), length, pos, arg);
+                    if (status != SC_SUCCESS)
+                    {
+                        return status;
+                    }
+                    pos += length;
+                }
+                break;
+
+            case NVM_SGL_SEGMENT:
+            case NVM_SGL_LAST_SEGMENT:
+                // Segment descriptors must be the last descriptor in a segment
+                if (last || n_descs != 0 || length == 0 || length % sizeof(nvm_sgl_t) != 0)
+                {
+                    return SC_SGL_SEGMENT_INVALID;
+                }
+
+                last = _RB(desc.dword[3], 31, 28) == NVM_SGL_LAST_SEGMENT;
+                seg = (const nvm_sgl_t*) ptr(ioaddr);
+                n_descs = length / sizeof(nvm_sgl_t);
+                break;
+
+            default:
+                return SC_SGL_TYPE_INVALID;
+        }
+
+        if (pos < size)
+        {
+            if (n_descs == 0)
+            {
+                return SC_SGL_LENGTH_INVALID;
+            }
+
+            desc = *seg++;
+            --n_descs;
+        }
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Copy a local buffer to host memory.
+ */
+static uint16_t copy_to_host(struct nvm_emu* emu, void* ptr, size_t len, size_t pos, const void* buffer)
+{
+    (void) emu;
+    memcpy(ptr, ((const unsigned char*) buffer) + pos, len);
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Copy host memory to a local buffer.
+ */
+static uint16_t copy_from_host(struct nvm_emu* emu, void* ptr, size_t len, size_t pos, void* buffer)
+{
+    (void) emu;
+    memcpy(((unsigned char*) buffer) + pos, ptr, len);
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Read or write namespace memory.
+ */
+static uint16_t access_namespace(struct nvm_emu* emu, void* ptr, size_t len, size_t pos, const struct ns_access* req)
+{
+    size_t offset = req->offset + pos;
+
+    if (emu->ns_mem != NULL)
+    {
+        if (req->write)
+        {
+            memcpy(emu->ns_mem + offset, ptr, len);
+        }
+        else
+        {
+            memcpy(ptr, emu->ns_mem + offset, len);
+        }
+
+        return SC_SUCCESS;
+    }
+
+    while (len > 0)
+    {
+        ssize_t n = req->write ? pwrite(emu->fd, ptr, len, offset) : pread(emu->fd, ptr, len, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0)
+        {
+            dprintf("Failed to access backing file: %s\n", strerror(errno));
+            return SC_DATA_TRANSFER_ERROR;
+        }
+        else if (n == 0)
+        {
+            // Reading past end of a sparse file
+            memset(ptr, 0, len);
+            break;
+        }
+
+        ptr = ((unsigned char*) ptr) + n;
+        offset += n;
+        len -= n;
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Compare host memory with namespace memory.
+ */
+static uint16_t compare_namespace(struct nvm_emu* emu, void* ptr, size_t len, size_t pos, const struct ns_access* req)
+{
+    unsigned char buffer[4096];
+    struct ns_access read = { .offset = req->offset + pos, .write = false };
+
+    if (emu->ns_mem != NULL)
+    {
+        return memcmp(emu->ns_mem + read.offset, ptr, len) == 0 ? SC_SUCCESS : SC_COMPARE_FAILURE;
+    }
+
+    for (size_t i = 0; i < len; i += sizeof(buffer))
+    {
+        size_t n = _MIN(sizeof(buffer), len - i);
+
+        uint16_t status = access_namespace(emu, buffer, n, i, &read);
+        if (status != SC_SUCCESS)
+        {
+            return status;
+        }
+
+        if (memcmp(buffer, ((unsigned char*) ptr) + i, n) != 0)
+        {
+            return SC_COMPARE_FAILURE;
+        }
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Check if any block in a range is marked as uncorrectable.
+ */
+static bool blocks_bad(const struct nvm_emu* emu, uint64_t start_lba, size_t n_blocks)
+{
+    for (uint64_t lba = start_lba; lba < start_lba + n_blocks; ++lba)
+    {
+        if (emu->bad_blocks[lba / 8] & (1 << (lba % 8)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+/*
+ * Mark blocks as uncorrectable, or as valid after they are written.
+ */
+static void mark_blocks(struct nvm_emu* emu, uint64_t start_lba, size_t n_blocks, bool bad)
+{
+    for (uint64_t lba = start_lba; lba < start_lba + n_blocks; ++lba)
+    {
+        if (bad)
+        {
+            emu->bad_blocks[lba / 8] |= (1 << (lba % 8));
+        }
+        else
+        {
+            emu->bad_blocks[lba / 8] &= ~(1 << (lba % 8));
+        }
+    }
+}
+
+
+
+/*
+ * Write zeroes to namespace.
+ */
+static uint16_t zero_namespace(struct nvm_emu* emu, size_t offset, size_t size)
+{
+    if (emu->ns_mem != NULL)
+    {
+        memset(emu->ns_mem + offset, 0, size);
+        return SC_SUCCESS;
+    }
+
+    unsigned char zeroes[4096];
+    memset(zeroes, 0, sizeof(zeroes));
+
+    struct ns_access req = { .offset = offset, .write = true };
+
+    for (size_t pos = 0; pos < size; pos += sizeof(zeroes))
+    {
+        uint16_t status = access_namespace(emu, zeroes, _MIN(sizeof(zeroes), size - pos), pos, &req);
+        if (status != SC_SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Write a space-padded string into an identify structure.
+ */
+static void set_string(unsigned char* dst, const char* str, size_t len)
+{
+    memset(dst, ' ', len);
+    memcpy(dst, str, _MIN(strlen(str), len));
+}
+
+
+
+/*
+ * Read a doorbell value.
+ * IO queues use the shadow doorbell buffer if it is configured. EventIdx is
+ * set to the value read, so that the host only rings the doorbell register
+ * for the first update after we have caught up. We poll the shadow doorbells
+ * anyway, so these doorbell register writes are merely ignored.
+ */
+static uint32_t read_doorbell(struct nvm_emu* emu, uint16_t no, bool cq)
+{
+    if (no != 0 && emu->shadow != NULL)
+    {
+        uint32_t value = emu->shadow[2 * no + cq];
+        emu->event_idx[2 * no + cq] = value;
+        return value;
+    }
+
+    return cq ? *CQ_DBL(emu->bar, no, 0) : *SQ_DBL(emu->bar, no, 0);
+}
+
+
+
+/*
+ * Reset doorbell values of a newly created queue, including the shadow
+ * doorbell, as it may still hold the value of a deleted queue.
+ */
+static void reset_doorbell(struct nvm_emu* emu, uint16_t no, bool cq)
+{
+    if (emu->shadow != NULL)
+    {
+        emu->shadow[2 * no + cq] = 0;
+        emu->event_idx[2 * no + cq] = 0;
+    }
+
+    if (cq)
+    {
+        *CQ_DBL(emu->bar, no, 0) = 0;
+    }
+    else
+    {
+        *SQ_DBL(emu->bar, no, 0) = 0;
+    }
+}
+
+
+
+/*
+ * Handle IDENTIFY admin command.
+ */
+static uint16_t identify(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    unsigned char data[0x1000];
+    uint32_t ns_id = cmd->dword[1];
+
+    memset(data, 0, sizeof(data));
+
+    switch (_RB(cmd->dword[10], 7, 0))
+    {
+        case 0x00: // Identify namespace
+            if (ns_id != EMU_NS_ID)
+            {
+                return SC_INVALID_NAMESPACE;
+            }
+
+            *((uint64_t*) (data + 0)) = emu->n_blocks;  // NSZE
+            *((uint64_t*) (data + 8)) = emu->n_blocks;  // NCAP
+            *((uint64_t*) (data + 16)) = emu->n_blocks; // NUSE
+            data[25] = 0;                               // NLBAF
+            data[26] = 0;                               // FLBAS: separate metadata
+            *((uint32_t*) (data + 128)) = _WB((uint32_t) _nvm_b2log(emu->block_size), 23, 16);
+
+            if (emu->pi_type != 0)
+            {
+                data[28] = (1 << 4) | (1 << (emu->pi_type - 1));  // DPC: last in metadata and type
+                data[29] = emu->pi_type;                // DPS: type, last in metadata
+                *((uint32_t*) (data + 128)) |= sizeof(nvm_pi_t);  // LBAF0 MS
+            }
+            break;
+
+        case 0x01: // Identify controller
+            set_string(data + 4, "EMU0000000000000001", 20);
+            set_string(data + 24, "libnvm emulated controller", 40);
+            set_string(data + 64, "0.1", 8);
+            data[77] = EMU_MDTS;
+            *((uint32_t*) (data + 80)) = EMU_VERSION;
+            *((uint16_t*) (data + 256)) = (1 << 8);     // OACS: Doorbell Buffer Config
+            data[512] = (6 << 4) | 6;                   // SQES
+            data[513] = (4 << 4) | 4;                   // CQES
+            *((uint16_t*) (data + 514)) = EMU_MAX_ENTRIES - 1;
+            *((uint32_t*) (data + 516)) = 1;            // NN
+            *((uint16_t*) (data + 520)) = (1 << 0)      // ONCS: Compare
+                | (1 << 1)                              //       Write Uncorrectable
+                | (1 << 2)                              //       Dataset Management
+                | (1 << 3)                              //       Write Zeroes
+                | (1 << 7);                             //       Verify
+            *((uint16_t*) (data + 522)) = 1;            // FUSES: Compare and Write
+            *((uint32_t*) (data + 536)) = 1;            // SGLS, no alignment requirement
+            break;
+
+        case 0x02: // Active namespace list
+            if (ns_id < EMU_NS_ID)
+            {
+                *((uint32_t*) data) = EMU_NS_ID;
+            }
+            break;
+
+        default:
+            return SC_INVALID_FIELD;
+    }
+
+    return walk_prps(emu, cmd, sizeof(data), (segment_cb_t) copy_to_host, data);
+}
+
+
+
+/*
+ * Handle SET FEATURES and GET FEATURES admin commands.
+ */
+static uint16_t features(struct nvm_emu* emu, const nvm_cmd_t* cmd, bool set, uint32_t* result)
+{
+    switch (_RB(cmd->dword[10], 7, 0))
+    {
+        case 0x07: // Number of queues
+            if (set)
+            {
+                uint32_t n_sqs = _RB(cmd->dword[11], 15, 0);
+                uint32_t n_cqs = _RB(cmd->dword[11], 31, 16);
+
+                if (n_sqs == 0xffff || n_cqs == 0xffff)
+                {
+                    return SC_INVALID_FIELD;
+                }
+
+                emu->n_sqs = _MIN(n_sqs + 1, EMU_MAX_QUEUES - 1);
+                emu->n_cqs = _MIN(n_cqs + 1, EMU_MAX_QUEUES - 1);
+            }
+
+            *result = ((uint32_t) (emu->n_cqs - 1) << 16) | (emu->n_sqs - 1);
+            return SC_SUCCESS;
+
+        default:
+            return SC_INVALID_FIELD;
+    }
+}
+
+
+
+/*
+ * Initialize an emulated queue.
+ */
+static void init_queue(struct emu_queue* q, uint16_t no, uint32_t max_entries, size_t entry_size, uint64_t ioaddr, bool contiguous)
+{
+    q->enabled = true;
+    q->no = no;
+    q->cq_no = 0;
+    q->max_entries = max_entries;
+    q->entry_size = entry_size;
+    q->ioaddr = ioaddr;
+    q->contiguous = contiguous;
+    q->head = 0;
+    q->tail = 0;
+    q->phase = 1;
+    q->fused_first = false;
+    q->fused_failed = false;
+}
+
+
+
+/*
+ * Handle CREATE IO COMPLETION QUEUE admin command.
+ */
+static uint16_t create_cq(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    uint16_t no = _RB(cmd->dword[10], 15, 0);
+    uint32_t max_entries = _RB(cmd->dword[10], 31, 16) + 1;
+    bool contiguous = !!_RB(cmd->dword[11], 0, 0);
+    uint64_t ioaddr = qword(cmd, 6);
+
+    if (no == 0 || no > emu->n_cqs || emu->cqs[no].enabled)
+    {
+        return SC_INVALID_QID;
+    }
+
+    if (max_entries < 2 || max_entries > EMU_MAX_ENTRIES)
+    {
+        return SC_INVALID_QSIZE;
+    }
+
+    if (ioaddr & (emu->page_size - 1))
+    {
+        return SC_PRP_OFFSET_INVALID;
+    }
+
+    init_queue(&emu->cqs[no], no, max_entries, sizeof(nvm_cpl_t), ioaddr, contiguous);
+    reset_doorbell(emu, no, true);
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Handle CREATE IO SUBMISSION QUEUE admin command.
+ */
+static uint16_t create_sq(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    uint16_t no = _RB(cmd->dword[10], 15, 0);
+    uint32_t max_entries = _RB(cmd->dword[10], 31, 16) + 1;
+    bool contiguous = !!_RB(cmd->dword[11], 0, 0);
+    uint16_t cq_no = _RB(cmd->dword[11], 31, 16);
+    uint64_t ioaddr = qword(cmd, 6);
+
+    if (no == 0 || no > emu->n_sqs || emu->sqs[no].enabled)
+    {
+        return SC_INVALID_QID;
+    }
+
+    if (cq_no == 0 || cq_no >= EMU_MAX_QUEUES || !emu->cqs[cq_no].enabled)
+    {
+        return SC_CQ_INVALID;
+    }
+
+    if (max_entries < 2 || max_entries > EMU_MAX_ENTRIES)
+    {
+        return SC_INVALID_QSIZE;
+    }
+
+    if (ioaddr & (emu->page_size - 1))
+    {
+        return SC_PRP_OFFSET_INVALID;
+    }
+
+    init_queue(&emu->sqs[no], no, max_entries, sizeof(nvm_cmd_t), ioaddr, contiguous);
+    emu->sqs[no].cq_no = cq_no;
+    reset_doorbell(emu, no, false);
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Handle DELETE IO SUBMISSION QUEUE admin command.
+ */
+static uint16_t delete_sq(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    uint16_t no = _RB(cmd->dword[10], 15, 0);
+
+    if (no == 0 || no >= EMU_MAX_QUEUES || !emu->sqs[no].enabled)
+    {
+        return SC_INVALID_QID;
+    }
+
+    emu->sqs[no].enabled = false;
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Handle DELETE IO COMPLETION QUEUE admin command.
+ */
+static uint16_t delete_cq(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    uint16_t no = _RB(cmd->dword[10], 15, 0);
+
+    if (no == 0 || no >= EMU_MAX_QUEUES || !emu->cqs[no].enabled)
+    {
+        return SC_INVALID_QID;
+    }
+
+    for (uint16_t i = 1; i < EMU_MAX_QUEUES; ++i)
+    {
+        if (emu->sqs[i].enabled && emu->sqs[i].cq_no == no)
+        {
+            return SC_INVALID_DELETION;
+        }
+    }
+
+    emu->cqs[no].enabled = false;
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Handle DOORBELL BUFFER CONFIG admin command.
+ */
+static uint16_t dbbuf_config(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    uint64_t shadow = qword(cmd, 6);
+    uint64_t event_idx = qword(cmd, 8);
+
+    if (shadow == 0 || event_idx == 0 || (shadow & (emu->page_size - 1)) || (event_idx & (emu->page_size - 1)))
+    {
+        return SC_INVALID_FIELD;
+    }
+
+    emu->shadow = ptr(shadow);
+    emu->event_idx = ptr(event_idx);
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Execute an admin command.
+ */
+static uint16_t admin_command(struct nvm_emu* emu, const nvm_cmd_t* cmd, uint32_t* result)
+{
+    switch (_RB(cmd->dword[0], 7, 0))
+    {
+        case NVM_ADMIN_DELETE_SUBMISSION_QUEUE:
+            return delete_sq(emu, cmd);
+
+        case NVM_ADMIN_CREATE_SUBMISSION_QUEUE:
+            return create_sq(emu, cmd);
+
+        case NVM_ADMIN_DELETE_COMPLETION_QUEUE:
+            return delete_cq(emu, cmd);
+
+        case NVM_ADMIN_CREATE_COMPLETION_QUEUE:
+            return create_cq(emu, cmd);
+
+        case NVM_ADMIN_IDENTIFY:
+            return identify(emu, cmd);
+
+        case NVM_ADMIN_ABORT:
+            // Commands are never outstanding long enough to be aborted
+            *result = 1;
+            return SC_SUCCESS;
+
+        case NVM_ADMIN_SET_FEATURES:
+            return features(emu, cmd, true, result);
+
+        case NVM_ADMIN_GET_FEATURES:
+            return features(emu, cmd, false, result);
+
+        case NVM_ADMIN_DOORBELL_BUFFER_CONFIG:
+            return dbbuf_config(emu, cmd);
+
+        default:
+            return SC_INVALID_OPCODE;
+    }
+}
+
+
+
+/*
+ * Transfer command data using PRPs or SGLs, depending on PSDT.
+ */
+static uint16_t transfer_data(struct nvm_emu* emu, const nvm_cmd_t* cmd, size_t size, segment_cb_t cb, void* arg)
+{
+    // Metadata is always a contiguous buffer at MPTR, also for SGLs
+    switch (_RB(cmd->dword[0], 15, 14))
+    {
+        case 0:
+            return walk_prps(emu, cmd, size, cb, arg);
+
+        case 1:
+        case 2:
+            return walk_sgl(emu, cmd, size, cb, arg);
+
+        default:
+            return SC_INVALID_FIELD;
+    }
+}
+
+
+
+/*
+ * Clear the metadata of blocks that are zeroed or deallocated.
+ */
+static void zero_metadata(struct nvm_emu* emu, uint64_t start_lba, size_t n_blocks)
+{
+    if (emu->metadata != NULL)
+    {
+        memset(&emu->metadata[start_lba], 0, n_blocks * sizeof(nvm_pi_t));
+    }
+}
+
+
+
+/*
+ * Check protection information of blocks against the tags of a command, as
+ * requested by PRINFO. Returns the status of the first check that fails.
+ */
+static uint16_t check_pi(const struct nvm_emu* emu, const nvm_cmd_t* cmd, const void* data, const nvm_pi_t* metadata, size_t n_blocks)
+{
+    static const struct { uint8_t check; uint16_t status; } checks[] =
+    {
+        { NVM_PRINFO_CHECK_GUARD, SC_GUARD_CHECK },
+        { NVM_PRINFO_CHECK_APP, SC_APP_TAG_CHECK },
+        { NVM_PRINFO_CHECK_REF, SC_REF_TAG_CHECK }
+    };
+
+    struct nvm_ns_info ns;
+    uint8_t prinfo = _RB(cmd->dword[12], 29, 26);
+
+    memset(&ns, 0, sizeof(ns));
+    ns.lba_data_size = emu->block_size;
+    ns.metadata_size = sizeof(nvm_pi_t);
+    ns.pi_type = emu->pi_type;
+
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); ++i)
+    {
+        if ((prinfo & checks[i].check) && nvm_pi_verify(&ns, data, metadata, n_blocks, cmd->dword[14],
+                    _RB(cmd->dword[15], 15, 0), _RB(cmd->dword[15], 31, 16), checks[i].check, NULL) != 0)
+        {
+            return checks[i].status;
+        }
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Read, write, compare or verify blocks of a namespace with protection
+ * information. Metadata is transferred as one contiguous buffer at MPTR,
+ * and is left as is if MPTR is not set. Data is staged in a local buffer,
+ * so that it is checked before it is written or returned to the host.
+ * Inserting and stripping protection information (PRACT) is not supported.
+ */
+static uint16_t protected_access(struct nvm_emu* emu, const nvm_cmd_t* cmd, uint64_t start_lba, size_t n_blocks, struct ns_access* req)
+{
+    uint8_t opcode = _RB(cmd->dword[0], 7, 0);
+    uint8_t prinfo = _RB(cmd->dword[12], 29, 26);
+    nvm_pi_t* md = (nvm_pi_t*) ptr(qword(cmd, 4));
+    nvm_pi_t* stored = &emu->metadata[start_lba];
+    size_t size = n_blocks * emu->block_size;
+    uint16_t status;
+
+    if ((prinfo & NVM_PRINFO_ACTION) || (opcode == NVM_IO_WRITE && prinfo != 0 && md == NULL))
+    {
+        return SC_INVALID_FIELD;
+    }
+
+    void* buffer = malloc(size);
+    if (buffer == NULL)
+    {
+        return SC_INTERNAL_ERROR;
+    }
+
+    if (opcode == NVM_IO_WRITE)
+    {
+        status = transfer_data(emu, cmd, size, (segment_cb_t) copy_from_host, buffer);
+        if (status == SC_SUCCESS && md != NULL)
+        {
+            status = check_pi(emu, cmd, buffer, md, n_blocks);
+        }
+
+        if (status == SC_SUCCESS)
+        {
+            status = access_namespace(emu, buffer, size, 0, req);
+        }
+
+        if (status == SC_SUCCESS && md != NULL)
+        {
+            memcpy(stored, md, n_blocks * sizeof(nvm_pi_t));
+        }
+    }
+    else
+    {
+        status = access_namespace(emu, buffer, size, 0, req);
+        if (status == SC_SUCCESS)
+        {
+            status = check_pi(emu, cmd, buffer, stored, n_blocks);
+        }
+
+        if (status == SC_SUCCESS && opcode == NVM_IO_READ)
+        {
+            status = transfer_data(emu, cmd, size, (segment_cb_t) copy_to_host, buffer);
+            if (status == SC_SUCCESS && md != NULL)
+            {
+                memcpy(md, stored, n_blocks * sizeof(nvm_pi_t));
+            }
+        }
+        else if (status == SC_SUCCESS && opcode == NVM_IO_COMPARE)
+        {
+            status = transfer_data(emu, cmd, size, (segment_cb_t) compare_namespace, req);
+        }
+    }
+
+    free(buffer);
+    return status;
+}
+
+
+
+/*
+ * Handle DATASET MANAGEMENT IO command.
+ * Access hints are ignored, deallocated blocks are read as zeroes.
+ */
+static uint16_t dataset_management(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    nvm_dsm_range_t ranges[NVM_DSM_MAX_RANGES];
+    size_t n_ranges = _RB(cmd->dword[10], 7, 0) + 1;
+
+    uint16_t status = transfer_data(emu, cmd, n_ranges * sizeof(nvm_dsm_range_t), (segment_cb_t) copy_from_host, ranges);
+    if (status != SC_SUCCESS)
+    {
+        return status;
+    }
+
+    for (size_t i = 0; i < n_ranges; ++i)
+    {
+        if (ranges[i].start_lba >= emu->n_blocks || emu->n_blocks - ranges[i].start_lba < ranges[i].n_blocks)
+        {
+            return SC_LBA_OUT_OF_RANGE;
+        }
+    }
+
+    if (!_RB(cmd->dword[11], 2, 2))
+    {
+        return SC_SUCCESS;
+    }
+
+    for (size_t i = 0; i < n_ranges; ++i)
+    {
+        status = zero_namespace(emu, ranges[i].start_lba * emu->block_size, ranges[i].n_blocks * emu->block_size);
+        if (status != SC_SUCCESS)
+        {
+            return status;
+        }
+
+        mark_blocks(emu, ranges[i].start_lba, ranges[i].n_blocks, false);
+        zero_metadata(emu, ranges[i].start_lba, ranges[i].n_blocks);
+    }
+
+    return SC_SUCCESS;
+}
+
+
+
+/*
+ * Execute an IO command.
+ */
+static uint16_t io_command(struct nvm_emu* emu, const nvm_cmd_t* cmd)
+{
+    uint8_t opcode = _RB(cmd->dword[0], 7, 0);
+    uint64_t start_lba = qword(cmd, 10);
+    size_t n_blocks = _RB(cmd->dword[12], 15, 0) + 1;
+    uint16_t status;
+
+    if (cmd->dword[1] != EMU_NS_ID)
+    {
+        return SC_INVALID_NAMESPACE;
+    }
+
+    if (opcode == NVM_IO_FLUSH)
+    {
+        if (emu->fd >= 0 && fdatasync(emu->fd) != 0)
+        {
+            return SC_INTERNAL_ERROR;
+        }
+        return SC_SUCCESS;
+    }
+
+    if (opcode == NVM_IO_DATASET_MANAGEMENT)
+    {
+        return dataset_management(emu, cmd);
+    }
+
+    if (start_lba >= emu->n_blocks || emu->n_blocks - start_lba < n_blocks)
+    {
+        return SC_LBA_OUT_OF_RANGE;
+    }
+
+    struct ns_access req = {
+        .offset = start_lba * emu->block_size,
+        .write = opcode == NVM_IO_WRITE
+    };
+    size_t size = n_blocks * emu->block_size;
+
+    switch (opcode)
+    {
+        case NVM_IO_WRITE:
+        case NVM_IO_READ:
+        case NVM_IO_COMPARE:
+            if (size > ((size_t) 1 << EMU_MDTS) * (1UL << (12 + EMU_MPS_MIN)))
+            {
+                return SC_INVALID_FIELD;
+            }
+
+            if (opcode != NVM_IO_WRITE && blocks_bad(emu, start_lba, n_blocks))
+            {
+                return SC_UNRECOVERED_READ;
+            }
+
+            if (emu->metadata != NULL)
+            {
+                status = protected_access(emu, cmd, start_lba, n_blocks, &req);
+            }
+            else if (opcode == NVM_IO_COMPARE)
+            {
+                return transfer_data(emu, cmd, size, (segment_cb_t) compare_namespace, &req);
+            }
+            else
+            {
+                status = transfer_data(emu, cmd, size, (segment_cb_t) access_namespace, &req);
+            }
+
+            if (status == SC_SUCCESS && opcode == NVM_IO_WRITE)
+            {
+                mark_blocks(emu, start_lba, n_blocks, false);
+            }
+            return status;
+
+        case NVM_IO_WRITE_ZEROES:
+            status = zero_namespace(emu, req.offset, size);
+            if (status == SC_SUCCESS)
+            {
+                mark_blocks(emu, start_lba, n_blocks, false);
+                zero_metadata(emu, start_lba, n_blocks);
+            }
+            return status;
+
+        case NVM_IO_WRITE_UNCORRECTABLE:
+            mark_blocks(emu, start_lba, n_blocks, true);
+            return SC_SUCCESS;
+
+        case NVM_IO_VERIFY:
+            // Data is never corrupted, except for blocks explicitly marked as uncorrectable
+            if (blocks_bad(emu, start_lba, n_blocks))
+            {
+                return SC_UNRECOVERED_READ;
+            }
+            return emu->metadata != NULL ? protected_access(emu, cmd, start_lba, n_blocks, &req) : SC_SUCCESS;
+
+        default:
+            return SC_INVALID_OPCODE;
+    }
+}
+
+
+
+/*
+ * Execute an IO command that may be part of a fused operation.
+ * The second command is only executed if the first command succeeded.
+ */
+static uint16_t fused_command(struct nvm_emu* emu, struct emu_queue* sq, const nvm_cmd_t* cmd, const nvm_cmd_t* next)
+{
+    uint16_t status;
+    bool first = sq->fused_first;
+    bool failed = sq->fused_failed;
+
+    sq->fused_first = false;
+    sq->fused_failed = false;
+
+    switch (_RB(cmd->dword[0], 9, 8))
+    {
+        case NVM_FUSE_NONE:
+            return io_command(emu, cmd);
+
+        case NVM_FUSE_FIRST:
+            if (next == NULL || _RB(next->dword[0], 9, 8) != NVM_FUSE_SECOND)
+            {
+                return SC_ABORTED_FUSED_MISS;
+            }
+
+            status = io_command(emu, cmd);
+            sq->fused_first = true;
+            sq->fused_failed = status != SC_SUCCESS;
+            return status;
+
+        case NVM_FUSE_SECOND:
+            if (!first)
+            {
+                return SC_ABORTED_FUSED_MISS;
+            }
+            else if (failed)
+            {
+                return SC_ABORTED_FUSED_FAIL;
+            }
+            return io_command(emu, cmd);
+
+        default:
+            return SC_INVALID_FIELD;
+    }
+}
+
+
+
+/*
+ * Check if a completion queue is full.
+ */
+static bool cq_full(struct nvm_emu* emu, const struct emu_queue* cq)
+{
+    uint32_t head = read_doorbell(emu, cq->no, true);
+    return (cq->tail + 1) % cq->max_entries == head;
+}
+
+
+
+/*
+ * Post a completion to the completion queue associated with an SQ.
+ */
+static void post_completion(struct nvm_emu* emu, const struct emu_queue* sq, uint16_t cid, uint32_t result, uint16_t status)
+{
+    struct emu_queue* cq = &emu->cqs[sq->cq_no];
+    volatile uint32_t* cpl = (volatile uint32_t*) queue_entry(emu, cq, cq->tail);
+
+    cpl[0] = result;
+    cpl[1] = 0;
+    cpl[2] = (((uint32_t) sq->no) << 16) | sq->head;
+
+    // Make sure completion is visible before phase tag is flipped
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    cpl[3] = (((uint32_t) status) << 17) | (((uint32_t) cq->phase) << 16) | cid;
+
+    if (++cq->tail == cq->max_entries)
+    {
+        cq->tail = 0;
+        cq->phase = !cq->phase;
+    }
+}
+
+
+
+/*
+ * Process commands in a submission queue.
+ * Returns the number of commands processed.
+ */
+static size_t process_queue(struct nvm_emu* emu, struct emu_queue* sq)
+{
+    size_t n_cmds = 0;
+    uint32_t tail = read_doorbell(emu, sq->no, false);
+
+    if (tail >= sq->max_entries)
+    {
+        // Invalid doorbell write, ignore it
+        return 0;
+    }
+
+    // Do not read commands before doorbell
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    while (sq->head != tail && sq->enabled && emu->cqs[sq->cq_no].enabled)
+    {
+        const struct emu_queue* cq = &emu->cqs[sq->cq_no];
+        if (cq_full(emu, cq))
+        {
+            break;
+        }
+
+        nvm_cmd_t cmd;
+        memcpy(&cmd, queue_entry(emu, sq, sq->head), sizeof(nvm_cmd_t));
+
+        uint32_t next = (sq->head + 1) % sq->max_entries;
+        const nvm_cmd_t* next_cmd = next != tail ? (const nvm_cmd_t*) queue_entry(emu, sq, next) : NULL;
+
+        // Both commands of a fused operation must be submitted together
+        if (sq->no != 0 && _RB(cmd.dword[0], 9, 8) == NVM_FUSE_FIRST && next_cmd == NULL)
+        {
+            break;
+        }
+
+        sq->head = next;
+
+        uint32_t result = 0;
+        uint16_t status;
+
+        if (sq->no == 0)
+        {
+            status = admin_command(emu, &cmd, &result);
+        }
+        else
+        {
+            status = fused_command(emu, sq, &cmd, next_cmd);
+        }
+
+        post_completion(emu, sq, *NVM_CMD_CID(&cmd), result, status);
+        ++n_cmds;
+    }
+
+    return n_cmds;
+}
+
+
+
+/*
+ * Disable all queues and reset controller state.
+ */
+static void reset_state(struct nvm_emu* emu)
+{
+    for (uint16_t i = 0; i < EMU_MAX_QUEUES; ++i)
+    {
+        emu->sqs[i].enabled = false;
+        emu->cqs[i].enabled = false;
+        *SQ_DBL(emu->bar, i, 0) = 0;
+        *CQ_DBL(emu->bar, i, 0) = 0;
+    }
+
+    emu->n_sqs = EMU_MAX_QUEUES - 1;
+    emu->n_cqs = EMU_MAX_QUEUES - 1;
+    emu->shadow = NULL;
+    emu->event_idx = NULL;
+    emu->enabled = false;
+    emu->shutdown = false;
+}
+
+
+
+/*
+ * Check controller configuration register and enable or disable the
+ * controller if CC.EN has changed.
+ */
+static void update_state(struct nvm_emu* emu)
+{
+    uint32_t cc = *CC(emu->bar);
+    bool enable = !!_RB(cc, 0, 0);
+
+    if (enable && !emu->enabled)
+    {
+        uint32_t aqa = *AQA(emu->bar);
+        uint32_t mps = _RB(cc, 10, 7);
+
+        reset_state(emu);
+
+        if (mps > EMU_MPS_MAX)
+        {
+            *CSTS(emu->bar) = 0x02; // Controller fatal status
+            return;
+        }
+
+        emu->page_size = 1UL << (12 + mps);
+
+        init_queue(&emu->sqs[0], 0, _RB(aqa, 11, 0) + 1, sizeof(nvm_cmd_t), *ASQ(emu->bar), true);
+        init_queue(&emu->cqs[0], 0, _RB(aqa, 27, 16) + 1, sizeof(nvm_cpl_t), *ACQ(emu->bar), true);
+
+        emu->enabled = true;
+        *CSTS(emu->bar) = 0x01;
+    }
+    else if (!enable && emu->enabled)
+    {
+        reset_state(emu);
+        *CSTS(emu->bar) = 0x00;
+    }
+    else if (emu->enabled && !emu->shutdown && _RB(cc, 15, 14) != 0)
+    {
+        // Commands are completed as soon as they are processed, so there is nothing to flush
+        emu->shutdown = true;
+        *CSTS(emu->bar) = 0x01 | (0x02 << 2);
+    }
+}
+
+
+
+/*
+ * Service thread routine.
+ */
+static void* run_service(struct nvm_emu* emu)
+{
+    size_t idle = 0;
+
+    while (!__atomic_load_n(&emu->stop, __ATOMIC_ACQUIRE))
+    {
+        size_t n_cmds = 0;
+
+        update_state(emu);
+
+        if (emu->enabled && !emu->shutdown)
+        {
+            for (uint16_t i = 0; i < EMU_MAX_QUEUES; ++i)
+            {
+                if (emu->sqs[i].enabled)
+                {
+                    n_cmds += process_queue(emu, &emu->sqs[i]);
+                }
+            }
+        }
+
+        if (n_cmds > 0)
+        {
+            idle = 0;
+        }
+        else if (++idle >= EMU_IDLE_SPINS)
+        {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = EMU_IDLE_SLEEP };
+            nanosleep(&ts, NULL);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    return emu;
+}
+
+
+
+/*
+ * Helper function to set up namespace backing storage.
+ */
+static int create_namespace(struct nvm_emu* emu, const char* path, size_t n_blocks)
+{
+    if (path == NULL)
+    {
+        if (n_blocks == 0)
+        {
+            return EINVAL;
+        }
+
+        emu->ns_mem = calloc(n_blocks, emu->block_size);
+        if (emu->ns_mem == NULL)
+        {
+            dprintf("Failed to allocate namespace memory: %s\n", strerror(errno));
+            return ENOMEM;
+        }
+
+        emu->n_blocks = n_blocks;
+        return 0;
+    }
+
+    emu->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (emu->fd < 0)
+    {
+        dprintf("Failed to open backing file: %s\n", strerror(errno));
+        return errno;
+    }
+
+    struct stat s;
+    if (fstat(emu->fd, &s) != 0)
+    {
+        dprintf("Failed to stat backing file: %s\n", strerror(errno));
+        return errno;
+    }
+
+    if (n_blocks == 0)
+    {
+        n_blocks = s.st_size / emu->block_size;
+    }
+    else if ((size_t) s.st_size < n_blocks * emu->block_size && ftruncate(emu->fd, n_blocks * emu->block_size) != 0)
+    {
+        dprintf("Failed to resize backing file: %s\n", strerror(errno));
+        return errno;
+    }
+
+    if (n_blocks == 0)
+    {
+        dprintf("Backing file is empty\n");
+        return EINVAL;
+    }
+
+    emu->n_blocks = n_blocks;
+    return 0;
+}
+
+
+
+/*
+ * Helper function to release emulator resources.
+ */
+static void remove_emulator(struct nvm_emu* emu)
+{
+    if (emu->fd >= 0)
+    {
+        close(emu->fd);
+    }
+
+    free(emu->ns_mem);
+    free(emu->metadata);
+    free(emu->bad_blocks);
+    free((void*) emu->bar);
+    free(emu);
+}
+
+
+
+int nvm_emu_create(struct nvm_emu** handle, const char* path, size_t n_blocks, size_t block_size)
+{
+    return nvm_emu_create_pi(handle, path, n_blocks, block_size, 0);
+}
+
+
+
+int nvm_emu_create_pi(struct nvm_emu** handle, const char* path, size_t n_blocks, size_t block_size, uint8_t pi_type)
+{
+    int err;
+    void* bar;
+
+    *handle = NULL;
+
+    if (block_size < 512 || (block_size & (block_size - 1)) != 0 || pi_type > 3)
+    {
+        return EINVAL;
+    }
+
+    struct nvm_emu* emu = (struct nvm_emu*) calloc(1, sizeof(struct nvm_emu));
+    if (emu == NULL)
+    {
+        dprintf("Failed to allocate emulator handle: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    emu->fd = -1;
+    emu->block_size = block_size;
+    emu->pi_type = pi_type;
+    emu->page_size = 1UL << (12 + EMU_MPS_MIN);
+
+    err = posix_memalign(&bar, 0x1000, EMU_BAR_SIZE);
+    if (err != 0)
+    {
+        free(emu);
+        dprintf("Failed to allocate BAR memory: %s\n", strerror(err));
+        return err;
+    }
+
+    memset(bar, 0, EMU_BAR_SIZE);
+    emu->bar = bar;
+    emu->bar_size = EMU_BAR_SIZE;
+
+    err = create_namespace(emu, path, n_blocks);
+    if (err != 0)
+    {
+        remove_emulator(emu);
+        return err;
+    }
+
+    emu->bad_blocks = calloc((emu->n_blocks + 7) / 8, 1);
+    if (emu->bad_blocks == NULL)
+    {
+        remove_emulator(emu);
+        dprintf("Failed to allocate block bitmap: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    if (pi_type != 0)
+    {
+        emu->metadata = calloc(emu->n_blocks, sizeof(nvm_pi_t));
+        if (emu->metadata == NULL)
+        {
+            remove_emulator(emu);
+            dprintf("Failed to allocate metadata: %s\n", strerror(errno));
+            return ENOMEM;
+        }
+    }
+
+    *CAP(emu->bar) = _WB((uint64_t) EMU_MPS_MAX, 55, 52)
+        | _WB((uint64_t) EMU_MPS_MIN, 51, 48)
+        | _WB((uint64_t) 1, 37, 37)                 // CSS: NVM command set
+        | _WB((uint64_t) 0, 35, 32)                 // DSTRD
+        | _WB((uint64_t) EMU_TIMEOUT, 31, 24)
+        | _WB((uint64_t) EMU_MAX_ENTRIES - 1, 15, 0);
+    *VER(emu->bar) = EMU_VERSION;
+
+    // Controller memory buffer follows the doorbells, in 4 KiB units
+    *CMBLOC(emu->bar) = _WB(EMU_CMB_OFFSET >> 12, 31, 12) | _WB(0, 2, 0);
+    *CMBSZ(emu->bar) = _WB(EMU_CMB_SIZE >> 12, 31, 12)
+        | _WB(0, 11, 8)                             // SZU: 4 KiB
+        | _WB(1, 2, 2)                              // LISTS: PRP lists
+        | _WB(1, 0, 0);                             // SQS: submission queues
+
+    reset_state(emu);
+
+    err = pthread_create(&emu->thread, NULL, (void* (*)(void*)) run_service, emu);
+    if (err != 0)
+    {
+        remove_emulator(emu);
+        dprintf("Failed to start service thread: %s\n", strerror(err));
+        return err;
+    }
+
+    *handle = emu;
+    return 0;
+}
+
+
+
+void nvm_emu_destroy(struct nvm_emu* emu)
+{
+    if (emu != NULL)
+    {
+        __atomic_store_n(&emu->stop, true, __ATOMIC_RELEASE);
+        pthread_join(emu->thread, NULL);
+        remove_emulator(emu);
+    }
+}
+
+
+
+volatile void* nvm_emu_bar(const struct nvm_emu* emu, size_t* size)
+{
+    if (size != NULL)
+    {
+        *size = emu->bar_size;
+    }
+
+    return emu->bar;
+}
+
+
+
+int nvm_emu_ctrl_init(nvm_ctrl_t** ctrl, struct nvm_emu* emu)
+{
+    *ctrl = NULL;
+
+    if (emu == NULL)
+    {
+        return EINVAL;
+    }
+
+    return _nvm_ctrl_init_emulated(ctrl, emu->bar, emu->bar_size);
+}
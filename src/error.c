@@ -22,7 +22,7 @@ static const char* generic_status[] =
     "Invalid namespace or format",
     "Command sequence error",
     "Invalid SGL segment descriptor",
-    "Invalid number of SQL descriptors",
+    "Invalid number of SGL descriptors",
     "Data SGL length invalid",
     "Metadata SGL length invalid",
     "SGL descriptor type invalid",
@@ -0,0 +1,316 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <nvm_dma.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "ctrl.h"
+#include "dma.h"
+#include "vfio.h"
+#include "ioctl.h"
+#include "util.h"
+#include "dprintf.h"
+
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT          26
+#endif
+
+/* Hugepage size used if system default can not be determined */
+#define DEFAULT_HUGE_PAGE_SIZE  (1UL << 21)
+
+
+
+/*
+ * Hugepage memory mapping descriptor.
+ * Describes hugepage memory allocated by the library.
+ */
+struct huge_mapping
+{
+    struct dma_map      mapping;        // DMA mapping descriptor
+    int                 ioctl_fd;       // File descriptor to kernel module (-1 if not used)
+    bool                mapped;         // Indicates if memory is mapped by the kernel module
+    struct vfio_mapping* vfio;          // VFIO mapping (NULL if not used)
+};
+
+
+
+/*
+ * Look up the system's default hugepage size.
+ */
+static size_t default_huge_page_size()
+{
+    char line[128];
+    size_t size = 0;
+
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL)
+    {
+        return DEFAULT_HUGE_PAGE_SIZE;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (sscanf(line, "Hugepagesize: %zu kB", &size) == 1)
+        {
+            size <<= 10;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return size != 0 ? size : DEFAULT_HUGE_PAGE_SIZE;
+}
+
+
+
+/*
+ * Unmap hugepages for the controller and release memory.
+ */
+static void remove_huge_mapping(struct huge_mapping* md)
+{
+    if (md->vfio != NULL)
+    {
+        _nvm_vfio_unmap(md->vfio);
+    }
+
+    if (md->mapped)
+    {
+        uint64_t addr = (uint64_t) md->mapping.vaddr;
+        if (ioctl(md->ioctl_fd, NVM_UNMAP_MEMORY, &addr) < 0)
+        {
+            dprintf("Page unmapping kernel request failed: %s\n", strerror(errno));
+        }
+    }
+
+    if (md->ioctl_fd >= 0)
+    {
+        close(md->ioctl_fd);
+    }
+
+    munmap(md->mapping.vaddr, md->mapping.page_size * md->mapping.n_pages);
+    free(md);
+}
+
+
+
+/*
+ * Retrieve bus address extents of hugepages using the kernel module.
+ * Every hugepage is mapped once, and contiguous hugepages are coalesced.
+ */
+static int map_ioctl(struct huge_mapping* md, int fd, size_t* n_runs, uint64_t* ioaddrs, size_t* sizes)
+{
+    md->ioctl_fd = dup(fd);
+    if (md->ioctl_fd < 0)
+    {
+        dprintf("Failed to duplicate file descriptor: %s\n", strerror(errno));
+        return EBADF;
+    }
+
+    struct nvm_ioctl_extent* extents = calloc(md->mapping.n_pages, sizeof(struct nvm_ioctl_extent));
+    if (extents == NULL)
+    {
+        dprintf("Failed to allocate extent list: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    struct nvm_ioctl_map_host request = {
+        .vaddr_start = (uint64_t) md->mapping.vaddr,
+        .n_pages = md->mapping.n_pages,
+        .n_extents = md->mapping.n_pages,
+        .extents = extents
+    };
+
+    if (ioctl(md->ioctl_fd, NVM_MAP_HOST_HUGEPAGES, &request) < 0)
+    {
+        int err = errno;
+        free(extents);
+        dprintf("Page mapping kernel request failed: %s\n", strerror(err));
+        return err;
+    }
+
+    md->mapped = true;
+
+    for (size_t i = 0; i < request.n_extents; ++i)
+    {
+        ioaddrs[i] = extents[i].ioaddr;
+        sizes[i] = extents[i].size;
+    }
+
+    *n_runs = request.n_extents;
+    free(extents);
+    return 0;
+}
+
+
+
+/*
+ * Retrieve physical addresses of hugepages by reading the page map.
+ * Physical addresses are used as bus addresses for manually mapped controllers.
+ */
+static int map_pagemap(const struct huge_mapping* md, uint64_t* ioaddrs)
+{
+    size_t host_page_size = _nvm_host_page_size();
+    uint64_t entry;
+
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+    {
+        dprintf("Failed to open page map: %s\n", strerror(errno));
+        return errno;
+    }
+
+    for (size_t i = 0; i < md->mapping.n_pages; ++i)
+    {
+        uint64_t vaddr = (uint64_t) NVM_PTR_OFFSET(md->mapping.vaddr, md->mapping.page_size, i);
+        off_t offset = (vaddr / host_page_size) * sizeof(uint64_t);
+
+        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry))
+        {
+            dprintf("Failed to read page map: %s\n", strerror(errno));
+            close(fd);
+            return EIO;
+        }
+
+        // Page frame number is zero if we lack permissions
+        if (!(entry & (1ULL << 63)) || (entry & ((1ULL << 55) - 1)) == 0)
+        {
+            dprintf("Page frame number is not available\n");
+            close(fd);
+            return EPERM;
+        }
+
+        ioaddrs[i] = (entry & ((1ULL << 55) - 1)) * host_page_size;
+    }
+
+    close(fd);
+    return 0;
+}
+
+
+
+/*
+ * Allocate hugepage memory and create an extent-based DMA mapping descriptor.
+ */
+int nvm_dma_ext_alloc_huge(nvm_dma_ext_t** handle, const nvm_ctrl_t* ctrl, size_t size, size_t huge_page_size)
+{
+    int err;
+    int fd = -1;
+    struct vfio_device* dev = _nvm_vfio_from_ctrl(ctrl);
+
+    *handle = NULL;
+
+    if (huge_page_size == 0)
+    {
+        huge_page_size = default_huge_page_size();
+    }
+
+    if (size == 0 || (huge_page_size & (huge_page_size - 1)) != 0 || huge_page_size % ctrl->page_size != 0)
+    {
+        return EINVAL;
+    }
+
+    if (!_nvm_ctrl_emulated(ctrl) && !_nvm_ctrl_raw(ctrl) && dev == NULL)
+    {
+        fd = _nvm_fd_from_ctrl(ctrl);
+        if (fd < 0)
+        {
+            dprintf("Controller does not support hugepage mapping\n");
+            return EBADF;
+        }
+    }
+
+    struct huge_mapping* md = malloc(sizeof(struct huge_mapping));
+    if (md == NULL)
+    {
+        dprintf("Failed to allocate mapping descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    md->mapping.page_size = huge_page_size;
+    md->mapping.n_pages = NVM_PAGE_ALIGN(size, huge_page_size) / huge_page_size;
+    md->ioctl_fd = -1;
+    md->mapped = false;
+    md->vfio = NULL;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE | MAP_LOCKED;
+    flags |= (__builtin_ctzl(huge_page_size) << MAP_HUGE_SHIFT);
+
+    md->mapping.vaddr = mmap(NULL, md->mapping.page_size * md->mapping.n_pages, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (md->mapping.vaddr == MAP_FAILED)
+    {
+        err = errno;
+        free(md);
+        dprintf("Failed to allocate hugepages: %s\n", strerror(err));
+        return err;
+    }
+
+    size_t n_runs = md->mapping.n_pages;
+    uint64_t* ioaddrs = calloc(md->mapping.n_pages, sizeof(uint64_t));
+    size_t* sizes = calloc(md->mapping.n_pages, sizeof(size_t));
+    if (ioaddrs == NULL || sizes == NULL)
+    {
+        free(ioaddrs);
+        free(sizes);
+        remove_huge_mapping(md);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < md->mapping.n_pages; ++i)
+    {
+        sizes[i] = huge_page_size;
+    }
+
+    if (_nvm_ctrl_emulated(ctrl))
+    {
+        // Emulated controllers use virtual addresses as bus addresses
+        for (size_t i = 0; i < md->mapping.n_pages; ++i)
+        {
+            ioaddrs[i] = (uint64_t) NVM_PTR_OFFSET(md->mapping.vaddr, huge_page_size, i);
+        }
+        err = 0;
+    }
+    else if (dev != NULL)
+    {
+        // Hugepages are mapped as one contiguous IO address range
+        err = _nvm_vfio_map(&md->vfio, dev, md->mapping.vaddr, huge_page_size, md->mapping.n_pages);
+        if (err == 0)
+        {
+            n_runs = 1;
+            ioaddrs[0] = md->vfio->iova;
+            sizes[0] = huge_page_size * md->mapping.n_pages;
+        }
+    }
+    else if (fd >= 0)
+    {
+        err = map_ioctl(md, fd, &n_runs, ioaddrs, sizes);
+    }
+    else
+    {
+        err = map_pagemap(md, ioaddrs);
+    }
+
+    if (err == 0)
+    {
+        err = _nvm_dma_ext_create(handle, ctrl, &md->mapping, (dma_map_free_t) remove_huge_mapping, n_runs, ioaddrs, sizes);
+    }
+
+    free(ioaddrs);
+    free(sizes);
+
+    if (err != 0)
+    {
+        remove_huge_mapping(md);
+        return err;
+    }
+
+    return 0;
+}
@@ -0,0 +1,268 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "identify.h"
+#include "util.h"
+
+
+
+/* Field is copied as is, for strings and identifiers */
+#define FIELD_BYTES         0x01
+
+/* Field is 0's based */
+#define FIELD_ZEROS_BASED   0x02
+
+/* Field is a power of two, reported as the exponent */
+#define FIELD_LOG2          0x04
+
+/* Field is a flag, any non-zero value is stored as 1 */
+#define FIELD_BOOL          0x08
+
+
+/* All bits of a field */
+#define ALL                 63, 0
+
+
+
+/*
+ * Description of a field in an identify data structure and the structure
+ * member it is parsed into.
+ */
+struct identify_field
+{
+    uint16_t        offset;         // Byte offset in identify data
+    uint8_t         size;           // Size of field in bytes
+    uint8_t         hi;             // Most significant bit of value
+    uint8_t         lo;             // Least significant bit of value
+    uint8_t         flags;          // How the value is converted
+    size_t          member;         // Offset of structure member
+    size_t          member_size;    // Size of structure member
+};
+
+
+#define FIELD(type, member, offset, size, hi, lo, flags) \
+    { (offset), (size), (hi), (lo), (flags), offsetof(type, member), sizeof(((type*) 0)->member) }
+
+#define CTRL(member, offset, size, ...) \
+    FIELD(struct nvm_ctrl_info, member, offset, size, __VA_ARGS__)
+
+#define NS(member, offset, size, ...) \
+    FIELD(struct nvm_ns_info, member, offset, size, __VA_ARGS__)
+
+#define LBAF(member, offset, size, ...) \
+    FIELD(struct nvm_lba_format, member, offset, size, __VA_ARGS__)
+
+
+
+/* Identify Controller data structure (CNS 01h) */
+static const struct identify_field ctrl_fields[] =
+{
+    CTRL(pci_vendor,        0,   4,  ALL,   FIELD_BYTES),       // VID and SSVID
+    CTRL(serial_no,         4,   20, ALL,   FIELD_BYTES),       // SN
+    CTRL(model_no,          24,  40, ALL,   FIELD_BYTES),       // MN
+    CTRL(firmware,          64,  8,  ALL,   FIELD_BYTES),       // FR
+    CTRL(ctrl_id,           78,  2,  ALL,   0),                 // CNTLID
+    CTRL(admin_cmds,        256, 2,  ALL,   0),                 // OACS
+    CTRL(abort_limit,       258, 1,  ALL,   FIELD_ZEROS_BASED), // ACL
+    CTRL(sq_entry_size,     512, 1,  3, 0,  FIELD_LOG2),        // SQES required
+    CTRL(max_sq_entry_size, 512, 1,  7, 4,  FIELD_LOG2),        // SQES maximum
+    CTRL(cq_entry_size,     513, 1,  3, 0,  FIELD_LOG2),        // CQES required
+    CTRL(max_cq_entry_size, 513, 1,  7, 4,  FIELD_LOG2),        // CQES maximum
+    CTRL(max_out_cmds,      514, 2,  ALL,   0),                 // MAXCMD
+    CTRL(max_n_ns,          516, 4,  ALL,   0),                 // NN
+    CTRL(nvm_cmds,          520, 2,  ALL,   0),                 // ONCS
+    CTRL(fused_ops,         522, 2,  ALL,   0),                 // FUSES
+    CTRL(volatile_cache,    525, 1,  0, 0,  FIELD_BOOL),        // VWC
+    CTRL(atomic_write,      526, 2,  ALL,   FIELD_ZEROS_BASED), // AWUN
+    CTRL(atomic_write_pf,   528, 2,  ALL,   FIELD_ZEROS_BASED), // AWUPF
+    CTRL(atomic_cmp_write,  532, 2,  ALL,   FIELD_ZEROS_BASED), // ACWU
+    CTRL(sgl_support,       536, 4,  1, 0,  FIELD_BOOL)         // SGLS
+};
+
+
+
+/* Identify Namespace data structure (CNS 00h) */
+static const struct identify_field ns_fields[] =
+{
+    NS(size,                0,   8,  ALL,   0),                 // NSZE
+    NS(capacity,            8,   8,  ALL,   0),                 // NCAP
+    NS(utilization,         16,  8,  ALL,   0),                 // NUSE
+    NS(features,            24,  1,  ALL,   0),                 // NSFEAT
+    NS(n_lba_formats,       25,  1,  ALL,   FIELD_ZEROS_BASED), // NLBAF
+    NS(format_idx,          26,  1,  3, 0,  0),                 // FLBAS format
+    NS(extended_lba,        26,  1,  4, 4,  FIELD_BOOL),        // FLBAS extended LBA
+    NS(pi_caps,             28,  1,  ALL,   0),                 // DPC
+    NS(pi_type,             29,  1,  2, 0,  0),                 // DPS type
+    NS(pi_first,            29,  1,  3, 3,  FIELD_BOOL),        // DPS location
+    NS(atomic_write,        34,  2,  ALL,   FIELD_ZEROS_BASED), // NAWUN
+    NS(atomic_write_pf,     36,  2,  ALL,   FIELD_ZEROS_BASED), // NAWUPF
+    NS(atomic_cmp_write,    38,  2,  ALL,   FIELD_ZEROS_BASED), // NACWU
+    NS(io_boundary,         46,  2,  ALL,   0),                 // NOIOB
+    NS(write_granularity,   64,  2,  ALL,   FIELD_ZEROS_BASED), // NPWG
+    NS(write_alignment,     66,  2,  ALL,   FIELD_ZEROS_BASED), // NPWA
+    NS(dealloc_granularity, 68,  2,  ALL,   FIELD_ZEROS_BASED), // NPDG
+    NS(dealloc_alignment,   70,  2,  ALL,   FIELD_ZEROS_BASED), // NPDA
+    NS(optimal_write_size,  72,  2,  ALL,   FIELD_ZEROS_BASED), // NOWS
+    NS(nguid,               104, 16, ALL,   FIELD_BYTES),       // NGUID
+    NS(eui64,               120, 8,  ALL,   FIELD_BYTES)        // EUI64
+};
+
+
+
+/* LBA format data structure (LBAF0-LBAF15 of Identify Namespace) */
+static const struct identify_field lba_format_fields[] =
+{
+    LBAF(metadata_size,     0,   2,  ALL,   0),                 // MS
+    LBAF(lba_data_size,     2,   1,  ALL,   FIELD_LOG2),        // LBADS
+    LBAF(performance,       3,   1,  1, 0,  0)                  // RP
+};
+
+
+#define N_FIELDS(fields)    (sizeof(fields) / sizeof(struct identify_field))
+
+#define N_LBA_FORMATS       (sizeof(((struct nvm_ns_info*) 0)->lba_formats) / sizeof(struct nvm_lba_format))
+
+
+
+/*
+ * Helper function to parse fields from identify data into a structure.
+ * Multi-byte values are little-endian.
+ */
+static void parse_fields(void* info, const unsigned char* data, const struct identify_field* fields, size_t n_fields)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < n_fields; ++i)
+    {
+        const struct identify_field* field = &fields[i];
+        unsigned char* member = ((unsigned char*) info) + field->member;
+
+        if (field->flags & FIELD_BYTES)
+        {
+            memcpy(member, data + field->offset, _MIN(field->size, field->member_size));
+            continue;
+        }
+
+        uint64_t value = 0;
+        for (j = field->size; j > 0; --j)
+        {
+            value = (value << 8) | data[field->offset + j - 1];
+        }
+
+        value = _RB(value, field->hi, field->lo);
+
+        if (field->flags & FIELD_ZEROS_BASED)
+        {
+            value += 1;
+        }
+
+        if (field->flags & FIELD_LOG2)
+        {
+            value = value < 64 ? 1ULL << value : 0;
+        }
+
+        if (field->flags & FIELD_BOOL)
+        {
+            value = !!value;
+        }
+
+        switch (field->member_size)
+        {
+            case sizeof(uint8_t):
+                *((uint8_t*) member) = (uint8_t) value;
+                break;
+
+            case sizeof(uint16_t):
+                *((uint16_t*) member) = (uint16_t) value;
+                break;
+
+            case sizeof(uint32_t):
+                *((uint32_t*) member) = (uint32_t) value;
+                break;
+
+            case sizeof(uint64_t):
+                *((uint64_t*) member) = value;
+                break;
+        }
+    }
+}
+
+
+
+void _nvm_identify_ctrl(struct nvm_ctrl_info* info, const void* data)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+
+    parse_fields(info, bytes, ctrl_fields, N_FIELDS(ctrl_fields));
+
+    info->sgl_dword_align = _RB(bytes[536], 1, 0) == 2;
+}
+
+
+
+void _nvm_identify_ns(struct nvm_ns_info* info, const void* data)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t i;
+
+    parse_fields(info, bytes, ns_fields, N_FIELDS(ns_fields));
+
+    // Only LBAF0-LBAF15 are in this data structure, although NLBAF may count up to 64 formats
+    info->n_lba_formats = _MIN(info->n_lba_formats, N_LBA_FORMATS);
+    if (info->format_idx >= N_LBA_FORMATS)
+    {
+        info->format_idx = 0;
+    }
+
+    for (i = 0; i < _MAX(info->n_lba_formats, info->format_idx + 1); ++i)
+    {
+        parse_fields(&info->lba_formats[i], bytes + 128 + 4 * i, lba_format_fields, N_FIELDS(lba_format_fields));
+    }
+
+    info->lba_data_size = info->lba_formats[info->format_idx].lba_data_size;
+    info->metadata_size = info->lba_formats[info->format_idx].metadata_size;
+
+    // Atomicity fields are only valid if NSFEAT bit 1 is set
+    if (!_RB(info->features, 1, 1))
+    {
+        info->atomic_write = 0;
+        info->atomic_write_pf = 0;
+        info->atomic_cmp_write = 0;
+    }
+
+    // Performance fields are only valid if NSFEAT bit 4 is set
+    if (!_RB(info->features, 4, 4))
+    {
+        info->write_granularity = 0;
+        info->write_alignment = 0;
+        info->dealloc_granularity = 0;
+        info->dealloc_alignment = 0;
+        info->optimal_write_size = 0;
+    }
+}
+
+
+
+size_t _nvm_identify_ns_list(uint32_t* ns_ids, size_t max_ids, const void* data)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t n_ids = 0;
+
+    while (n_ids < max_ids && n_ids < IDENTIFY_DATA_SIZE / sizeof(uint32_t))
+    {
+        const unsigned char* entry = bytes + n_ids * sizeof(uint32_t);
+        uint32_t ns_id = entry[0] | (entry[1] << 8) | (entry[2] << 16) | (((uint32_t) entry[3]) << 24);
+
+        if (ns_id == 0)
+        {
+            break;
+        }
+
+        ns_ids[n_ids++] = ns_id;
+    }
+
+    return n_ids;
+}
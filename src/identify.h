@@ -0,0 +1,41 @@
+#ifndef __NVM_INTERNAL_IDENTIFY_H__
+#define __NVM_INTERNAL_IDENTIFY_H__
+
+#include <nvm_types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/* Size of identify data structures */
+#define IDENTIFY_DATA_SIZE  0x1000
+
+
+
+/*
+ * Parse an Identify Controller data structure.
+ * Only fields found in the identify data are set, register values and
+ * values derived from them are left untouched.
+ */
+void _nvm_identify_ctrl(struct nvm_ctrl_info* info, const void* data);
+
+
+
+/*
+ * Parse an Identify Namespace data structure.
+ * Fields that are not valid according to NSFEAT are set to 0.
+ */
+void _nvm_identify_ns(struct nvm_ns_info* info, const void* data);
+
+
+
+/*
+ * Parse an Active Namespace ID list.
+ * Up to max_ids identifiers are copied to ns_ids, and the number of
+ * identifiers copied is returned.
+ */
+size_t _nvm_identify_ns_list(uint32_t* ns_ids, size_t max_ids, const void* data);
+
+
+
+#endif /* __NVM_INTERNAL_IDENTIFY_H__ */
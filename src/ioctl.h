@@ -8,7 +8,16 @@
 
 
 
-/* Memory map request */
+/*
+ * Offset used to mmap() BAR bir through the device file.
+ * Offset 0 is the start of BAR0, for compatibility with older versions.
+ */
+#define NVM_IOCTL_BAR_SHIFT     40
+#define NVM_IOCTL_BAR_OFFSET(bir)   (((uint64_t) (bir)) << NVM_IOCTL_BAR_SHIFT)
+
+
+
+/* Device memory map request */
 struct nvm_ioctl_map
 {
     uint64_t    vaddr_start;
@@ -18,14 +27,46 @@ struct nvm_ioctl_map
 
 
 
+/* Mapped memory extent */
+struct nvm_ioctl_extent
+{
+    uint64_t    ioaddr;         // Bus address of extent
+    uint64_t    size;           // Size of extent (in bytes)
+};
+
+
+
+/* Host memory map request */
+struct nvm_ioctl_map_host
+{
+    uint64_t                    vaddr_start;
+    size_t                      n_pages;        // Number of pages (hugepages for NVM_MAP_HOST_HUGEPAGES)
+    size_t                      n_extents;      // Size of extent list, set to number of extents on return
+    struct nvm_ioctl_extent*    extents;        // Bus address extents
+};
+
+
+
+/* BAR information request */
+struct nvm_ioctl_bar
+{
+    uint32_t    bir;            // BAR indicator (BAR register number)
+    uint64_t    ioaddr;         // Bus address of BAR (set on return)
+    uint64_t    size;           // Size of BAR (set on return)
+};
+
+
+
 /* Supported operations */
 enum nvm_ioctl_type
 {
-    NVM_MAP_HOST_MEMORY         = _IOW(NVM_IOCTL_TYPE, 1, struct nvm_ioctl_map),
+    NVM_MAP_HOST_MEMORY         = _IOWR(NVM_IOCTL_TYPE, 1, struct nvm_ioctl_map_host),
 #ifdef _CUDA
     NVM_MAP_DEVICE_MEMORY       = _IOW(NVM_IOCTL_TYPE, 2, struct nvm_ioctl_map),
 #endif
-    NVM_UNMAP_MEMORY            = _IOW(NVM_IOCTL_TYPE, 3, uint64_t)
+    NVM_UNMAP_MEMORY            = _IOW(NVM_IOCTL_TYPE, 3, uint64_t),
+    NVM_MAP_HOST_HUGEPAGES      = _IOWR(NVM_IOCTL_TYPE, 4, struct nvm_ioctl_map_host),
+    NVM_GET_BAR                 = _IOWR(NVM_IOCTL_TYPE, 5, struct nvm_ioctl_bar)
 };
 
 
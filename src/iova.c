@@ -0,0 +1,216 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "iova.h"
+#include "dprintf.h"
+
+
+
+/*
+ * Free address range.
+ */
+struct iova_range
+{
+    struct iova_range*  next;       // Pointer to next range in list
+    uint64_t            start;      // First address in range
+    uint64_t            end;        // First address after range
+};
+
+
+
+/*
+ * Helper function to insert a free range into the sorted list and merge it
+ * with adjacent ranges.
+ * Lock must be held when calling this function.
+ */
+static int insert_range(struct iova_allocator* alloc, uint64_t start, uint64_t end)
+{
+    struct iova_range* prev = NULL;
+    struct iova_range* next = alloc->free;
+
+    while (next != NULL && next->start < start)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    if ((prev != NULL && prev->end > start) || (next != NULL && next->start < end))
+    {
+        dprintf("IOVA range overlaps free range\n");
+        return EINVAL;
+    }
+
+    bool merge_prev = prev != NULL && prev->end == start;
+    bool merge_next = next != NULL && next->start == end;
+
+    if (merge_prev && merge_next)
+    {
+        prev->end = next->end;
+        prev->next = next->next;
+        free(next);
+    }
+    else if (merge_prev)
+    {
+        prev->end = end;
+    }
+    else if (merge_next)
+    {
+        next->start = start;
+    }
+    else
+    {
+        struct iova_range* range = (struct iova_range*) malloc(sizeof(struct iova_range));
+        if (range == NULL)
+        {
+            dprintf("Failed to allocate IOVA range: %s\n", strerror(errno));
+            return ENOMEM;
+        }
+
+        range->start = start;
+        range->end = end;
+        range->next = next;
+
+        if (prev != NULL)
+        {
+            prev->next = range;
+        }
+        else
+        {
+            alloc->free = range;
+        }
+    }
+
+    return 0;
+}
+
+
+
+int _nvm_iova_init(struct iova_allocator* alloc)
+{
+    alloc->free = NULL;
+    return pthread_mutex_init(&alloc->lock, NULL);
+}
+
+
+
+void _nvm_iova_destroy(struct iova_allocator* alloc)
+{
+    struct iova_range* range = alloc->free;
+
+    while (range != NULL)
+    {
+        struct iova_range* next = range->next;
+        free(range);
+        range = next;
+    }
+
+    alloc->free = NULL;
+    pthread_mutex_destroy(&alloc->lock);
+}
+
+
+
+int _nvm_iova_add_range(struct iova_allocator* alloc, uint64_t start, uint64_t size)
+{
+    if (size == 0 || start + size < start)
+    {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&alloc->lock);
+    int err = insert_range(alloc, start, start + size);
+    pthread_mutex_unlock(&alloc->lock);
+
+    return err;
+}
+
+
+
+int _nvm_iova_alloc(struct iova_allocator* alloc, uint64_t size, uint64_t align, uint64_t* iova)
+{
+    struct iova_range* prev = NULL;
+    struct iova_range* range;
+
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0)
+    {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&alloc->lock);
+
+    for (range = alloc->free; range != NULL; prev = range, range = range->next)
+    {
+        uint64_t start = (range->start + align - 1) & ~(align - 1);
+
+        if (start < range->start || start >= range->end || range->end - start < size)
+        {
+            continue;
+        }
+
+        uint64_t end = start + size;
+
+        if (start == range->start && end == range->end)
+        {
+            // Range is used up
+            if (prev != NULL)
+            {
+                prev->next = range->next;
+            }
+            else
+            {
+                alloc->free = range->next;
+            }
+            free(range);
+        }
+        else if (start == range->start)
+        {
+            range->start = end;
+        }
+        else if (end == range->end)
+        {
+            range->end = start;
+        }
+        else
+        {
+            // Split range in two, keeping the alignment padding free
+            struct iova_range* tail = (struct iova_range*) malloc(sizeof(struct iova_range));
+            if (tail == NULL)
+            {
+                pthread_mutex_unlock(&alloc->lock);
+                dprintf("Failed to allocate IOVA range: %s\n", strerror(errno));
+                return ENOMEM;
+            }
+
+            tail->start = end;
+            tail->end = range->end;
+            tail->next = range->next;
+            range->end = start;
+            range->next = tail;
+        }
+
+        pthread_mutex_unlock(&alloc->lock);
+        *iova = start;
+        return 0;
+    }
+
+    pthread_mutex_unlock(&alloc->lock);
+    return ENOMEM;
+}
+
+
+
+void _nvm_iova_free(struct iova_allocator* alloc, uint64_t iova, uint64_t size)
+{
+    pthread_mutex_lock(&alloc->lock);
+
+    if (insert_range(alloc, iova, iova + size) != 0)
+    {
+        dprintf("Failed to release IOVA range %llx\n", (unsigned long long) iova);
+    }
+
+    pthread_mutex_unlock(&alloc->lock);
+}
@@ -0,0 +1,68 @@
+#ifndef __NVM_INTERNAL_IOVA_H__
+#define __NVM_INTERNAL_IOVA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+/* Forward declaration */
+struct iova_range;
+
+
+
+/*
+ * IO virtual address (IOVA) allocator.
+ *
+ * Keeps a sorted list of free address ranges, and hands out address ranges
+ * first-fit. Freed ranges are merged with their neighbours.
+ * The allocator does not know anything about the IOMMU, so it can be used
+ * (and tested) without hardware.
+ */
+struct iova_allocator
+{
+    pthread_mutex_t     lock;       // Ensure exclusive access to the free list
+    struct iova_range*  free;       // Sorted list of free ranges
+};
+
+
+
+/*
+ * Initialize an empty allocator.
+ */
+int _nvm_iova_init(struct iova_allocator* alloc);
+
+
+
+/*
+ * Release all ranges and destroy allocator.
+ */
+void _nvm_iova_destroy(struct iova_allocator* alloc);
+
+
+
+/*
+ * Make an address range available for allocation.
+ * The range must not overlap ranges already made available.
+ */
+int _nvm_iova_add_range(struct iova_allocator* alloc, uint64_t start, uint64_t size);
+
+
+
+/*
+ * Allocate an address range of the specified size.
+ * The start address is aligned to align, which must be a power of two.
+ * Returns ENOMEM if no free range is large enough.
+ */
+int _nvm_iova_alloc(struct iova_allocator* alloc, uint64_t size, uint64_t align, uint64_t* iova);
+
+
+
+/*
+ * Release an address range previously returned by _nvm_iova_alloc().
+ */
+void _nvm_iova_free(struct iova_allocator* alloc, uint64_t iova, uint64_t size);
+
+
+
+#endif /* __NVM_INTERNAL_IOVA_H__ */
@@ -0,0 +1,237 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <nvm_cmd.h>
+#include <nvm_pi.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <pthread.h>
+#include "dprintf.h"
+
+
+/* CRC16 T10-DIF generator polynomial */
+#define CRC16_T10DIF_POLY   0x8bb7
+
+
+/* Escape values that disable checking of a block */
+#define ESCAPE_APP_TAG      0xffff
+#define ESCAPE_REF_TAG      0xffffffff
+
+
+
+/*
+ * Lookup tables for calculating the CRC eight bytes at the time.
+ * Table k holds the CRC of a byte followed by k zero bytes.
+ */
+static uint16_t crc_tables[8][256];
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+
+
+/*
+ * Location of data and metadata of a block.
+ */
+struct block_layout
+{
+    size_t              data_stride;    // Distance between blocks in data buffer
+    size_t              md_stride;      // Distance between blocks in metadata buffer
+    size_t              md_offset;      // Offset to metadata within block (extended LBA)
+    size_t              pi_offset;      // Offset to protection information within metadata
+};
+
+
+
+static void create_crc_tables(void)
+{
+    uint32_t i;
+    uint32_t bit;
+    uint32_t k;
+
+    for (i = 0; i < 256; ++i)
+    {
+        uint16_t crc = i << 8;
+
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ CRC16_T10DIF_POLY : crc << 1;
+        }
+
+        crc_tables[0][i] = crc;
+    }
+
+    for (k = 1; k < 8; ++k)
+    {
+        for (i = 0; i < 256; ++i)
+        {
+            uint16_t crc = crc_tables[k - 1][i];
+            crc_tables[k][i] = (crc << 8) ^ crc_tables[0][crc >> 8];
+        }
+    }
+}
+
+
+
+uint16_t nvm_crc16_t10dif(uint16_t crc, const void* data, size_t size)
+{
+    const unsigned char* ptr = (const unsigned char*) data;
+
+    pthread_once(&crc_tables_once, create_crc_tables);
+
+    while (size >= 8)
+    {
+        crc ^= (ptr[0] << 8) | ptr[1];
+
+        crc = crc_tables[7][crc >> 8] ^ crc_tables[6][crc & 0xff]
+            ^ crc_tables[5][ptr[2]] ^ crc_tables[4][ptr[3]]
+            ^ crc_tables[3][ptr[4]] ^ crc_tables[2][ptr[5]]
+            ^ crc_tables[1][ptr[6]] ^ crc_tables[0][ptr[7]];
+
+        ptr += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0)
+    {
+        crc = (crc << 8) ^ crc_tables[0][(crc >> 8) ^ *ptr++];
+    }
+
+    return crc;
+}
+
+
+
+/*
+ * Helper function to find where data and protection information of each
+ * block is located.
+ */
+static int get_layout(struct block_layout* layout, const struct nvm_ns_info* ns, const void* metadata)
+{
+    if (ns->pi_type == 0 || ns->metadata_size < sizeof(nvm_pi_t))
+    {
+        dprintf("Namespace is not formatted with protection information\n");
+        return EINVAL;
+    }
+
+    if (!ns->extended_lba && metadata == NULL)
+    {
+        dprintf("Namespace requires a separate metadata buffer\n");
+        return EINVAL;
+    }
+
+    layout->data_stride = NVM_NS_BLOCK_SIZE(ns);
+    layout->md_stride = ns->extended_lba ? layout->data_stride : ns->metadata_size;
+    layout->md_offset = ns->extended_lba ? ns->lba_data_size : 0;
+    layout->pi_offset = ns->pi_first ? 0 : ns->metadata_size - sizeof(nvm_pi_t);
+
+    return 0;
+}
+
+
+
+/*
+ * Helper function to calculate the guard of a block. If protection
+ * information is last in the metadata, the preceding metadata is covered
+ * by the guard.
+ */
+static uint16_t calculate_guard(const struct nvm_ns_info* ns, const struct block_layout* layout, const unsigned char* data, const unsigned char* md)
+{
+    uint16_t crc = nvm_crc16_t10dif(0, data, ns->lba_data_size);
+    return nvm_crc16_t10dif(crc, md, layout->pi_offset);
+}
+
+
+
+int nvm_pi_generate(const struct nvm_ns_info* ns, void* data, void* metadata, size_t n_blocks, uint32_t ref_tag, uint16_t app_tag)
+{
+    struct block_layout layout;
+    size_t i;
+
+    int err = get_layout(&layout, ns, metadata);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    unsigned char* md_base = ns->extended_lba ? (unsigned char*) data : (unsigned char*) metadata;
+
+    for (i = 0; i < n_blocks; ++i)
+    {
+        const unsigned char* block = ((const unsigned char*) data) + layout.data_stride * i;
+        unsigned char* md = md_base + layout.md_stride * i + layout.md_offset;
+        nvm_pi_t pi;
+
+        pi.guard = htobe16(calculate_guard(ns, &layout, block, md));
+        pi.app_tag = htobe16(app_tag);
+        pi.ref_tag = htobe32(ns->pi_type == 3 ? ref_tag : ref_tag + (uint32_t) i);
+
+        memcpy(md + layout.pi_offset, &pi, sizeof(pi));
+    }
+
+    return 0;
+}
+
+
+
+int nvm_pi_verify(const struct nvm_ns_info* ns, const void* data, const void* metadata, size_t n_blocks, uint32_t ref_tag, uint16_t app_tag, uint16_t app_mask, uint8_t prinfo, size_t* bad_block)
+{
+    struct block_layout layout;
+    size_t i;
+
+    int err = get_layout(&layout, ns, metadata);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    const unsigned char* md_base = ns->extended_lba ? (const unsigned char*) data : (const unsigned char*) metadata;
+
+    for (i = 0; i < n_blocks; ++i)
+    {
+        const unsigned char* block = ((const unsigned char*) data) + layout.data_stride * i;
+        const unsigned char* md = md_base + layout.md_stride * i + layout.md_offset;
+        nvm_pi_t pi;
+
+        memcpy(&pi, md + layout.pi_offset, sizeof(pi));
+
+        uint16_t block_app_tag = be16toh(pi.app_tag);
+        uint32_t block_ref_tag = be32toh(pi.ref_tag);
+        uint32_t expected_ref_tag = ns->pi_type == 3 ? ref_tag : ref_tag + (uint32_t) i;
+
+        // Skip blocks with escape values
+        if (block_app_tag == ESCAPE_APP_TAG && (ns->pi_type != 3 || block_ref_tag == ESCAPE_REF_TAG))
+        {
+            continue;
+        }
+
+        bool ok = true;
+
+        if ((prinfo & NVM_PRINFO_CHECK_GUARD) && be16toh(pi.guard) != calculate_guard(ns, &layout, block, md))
+        {
+            ok = false;
+        }
+
+        if ((prinfo & NVM_PRINFO_CHECK_APP) && ((block_app_tag ^ app_tag) & app_mask) != 0)
+        {
+            ok = false;
+        }
+
+        if ((prinfo & NVM_PRINFO_CHECK_REF) && block_ref_tag != expected_ref_tag)
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            if (bad_block != NULL)
+            {
+                *bad_block = i;
+            }
+            return EIO;
+        }
+    }
+
+    return 0;
+}
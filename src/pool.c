@@ -0,0 +1,206 @@
+#include <nvm_types.h>
+#include <nvm_pool.h>
+#include <nvm_cmd.h>
+#include <nvm_util.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "util.h"
+#include "dprintf.h"
+
+
+
+/*
+ * PRP list pool.
+ */
+struct nvm_prp_pool
+{
+    pthread_mutex_t         lock;           // Ensure exclusive access to free list
+    const nvm_dma_t*        dma;            // PRP list memory
+    size_t                  page_offset;    // Offset to first PRP list page
+    size_t                  n_pages;        // Number of PRP list pages
+    size_t                  n_free;         // Number of free pages
+    size_t*                 next_pages;     // Next page in chain for pages in use
+    size_t                  free_pages[];   // Stack of free page indices
+};
+
+
+
+/* Marks the last page in a chain of PRP list pages */
+#define POOL_CHAIN_END      ((size_t) -1)
+
+
+
+int nvm_prp_pool_create(struct nvm_prp_pool** handle, const nvm_dma_t* dma, size_t page_offset, size_t n_pages)
+{
+    *handle = NULL;
+
+    if (dma == NULL || dma->vaddr == NULL || n_pages == 0 || page_offset + n_pages > dma->n_ioaddrs)
+    {
+        return EINVAL;
+    }
+
+    struct nvm_prp_pool* pool = (struct nvm_prp_pool*) malloc(sizeof(struct nvm_prp_pool) + 2 * n_pages * sizeof(size_t));
+    if (pool == NULL)
+    {
+        dprintf("Failed to allocate PRP list pool: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    int err = pthread_mutex_init(&pool->lock, NULL);
+    if (err != 0)
+    {
+        free(pool);
+        dprintf("Failed to initialize mutex: %s\n", strerror(err));
+        return err;
+    }
+
+    pool->dma = dma;
+    pool->page_offset = page_offset;
+    pool->n_pages = n_pages;
+    pool->n_free = n_pages;
+    pool->next_pages = &pool->free_pages[n_pages];
+
+    for (size_t i = 0; i < n_pages; ++i)
+    {
+        pool->free_pages[i] = page_offset + n_pages - 1 - i;
+        pool->next_pages[i] = POOL_CHAIN_END;
+    }
+
+    *handle = pool;
+    return 0;
+}
+
+
+
+void nvm_prp_pool_free(struct nvm_prp_pool* pool)
+{
+    if (pool != NULL)
+    {
+        if (pool->n_free != pool->n_pages)
+        {
+            dprintf("PRP list pool freed with %zu pages in use\n", pool->n_pages - pool->n_free);
+        }
+
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+    }
+}
+
+
+
+/*
+ * Take a chain of pages from the pool, either all or none.
+ * Returns the first page index, or POOL_CHAIN_END if not enough pages are free.
+ */
+static size_t take_chain(struct nvm_prp_pool* pool, size_t n_pages)
+{
+    size_t first = POOL_CHAIN_END;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->n_free >= n_pages)
+    {
+        // Take pages in reverse order so the chain is built front to back
+        for (size_t i = 0; i < n_pages; ++i)
+        {
+            size_t page = pool->free_pages[--pool->n_free];
+            pool->next_pages[page - pool->page_offset] = first;
+            first = page;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return first;
+}
+
+
+
+int nvm_prp_pool_get(struct nvm_prp_pool* pool, void** list_ptr, uint64_t* list_ioaddr)
+{
+    size_t page = take_chain(pool, 1);
+
+    if (page == POOL_CHAIN_END)
+    {
+        return EAGAIN;
+    }
+
+    *list_ptr = NVM_DMA_OFFSET(pool->dma, page);
+    *list_ioaddr = pool->dma->ioaddrs[page];
+    return 0;
+}
+
+
+
+void nvm_prp_pool_put(struct nvm_prp_pool* pool, void* list_ptr)
+{
+    const nvm_dma_t* dma = pool->dma;
+    size_t page = (((unsigned char*) list_ptr) - ((unsigned char*) dma->vaddr)) / dma->page_size;
+
+    if (list_ptr == NULL || page < pool->page_offset || page >= pool->page_offset + pool->n_pages)
+    {
+        dprintf("Page does not belong to PRP list pool\n");
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (page != POOL_CHAIN_END)
+    {
+        size_t next = pool->next_pages[page - pool->page_offset];
+        pool->next_pages[page - pool->page_offset] = POOL_CHAIN_END;
+        pool->free_pages[pool->n_free++] = page;
+        page = next;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+int nvm_prp_pool_cmd_data(struct nvm_prp_pool* pool, nvm_cmd_t* cmd, size_t n_pages, const uint64_t* data_ioaddrs, void** list_ptr)
+{
+    const nvm_dma_t* dma = pool->dma;
+    size_t n_lists = nvm_prp_num_lists(dma->page_size, n_pages);
+    size_t prps_per_page = dma->page_size / sizeof(uint64_t);
+    size_t page;
+    size_t prp;
+
+    *list_ptr = NULL;
+
+    if (n_lists == 0)
+    {
+        nvm_cmd_data(cmd, dma->page_size, n_pages, NULL, 0, data_ioaddrs);
+        return 0;
+    }
+
+    if (n_lists > pool->n_pages)
+    {
+        return EINVAL;
+    }
+
+    page = take_chain(pool, n_lists);
+    if (page == POOL_CHAIN_END)
+    {
+        return EAGAIN;
+    }
+
+    *list_ptr = NVM_DMA_OFFSET(dma, page);
+    nvm_cmd_data_ptr(cmd, data_ioaddrs[0], dma->ioaddrs[page]);
+
+    // Fill list pages one by one, linking the last entry to the next page
+    for (prp = 1; page != POOL_CHAIN_END; page = pool->next_pages[page - pool->page_offset])
+    {
+        void* list = NVM_DMA_OFFSET(dma, page);
+        size_t next = pool->next_pages[page - pool->page_offset];
+
+        prp += nvm_prp_list_chain(dma->page_size, n_pages - prp, 1, &list, &dma->ioaddrs[page], &data_ioaddrs[prp]);
+
+        if (next != POOL_CHAIN_END)
+        {
+            ((uint64_t*) list)[prps_per_page - 1] = dma->ioaddrs[next];
+        }
+    }
+
+    return 0;
+}
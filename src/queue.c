@@ -3,13 +3,18 @@
 #include <nvm_util.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
 #include "regs.h"
 #include "util.h"
+#include "wait.h"
+#include "dprintf.h"
 
 
 
-void nvm_queue_clear(nvm_queue_t* queue, const nvm_ctrl_t* ctrl, bool cq, uint16_t no, void* vaddr, uint64_t ioaddr)
+void nvm_queue_clear(nvm_queue_t* queue, const nvm_ctrl_t* ctrl, bool cq, uint16_t no, uint16_t qs, void* vaddr, uint64_t ioaddr)
 {
     queue->no = no;
     queue->max_entries = 0;
@@ -18,25 +23,143 @@ void nvm_queue_clear(nvm_queue_t* queue, const nvm_ctrl_t* ctrl, bool cq, uint16
     queue->tail = 0;
     queue->phase = 1;
     queue->last = 0;
+    queue->contiguous = 1;
     queue->vaddr = vaddr;
     queue->ioaddr = ioaddr;
     queue->db = cq ? CQ_DBL(ctrl->mm_ptr, queue->no, ctrl->dstrd) : SQ_DBL(ctrl->mm_ptr, queue->no, ctrl->dstrd);
-    queue->max_entries = _MIN(ctrl->max_entries, ctrl->page_size / queue->entry_size);
+    queue->shadow = NULL;
+    queue->event_idx = NULL;
+
+    if (qs == 0)
+    {
+        qs = ctrl->page_size / queue->entry_size;
+    }
+
+    queue->max_entries = _MIN(ctrl->max_entries, qs);
+}
+
+
+
+int nvm_queue_dbbuf(nvm_queue_t* queue, const nvm_ctrl_t* ctrl, const nvm_dma_t* dma, size_t page_offset)
+{
+    // Shadow doorbells have the same offset as the doorbell registers
+    size_t offset = ((volatile unsigned char*) queue->db) - (((volatile unsigned char*) ctrl->mm_ptr) + 0x1000);
+
+    if (queue->no == 0 || dma == NULL || dma->vaddr == NULL || dma->page_size != ctrl->page_size 
+            || dma->n_ioaddrs < page_offset + 2 || offset + sizeof(uint32_t) > dma->page_size)
+    {
+        return EINVAL;
+    }
+
+    unsigned char* shadow_page = ((unsigned char*) dma->vaddr) + page_offset * dma->page_size;
+
+    queue->shadow = (volatile uint32_t*) (shadow_page + offset);
+    queue->event_idx = (volatile uint32_t*) (shadow_page + dma->page_size + offset);
+
+    // Queue is newly created, so the doorbell value is still the initial one
+    *queue->shadow = queue->last;
+    return 0;
 }
 
 
 
 nvm_cpl_t* nvm_cq_dequeue_block(nvm_queue_t* cq, uint64_t timeout)
 {
-    uint64_t nsecs = timeout * 1000000UL;
+    struct wait_state wait;
     nvm_cpl_t* cpl = nvm_cq_dequeue(cq);
 
-    while (cpl == NULL && nsecs > 0)
+    _nvm_wait_start(&wait, timeout * 1000000UL);
+
+    while (cpl == NULL && _nvm_wait(&wait))
     {
-        nsecs = _nvm_delay_remain(nsecs);
         cpl = nvm_cq_dequeue(cq);
     }
 
     return cpl;
 }
 
+
+
+int nvm_sq_mp_create(nvm_sq_mp_t** handle, nvm_queue_t* sq)
+{
+    *handle = NULL;
+
+    if (sq->head != sq->tail || sq->max_entries < 2)
+    {
+        return EINVAL;
+    }
+
+    nvm_sq_mp_t* mp = NULL;
+    int err = posix_memalign((void**) &mp, 64, sizeof(nvm_sq_mp_t) + sq->max_entries * sizeof(uint64_t));
+    if (err != 0)
+    {
+        dprintf("Failed to allocate multi-producer SQ descriptor: %s\n", strerror(err));
+        return err;
+    }
+
+    memset(mp, 0, sizeof(nvm_sq_mp_t) + sq->max_entries * sizeof(uint64_t));
+    mp->sq = sq;
+    mp->reserved = sq->tail;
+    mp->head = sq->tail;
+    mp->submitted = sq->tail;
+    mp->lock = 0;
+
+    *handle = mp;
+    return 0;
+}
+
+
+
+void nvm_sq_mp_free(nvm_sq_mp_t* mp)
+{
+    free(mp);
+}
+
+
+
+int nvm_cid_table_create(nvm_cid_table_t** handle, size_t size)
+{
+    *handle = NULL;
+
+    if (size == 0 || size > 0x10000)
+    {
+        return EINVAL;
+    }
+
+    // Place context array first so that it is cache-line aligned
+    size_t ctx_size = NVM_PAGE_ALIGN(size * sizeof(void*), 64);
+    size_t total_size = sizeof(nvm_cid_table_t) + ctx_size + size * sizeof(uint16_t) + size;
+
+    void* ptr = NULL;
+    int err = posix_memalign(&ptr, 64, total_size);
+    if (err != 0)
+    {
+        dprintf("Failed to allocate CID table: %s\n", strerror(err));
+        return err;
+    }
+
+    memset(ptr, 0, total_size);
+
+    nvm_cid_table_t* table = (nvm_cid_table_t*) ptr;
+    table->contexts = (void**) (table + 1);
+    table->free_cids = (uint16_t*) (((unsigned char*) table->contexts) + ctx_size);
+    table->busy = (uint8_t*) (table->free_cids + size);
+    table->size = size;
+    table->n_free = size;
+
+    // Hand out low CIDs first
+    for (size_t i = 0; i < size; ++i)
+    {
+        table->free_cids[i] = (uint16_t) (size - 1 - i);
+    }
+
+    *handle = table;
+    return 0;
+}
+
+
+
+void nvm_cid_table_free(nvm_cid_table_t* table)
+{
+    free(table);
+}
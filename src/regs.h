@@ -13,6 +13,8 @@
 #define AQA(p)          _REG(p, 0x0024, 32)     // Admin Queue Attributes
 #define ASQ(p)          _REG(p, 0x0028, 64)     // Admin Submission Queue Base Address
 #define ACQ(p)          _REG(p, 0x0030, 64)     // Admin Completion Queue Base Address
+#define CMBLOC(p)       _REG(p, 0x0038, 32)     // Controller Memory Buffer Location
+#define CMBSZ(p)        _REG(p, 0x003c, 32)     // Controller Memory Buffer Size
 
 
 /* Read bit fields */
@@ -24,17 +26,30 @@
 #define CAP$MQES(p)     _RB(*CAP(p), 15,  0)    // Maximum Queue Entries Supported
 
 #define CSTS$RDY(p)     _RB(*CSTS(p), 0,  0)    // Ready indicator
+#define CSTS$SHST(p)    _RB(*CSTS(p), 3,  2)    // Shutdown Status
+
+#define CMBLOC$OFST(p)  _RB(*CMBLOC(p), 31, 12) // Offset (in CMBSZ.SZU units)
+#define CMBLOC$BIR(p)   _RB(*CMBLOC(p),  2,  0) // Base Indicator Register
+
+#define CMBSZ$SZ(p)     _RB(*CMBSZ(p), 31, 12)  // Size (in CMBSZ.SZU units)
+#define CMBSZ$SZU(p)    _RB(*CMBSZ(p), 11,  8)  // Size Units (4 KiB * 16^SZU)
+#define CMBSZ$WDS(p)    _RB(*CMBSZ(p),  4,  4)  // Write Data Support
+#define CMBSZ$RDS(p)    _RB(*CMBSZ(p),  3,  3)  // Read Data Support
+#define CMBSZ$LISTS(p)  _RB(*CMBSZ(p),  2,  2)  // PRP SGL List Support
+#define CMBSZ$CQS(p)    _RB(*CMBSZ(p),  1,  1)  // Completion Queue Support
+#define CMBSZ$SQS(p)    _RB(*CMBSZ(p),  0,  0)  // Submission Queue Support
 
 
 /* Write bit fields */
 #define CC$IOCQES(v)    _WB(v, 23, 20)          // IO Completion Queue Entry Size
 #define CC$IOSQES(v)    _WB(v, 19, 16)          // IO Submission Queue Entry Size
+#define CC$SHN(v)       _WB(v, 15, 14)          // Shutdown Notification
 #define CC$MPS(v)       _WB(v, 10,  7)          // Memory Page Size
 #define CC$CSS(v)       _WB(0,  3,  1)          // IO Command Set Selected (0=NVM Command Set)
 #define CC$EN(v)        _WB(v,  0,  0)          // Enable
 
-#define AQA$AQS(v)      _WB(v, 27, 16)          // Admin Completion Queue Size
-#define AQA$AQC(v)      _WB(v, 11,  0)          // Admin Submission Queue Size
+#define AQA$AQS(v)      _WB(v, 11,  0)          // Admin Submission Queue Size
+#define AQA$AQC(v)      _WB(v, 27, 16)          // Admin Completion Queue Size
 
 
 /* SQ doorbell register offset */
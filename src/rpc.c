@@ -25,12 +25,58 @@
 #include <string.h>
 #include "dis/device.h"
 #include "rpc.h"
+#include "admin.h"
 #include "ctrl.h"
 #include "util.h"
+#include "wait.h"
 #include "dprintf.h"
 
 
 
+/*
+ * State of an admin command slot.
+ */
+enum admin_slot_state
+{
+    _SLOT_PENDING       = 0x01,     // Command is submitted, waiting for completion
+    _SLOT_DONE          = 0x02,     // Completion is received, waiting to be collected
+    _SLOT_ABANDONED     = 0x03      // Waiting for completion timed out, release CID on completion
+};
+
+
+
+/*
+ * IO queue bookkeeping to do when an admin command completes.
+ */
+enum admin_queue_action
+{
+    _QUEUE_NONE         = 0x00,     // Command does not affect IO queues
+    _QUEUE_ALLOCATED    = 0x01,     // CQ identifier was picked by us, release it on failure
+    _QUEUE_RESERVED     = 0x02,     // CQ identifier was picked by caller, release it on failure
+    _QUEUE_DELETED      = 0x03,     // CQ is deleted, release identifier on success
+    _QUEUE_GRANTED      = 0x04      // Number of queues is set or read, update pool on success
+};
+
+
+
+/* Size of the IO queue identifier bitmap */
+#define _QID_MAP_WORDS      ((0xffff + 1) / 64)
+
+
+
+/*
+ * Outstanding admin command, indexed by command identifier.
+ */
+struct admin_slot
+{
+    enum admin_slot_state   state;  // Command state
+    enum admin_queue_action action; // IO queue bookkeeping on completion
+    uint16_t                qid;    // IO queue identifier affected by command
+    nvm_cpl_t               cpl;    // Copy of completion
+};
+
+
+
 /*
  * Local admin queue-pair descriptor.
  */
@@ -39,6 +85,10 @@ struct local_admin
     nvm_queue_t         acq;        // Admin completion queue (ACQ)
     nvm_queue_t         asq;        // Admin submission queue (ASQ)
     uint64_t            timeout;    // Controller timeout
+    nvm_cid_table_t*    cids;       // Command identifiers of outstanding commands
+    struct admin_slot*  slots;      // Outstanding commands indexed by CID
+    uint32_t            n_qids;     // Number of IO queue pairs granted by the controller
+    uint64_t            qids[_QID_MAP_WORDS]; // IO queue identifiers in use
 };
 
 
@@ -72,6 +122,7 @@ struct nvm_admin_reference
     void*                   data;       // Custom instance data
     rpc_deleter_t           release;    // Callback to release instance data
     rpc_stub_t              stub;       // Client-side stub
+    bool                    concurrent; // Stub may be called without holding the lock
 };
 
 
@@ -150,6 +201,12 @@ void _nvm_rpc_handle_remove(nvm_aq_ref ref, uint32_t key)
         curr = curr->next;
     }
 
+    if (curr == NULL)
+    {
+        pthread_mutex_unlock(&ref->lock);
+        return;
+    }
+
     if (prev != NULL)
     {
         prev->next = curr->next;
@@ -159,39 +216,43 @@ void _nvm_rpc_handle_remove(nvm_aq_ref ref, uint32_t key)
         ref->handles = curr->next;
     }
 
-    if (curr != NULL)
-    {
-        curr->release(curr->data, curr->key, --ref->n_handles);
-        free(curr);
-    }
+    int remaining = --ref->n_handles;
 
     pthread_mutex_unlock(&ref->lock);
+
+    // Handles may wait for threads that execute commands, so do not hold the lock
+    curr->release(curr->data, curr->key, remaining);
+    free(curr);
 }
 
 
 
 /*
  * Helper function to remove all server handles.
- * Lock must be held when calling this.
+ * Lock must not be held when calling this, as handles may wait for threads
+ * that execute commands using the reference.
  */
 static void release_handles(nvm_aq_ref ref)
 {
     struct rpc_handle* curr;
     struct rpc_handle* next;
 
-    if (ref != NULL)
-    {
-        curr = NULL;
-        next = ref->handles;
-        while (next != NULL)
-        {
-            curr = next;
-            next = curr->next;
-            curr->release(curr->data, curr->key, --ref->n_handles);
-            free(curr);
-        }
+    pthread_mutex_lock(&ref->lock);
+
+    next = ref->handles;
+    int remaining = ref->n_handles;
+
+    ref->handles = NULL;
+    ref->n_handles = 0;
+
+    pthread_mutex_unlock(&ref->lock);
 
-        ref->handles = NULL;
+    while (next != NULL)
+    {
+        curr = next;
+        next = curr->next;
+        curr->release(curr->data, curr->key, --remaining);
+        free(curr);
     }
 }
 
@@ -220,10 +281,12 @@ int _nvm_ref_get(nvm_aq_ref* handle, const nvm_ctrl_t* ctrl)
     }
 
     ref->ctrl = ctrl;
+    ref->n_handles = 0;
     ref->handles = NULL;
     ref->data = NULL;
     ref->release = NULL;
     ref->stub = NULL;
+    ref->concurrent = false;
 
     *handle = ref;
     return 0;
@@ -238,10 +301,10 @@ void _nvm_ref_put(nvm_aq_ref ref)
 {
     if (ref != NULL)
     {
-        pthread_mutex_lock(&ref->lock);
-
         release_handles(ref);
 
+        pthread_mutex_lock(&ref->lock);
+
         if (ref->release != NULL)
         {
             ref->release(ref->data, 0, 0);
@@ -256,44 +319,459 @@ void _nvm_ref_put(nvm_aq_ref ref)
 
 
 
-/* 
- * Execute an NVM admin command.
+/*
+ * Helper functions to look up and update the IO queue identifier bitmap.
+ */
+static inline bool qid_used(const struct local_admin* admin, uint16_t qid)
+{
+    return !!(admin->qids[qid / 64] & (1ULL << (qid % 64)));
+}
+
+
+static inline void qid_set(struct local_admin* admin, uint16_t qid, bool used)
+{
+    if (used)
+    {
+        admin->qids[qid / 64] |= 1ULL << (qid % 64);
+    }
+    else
+    {
+        admin->qids[qid / 64] &= ~(1ULL << (qid % 64));
+    }
+}
+
+
+
+/*
+ * Track IO queue identifiers used by a command before it is submitted.
+ * Create CQ commands with queue identifier 0 are assigned the lowest free
+ * identifier among the queue pairs granted by the controller (see
+ * query_queues()).
  * Lock must be held when calling this function.
  */
-static int execute_command(struct local_admin* admin, const nvm_cmd_t* cmd, nvm_cpl_t* cpl)
+static int track_queue(struct local_admin* admin, nvm_cmd_t* cmd, struct admin_slot* slot)
+{
+    uint8_t opcode = _RB(cmd->dword[0], 7, 0);
+    uint16_t qid = _RB(cmd->dword[10], 15, 0);
+
+    slot->action = _QUEUE_NONE;
+    slot->qid = qid;
+
+    switch (opcode)
+    {
+        case NVM_ADMIN_CREATE_COMPLETION_QUEUE:
+            if (qid == 0)
+            {
+                for (qid = 1; qid <= admin->n_qids && qid_used(admin, qid); ++qid);
+
+                if (qid > admin->n_qids)
+                {
+                    dprintf("No free IO queues (%u granted)\n", admin->n_qids);
+                    return ENOSPC;
+                }
+
+                cmd->dword[10] = (cmd->dword[10] & 0xffff0000) | qid;
+                slot->action = _QUEUE_ALLOCATED;
+                slot->qid = qid;
+            }
+            else if (!qid_used(admin, qid))
+            {
+                slot->action = _QUEUE_RESERVED;
+            }
+            else
+            {
+                // Let the controller decide
+                return 0;
+            }
+
+            qid_set(admin, qid, true);
+            return 0;
+
+        case NVM_ADMIN_DELETE_COMPLETION_QUEUE:
+            slot->action = _QUEUE_DELETED;
+            return 0;
+
+        case NVM_ADMIN_SET_FEATURES:
+        case NVM_ADMIN_GET_FEATURES:
+            if (_RB(cmd->dword[10], 7, 0) == 0x07)
+            {
+                slot->action = _QUEUE_GRANTED;
+            }
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+/*
+ * Release queue identifier picked for a command that failed.
+ * Lock must be held when calling this function.
+ */
+static void untrack_queue(struct local_admin* admin, const struct admin_slot* slot)
+{
+    if (slot->action == _QUEUE_ALLOCATED || slot->action == _QUEUE_RESERVED)
+    {
+        qid_set(admin, slot->qid, false);
+    }
+}
+
+
+
+/*
+ * Update IO queue identifiers when a command completes.
+ * Lock must be held when calling this function.
+ */
+static void update_queues(struct local_admin* admin, struct admin_slot* slot)
+{
+    bool success = NVM_ERR_OK(&slot->cpl);
+
+    switch (slot->action)
+    {
+        case _QUEUE_ALLOCATED:
+        case _QUEUE_RESERVED:
+            if (!success)
+            {
+                untrack_queue(admin, slot);
+            }
+            else if (slot->action == _QUEUE_ALLOCATED)
+            {
+                // Tell the caller which identifier it got
+                slot->cpl.dword[0] = slot->qid;
+            }
+            break;
+
+        case _QUEUE_DELETED:
+            if (success)
+            {
+                qid_set(admin, slot->qid, false);
+            }
+            break;
+
+        case _QUEUE_GRANTED:
+            if (success)
+            {
+                uint32_t n_sqs = _RB(slot->cpl.dword[0], 15, 0) + 1;
+                uint32_t n_cqs = _RB(slot->cpl.dword[0], 31, 16) + 1;
+                admin->n_qids = _MIN(_MIN(n_cqs, n_sqs), 0xffff);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+
+/*
+ * Collect all ready completions from the ACQ and match them with their
+ * outstanding commands using the command identifier.
+ * Lock must be held when calling this function.
+ */
+static void reap_completions(struct local_admin* admin)
 {
+    nvm_cpl_t* cpl;
+    struct admin_slot* slot;
+    uint16_t cid;
+    bool reaped = false;
+
+    while ((cpl = nvm_cq_dequeue(&admin->acq)) != NULL)
+    {
+        reaped = true;
+        admin->asq.head = *NVM_CPL_SQHD(cpl);
+
+        cid = *NVM_CPL_CID(cpl);
+        if (cid >= admin->cids->size || !admin->cids->busy[cid])
+        {
+            dprintf("Unexpected admin completion with CID %u\n", cid);
+            continue;
+        }
+
+        slot = &admin->slots[cid];
+        memcpy(&slot->cpl, (void*) cpl, sizeof(nvm_cpl_t));
+        update_queues(admin, slot);
+
+        if (slot->state == _SLOT_ABANDONED)
+        {
+            nvm_cid_complete(admin->cids, cid);
+            continue;
+        }
+
+        slot->state = _SLOT_DONE;
+    }
+
+    if (reaped)
+    {
+        nvm_cq_update(&admin->acq);
+    }
+}
+
+
+
+static int execute_command(struct local_admin* admin, const nvm_cmd_t* cmd, nvm_cpl_t* cpl);
+
+
+
+/*
+ * Ask the controller how many IO queues it has granted, if no Number of
+ * Queues completion has been seen yet. The count is picked up from the
+ * completion by update_queues().
+ * Lock must be held when calling this function.
+ */
+static int query_queues(struct local_admin* admin, const nvm_cmd_t* cmd)
+{
+    nvm_cmd_t command;
+    nvm_cpl_t completion;
+
+    if (admin->n_qids != 0
+            || _RB(cmd->dword[0], 7, 0) != NVM_ADMIN_CREATE_COMPLETION_QUEUE
+            || _RB(cmd->dword[10], 15, 0) != 0)
+    {
+        return 0;
+    }
+
+    memset(&command, 0, sizeof(command));
+    _nvm_admin_current_num_queues(&command, false, 0, 0);
+
+    // A failed command leaves the count at zero, so no identifier is picked
+    return execute_command(admin, &command, &completion);
+}
+
+
+
+/*
+ * Enqueue an admin command in the ASQ without ringing the doorbell.
+ * Lock must be held when calling this function.
+ */
+static int enqueue_command(struct local_admin* admin, const nvm_cmd_t* cmd, uint16_t* cid)
+{
+    nvm_cmd_t command;
     nvm_cmd_t* in_queue_cmd;
-    nvm_cpl_t* in_queue_cpl;
+    struct admin_slot* slot;
+
+    int err = query_queues(admin, cmd);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    // Number of CIDs is less than the queue size, so the ASQ has room
+    if (!nvm_cid_alloc(admin->cids, NULL, cid))
+    {
+        // Completions of abandoned commands may be waiting to release their CIDs
+        reap_completions(admin);
+
+        if (!nvm_cid_alloc(admin->cids, NULL, cid))
+        {
+            return EAGAIN;
+        }
+    }
+
+    slot = &admin->slots[*cid];
+
+    // Copy command so queue identifier can be assigned before it is visible to the controller
+    memcpy(&command, cmd, sizeof(nvm_cmd_t));
+
+    err = track_queue(admin, &command, slot);
+    if (err != 0)
+    {
+        nvm_cid_complete(admin->cids, *cid);
+        return err;
+    }
 
-    // Try to enqueue a message
     if ((in_queue_cmd = nvm_sq_enqueue(&admin->asq)) == NULL)
     {
-        // Queue was full, but we're holding the lock so no blocking
+        untrack_queue(admin, slot);
+        nvm_cid_complete(admin->cids, *cid);
         return EAGAIN;
     }
 
-    // Copy command into queue slot (but keep original id)
-    uint16_t in_queue_id = *NVM_CMD_CID(in_queue_cmd);
-    memcpy(in_queue_cmd, cmd, sizeof(nvm_cmd_t));
-    *NVM_CMD_CID(in_queue_cmd) = in_queue_id;
+    slot->state = _SLOT_PENDING;
+
+    // Copy command into queue slot and replace command identifier
+    memcpy(in_queue_cmd, &command, sizeof(nvm_cmd_t));
+    *NVM_CMD_CID(in_queue_cmd) = *cid;
+
+    return 0;
+}
+
+
+
+/*
+ * Check if an outstanding command has completed, and if so, release its
+ * command identifier and copy the completion.
+ * Lock must be held when calling this function.
+ */
+static int collect_completion(struct local_admin* admin, uint16_t cid, nvm_cpl_t* cpl)
+{
+    struct admin_slot* slot;
+
+    if (cid >= admin->cids->size || !admin->cids->busy[cid] || admin->slots[cid].state == _SLOT_ABANDONED)
+    {
+        return EINVAL;
+    }
+
+    slot = &admin->slots[cid];
+    if (slot->state != _SLOT_DONE)
+    {
+        reap_completions(admin);
+
+        if (slot->state != _SLOT_DONE)
+        {
+            return EAGAIN;
+        }
+    }
+
+    memcpy(cpl, &slot->cpl, sizeof(nvm_cpl_t));
+    nvm_cid_complete(admin->cids, cid);
+
+    return 0;
+}
+
+
+
+/*
+ * Stop waiting for an outstanding command. If the command has completed,
+ * its command identifier is released right away. Otherwise, it is released
+ * when the completion arrives.
+ * Lock must be held when calling this function.
+ */
+static int abandon_command(struct local_admin* admin, uint16_t cid)
+{
+    if (cid >= admin->cids->size || !admin->cids->busy[cid] || admin->slots[cid].state == _SLOT_ABANDONED)
+    {
+        return EINVAL;
+    }
+
+    reap_completions(admin);
+
+    if (admin->slots[cid].state == _SLOT_DONE)
+    {
+        nvm_cid_complete(admin->cids, cid);
+        return 0;
+    }
+
+    admin->slots[cid].state = _SLOT_ABANDONED;
+    return 0;
+}
+
+
+
+/* 
+ * Execute an NVM admin command.
+ * Lock must be held when calling this function.
+ */
+static int execute_command(struct local_admin* admin, const nvm_cmd_t* cmd, nvm_cpl_t* cpl)
+{
+    uint16_t cid;
+
+    int err = enqueue_command(admin, cmd, &cid);
+    if (err != 0)
+    {
+        // Queue was full, but we're holding the lock so no blocking
+        return err;
+    }
 
     // Submit command and wait for completion
     nvm_sq_submit(&admin->asq);
 
-    in_queue_cpl = nvm_cq_dequeue_block(&admin->acq, admin->timeout);
-    if (in_queue_cpl == NULL)
+    struct wait_state wait;
+    _nvm_wait_start(&wait, admin->timeout * 1000000UL);
+
+    while ((err = collect_completion(admin, cid, cpl)) == EAGAIN)
     {
-        dprintf("Waiting for admin queue completion timed out\n");
-        return ETIME;
+        if (!_nvm_wait(&wait))
+        {
+            // Release CID when the completion eventually arrives
+            abandon_command(admin, cid);
+            dprintf("Waiting for admin queue completion timed out\n");
+            return ETIME;
+        }
     }
 
-    nvm_sq_update(&admin->asq);
-
-    // Copy completion and return
-    memcpy(cpl, (void*) in_queue_cpl, sizeof(nvm_cpl_t));
+    // Return original command identifier
     *NVM_CPL_CID(cpl) = *NVM_CMD_CID(cmd);
+    return err;
+}
 
-    return 0;
+
+
+/*
+ * Abort outstanding admin commands and wait for them to complete, so that
+ * the controller is done with the admin queues before they are released.
+ * Lock must be held when calling this function.
+ */
+static void abort_commands(struct local_admin* admin)
+{
+    nvm_cmd_t command;
+    uint16_t cid;
+    bool submitted = false;
+
+    uint16_t* outstanding = (uint16_t*) calloc(admin->cids->size, sizeof(uint16_t));
+    if (outstanding == NULL)
+    {
+        return;
+    }
+
+    size_t n_outstanding = 0;
+    for (uint32_t i = 0; i < admin->cids->size; ++i)
+    {
+        if (admin->cids->busy[i] && admin->slots[i].state != _SLOT_DONE)
+        {
+            outstanding[n_outstanding++] = i;
+        }
+    }
+
+    for (size_t i = 0; i < n_outstanding; ++i)
+    {
+        memset(&command, 0, sizeof(command));
+        _nvm_admin_abort(&command, 0, outstanding[i]);
+
+        if (enqueue_command(admin, &command, &cid) != 0)
+        {
+            break;
+        }
+
+        // Nobody collects the abort completion
+        admin->slots[cid].state = _SLOT_ABANDONED;
+        submitted = true;
+    }
+
+    free(outstanding);
+
+    if (submitted)
+    {
+        nvm_sq_submit(&admin->asq);
+    }
+
+    // Wait until neither the aborted commands nor the aborts are outstanding
+    struct wait_state wait;
+    _nvm_wait_start(&wait, admin->timeout * 1000000UL);
+
+    while (true)
+    {
+        reap_completions(admin);
+
+        bool pending = false;
+        for (uint32_t i = 0; i < admin->cids->size && !pending; ++i)
+        {
+            pending = admin->cids->busy[i] && admin->slots[i].state != _SLOT_DONE;
+        }
+
+        if (!pending)
+        {
+            break;
+        }
+
+        if (!_nvm_wait(&wait))
+        {
+            dprintf("Outstanding admin commands did not complete\n");
+            break;
+        }
+    }
 }
 
 
@@ -311,14 +789,33 @@ static struct local_admin* create_admin(const nvm_ctrl_t* ctrl, const nvm_dma_t*
         return NULL;
     }
 
-    nvm_queue_clear(&admin->acq, ctrl, true, 0, window->vaddr, window->ioaddrs[0]);
+    nvm_queue_clear(&admin->acq, ctrl, true, 0, 0, window->vaddr, window->ioaddrs[0]);
 
     void* asq_vaddr = (void*) (((unsigned char*) window->vaddr) + window->page_size);
-    nvm_queue_clear(&admin->asq, ctrl, false, 0, asq_vaddr, window->ioaddrs[1]);
+    nvm_queue_clear(&admin->asq, ctrl, false, 0, 0, asq_vaddr, window->ioaddrs[1]);
 
     memset(window->vaddr, 0, 2 * window->page_size);
 
     admin->timeout = ctrl->timeout;
+    admin->n_qids = 0;
+    memset(admin->qids, 0, sizeof(admin->qids));
+
+    // One CID per ASQ slot, except the slot that indicates a full queue
+    int err = nvm_cid_table_create(&admin->cids, admin->asq.max_entries - 1);
+    if (err != 0)
+    {
+        free(admin);
+        return NULL;
+    }
+
+    admin->slots = (struct admin_slot*) calloc(admin->cids->size, sizeof(struct admin_slot));
+    if (admin->slots == NULL)
+    {
+        dprintf("Failed to allocate admin command slots: %s\n", strerror(errno));
+        nvm_cid_table_free(admin->cids);
+        free(admin);
+        return NULL;
+    }
 
     return admin;
 }
@@ -327,10 +824,16 @@ static struct local_admin* create_admin(const nvm_ctrl_t* ctrl, const nvm_dma_t*
 /*
  * Helper function to remove an admin descriptor.
  */
-static void remove_admin(const struct nvm_admin_reference* ref, struct local_admin* admin)
+static void remove_admin(void* data, uint32_t key, int remaining_handles)
 {
-    if (ref != NULL)
+    struct local_admin* admin = (struct local_admin*) data;
+    (void) key;
+    (void) remaining_handles;
+
+    if (admin != NULL)
     {
+        free(admin->slots);
+        nvm_cid_table_free(admin->cids);
         free(admin);
     }
 }
@@ -358,6 +861,18 @@ int nvm_raw_rpc(nvm_aq_ref ref, nvm_cmd_t* cmd, nvm_cpl_t* cpl)
         return NVM_ERR_PACK(NULL, EINVAL);
     }
 
+    if (ref->concurrent)
+    {
+        // Stub handles several outstanding commands itself
+        rpc_stub_t stub = ref->stub;
+        void* data = ref->data;
+
+        pthread_mutex_unlock(&ref->lock);
+
+        err = stub(data, cmd, cpl);
+        return NVM_ERR_PACK(cpl, err);
+    }
+
     err = ref->stub(ref->data, cmd, cpl);
 
     pthread_mutex_unlock(&ref->lock);
@@ -370,7 +885,7 @@ int nvm_raw_rpc(nvm_aq_ref ref, nvm_cmd_t* cmd, nvm_cpl_t* cpl)
 /*
  * Bind reference to remote handle.
  */
-int _nvm_rpc_bind(nvm_aq_ref ref, void* data, rpc_deleter_t release, rpc_stub_t stub)
+int _nvm_rpc_bind(nvm_aq_ref ref, void* data, rpc_deleter_t release, rpc_stub_t stub, bool concurrent)
 {
     int err;
 
@@ -391,6 +906,7 @@ int _nvm_rpc_bind(nvm_aq_ref ref, void* data, rpc_deleter_t release, rpc_stub_t
     ref->data = data;
     ref->release = release;
     ref->stub = stub;
+    ref->concurrent = concurrent;
 
     pthread_mutex_unlock(&ref->lock);
     return 0;
@@ -440,7 +956,7 @@ int nvm_aq_create(nvm_aq_ref* handle, const nvm_ctrl_t* ctrl, const nvm_dma_t* w
     }
 
     ref->stub = (rpc_stub_t) execute_command;
-    ref->release = (rpc_deleter_t) remove_admin;
+    ref->release = remove_admin;
 
     // Reset controller
     const struct local_admin* admin = (const struct local_admin*) ref->data;
@@ -456,11 +972,19 @@ void nvm_aq_destroy(nvm_aq_ref ref)
 {
     if (ref != NULL)
     {
-        //if (ref->stub == (rpc_stub_t) execute_command)
-        //{
-            // TODO: send abort command
-            _nvm_ref_put(ref);
-        //}
+        if (ref->stub == (rpc_stub_t) execute_command)
+        {
+            // Stop serving remote commands before tearing down
+            release_handles(ref);
+
+            pthread_mutex_lock(&ref->lock);
+            abort_commands((struct local_admin*) ref->data);
+            pthread_mutex_unlock(&ref->lock);
+
+            nvm_raw_ctrl_shutdown(ref->ctrl);
+        }
+
+        _nvm_ref_put(ref);
     }
 }
 
@@ -485,23 +1009,42 @@ const nvm_ctrl_t* nvm_ctrl_from_aq_ref(nvm_aq_ref ref)
 
 
 
-int _nvm_local_admin(nvm_aq_ref ref, const nvm_cmd_t* cmd, nvm_cpl_t* cpl)
+/*
+ * Helper function to take the lock of a local admin reference.
+ */
+static int lock_local(nvm_aq_ref ref, struct local_admin** admin)
 {
     int err = pthread_mutex_lock(&ref->lock);
     if (err != 0)
     {
         dprintf("Failed to take reference lock: %s\n", strerror(err));
-        return NVM_ERR_PACK(NULL, err);
+        return err;
     }
 
-    if (ref->stub != (rpc_stub_t) execute_command) 
+    if (ref->stub != (rpc_stub_t) execute_command)
     {
         pthread_mutex_unlock(&ref->lock);
         dprintf("Reference is not local descriptor\n");
-        return NVM_ERR_PACK(NULL, EINVAL);
+        return EINVAL;
     }
 
-    err = execute_command((struct local_admin*) ref->data, cmd, cpl);
+    *admin = (struct local_admin*) ref->data;
+    return 0;
+}
+
+
+
+int _nvm_local_admin(nvm_aq_ref ref, const nvm_cmd_t* cmd, nvm_cpl_t* cpl)
+{
+    struct local_admin* admin;
+
+    int err = lock_local(ref, &admin);
+    if (err != 0)
+    {
+        return NVM_ERR_PACK(NULL, err);
+    }
+
+    err = execute_command(admin, cmd, cpl);
 
     pthread_mutex_unlock(&ref->lock);
     return NVM_ERR_PACK(NULL, err);
@@ -520,3 +1063,106 @@ void nvm_rpc_unbind(nvm_aq_ref ref)
     }
 }
 
+
+
+/*
+ * Submit an admin command without waiting for completion.
+ */
+int nvm_admin_submit(nvm_aq_ref ref, const nvm_cmd_t* cmd, uint16_t* cid)
+{
+    struct local_admin* admin;
+
+    int err = lock_local(ref, &admin);
+    if (err != 0)
+    {
+        return NVM_ERR_PACK(NULL, err);
+    }
+
+    err = enqueue_command(admin, cmd, cid);
+    if (err == 0)
+    {
+        nvm_sq_submit(&admin->asq);
+    }
+
+    pthread_mutex_unlock(&ref->lock);
+    return NVM_ERR_PACK(NULL, err);
+}
+
+
+
+/*
+ * Poll for completion of an admin command submitted with nvm_admin_submit().
+ */
+int nvm_admin_poll(nvm_aq_ref ref, uint16_t cid, nvm_cpl_t* cpl, uint64_t timeout)
+{
+    struct local_admin* admin;
+    struct wait_state wait;
+
+    _nvm_wait_start(&wait, timeout * 1000000UL);
+
+    while (true)
+    {
+        int err = lock_local(ref, &admin);
+        if (err != 0)
+        {
+            return NVM_ERR_PACK(NULL, err);
+        }
+
+        err = collect_completion(admin, cid, cpl);
+        pthread_mutex_unlock(&ref->lock);
+
+        if (err != EAGAIN)
+        {
+            return NVM_ERR_PACK(err == 0 ? cpl : NULL, err);
+        }
+
+        if (timeout == 0)
+        {
+            return NVM_ERR_PACK(NULL, EAGAIN);
+        }
+        
+        if (!_nvm_wait(&wait))
+        {
+            break;
+        }
+    }
+
+    // Check one last time before giving up on the command
+    int err = lock_local(ref, &admin);
+    if (err != 0)
+    {
+        return NVM_ERR_PACK(NULL, err);
+    }
+
+    err = collect_completion(admin, cid, cpl);
+    if (err == EAGAIN)
+    {
+        abandon_command(admin, cid);
+        dprintf("Waiting for admin queue completion timed out\n");
+        err = ETIME;
+    }
+
+    pthread_mutex_unlock(&ref->lock);
+    return NVM_ERR_PACK(err == 0 ? cpl : NULL, err);
+}
+
+
+
+/*
+ * Stop waiting for an admin command submitted with nvm_admin_submit().
+ */
+int nvm_admin_cancel(nvm_aq_ref ref, uint16_t cid)
+{
+    struct local_admin* admin;
+
+    int err = lock_local(ref, &admin);
+    if (err != 0)
+    {
+        return NVM_ERR_PACK(NULL, err);
+    }
+
+    err = abandon_command(admin, cid);
+
+    pthread_mutex_unlock(&ref->lock);
+    return NVM_ERR_PACK(NULL, err);
+}
@@ -72,8 +72,10 @@ void _nvm_rpc_handle_remove(nvm_aq_ref ref, uint32_t key);
 
 /*
  * Bind reference to remote handle.
+ * If concurrent is true, the stub is called without holding the reference
+ * lock, and must be able to handle several outstanding commands at once.
  */
-int _nvm_rpc_bind(nvm_aq_ref ref, void* data, rpc_deleter_t deleter, rpc_stub_t stub);
+int _nvm_rpc_bind(nvm_aq_ref ref, void* data, rpc_deleter_t deleter, rpc_stub_t stub, bool concurrent);
 
 
 
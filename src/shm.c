@@ -0,0 +1,700 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <nvm_aq.h>
+#include <nvm_rpc.h>
+#include <nvm_admin.h>
+#include <nvm_error.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "rpc.h"
+#include "wait.h"
+#include "util.h"
+#include "dprintf.h"
+
+
+
+#define RPC_COMMAND_TIMEOUT     2500
+#define RPC_MAGIC_SIGNATURE     0x4e564d53
+#define RPC_SHM_SLOTS           64
+
+
+/* Handle keys, kept apart from SmartIO adapter numbers and sockets */
+#define SHM_HANDLE_KEY(name)    (0xc0000000 | (_nvm_str_hash(name) & 0x3fffffff))
+
+
+
+/*
+ * State of a request slot.
+ * Clients move slots from FREE to REQUEST, the server from REQUEST to DONE.
+ */
+enum slot_state
+{
+    SLOT_FREE       = 0,    // Slot can be claimed by a client
+    SLOT_CLAIMED    = 1,    // Client is writing request
+    SLOT_REQUEST    = 2,    // Request is posted
+    SLOT_ACCEPTED   = 3,    // Server has picked up the request
+    SLOT_DONE       = 4,    // Reply is written
+    SLOT_ABANDONED  = 5     // Client gave up waiting for the reply
+};
+
+
+
+/*
+ * Request slot in shared memory.
+ */
+struct __attribute__((aligned (64))) shm_slot
+{
+    uint32_t                    state;      // Slot state (futex word)
+    uint32_t                    waiting;    // Indicates that the client sleeps on state
+    int32_t                     status;     // Error number (EPERM means rejected)
+    uint32_t                    reserved;
+    unsigned char               cmd[64];    // Command (modified by server)
+    unsigned char               cpl[16];    // Command completion
+};
+
+
+
+/*
+ * Layout of the shared memory segment.
+ */
+struct shm_ring
+{
+    uint32_t                    magic;      // Magic signature
+    uint32_t                    n_slots;    // Number of request slots
+    uint32_t                    closed;     // Indicates that the server is stopped
+    uint32_t                    next;       // Hint to next free slot
+    uint32_t __attribute__((aligned (64))) seq; // Incremented for every request (futex word)
+    uint32_t                    sleeping;   // Indicates that the server sleeps on seq
+    struct shm_slot             slots[RPC_SHM_SLOTS];
+};
+
+
+
+/*
+ * Request taken from the ring and not yet completed.
+ */
+struct pending
+{
+    struct shm_slot*            slot;       // Request slot
+    uint16_t                    cid;        // Command identifier in ASQ
+    bool                        submitted;  // Indicates if command is submitted
+};
+
+
+
+/*
+ * Server binding handle.
+ */
+struct server
+{
+    nvm_aq_ref                  ref;        // RPC reference
+    nvm_rpc_cb_t                filter;     // RPC filter callback
+    void*                       data;       // User data for filter callback
+    struct shm_ring*            ring;       // Shared memory segment
+    pthread_t                   thread;     // Server thread
+    bool                        stop;       // Indicates that the server should stop
+    char                        name[256];  // Name of shared memory segment
+};
+
+
+
+/*
+ * Client-side binding.
+ */
+struct binding
+{
+    struct shm_ring*            ring;       // Shared memory segment
+};
+
+
+
+static long futex_wait(uint32_t* addr, uint32_t value, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+
+
+static void futex_wake(uint32_t* addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+
+
+/*
+ * Write reply to slot and wake up the client if it is sleeping.
+ * If the client has given up, the slot is released instead.
+ */
+static void complete_slot(struct shm_slot* slot, int status, const nvm_cpl_t* cpl)
+{
+    uint32_t expected = SLOT_ACCEPTED;
+
+    slot->status = status;
+    if (cpl != NULL)
+    {
+        memcpy(&slot->cpl, cpl, sizeof(nvm_cpl_t));
+    }
+    else
+    {
+        memset(&slot->cpl, 0, sizeof(nvm_cpl_t));
+    }
+
+    if (__atomic_compare_exchange_n(&slot->state, &expected, SLOT_DONE, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        if (__atomic_load_n(&slot->waiting, __ATOMIC_SEQ_CST))
+        {
+            futex_wake(&slot->state);
+        }
+    }
+    else
+    {
+        __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+
+
+/*
+ * Take all posted requests from the ring.
+ */
+static size_t drain_requests(struct server* server, struct pending* pending, size_t n_pending)
+{
+    struct shm_ring* ring = server->ring;
+
+    for (uint32_t i = 0; i < ring->n_slots; ++i)
+    {
+        struct shm_slot* slot = &ring->slots[i];
+        uint32_t expected = SLOT_REQUEST;
+
+        // Clients may abandon posted requests, so claim it before using it
+        if (!__atomic_compare_exchange_n(&slot->state, &expected, SLOT_ACCEPTED, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        // Allow user callback to modify request in place
+        if (server->filter != NULL && !server->filter((nvm_cmd_t*) &slot->cmd, server->data))
+        {
+            complete_slot(slot, EPERM, NULL);
+            continue;
+        }
+
+        pending[n_pending].slot = slot;
+        pending[n_pending].submitted = false;
+        ++n_pending;
+    }
+
+    return n_pending;
+}
+
+
+
+/*
+ * Submit drained requests to the admin queue.
+ * Requests that do not fit in the ASQ are submitted later.
+ */
+static size_t submit_requests(struct server* server, struct pending* pending, size_t n_pending, bool* progress)
+{
+    for (size_t i = 0; i < n_pending; )
+    {
+        if (pending[i].submitted)
+        {
+            ++i;
+            continue;
+        }
+
+        int status = nvm_admin_submit(server->ref, (nvm_cmd_t*) &pending[i].slot->cmd, &pending[i].cid);
+        if (status == EAGAIN)
+        {
+            break;
+        }
+
+        *progress = true;
+
+        if (status != 0)
+        {
+            complete_slot(pending[i].slot, status > 0 ? status : EIO, NULL);
+            pending[i] = pending[--n_pending];
+            continue;
+        }
+
+        pending[i++].submitted = true;
+    }
+
+    return n_pending;
+}
+
+
+
+/*
+ * Reply to completed commands.
+ */
+static size_t collect_completions(struct server* server, struct pending* pending, size_t n_pending, bool* progress)
+{
+    nvm_cpl_t cpl;
+
+    for (size_t i = 0; i < n_pending; )
+    {
+        if (!pending[i].submitted)
+        {
+            ++i;
+            continue;
+        }
+
+        int status = nvm_admin_poll(server->ref, pending[i].cid, &cpl, 0);
+        if (status == EAGAIN)
+        {
+            ++i;
+            continue;
+        }
+
+        complete_slot(pending[i].slot, status > 0 ? status : 0, status > 0 ? NULL : &cpl);
+        pending[i] = pending[--n_pending];
+        *progress = true;
+    }
+
+    return n_pending;
+}
+
+
+
+/*
+ * Sleep until a client posts a request or the server is stopped.
+ */
+static void sleep_server(struct server* server, uint32_t seq)
+{
+    struct shm_ring* ring = server->ring;
+
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST) == seq && !__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE))
+    {
+        futex_wait(&ring->seq, seq, NULL);
+    }
+
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+
+
+/*
+ * Serve requests from clients until the server is stopped.
+ */
+static void* serve_requests(struct server* server)
+{
+    struct shm_ring* ring = server->ring;
+    struct pending pending[RPC_SHM_SLOTS];
+    size_t n_pending = 0;
+    struct wait_state wait;
+    nvm_wait_policy_t policy;
+
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(server->ref);
+    nvm_wait_policy_get(&policy);
+
+    _nvm_wait_start(&wait, policy.spin_ns);
+
+    while (!__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE) || n_pending > 0)
+    {
+        uint32_t seq = __atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST);
+        bool progress = false;
+
+        if (!__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE))
+        {
+            n_pending = drain_requests(server, pending, n_pending);
+        }
+
+        n_pending = submit_requests(server, pending, n_pending, &progress);
+        n_pending = collect_completions(server, pending, n_pending, &progress);
+
+        if (progress)
+        {
+            _nvm_wait_start(&wait, n_pending > 0 ? ctrl->timeout * 1000000UL : policy.spin_ns);
+        }
+        else if (n_pending > 0)
+        {
+            if (!_nvm_wait(&wait))
+            {
+                dprintf("Waiting for admin queue completion timed out\n");
+                while (n_pending > 0)
+                {
+                    struct pending* p = &pending[--n_pending];
+
+                    // Release command identifier when the completion eventually arrives
+                    if (p->submitted)
+                    {
+                        nvm_admin_cancel(server->ref, p->cid);
+                    }
+
+                    complete_slot(p->slot, ETIME, NULL);
+                }
+            }
+        }
+        else if (!_nvm_wait(&wait))
+        {
+            // Nothing to do for a while, sleep until woken up
+            sleep_server(server, seq);
+            _nvm_wait_start(&wait, policy.spin_ns);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Helper function to stop server and remove shared memory segment.
+ */
+static void remove_server(void* data, uint32_t key, int remaining_handles)
+{
+    struct server* server = (struct server*) data;
+    struct shm_ring* ring = server->ring;
+    (void) key;
+    (void) remaining_handles;
+
+    __atomic_store_n(&server->stop, true, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->seq);
+
+    pthread_join(server->thread, NULL);
+
+    // Wake up clients that are still waiting, they will see that the ring is closed
+    for (uint32_t i = 0; i < ring->n_slots; ++i)
+    {
+        futex_wake(&ring->slots[i].state);
+    }
+
+    shm_unlink(server->name);
+    munmap(ring, sizeof(struct shm_ring));
+    free(server);
+}
+
+
+
+int nvm_shm_rpc_enable(nvm_aq_ref ref, const char* name, nvm_rpc_cb_t filter, void* data)
+{
+    struct server* server;
+
+    if (ref == NULL || name == NULL || name[0] != '/' || strlen(name) >= sizeof(server->name))
+    {
+        return EINVAL;
+    }
+
+    server = (struct server*) malloc(sizeof(struct server));
+    if (server == NULL)
+    {
+        dprintf("Failed to allocate RPC server handle: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    server->ref = ref;
+    server->filter = filter;
+    server->data = data;
+    server->stop = false;
+    strcpy(server->name, name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        int err = errno;
+        dprintf("Failed to create shared memory segment %s: %s\n", name, strerror(err));
+        free(server);
+        return err;
+    }
+
+    if (ftruncate(fd, sizeof(struct shm_ring)) != 0)
+    {
+        int err = errno;
+        dprintf("Failed to set size of shared memory segment: %s\n", strerror(err));
+        close(fd);
+        shm_unlink(name);
+        free(server);
+        return err;
+    }
+
+    server->ring = mmap(NULL, sizeof(struct shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (server->ring == MAP_FAILED)
+    {
+        int err = errno;
+        dprintf("Failed to map shared memory segment: %s\n", strerror(err));
+        shm_unlink(name);
+        free(server);
+        return err;
+    }
+
+    // Segment is zeroed by ftruncate, so all slots are free
+    server->ring->n_slots = RPC_SHM_SLOTS;
+    __atomic_store_n(&server->ring->magic, RPC_MAGIC_SIGNATURE, __ATOMIC_RELEASE);
+
+    int err = pthread_create(&server->thread, NULL, (void* (*)(void*)) serve_requests, server);
+    if (err != 0)
+    {
+        dprintf("Failed to create server thread: %s\n", strerror(err));
+        munmap(server->ring, sizeof(struct shm_ring));
+        shm_unlink(name);
+        free(server);
+        return err;
+    }
+
+    err = _nvm_rpc_handle_insert(ref, SHM_HANDLE_KEY(name), server, remove_server);
+    if (err != 0)
+    {
+        remove_server(server, 0, 0);
+        return err;
+    }
+
+    return 0;
+}
+
+
+
+void nvm_shm_rpc_disable(nvm_aq_ref ref, const char* name)
+{
+    _nvm_rpc_handle_remove(ref, SHM_HANDLE_KEY(name));
+}
+
+
+
+/*
+ * Claim a free request slot.
+ */
+static struct shm_slot* claim_slot(struct shm_ring* ring)
+{
+    uint32_t start = __atomic_fetch_add(&ring->next, 1, __ATOMIC_RELAXED);
+
+    for (uint32_t i = 0; i < ring->n_slots; ++i)
+    {
+        struct shm_slot* slot = &ring->slots[(start + i) % ring->n_slots];
+        uint32_t expected = SLOT_FREE;
+
+        if (__atomic_compare_exchange_n(&slot->state, &expected, SLOT_CLAIMED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Give up on a posted request.
+ * If the server has not picked it up yet, the slot is released right away.
+ * Otherwise, the server releases it when the command completes.
+ */
+static void abandon_slot(struct shm_slot* slot)
+{
+    uint32_t expected = SLOT_REQUEST;
+
+    if (__atomic_compare_exchange_n(&slot->state, &expected, SLOT_FREE, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+
+    if (expected == SLOT_ACCEPTED
+            && __atomic_compare_exchange_n(&slot->state, &expected, SLOT_ABANDONED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+
+    // Reply arrived in the meantime
+    __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+}
+
+
+
+/*
+ * Initiate remote command request.
+ * Several threads may call this at the same time.
+ */
+static int remote_command(struct binding* binding, nvm_cmd_t* cmd, nvm_cpl_t* cpl)
+{
+    struct shm_ring* ring = binding->ring;
+    struct shm_slot* slot;
+    struct wait_state wait;
+    nvm_wait_policy_t policy;
+
+    if (cmd == NULL || cpl == NULL)
+    {
+        return EINVAL;
+    }
+
+    nvm_wait_policy_get(&policy);
+    _nvm_wait_start(&wait, RPC_COMMAND_TIMEOUT * 1000000UL);
+
+    // Find free slot
+    while ((slot = claim_slot(ring)) == NULL)
+    {
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+        {
+            return ENOTCONN;
+        }
+
+        if (!_nvm_wait(&wait))
+        {
+            return ETIME;
+        }
+    }
+
+    if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+        return ENOTCONN;
+    }
+
+    memcpy(&slot->cmd, cmd, sizeof(nvm_cmd_t));
+    slot->waiting = 0;
+    __atomic_store_n(&slot->state, SLOT_REQUEST, __ATOMIC_SEQ_CST);
+
+    // Notify server, but only enter the kernel if it is sleeping
+    __atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST))
+    {
+        futex_wake(&ring->seq);
+    }
+
+    // Busy-wait for reply for a little while before sleeping
+    uint64_t deadline = _nvm_time_ns() + RPC_COMMAND_TIMEOUT * 1000000UL;
+    uint64_t spin_end = _nvm_time_ns() + policy.spin_ns;
+    uint32_t state;
+
+    while ((state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) != SLOT_DONE)
+    {
+        uint64_t now = _nvm_time_ns();
+
+        if (now >= deadline || __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+        {
+            bool closed = now < deadline;
+            abandon_slot(slot);
+            return closed ? ENOTCONN : ETIME;
+        }
+
+        if (now < spin_end)
+        {
+            _nvm_cpu_relax();
+            continue;
+        }
+
+        __atomic_store_n(&slot->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->state, __ATOMIC_SEQ_CST) == state)
+        {
+            struct timespec timeout;
+            timeout.tv_sec = (deadline - now) / 1000000000UL;
+            timeout.tv_nsec = (deadline - now) % 1000000000UL;
+            futex_wait(&slot->state, state, &timeout);
+        }
+    }
+
+    int status = slot->status;
+    memcpy(cmd, &slot->cmd, sizeof(nvm_cmd_t));
+    memcpy(cpl, &slot->cpl, sizeof(nvm_cpl_t));
+
+    __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+    return status;
+}
+
+
+
+/*
+ * Helper function to unmap shared memory segment.
+ */
+static void remove_binding(void* data, uint32_t key, int remaining_handles)
+{
+    struct binding* binding = (struct binding*) data;
+    (void) key;
+    (void) remaining_handles;
+
+    munmap(binding->ring, sizeof(struct shm_ring));
+    free(binding);
+}
+
+
+
+int nvm_shm_rpc_bind(nvm_aq_ref* handle, const nvm_ctrl_t* ctrl, const char* name)
+{
+    struct stat st;
+    nvm_aq_ref ref;
+
+    *handle = NULL;
+
+    if (ctrl == NULL || name == NULL || name[0] != '/')
+    {
+        return EINVAL;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        int err = errno;
+        dprintf("Failed to open shared memory segment %s: %s\n", name, strerror(err));
+        return err;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(struct shm_ring))
+    {
+        dprintf("Shared memory segment %s is not an RPC segment\n", name);
+        close(fd);
+        return EBADF;
+    }
+
+    struct binding* binding = (struct binding*) malloc(sizeof(struct binding));
+    if (binding == NULL)
+    {
+        dprintf("Failed to allocate binding descriptor: %s\n", strerror(errno));
+        close(fd);
+        return ENOMEM;
+    }
+
+    binding->ring = mmap(NULL, sizeof(struct shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (binding->ring == MAP_FAILED)
+    {
+        int err = errno;
+        dprintf("Failed to map shared memory segment: %s\n", strerror(err));
+        free(binding);
+        return err;
+    }
+
+    if (__atomic_load_n(&binding->ring->magic, __ATOMIC_ACQUIRE) != RPC_MAGIC_SIGNATURE
+            || binding->ring->n_slots != RPC_SHM_SLOTS
+            || __atomic_load_n(&binding->ring->closed, __ATOMIC_ACQUIRE))
+    {
+        dprintf("Shared memory segment %s is not an active RPC segment\n", name);
+        remove_binding(binding, 0, 0);
+        return ENOTCONN;
+    }
+
+    int err = _nvm_ref_get(&ref, ctrl);
+    if (err != 0)
+    {
+        remove_binding(binding, 0, 0);
+        return err;
+    }
+
+    err = _nvm_rpc_bind(ref, binding, remove_binding, (rpc_stub_t) remote_command, true);
+    if (err != 0)
+    {
+        remove_binding(binding, 0, 0);
+        _nvm_ref_put(ref);
+        return err;
+    }
+
+    *handle = ref;
+    return 0;
+}
@@ -0,0 +1,992 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <nvm_aq.h>
+#include <nvm_rpc.h>
+#include <nvm_admin.h>
+#include <nvm_error.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "rpc.h"
+#include "util.h"
+#include "wait.h"
+#include "dprintf.h"
+
+
+
+#define RPC_COMMAND_TIMEOUT     2500
+#define RPC_MAGIC_SIGNATURE     0x4e564d52
+#define RPC_MAX_INFLIGHT        64
+
+
+/* Handle keys, kept apart from SmartIO adapter numbers */
+#define TCP_HANDLE_KEY(port)    (0x40000000 | (port))
+#define UNIX_HANDLE_KEY(path)   (0x80000000 | (_nvm_str_hash(path) & 0x3fffffff))
+
+
+
+/*
+ * RPC command message format.
+ */
+struct __attribute__((packed)) rpc_cmd
+{
+    uint32_t                    magic;      // Magic signature
+    uint32_t                    tag;        // Request tag, used to match replies
+    unsigned char               cmd[64];    // Command to execute
+};
+
+
+
+/*
+ * RPC completion message format.
+ */
+struct __attribute__((packed)) rpc_cpl
+{
+    uint32_t                    magic;      // Magic signature
+    uint32_t                    tag;        // Tag of request
+    int32_t                     status;     // Error number (EPERM means rejected)
+    unsigned char               cmd[64];    // Modified command
+    unsigned char               cpl[16];    // Command completion
+};
+
+
+
+/*
+ * Command received by the server and not yet completed.
+ */
+struct pending
+{
+    uint32_t                    tag;        // Request tag
+    uint16_t                    cid;        // Command identifier in ASQ
+    bool                        submitted;  // Indicates if command was submitted
+    int                         status;     // Error number if not submitted
+    nvm_cmd_t                   cmd;        // Command (possibly modified by filter)
+};
+
+
+
+/*
+ * Server-side connection to a client.
+ */
+struct connection
+{
+    struct connection*          next;       // Pointer to next connection in list
+    struct server*              server;     // Server the connection belongs to
+    int                         fd;         // Socket descriptor
+    pthread_t                   thread;     // Connection thread
+    bool                        done;       // Indicates that the connection thread has finished
+};
+
+
+
+/*
+ * Server binding handle.
+ */
+struct server
+{
+    nvm_aq_ref                  ref;        // RPC reference
+    nvm_rpc_cb_t                filter;     // RPC filter callback
+    void*                       data;       // User data for filter callback
+    int                         fd;         // Listening socket descriptor
+    pthread_t                   thread;     // Accepting thread
+    pthread_mutex_t             lock;       // Protects list of connections
+    struct connection*          conns;      // List of connections
+    char                        path[sizeof(((struct sockaddr_un*) 0)->sun_path)]; // Socket file path (empty if TCP)
+};
+
+
+
+/*
+ * Outstanding client-side command.
+ */
+struct call
+{
+    struct call*                next;       // Pointer to next call in list
+    uint32_t                    tag;        // Request tag
+    bool                        done;       // Indicates if reply is received
+    int                         status;     // Error number from reply
+    nvm_cmd_t*                  cmd;        // Command
+    nvm_cpl_t*                  cpl;        // Completion
+};
+
+
+
+/*
+ * Client-side binding.
+ */
+struct binding
+{
+    int                         fd;         // Socket descriptor
+    pthread_t                   thread;     // Receiving thread
+    pthread_mutex_t             send_lock;  // Ensure that requests are not interleaved
+    pthread_mutex_t             lock;       // Protects list of calls
+    pthread_cond_t              cond;       // Signalled when a reply is received
+    uint32_t                    next_tag;   // Next request tag
+    struct call*                calls;      // List of outstanding calls
+    bool                        broken;     // Indicates that the connection is lost
+};
+
+
+
+/*
+ * Read exactly len bytes from socket.
+ */
+static int read_full(int fd, void* buf, size_t len)
+{
+    unsigned char* ptr = (unsigned char*) buf;
+
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, ptr, len, 0);
+        if (n == 0)
+        {
+            return ECONNRESET;
+        }
+        else if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        ptr += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Write exactly len bytes to socket.
+ */
+static int write_full(int fd, const void* buf, size_t len)
+{
+    const unsigned char* ptr = (const unsigned char*) buf;
+
+    while (len > 0)
+    {
+        ssize_t n = send(fd, ptr, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        ptr += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Helper function to disable Nagle's algorithm on TCP sockets.
+ * Messages are small and latency sensitive.
+ */
+static void set_nodelay(int fd)
+{
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+
+
+/*
+ * Send reply for a completed (or rejected) command.
+ */
+static int send_reply(int fd, const struct pending* p, int status, const nvm_cpl_t* cpl)
+{
+    struct rpc_cpl reply;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = RPC_MAGIC_SIGNATURE;
+    reply.tag = p->tag;
+    reply.status = status;
+    memcpy(&reply.cmd, &p->cmd, sizeof(nvm_cmd_t));
+
+    if (cpl != NULL)
+    {
+        memcpy(&reply.cpl, cpl, sizeof(nvm_cpl_t));
+    }
+
+    return write_full(fd, &reply, sizeof(reply));
+}
+
+
+
+/*
+ * Accept a request and submit it to the admin queue.
+ * Returns EAGAIN if the ASQ is full and the request should be retried.
+ */
+static int submit_request(struct server* server, struct pending* p, const struct rpc_cmd* request)
+{
+    p->tag = request->tag;
+    p->submitted = false;
+    p->status = 0;
+    memcpy(&p->cmd, &request->cmd, sizeof(nvm_cmd_t));
+
+    // Allow user callback to modify request in place
+    if (server->filter != NULL && !server->filter(&p->cmd, server->data))
+    {
+        p->status = EPERM;
+        return 0;
+    }
+
+    int status = nvm_admin_submit(server->ref, &p->cmd, &p->cid);
+    if (status == EAGAIN)
+    {
+        return EAGAIN;
+    }
+
+    p->submitted = status == 0;
+    p->status = status > 0 ? status : EIO;
+    return 0;
+}
+
+
+
+/*
+ * Serve requests from a client. Several requests may be outstanding at
+ * once, and replies are sent as soon as commands complete.
+ */
+static void* serve_connection(struct connection* conn)
+{
+    struct server* server = conn->server;
+    struct pending pending[RPC_MAX_INFLIGHT];
+    struct rpc_cmd request;
+    struct wait_state wait;
+    nvm_cpl_t cpl;
+    size_t n_pending = 0;
+    bool have_request = false;
+    bool closed = false;
+    bool broken = false;
+
+    const nvm_ctrl_t* ctrl = nvm_ctrl_from_aq_ref(server->ref);
+    _nvm_wait_start(&wait, ctrl->timeout * 1000000UL);
+
+    while (!closed || n_pending > 0)
+    {
+        bool progress = false;
+
+        // Read next request if there is room for it
+        if (!closed && !have_request && n_pending < RPC_MAX_INFLIGHT)
+        {
+            struct pollfd pfd = { .fd = conn->fd, .events = POLLIN, .revents = 0 };
+
+            int ready = poll(&pfd, 1, n_pending > 0 ? 0 : -1);
+            if (ready > 0)
+            {
+                if (read_full(conn->fd, &request, sizeof(request)) != 0 || request.magic != RPC_MAGIC_SIGNATURE)
+                {
+                    closed = true;
+                }
+                else
+                {
+                    have_request = true;
+                }
+            }
+            else if (ready < 0 && errno != EINTR)
+            {
+                closed = true;
+            }
+        }
+
+        if (have_request)
+        {
+            if (submit_request(server, &pending[n_pending], &request) == 0)
+            {
+                have_request = false;
+                ++n_pending;
+                progress = true;
+            }
+            else if (n_pending == 0)
+            {
+                // ASQ is full of commands from someone else
+                if (send_reply(conn->fd, &pending[n_pending], EAGAIN, NULL) != 0)
+                {
+                    broken = true;
+                }
+                have_request = false;
+            }
+        }
+
+        // Reply to completed commands, in any order
+        for (size_t i = 0; i < n_pending; )
+        {
+            struct pending* p = &pending[i];
+            int status = p->status;
+
+            if (p->submitted)
+            {
+                int poll_status = nvm_admin_poll(server->ref, p->cid, &cpl, 0);
+                if (poll_status == EAGAIN)
+                {
+                    ++i;
+                    continue;
+                }
+
+                status = poll_status > 0 ? poll_status : 0;
+            }
+
+            if (!broken && send_reply(conn->fd, p, status, p->submitted ? &cpl : NULL) != 0)
+            {
+                broken = true;
+            }
+
+            pending[i] = pending[--n_pending];
+            progress = true;
+        }
+
+        if (broken)
+        {
+            // Stop reading requests, but collect outstanding completions
+            closed = true;
+            have_request = false;
+        }
+
+        if (progress)
+        {
+            _nvm_wait_start(&wait, ctrl->timeout * 1000000UL);
+        }
+        else if (n_pending > 0 && !_nvm_wait(&wait))
+        {
+            dprintf("Waiting for admin queue completion timed out\n");
+
+            // Release command identifiers when the completions eventually arrive
+            for (size_t i = 0; i < n_pending; ++i)
+            {
+                if (pending[i].submitted)
+                {
+                    nvm_admin_cancel(server->ref, pending[i].cid);
+                }
+            }
+            break;
+        }
+    }
+
+    shutdown(conn->fd, SHUT_RDWR);
+    __atomic_store_n(&conn->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+
+/*
+ * Join and remove connections. If all is false, only connections that have
+ * finished are removed.
+ */
+static void remove_connections(struct server* server, bool all)
+{
+    struct connection** prev = &server->conns;
+    struct connection* conn;
+
+    pthread_mutex_lock(&server->lock);
+
+    while ((conn = *prev) != NULL)
+    {
+        if (!all && !__atomic_load_n(&conn->done, __ATOMIC_ACQUIRE))
+        {
+            prev = &conn->next;
+            continue;
+        }
+
+        *prev = conn->next;
+
+        shutdown(conn->fd, SHUT_RDWR);
+        pthread_join(conn->thread, NULL);
+        close(conn->fd);
+        free(conn);
+    }
+
+    pthread_mutex_unlock(&server->lock);
+}
+
+
+
+/*
+ * Accept incoming connections until the listening socket is shut down.
+ */
+static void* accept_connections(struct server* server)
+{
+    while (true)
+    {
+        int fd = accept(server->fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (server->path[0] == '\0')
+        {
+            set_nodelay(fd);
+        }
+
+        remove_connections(server, false);
+
+        struct connection* conn = (struct connection*) malloc(sizeof(struct connection));
+        if (conn == NULL)
+        {
+            dprintf("Failed to allocate connection: %s\n", strerror(errno));
+            close(fd);
+            continue;
+        }
+
+        conn->server = server;
+        conn->fd = fd;
+        conn->done = false;
+
+        pthread_mutex_lock(&server->lock);
+
+        int err = pthread_create(&conn->thread, NULL, (void* (*)(void*)) serve_connection, conn);
+        if (err != 0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            dprintf("Failed to create connection thread: %s\n", strerror(err));
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = server->conns;
+        server->conns = conn;
+
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Helper function to stop server and remove all connections.
+ */
+static void remove_server(void* data, uint32_t key, int remaining_handles)
+{
+    struct server* server = (struct server*) data;
+    (void) key;
+    (void) remaining_handles;
+
+    shutdown(server->fd, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->fd);
+
+    if (server->path[0] != '\0')
+    {
+        unlink(server->path);
+    }
+
+    remove_connections(server, true);
+
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
+
+
+
+/*
+ * Helper function to create a server for a listening socket and insert it
+ * as a binding handle. The socket is closed on failure.
+ */
+static int create_server(nvm_aq_ref ref, int fd, uint32_t key, const char* path, nvm_rpc_cb_t filter, void* data)
+{
+    struct server* server = (struct server*) malloc(sizeof(struct server));
+    if (server == NULL)
+    {
+        dprintf("Failed to allocate RPC server handle: %s\n", strerror(errno));
+        close(fd);
+        return ENOMEM;
+    }
+
+    server->ref = ref;
+    server->filter = filter;
+    server->data = data;
+    server->fd = fd;
+    server->conns = NULL;
+    server->path[0] = '\0';
+
+    if (path != NULL)
+    {
+        strncpy(server->path, path, sizeof(server->path) - 1);
+        server->path[sizeof(server->path) - 1] = '\0';
+    }
+
+    int err = pthread_mutex_init(&server->lock, NULL);
+    if (err != 0)
+    {
+        close(fd);
+        free(server);
+        return err;
+    }
+
+    if (listen(fd, SOMAXCONN) != 0)
+    {
+        err = errno;
+        dprintf("Failed to listen on socket: %s\n", strerror(err));
+        pthread_mutex_destroy(&server->lock);
+        close(fd);
+        free(server);
+        return err;
+    }
+
+    err = pthread_create(&server->thread, NULL, (void* (*)(void*)) accept_connections, server);
+    if (err != 0)
+    {
+        dprintf("Failed to create server thread: %s\n", strerror(err));
+        pthread_mutex_destroy(&server->lock);
+        close(fd);
+        free(server);
+        return err;
+    }
+
+    err = _nvm_rpc_handle_insert(ref, key, server, remove_server);
+    if (err != 0)
+    {
+        remove_server(server, key, 0);
+        return err;
+    }
+
+    return 0;
+}
+
+
+
+int nvm_tcp_rpc_enable(nvm_aq_ref ref, const char* address, uint16_t port, nvm_rpc_cb_t filter, void* data)
+{
+    struct sockaddr_in addr;
+    int flag = 1;
+
+    if (ref == NULL || port == 0)
+    {
+        return EINVAL;
+    }
+
+    // Any local user can connect to a loopback port, and any host that can
+    // reach other addresses, so the caller must decide which commands to accept
+    if (filter == NULL)
+    {
+        dprintf("Enabling remote admin commands over TCP requires a filter\n");
+        return EPERM;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (address != NULL && inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+    {
+        dprintf("Invalid bind address: %s\n", address);
+        return EINVAL;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        dprintf("Failed to create socket: %s\n", strerror(errno));
+        return errno;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        int err = errno;
+        dprintf("Failed to bind to port %u: %s\n", port, strerror(err));
+        close(fd);
+        return err;
+    }
+
+    return create_server(ref, fd, TCP_HANDLE_KEY(port), NULL, filter, data);
+}
+
+
+
+void nvm_tcp_rpc_disable(nvm_aq_ref ref, uint16_t port)
+{
+    _nvm_rpc_handle_remove(ref, TCP_HANDLE_KEY(port));
+}
+
+
+
+int nvm_unix_rpc_enable(nvm_aq_ref ref, const char* path, nvm_rpc_cb_t filter, void* data)
+{
+    struct sockaddr_un addr;
+
+    if (ref == NULL || path == NULL || path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path))
+    {
+        return EINVAL;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        dprintf("Failed to create socket: %s\n", strerror(errno));
+        return errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        int err = errno;
+        dprintf("Failed to bind to %s: %s\n", path, strerror(err));
+        close(fd);
+        return err;
+    }
+
+    // Only the owner may connect, like the shared memory segment (before listening, so there is no window)
+    if (chmod(path, S_IRUSR | S_IWUSR) != 0)
+    {
+        int err = errno;
+        dprintf("Failed to set permissions of %s: %s\n", path, strerror(err));
+        unlink(path);
+        close(fd);
+        return err;
+    }
+
+    return create_server(ref, fd, UNIX_HANDLE_KEY(path), path, filter, data);
+}
+
+
+
+void nvm_unix_rpc_disable(nvm_aq_ref ref, const char* path)
+{
+    _nvm_rpc_handle_remove(ref, UNIX_HANDLE_KEY(path));
+}
+
+
+
+/*
+ * Receive replies and hand them to the waiting callers.
+ */
+static void* receive_replies(struct binding* binding)
+{
+    struct rpc_cpl reply;
+
+    while (read_full(binding->fd, &reply, sizeof(reply)) == 0 && reply.magic == RPC_MAGIC_SIGNATURE)
+    {
+        pthread_mutex_lock(&binding->lock);
+
+        for (struct call* call = binding->calls; call != NULL; call = call->next)
+        {
+            if (call->tag == reply.tag)
+            {
+                memcpy(call->cmd, &reply.cmd, sizeof(nvm_cmd_t));
+                memcpy(call->cpl, &reply.cpl, sizeof(nvm_cpl_t));
+                call->status = reply.status;
+                call->done = true;
+                pthread_cond_broadcast(&binding->cond);
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&binding->lock);
+    }
+
+    pthread_mutex_lock(&binding->lock);
+    binding->broken = true;
+    pthread_cond_broadcast(&binding->cond);
+    pthread_mutex_unlock(&binding->lock);
+
+    return NULL;
+}
+
+
+
+/*
+ * Initiate remote command request.
+ * Several threads may call this at the same time.
+ */
+static int remote_command(struct binding* binding, nvm_cmd_t* cmd, nvm_cpl_t* cpl)
+{
+    struct rpc_cmd request;
+    struct call call;
+    struct timespec deadline;
+    int status = 0;
+
+    if (cmd == NULL || cpl == NULL)
+    {
+        return EINVAL;
+    }
+
+    call.done = false;
+    call.status = 0;
+    call.cmd = cmd;
+    call.cpl = cpl;
+
+    pthread_mutex_lock(&binding->lock);
+
+    if (binding->broken)
+    {
+        pthread_mutex_unlock(&binding->lock);
+        return ECONNRESET;
+    }
+
+    call.tag = binding->next_tag++;
+    call.next = binding->calls;
+    binding->calls = &call;
+
+    pthread_mutex_unlock(&binding->lock);
+
+    request.magic = RPC_MAGIC_SIGNATURE;
+    request.tag = call.tag;
+    memcpy(&request.cmd, cmd, sizeof(nvm_cmd_t));
+
+    pthread_mutex_lock(&binding->send_lock);
+    status = write_full(binding->fd, &request, sizeof(request));
+    pthread_mutex_unlock(&binding->send_lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += RPC_COMMAND_TIMEOUT / 1000;
+    deadline.tv_nsec += (RPC_COMMAND_TIMEOUT % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&binding->lock);
+
+    // Wait for reply
+    while (status == 0 && !call.done && !binding->broken)
+    {
+        if (pthread_cond_timedwait(&binding->cond, &binding->lock, &deadline) == ETIMEDOUT)
+        {
+            status = ETIME;
+        }
+    }
+
+    if (call.done)
+    {
+        status = call.status;
+    }
+    else if (status == 0)
+    {
+        status = ECONNRESET;
+    }
+
+    // Remove call from list
+    struct call** prev = &binding->calls;
+    while (*prev != &call)
+    {
+        prev = &(*prev)->next;
+    }
+    *prev = call.next;
+
+    pthread_mutex_unlock(&binding->lock);
+
+    return status;
+}
+
+
+
+/*
+ * Helper function to disconnect and remove binding.
+ */
+static void remove_binding(void* data, uint32_t key, int remaining_handles)
+{
+    struct binding* binding = (struct binding*) data;
+    (void) key;
+    (void) remaining_handles;
+
+    shutdown(binding->fd, SHUT_RDWR);
+    pthread_join(binding->thread, NULL);
+    close(binding->fd);
+
+    pthread_cond_destroy(&binding->cond);
+    pthread_mutex_destroy(&binding->lock);
+    pthread_mutex_destroy(&binding->send_lock);
+    free(binding);
+}
+
+
+
+/*
+ * Helper function to create a binding for a connected socket and bind
+ * the reference to it. The socket is closed on failure.
+ */
+static int create_binding(nvm_aq_ref* handle, const nvm_ctrl_t* ctrl, int fd)
+{
+    nvm_aq_ref ref;
+    pthread_condattr_t attr;
+
+    struct binding* binding = (struct binding*) malloc(sizeof(struct binding));
+    if (binding == NULL)
+    {
+        dprintf("Failed to allocate binding descriptor: %s\n", strerror(errno));
+        close(fd);
+        return ENOMEM;
+    }
+
+    binding->fd = fd;
+    binding->next_tag = 0;
+    binding->calls = NULL;
+    binding->broken = false;
+
+    pthread_mutex_init(&binding->send_lock, NULL);
+    pthread_mutex_init(&binding->lock, NULL);
+
+    // Timeouts are measured against the monotonic clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&binding->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    int err = pthread_create(&binding->thread, NULL, (void* (*)(void*)) receive_replies, binding);
+    if (err != 0)
+    {
+        dprintf("Failed to create receiving thread: %s\n", strerror(err));
+        pthread_cond_destroy(&binding->cond);
+        pthread_mutex_destroy(&binding->lock);
+        pthread_mutex_destroy(&binding->send_lock);
+        close(fd);
+        free(binding);
+        return err;
+    }
+
+    err = _nvm_ref_get(&ref, ctrl);
+    if (err != 0)
+    {
+        remove_binding(binding, 0, 0);
+        return err;
+    }
+
+    err = _nvm_rpc_bind(ref, binding, remove_binding, (rpc_stub_t) remote_command, true);
+    if (err != 0)
+    {
+        remove_binding(binding, 0, 0);
+        _nvm_ref_put(ref);
+        return err;
+    }
+
+    *handle = ref;
+    return 0;
+}
+
+
+
+int nvm_tcp_rpc_bind(nvm_aq_ref* handle, const nvm_ctrl_t* ctrl, const char* hostname, uint16_t port)
+{
+    struct addrinfo hints;
+    struct addrinfo* addrs;
+    char service[8];
+    int fd = -1;
+    int err;
+
+    *handle = NULL;
+
+    if (ctrl == NULL || hostname == NULL || port == 0)
+    {
+        return EINVAL;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", port);
+
+    err = getaddrinfo(hostname, service, &hints, &addrs);
+    if (err != 0)
+    {
+        dprintf("Failed to look up %s: %s\n", hostname, gai_strerror(err));
+        return EHOSTUNREACH;
+    }
+
+    err = ECONNREFUSED;
+    for (struct addrinfo* ai = addrs; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            err = errno;
+            continue;
+        }
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+
+        err = errno;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(addrs);
+
+    if (fd < 0)
+    {
+        dprintf("Failed to connect to %s:%u: %s\n", hostname, port, strerror(err));
+        return err;
+    }
+
+    set_nodelay(fd);
+    return create_binding(handle, ctrl, fd);
+}
+
+
+
+int nvm_unix_rpc_bind(nvm_aq_ref* handle, const nvm_ctrl_t* ctrl, const char* path)
+{
+    struct sockaddr_un addr;
+
+    *handle = NULL;
+
+    if (ctrl == NULL || path == NULL || path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path))
+    {
+        return EINVAL;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        dprintf("Failed to create socket: %s\n", strerror(errno));
+        return errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        int err = errno;
+        dprintf("Failed to connect to %s: %s\n", path, strerror(err));
+        close(fd);
+        return err;
+    }
+
+    return create_binding(handle, ctrl, fd);
+}
@@ -39,26 +39,6 @@ static inline uint32_t _nvm_b2log(uint32_t n)
 }
 
 
-/* Delay the minimum of one millisecond and a time remainder */
-static inline uint64_t _nvm_delay_remain(uint64_t remaining_nanoseconds)
-{
-    if (remaining_nanoseconds == 0)
-    {
-        return 0;
-    }
-
-    struct timespec ts;
-    ts.tv_sec = 0;
-    ts.tv_nsec = _MIN(1000000UL, remaining_nanoseconds);
-
-    //pthread_yield();
-    clock_nanosleep(CLOCK_REALTIME, 0, &ts, NULL);
-
-    remaining_nanoseconds -= _MIN(1000000UL, remaining_nanoseconds);
-    return remaining_nanoseconds;
-}
-
-
 /* Get the system page size */
 static inline size_t _nvm_host_page_size()
 {
@@ -76,4 +56,18 @@ static inline size_t _nvm_host_page_size()
 }
 
 
+/* Hash a string (FNV-1a) */
+static inline uint32_t _nvm_str_hash(const char* str)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*str != '\0')
+    {
+        hash = (hash ^ (unsigned char) *str++) * 16777619U;
+    }
+
+    return hash;
+}
+
+
 #endif /* __NVM_INTERNAL_UTIL_H__ */
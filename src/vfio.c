@@ -0,0 +1,589 @@
+#include <nvm_types.h>
+#include <nvm_util.h>
+#include <nvm_ctrl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/vfio.h>
+#include "vfio.h"
+#include "iova.h"
+#include "dma.h"
+#include "util.h"
+#include "dprintf.h"
+
+
+
+/* PCI configuration space command register and its enable bits */
+#define PCI_COMMAND_OFFSET      0x04
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004
+
+
+/* PCI configuration space base address registers */
+#define PCI_BAR_OFFSET(bir)     (0x10 + 4 * (bir))
+#define PCI_BAR_64BIT(v)        (((v) & 0x06) == 0x04)
+#define PCI_BAR_MASK            (~0x0fULL)
+
+
+/* IO address range used if the IOMMU does not report valid ranges */
+#define DEFAULT_IOVA_START      (1ULL << 32)
+#define DEFAULT_IOVA_END        (1ULL << 39)
+
+
+
+/*
+ * Helper function to look up the IOMMU group number of a PCI device.
+ */
+static int find_group(const char* bdf, int* group)
+{
+    char path[PATH_MAX];
+    char link[PATH_MAX];
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/iommu_group", bdf);
+
+    ssize_t len = readlink(path, link, sizeof(link) - 1);
+    if (len < 0)
+    {
+        dprintf("Failed to look up IOMMU group for device %s: %s\n", bdf, strerror(errno));
+        return errno;
+    }
+    link[len] = '\0';
+
+    const char* name = strrchr(link, '/');
+    if (name == NULL || sscanf(name + 1, "%d", group) != 1)
+    {
+        dprintf("Unexpected IOMMU group path: %s\n", link);
+        return ENODEV;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Helper function to open the container and select an IOMMU model.
+ * Type 1 v2 is preferred, as it does not allow partial unmapping.
+ */
+static int open_container(int* container, int* iommu_type)
+{
+    int fd = open("/dev/vfio/vfio", O_RDWR);
+    if (fd < 0)
+    {
+        dprintf("Failed to open VFIO container: %s\n", strerror(errno));
+        return errno;
+    }
+
+    if (ioctl(fd, VFIO_GET_API_VERSION) != VFIO_API_VERSION)
+    {
+        dprintf("Unknown VFIO API version\n");
+        close(fd);
+        return ENOTSUP;
+    }
+
+    if (ioctl(fd, VFIO_CHECK_EXTENSION, VFIO_TYPE1v2_IOMMU) > 0)
+    {
+        *iommu_type = VFIO_TYPE1v2_IOMMU;
+    }
+    else if (ioctl(fd, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU) > 0)
+    {
+        *iommu_type = VFIO_TYPE1_IOMMU;
+    }
+    else
+    {
+        dprintf("VFIO container does not support type 1 IOMMU\n");
+        close(fd);
+        return ENOTSUP;
+    }
+
+    *container = fd;
+    return 0;
+}
+
+
+
+/*
+ * Helper function to open the group and attach it to the container.
+ */
+static int attach_group(int container, int group_no, int iommu_type, int* group)
+{
+    char path[64];
+    struct vfio_group_status status = { .argsz = sizeof(status) };
+
+    snprintf(path, sizeof(path), "/dev/vfio/%d", group_no);
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        dprintf("Failed to open VFIO group %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+
+    if (ioctl(fd, VFIO_GROUP_GET_STATUS, &status) < 0 || !(status.flags & VFIO_GROUP_FLAGS_VIABLE))
+    {
+        dprintf("VFIO group %d is not viable, are all devices bound to vfio-pci?\n", group_no);
+        close(fd);
+        return EBUSY;
+    }
+
+    if (ioctl(fd, VFIO_GROUP_SET_CONTAINER, &container) < 0)
+    {
+        int err = errno;
+        dprintf("Failed to add VFIO group to container: %s\n", strerror(err));
+        close(fd);
+        return err;
+    }
+
+    if (ioctl(container, VFIO_SET_IOMMU, iommu_type) < 0)
+    {
+        int err = errno;
+        dprintf("Failed to set IOMMU model: %s\n", strerror(err));
+        ioctl(fd, VFIO_GROUP_UNSET_CONTAINER);
+        close(fd);
+        return err;
+    }
+
+    *group = fd;
+    return 0;
+}
+
+
+
+/*
+ * Helper function to add the usable IO address ranges to the allocator.
+ * Address zero is never handed out, as the library treats it as invalid.
+ */
+static int add_iova_ranges(struct vfio_device* dev)
+{
+    int err;
+    size_t page_size = _nvm_host_page_size();
+    bool found = false;
+
+    struct vfio_iommu_type1_info* info = calloc(1, sizeof(struct vfio_iommu_type1_info));
+    if (info == NULL)
+    {
+        return ENOMEM;
+    }
+    info->argsz = sizeof(struct vfio_iommu_type1_info);
+
+    if (ioctl(dev->container, VFIO_IOMMU_GET_INFO, info) < 0)
+    {
+        err = errno;
+        free(info);
+        dprintf("Failed to get IOMMU info: %s\n", strerror(err));
+        return err;
+    }
+
+    // Capabilities do not fit, retry with the size reported by the kernel
+    if (info->argsz > sizeof(struct vfio_iommu_type1_info))
+    {
+        uint32_t argsz = info->argsz;
+        free(info);
+
+        info = calloc(1, argsz);
+        if (info == NULL)
+        {
+            return ENOMEM;
+        }
+        info->argsz = argsz;
+
+        if (ioctl(dev->container, VFIO_IOMMU_GET_INFO, info) < 0)
+        {
+            err = errno;
+            free(info);
+            dprintf("Failed to get IOMMU info: %s\n", strerror(err));
+            return err;
+        }
+    }
+
+    uint32_t offset = (info->flags & VFIO_IOMMU_INFO_CAPS) ? info->cap_offset : 0;
+    while (offset != 0 && offset < info->argsz)
+    {
+        const struct vfio_info_cap_header* cap = (const void*) (((const unsigned char*) info) + offset);
+
+        if (cap->id == VFIO_IOMMU_TYPE1_INFO_CAP_IOVA_RANGE)
+        {
+            const struct vfio_iommu_type1_info_cap_iova_range* ranges = (const void*) cap;
+
+            for (uint32_t i = 0; i < ranges->nr_iovas; ++i)
+            {
+                uint64_t start = _MAX(ranges->iova_ranges[i].start, page_size);
+                uint64_t end = ranges->iova_ranges[i].end; // Range end is inclusive
+
+                if (end == UINT64_MAX)
+                {
+                    end = UINT64_MAX - page_size + 1;
+                }
+                else
+                {
+                    end += 1;
+                }
+
+                start = NVM_PAGE_ALIGN(start, page_size);
+                end &= ~((uint64_t) page_size - 1);
+
+                if (start < end && _nvm_iova_add_range(&dev->iova, start, end - start) == 0)
+                {
+                    found = true;
+                }
+            }
+        }
+
+        offset = cap->next;
+    }
+
+    free(info);
+
+    if (!found)
+    {
+        return _nvm_iova_add_range(&dev->iova, DEFAULT_IOVA_START, DEFAULT_IOVA_END - DEFAULT_IOVA_START);
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Helper function to map BAR0 and enable memory space access and
+ * bus mastering in the device's command register.
+ */
+static int map_bar(struct vfio_device* dev)
+{
+    struct vfio_region_info bar = { .argsz = sizeof(bar), .index = VFIO_PCI_BAR0_REGION_INDEX };
+    struct vfio_region_info cfg = { .argsz = sizeof(cfg), .index = VFIO_PCI_CONFIG_REGION_INDEX };
+    uint16_t command;
+
+    if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &bar) < 0)
+    {
+        dprintf("Failed to get BAR0 region info: %s\n", strerror(errno));
+        return errno;
+    }
+
+    if (!(bar.flags & VFIO_REGION_INFO_FLAG_MMAP) || bar.size < NVM_CTRL_MEM_MINSIZE)
+    {
+        dprintf("BAR0 can not be memory-mapped\n");
+        return EINVAL;
+    }
+
+    if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &cfg) < 0)
+    {
+        dprintf("Failed to get config space region info: %s\n", strerror(errno));
+        return errno;
+    }
+
+    if (pread(dev->device, &command, sizeof(command), cfg.offset + PCI_COMMAND_OFFSET) != sizeof(command))
+    {
+        dprintf("Failed to read PCI command register: %s\n", strerror(errno));
+        return EIO;
+    }
+
+    command |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+
+    if (pwrite(dev->device, &command, sizeof(command), cfg.offset + PCI_COMMAND_OFFSET) != sizeof(command))
+    {
+        dprintf("Failed to write PCI command register: %s\n", strerror(errno));
+        return EIO;
+    }
+
+    void* ptr = mmap(NULL, bar.size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->device, bar.offset);
+    if (ptr == MAP_FAILED)
+    {
+        dprintf("Failed to map device memory: %s\n", strerror(errno));
+        return errno;
+    }
+
+    dev->bar = ptr;
+    dev->bar_size = bar.size;
+    return 0;
+}
+
+
+
+/*
+ * Helper function to close file descriptors that are open.
+ */
+static void close_device(struct vfio_device* dev)
+{
+    if (dev->device >= 0)
+    {
+        close(dev->device);
+    }
+
+    if (dev->group >= 0)
+    {
+        ioctl(dev->group, VFIO_GROUP_UNSET_CONTAINER);
+        close(dev->group);
+    }
+
+    if (dev->container >= 0)
+    {
+        close(dev->container);
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        if (dev->bars[i] != NULL)
+        {
+            munmap((void*) dev->bars[i], dev->bar_sizes[i]);
+        }
+    }
+
+    _nvm_iova_destroy(&dev->iova);
+    free(dev);
+}
+
+
+
+int _nvm_vfio_open(struct vfio_device** handle, const char* bdf)
+{
+    int err;
+    int group_no;
+    int iommu_type;
+
+    *handle = NULL;
+
+    err = find_group(bdf, &group_no);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    struct vfio_device* dev = (struct vfio_device*) malloc(sizeof(struct vfio_device));
+    if (dev == NULL)
+    {
+        dprintf("Failed to allocate VFIO device descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    dev->container = -1;
+    dev->group = -1;
+    dev->device = -1;
+    dev->bar = NULL;
+    dev->bar_size = 0;
+    memset((void*) dev->bars, 0, sizeof(dev->bars));
+    memset(dev->bar_sizes, 0, sizeof(dev->bar_sizes));
+
+    err = _nvm_iova_init(&dev->iova);
+    if (err != 0)
+    {
+        free(dev);
+        return err;
+    }
+
+    err = open_container(&dev->container, &iommu_type);
+    if (err != 0)
+    {
+        close_device(dev);
+        return err;
+    }
+
+    err = attach_group(dev->container, group_no, iommu_type, &dev->group);
+    if (err != 0)
+    {
+        close_device(dev);
+        return err;
+    }
+
+    err = add_iova_ranges(dev);
+    if (err != 0)
+    {
+        close_device(dev);
+        return err;
+    }
+
+    dev->device = ioctl(dev->group, VFIO_GROUP_GET_DEVICE_FD, bdf);
+    if (dev->device < 0)
+    {
+        err = errno;
+        dprintf("Failed to get VFIO device %s: %s\n", bdf, strerror(err));
+        close_device(dev);
+        return err;
+    }
+
+    err = map_bar(dev);
+    if (err != 0)
+    {
+        close_device(dev);
+        return err;
+    }
+
+    *handle = dev;
+    return 0;
+}
+
+
+
+void _nvm_vfio_close(struct vfio_device* dev)
+{
+    if (dev != NULL)
+    {
+        munmap((void*) dev->bar, dev->bar_size);
+        close_device(dev);
+    }
+}
+
+
+
+int _nvm_vfio_bar(struct vfio_device* dev, int bir, volatile void** ptr, size_t* size, uint64_t* ioaddr)
+{
+    struct vfio_region_info cfg = { .argsz = sizeof(cfg), .index = VFIO_PCI_CONFIG_REGION_INDEX };
+    uint32_t bar[2] = {0, 0};
+
+    if (bir < 0 || bir > VFIO_PCI_BAR5_REGION_INDEX)
+    {
+        return EINVAL;
+    }
+
+    if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &cfg) < 0)
+    {
+        dprintf("Failed to get config space region info: %s\n", strerror(errno));
+        return errno;
+    }
+
+    if (pread(dev->device, &bar[0], sizeof(uint32_t), cfg.offset + PCI_BAR_OFFSET(bir)) != sizeof(uint32_t))
+    {
+        dprintf("Failed to read PCI base address register: %s\n", strerror(errno));
+        return EIO;
+    }
+
+    if (PCI_BAR_64BIT(bar[0]) && bir < VFIO_PCI_BAR5_REGION_INDEX)
+    {
+        if (pread(dev->device, &bar[1], sizeof(uint32_t), cfg.offset + PCI_BAR_OFFSET(bir + 1)) != sizeof(uint32_t))
+        {
+            dprintf("Failed to read PCI base address register: %s\n", strerror(errno));
+            return EIO;
+        }
+    }
+
+    *ioaddr = ((((uint64_t) bar[1]) << 32) | bar[0]) & PCI_BAR_MASK;
+
+    if (bir == VFIO_PCI_BAR0_REGION_INDEX)
+    {
+        *ptr = dev->bar;
+        *size = dev->bar_size;
+        return 0;
+    }
+
+    if (dev->bars[bir] == NULL)
+    {
+        struct vfio_region_info info = { .argsz = sizeof(info), .index = bir };
+
+        if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &info) < 0)
+        {
+            dprintf("Failed to get BAR%d region info: %s\n", bir, strerror(errno));
+            return errno;
+        }
+
+        if (!(info.flags & VFIO_REGION_INFO_FLAG_MMAP))
+        {
+            dprintf("BAR%d can not be memory-mapped\n", bir);
+            return ENOTSUP;
+        }
+
+        void* bar_ptr = mmap(NULL, info.size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->device, info.offset);
+        if (bar_ptr == MAP_FAILED)
+        {
+            dprintf("Failed to map device memory: %s\n", strerror(errno));
+            return errno;
+        }
+
+        dev->bars[bir] = bar_ptr;
+        dev->bar_sizes[bir] = info.size;
+    }
+
+    *ptr = dev->bars[bir];
+    *size = dev->bar_sizes[bir];
+    return 0;
+}
+
+
+
+int _nvm_vfio_map(struct vfio_mapping** handle, struct vfio_device* dev, void* vaddr, size_t page_size, size_t n_pages)
+{
+    int err;
+    size_t size = page_size * n_pages;
+
+    *handle = NULL;
+
+    if (vaddr == NULL || ((uint64_t) vaddr) & (_nvm_host_page_size() - 1) || size == 0)
+    {
+        dprintf("Virtual address is not aligned to system page size\n");
+        return EINVAL;
+    }
+
+    struct vfio_mapping* md = (struct vfio_mapping*) malloc(sizeof(struct vfio_mapping));
+    if (md == NULL)
+    {
+        dprintf("Failed to allocate mapping descriptor: %s\n", strerror(errno));
+        return ENOMEM;
+    }
+
+    md->mapping.vaddr = vaddr;
+    md->mapping.page_size = page_size;
+    md->mapping.n_pages = n_pages;
+    md->dev = dev;
+
+    err = _nvm_iova_alloc(&dev->iova, size, page_size, &md->iova);
+    if (err != 0)
+    {
+        dprintf("Failed to allocate IO address range: %s\n", strerror(err));
+        free(md);
+        return err;
+    }
+
+    struct vfio_iommu_type1_dma_map request = {
+        .argsz = sizeof(request),
+        .flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE,
+        .vaddr = (uint64_t) vaddr,
+        .iova = md->iova,
+        .size = size
+    };
+
+    if (ioctl(dev->container, VFIO_IOMMU_MAP_DMA, &request) < 0)
+    {
+        err = errno;
+        dprintf("Failed to map memory for device: %s\n", strerror(err));
+        _nvm_iova_free(&dev->iova, md->iova, size);
+        free(md);
+        return err;
+    }
+
+    *handle = md;
+    return 0;
+}
+
+
+
+void _nvm_vfio_unmap(struct vfio_mapping* md)
+{
+    size_t size = md->mapping.page_size * md->mapping.n_pages;
+
+    struct vfio_iommu_type1_dma_unmap request = {
+        .argsz = sizeof(request),
+        .flags = 0,
+        .iova = md->iova,
+        .size = size
+    };
+
+    if (ioctl(md->dev->container, VFIO_IOMMU_UNMAP_DMA, &request) < 0)
+    {
+        // Do not reuse addresses that may still be mapped
+        dprintf("Failed to unmap memory for device: %s\n", strerror(errno));
+    }
+    else
+    {
+        _nvm_iova_free(&md->dev->iova, md->iova, size);
+    }
+
+    free(md);
+}
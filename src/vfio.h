@@ -0,0 +1,85 @@
+#ifndef __NVM_INTERNAL_VFIO_H__
+#define __NVM_INTERNAL_VFIO_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "iova.h"
+#include "dma.h"
+
+
+
+/*
+ * VFIO device descriptor.
+ *
+ * Holds the container, group and device file descriptors for a controller
+ * that is bound to the vfio-pci driver, as well as the IOVA allocator used
+ * to place DMA mappings in the container's IO address space.
+ */
+struct vfio_device
+{
+    int                     container;  // VFIO container file descriptor
+    int                     group;      // VFIO group file descriptor
+    int                     device;     // VFIO device file descriptor
+    volatile void*          bar;        // Mapped BAR0
+    size_t                  bar_size;   // Size of mapped BAR0
+    volatile void*          bars[6];    // Other mapped BARs, indexed by BIR (NULL if not mapped)
+    size_t                  bar_sizes[6];   // Sizes of other mapped BARs
+    struct iova_allocator   iova;       // IO virtual address allocator
+};
+
+
+
+/*
+ * VFIO mapping descriptor.
+ * Describes memory mapped into the IO address space of a VFIO container.
+ */
+struct vfio_mapping
+{
+    struct dma_map          mapping;    // DMA mapping descriptor
+    struct vfio_device*     dev;        // Device the memory is mapped for
+    uint64_t                iova;       // IO virtual address of the first page
+};
+
+
+
+/*
+ * Open a VFIO device by its PCI address (domain:bus:device.function),
+ * attach its IOMMU group to a new container and map BAR0.
+ */
+int _nvm_vfio_open(struct vfio_device** dev, const char* bdf);
+
+
+
+/*
+ * Unmap BAR0 and close the device, group and container.
+ * All DMA mappings must be removed before calling this.
+ */
+void _nvm_vfio_close(struct vfio_device* dev);
+
+
+
+/*
+ * Map the BAR indicated by bir and look up its bus address.
+ * BAR0 is already mapped, any other BAR is mapped once per BAR indicator
+ * and unmapped when the device is closed.
+ */
+int _nvm_vfio_bar(struct vfio_device* dev, int bir, volatile void** ptr, size_t* size, uint64_t* ioaddr);
+
+
+
+/*
+ * Map memory into the container's IO address space.
+ * The memory is given one contiguous IO address range aligned to page_size.
+ */
+int _nvm_vfio_map(struct vfio_mapping** md, struct vfio_device* dev, void* vaddr, size_t page_size, size_t n_pages);
+
+
+
+/*
+ * Unmap memory from the IO address space and release mapping descriptor.
+ */
+void _nvm_vfio_unmap(struct vfio_mapping* md);
+
+
+
+#endif /* __NVM_INTERNAL_VFIO_H__ */
@@ -0,0 +1,100 @@
+#include <nvm_types.h>
+#include <nvm_queue.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "wait.h"
+#include "util.h"
+
+
+
+/* Number of pause instructions between clock reads while spinning */
+#define SPIN_BATCH              32
+
+
+/* Default policy, spin long enough to catch fast admin completions */
+#define DEFAULT_SPIN_NS         20000UL
+#define DEFAULT_MIN_SLEEP_NS    1000UL
+#define DEFAULT_MAX_SLEEP_NS    1000000UL
+
+#define DEFAULT_POLICY          { DEFAULT_SPIN_NS, DEFAULT_MIN_SLEEP_NS, DEFAULT_MAX_SLEEP_NS }
+
+
+
+static const nvm_wait_policy_t default_policy = DEFAULT_POLICY;
+
+
+/* Policy used by blocking functions */
+static nvm_wait_policy_t current_policy = DEFAULT_POLICY;
+
+
+/* Serializes access to the policy, so that readers never see a partial update */
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+int nvm_wait_policy_set(const nvm_wait_policy_t* policy)
+{
+    if (policy != NULL && (policy->min_sleep_ns == 0 || policy->max_sleep_ns < policy->min_sleep_ns))
+    {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&policy_lock);
+    current_policy = policy != NULL ? *policy : default_policy;
+    pthread_mutex_unlock(&policy_lock);
+    return 0;
+}
+
+
+
+void nvm_wait_policy_get(nvm_wait_policy_t* policy)
+{
+    pthread_mutex_lock(&policy_lock);
+    *policy = current_policy;
+    pthread_mutex_unlock(&policy_lock);
+}
+
+
+
+void _nvm_wait_start(struct wait_state* wait, uint64_t timeout_ns)
+{
+    nvm_wait_policy_get(&wait->policy);
+    wait->start = _nvm_time_ns();
+    wait->deadline = wait->start + timeout_ns;
+    wait->sleep_ns = wait->policy.min_sleep_ns;
+}
+
+
+
+bool _nvm_wait(struct wait_state* wait)
+{
+    uint64_t now = _nvm_time_ns();
+
+    if (now >= wait->deadline)
+    {
+        return false;
+    }
+
+    if (now - wait->start < wait->policy.spin_ns)
+    {
+        for (size_t i = 0; i < SPIN_BATCH; ++i)
+        {
+            _nvm_cpu_relax();
+        }
+        return true;
+    }
+
+    uint64_t sleep_ns = _MIN(wait->sleep_ns, wait->deadline - now);
+
+    struct timespec ts;
+    ts.tv_sec = sleep_ns / 1000000000UL;
+    ts.tv_nsec = sleep_ns % 1000000000UL;
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+
+    wait->sleep_ns = _MIN(wait->sleep_ns * 2, wait->policy.max_sleep_ns);
+    return true;
+}
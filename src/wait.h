@@ -0,0 +1,67 @@
+#ifndef __NVM_INTERNAL_WAIT_H__
+#define __NVM_INTERNAL_WAIT_H__
+
+#include <nvm_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+
+
+/*
+ * State of an ongoing wait.
+ */
+struct wait_state
+{
+    uint64_t            start;          // Time the wait started
+    uint64_t            deadline;       // Time the wait times out
+    uint64_t            sleep_ns;       // Next sleep interval
+    nvm_wait_policy_t   policy;         // Copy of the policy in effect
+};
+
+
+
+/* Get current monotonic time in nanoseconds */
+static inline uint64_t _nvm_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000UL + ts.tv_nsec;
+}
+
+
+
+/* Hint to the CPU that we are busy-waiting */
+static inline void _nvm_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("yield" ::: "memory");
+#else
+    __asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+
+
+/*
+ * Start waiting, using the current wait policy.
+ * The wait times out after timeout_ns nanoseconds.
+ */
+void _nvm_wait_start(struct wait_state* wait, uint64_t timeout_ns);
+
+
+
+/*
+ * Wait a little before polling again.
+ * Busy-waits within the spin window, and sleeps with exponential backoff
+ * after that, never past the deadline.
+ *
+ * Returns false if the wait has timed out.
+ */
+bool _nvm_wait(struct wait_state* wait);
+
+
+
+#endif /* __NVM_INTERNAL_WAIT_H__ */
@@ -0,0 +1,34 @@
+#ifndef __LIBNVM_TESTS_CHECK_H__
+#define __LIBNVM_TESTS_CHECK_H__
+
+#include <stdio.h>
+
+
+
+/*
+ * Fail the current test function (returning 1) if a condition is false.
+ */
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+
+
+/*
+ * Report the result of a test program and return its exit status.
+ * Combine test functions with || so that the first failure stops the run.
+ */
+static inline int check_report(const char* name, int failed)
+{
+    fprintf(stderr, "%s %s\n", name, failed ? "failed" : "passed");
+    return failed ? 1 : 0;
+}
+
+
+#endif
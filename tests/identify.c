@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Include the parser itself to reach its internal functions */
+#include "../src/identify.c"
+#include "check.h"
+
+
+
+/*
+ * Store a little-endian value in identify data.
+ */
+static void put(unsigned char* data, size_t offset, size_t size, uint64_t value)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[offset + i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+
+
+/*
+ * Store an LBA format descriptor in Identify Namespace data.
+ */
+static void put_lba_format(unsigned char* data, size_t idx, uint16_t ms, uint8_t lbads, uint8_t rp)
+{
+    put(data, 128 + 4 * idx, 2, ms);
+    data[128 + 4 * idx + 2] = lbads;
+    data[128 + 4 * idx + 3] = rp;
+}
+
+
+
+/*
+ * Identify Controller (CNS 01h) of a typical controller. Values derived
+ * from controller registers, such as the page size, are left untouched.
+ */
+static int test_ctrl()
+{
+    unsigned char data[IDENTIFY_DATA_SIZE];
+    struct nvm_ctrl_info info;
+
+    memset(data, 0, sizeof(data));
+    put(data, 0, 2, 0x144d);                        // VID
+    put(data, 2, 2, 0xa801);                        // SSVID
+    memcpy(data + 4, "S4EWNX0R123456      ", 20);   // SN
+    memset(data + 24, ' ', 40);
+    memcpy(data + 24, "Example NVMe SSD 1TB", 20);  // MN
+    memcpy(data + 64, "2B2QEXM7", 8);               // FR
+    put(data, 78, 2, 0x0041);                       // CNTLID
+    put(data, 256, 2, 0x0017);                      // OACS
+    data[258] = 7;                                  // ACL
+    data[512] = 0x66;                               // SQES
+    data[513] = 0x44;                               // CQES
+    put(data, 514, 2, 0);                           // MAXCMD
+    put(data, 516, 4, 1);                           // NN
+    put(data, 520, 2, 0x005f);                      // ONCS
+    put(data, 522, 2, 0x0001);                      // FUSES
+    data[525] = 0x07;                               // VWC
+    put(data, 526, 2, 0xff);                        // AWUN
+    put(data, 528, 2, 0);                           // AWUPF
+    put(data, 532, 2, 0);                           // ACWU
+    put(data, 536, 4, 0x00000002);                  // SGLS
+
+    memset(&info, 0, sizeof(info));
+    info.page_size = 0x1000;
+    _nvm_identify_ctrl(&info, data);
+
+    CHECK(info.page_size == 0x1000);
+    CHECK(info.pci_vendor[0] == 0x4d && info.pci_vendor[1] == 0x14);
+    CHECK(info.pci_vendor[2] == 0x01 && info.pci_vendor[3] == 0xa8);
+    CHECK(memcmp(info.serial_no, "S4EWNX0R123456      ", 20) == 0);
+    CHECK(memcmp(info.model_no, "Example NVMe SSD 1TB", 20) == 0 && info.model_no[39] == ' ');
+    CHECK(memcmp(info.firmware, "2B2QEXM7", 8) == 0);
+    CHECK(info.ctrl_id == 0x41);
+    CHECK(info.admin_cmds == 0x17);
+    CHECK(info.abort_limit == 8);
+    CHECK(info.sq_entry_size == 64 && info.max_sq_entry_size == 64);
+    CHECK(info.cq_entry_size == 16 && info.max_cq_entry_size == 16);
+    CHECK(info.max_out_cmds == 0);
+    CHECK(info.max_n_ns == 1);
+    CHECK(info.nvm_cmds == 0x5f);
+    CHECK(info.fused_ops == 1);
+    CHECK(info.volatile_cache == 1);
+    CHECK(info.atomic_write == 256 && info.atomic_write_pf == 1 && info.atomic_cmp_write == 1);
+    CHECK(info.sgl_support == 1 && info.sgl_dword_align == 1);
+
+    return 0;
+}
+
+
+
+/*
+ * Identify Namespace (CNS 00h) with two LBA formats, the second in use,
+ * and atomicity fields that are not valid according to NSFEAT.
+ */
+static int test_ns()
+{
+    unsigned char data[IDENTIFY_DATA_SIZE];
+    struct nvm_ns_info info;
+
+    memset(data, 0, sizeof(data));
+    put(data, 0, 8, 0x74706db0);                    // NSZE
+    put(data, 8, 8, 0x74706db0);                    // NCAP
+    put(data, 16, 8, 0x1000);                       // NUSE
+    data[24] = 0x10;                                // NSFEAT: performance fields only
+    data[25] = 1;                                   // NLBAF
+    data[26] = 0x11;                                // FLBAS: format 1, extended LBA
+    data[28] = 0x17;                                // DPC
+    data[29] = 0x09;                                // DPS: type 1, first
+    put(data, 34, 2, 7);                            // NAWUN
+    put(data, 46, 2, 0x100);                        // NOIOB
+    put(data, 64, 2, 7);                            // NPWG
+    put(data, 72, 2, 31);                           // NOWS
+    memset(data + 104, 0xab, 16);                   // NGUID
+    memset(data + 120, 0xcd, 8);                    // EUI64
+    put_lba_format(data, 0, 0, 9, 2);
+    put_lba_format(data, 1, 8, 12, 0);
+    put_lba_format(data, 2, 64, 12, 1);             // Not counted by NLBAF
+
+    memset(&info, 0, sizeof(info));
+    info.ns_id = 1;
+    _nvm_identify_ns(&info, data);
+
+    CHECK(info.ns_id == 1);
+    CHECK(info.size == 0x74706db0 && info.capacity == 0x74706db0 && info.utilization == 0x1000);
+    CHECK(info.n_lba_formats == 2 && info.format_idx == 1);
+    CHECK(info.lba_data_size == 4096 && info.metadata_size == 8);
+    CHECK(info.extended_lba == 1);
+    CHECK(info.pi_caps == 0x17 && info.pi_type == 1 && info.pi_first == 1);
+    CHECK(info.lba_formats[0].lba_data_size == 512 && info.lba_formats[0].performance == 2);
+    CHECK(info.lba_formats[2].lba_data_size == 0);
+    CHECK(info.atomic_write == 0);
+    CHECK(info.io_boundary == 0x100);
+    CHECK(info.write_granularity == 8 && info.optimal_write_size == 32);
+    CHECK(info.nguid[0] == 0xab && info.nguid[15] == 0xab && info.eui64[7] == 0xcd);
+
+    return 0;
+}
+
+
+
+/*
+ * Identify Namespace reporting more LBA formats than the data structure
+ * holds (NLBAF is 63), with the last of the 16 formats in use.
+ */
+static int test_ns_many_formats()
+{
+    unsigned char data[IDENTIFY_DATA_SIZE];
+    struct
+    {
+        struct nvm_ns_info  info;
+        unsigned char       canary[256];
+    } ns;
+
+    memset(data, 0, sizeof(data));
+    put(data, 0, 8, 1 << 20);                       // NSZE
+    data[25] = 63;                                  // NLBAF
+    data[26] = 0x6f;                                // FLBAS: format 15, upper format bits set
+    for (size_t i = 0; i < 16; ++i)
+    {
+        put_lba_format(data, i, 8 * i, 9 + (i % 4), i % 4);
+    }
+
+    // Vendor specific area following LBAF15
+    memset(data + 192, 0xff, 192);
+
+    memset(&ns, 0, sizeof(ns));
+    memset(ns.canary, 0x5a, sizeof(ns.canary));
+    _nvm_identify_ns(&ns.info, data);
+
+    CHECK(ns.info.n_lba_formats == 16);
+    CHECK(ns.info.format_idx == 15);
+    CHECK(ns.info.lba_data_size == 4096 && ns.info.metadata_size == 120);
+    CHECK(ns.info.extended_lba == 0);
+    CHECK(ns.info.lba_formats[15].performance == 3);
+
+    for (size_t i = 0; i < sizeof(ns.canary); ++i)
+    {
+        CHECK(ns.canary[i] == 0x5a);
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Active Namespace ID list (CNS 02h), which ends at the first zero entry
+ * or after 1024 entries.
+ */
+static int test_ns_list()
+{
+    unsigned char data[IDENTIFY_DATA_SIZE];
+    uint32_t ns_ids[IDENTIFY_DATA_SIZE / sizeof(uint32_t) + 1];
+
+    memset(data, 0, sizeof(data));
+    put(data, 0, 4, 1);
+    put(data, 4, 4, 2);
+    put(data, 8, 4, 0xfffffffe);
+    put(data, 16, 4, 5);                            // After the list end
+
+    CHECK(_nvm_identify_ns_list(ns_ids, 16, data) == 3);
+    CHECK(ns_ids[0] == 1 && ns_ids[1] == 2 && ns_ids[2] == 0xfffffffe);
+    CHECK(_nvm_identify_ns_list(ns_ids, 2, data) == 2);
+
+    for (size_t i = 0; i < IDENTIFY_DATA_SIZE / sizeof(uint32_t); ++i)
+    {
+        put(data, 4 * i, 4, i + 1);
+    }
+
+    ns_ids[IDENTIFY_DATA_SIZE / sizeof(uint32_t)] = 0;
+    CHECK(_nvm_identify_ns_list(ns_ids, IDENTIFY_DATA_SIZE, data) == IDENTIFY_DATA_SIZE / sizeof(uint32_t));
+    CHECK(ns_ids[1023] == 1024 && ns_ids[IDENTIFY_DATA_SIZE / sizeof(uint32_t)] == 0);
+
+    return 0;
+}
+
+
+
+int main()
+{
+    return check_report("Identify parsing",
+            test_ctrl() != 0 || test_ns() != 0 || test_ns_many_formats() != 0 || test_ns_list() != 0);
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+/* Include the allocator itself to look at its free list */
+#include "../src/iova.c"
+#include "check.h"
+
+
+#define KB(n)   ((uint64_t) (n) << 10)
+#define MB(n)   ((uint64_t) (n) << 20)
+
+
+
+/*
+ * Count free ranges and check that they are sorted and not adjacent.
+ * Returns -1 if the list is inconsistent.
+ */
+static long count_ranges(const struct iova_allocator* alloc)
+{
+    const struct iova_range* prev = NULL;
+    long n = 0;
+
+    for (const struct iova_range* range = alloc->free; range != NULL; range = range->next)
+    {
+        if (range->start >= range->end || (prev != NULL && prev->end >= range->start))
+        {
+            return -1;
+        }
+
+        prev = range;
+        ++n;
+    }
+
+    return n;
+}
+
+
+
+static int test_first_fit(void)
+{
+    struct iova_allocator alloc;
+    uint64_t iova;
+
+    CHECK(_nvm_iova_init(&alloc) == 0);
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(4), &iova) == ENOMEM);
+
+    // Two free ranges, the first one smaller
+    CHECK(_nvm_iova_add_range(&alloc, MB(16), MB(1)) == 0);
+    CHECK(_nvm_iova_add_range(&alloc, MB(1), KB(64)) == 0);
+    CHECK(count_ranges(&alloc) == 2);
+
+    // Allocations are taken from the lowest range that fits
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(4), &iova) == 0);
+    CHECK(iova == MB(1));
+
+    CHECK(_nvm_iova_alloc(&alloc, KB(128), KB(4), &iova) == 0);
+    CHECK(iova == MB(16));
+
+    // Alignment padding is skipped, and remains free on both sides
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(32), &iova) == 0);
+    CHECK(iova == MB(1) + KB(32));
+    CHECK(count_ranges(&alloc) == 3);
+
+    // The padding before the aligned allocation is still used for smaller allocations
+    CHECK(_nvm_iova_alloc(&alloc, KB(28), KB(4), &iova) == 0);
+    CHECK(iova == MB(1) + KB(4));
+    CHECK(count_ranges(&alloc) == 2);
+
+    // Rest of the first range, from the end of the aligned allocation
+    CHECK(_nvm_iova_alloc(&alloc, KB(28), KB(4), &iova) == 0);
+    CHECK(iova == MB(1) + KB(36));
+    CHECK(count_ranges(&alloc) == 1);
+
+    // Alignment larger than any free range start
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), MB(2), &iova) == ENOMEM);
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), MB(16), &iova) == ENOMEM);
+
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), 0, &iova) == EINVAL);
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(3), &iova) == EINVAL);
+    CHECK(_nvm_iova_alloc(&alloc, 0, KB(4), &iova) == EINVAL);
+
+    _nvm_iova_destroy(&alloc);
+    return 0;
+}
+
+
+
+static int test_merge(void)
+{
+    struct iova_allocator alloc;
+    uint64_t iovas[8];
+
+    CHECK(_nvm_iova_init(&alloc) == 0);
+    CHECK(_nvm_iova_add_range(&alloc, MB(1), 8 * KB(4)) == 0);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(4), &iovas[i]) == 0);
+        CHECK(iovas[i] == MB(1) + i * KB(4));
+    }
+
+    // Exhausted
+    CHECK(alloc.free == NULL);
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(4), &iovas[0]) == ENOMEM);
+
+    // Free every other page, so that no ranges are adjacent
+    for (int i = 0; i < 8; i += 2)
+    {
+        _nvm_iova_free(&alloc, iovas[i], KB(4));
+    }
+    CHECK(count_ranges(&alloc) == 4);
+
+    // Two pages are not available contiguously
+    CHECK(_nvm_iova_alloc(&alloc, KB(8), KB(4), &iovas[0]) == ENOMEM);
+
+    // Freeing a page between two free ranges merges all three
+    _nvm_iova_free(&alloc, iovas[1], KB(4));
+    CHECK(count_ranges(&alloc) == 3);
+
+    // Freeing a page next to one free range extends it
+    _nvm_iova_free(&alloc, iovas[7], KB(4));
+    CHECK(count_ranges(&alloc) == 3);
+
+    _nvm_iova_free(&alloc, iovas[3], KB(4));
+    _nvm_iova_free(&alloc, iovas[5], KB(4));
+    CHECK(count_ranges(&alloc) == 1);
+
+    // Everything is one range again
+    CHECK(_nvm_iova_alloc(&alloc, 8 * KB(4), KB(4), &iovas[0]) == 0);
+    CHECK(iovas[0] == MB(1));
+    CHECK(alloc.free == NULL);
+
+    _nvm_iova_destroy(&alloc);
+    return 0;
+}
+
+
+
+static int test_overlap(void)
+{
+    struct iova_allocator alloc;
+    uint64_t iova;
+
+    CHECK(_nvm_iova_init(&alloc) == 0);
+    CHECK(_nvm_iova_add_range(&alloc, MB(1), MB(1)) == 0);
+
+    // Ranges that overlap a free range are rejected
+    CHECK(_nvm_iova_add_range(&alloc, MB(1), KB(4)) == EINVAL);
+    CHECK(_nvm_iova_add_range(&alloc, MB(1) - KB(4), KB(8)) == EINVAL);
+    CHECK(_nvm_iova_add_range(&alloc, MB(2) - KB(4), KB(8)) == EINVAL);
+    CHECK(_nvm_iova_add_range(&alloc, 0, MB(4)) == EINVAL);
+
+    // Empty and wrapping ranges are rejected
+    CHECK(_nvm_iova_add_range(&alloc, MB(4), 0) == EINVAL);
+    CHECK(_nvm_iova_add_range(&alloc, UINT64_MAX - KB(4), KB(8)) == EINVAL);
+    CHECK(count_ranges(&alloc) == 1);
+
+    // Adjacent ranges are merged
+    CHECK(_nvm_iova_add_range(&alloc, MB(2), MB(1)) == 0);
+    CHECK(_nvm_iova_add_range(&alloc, 0, MB(1)) == 0);
+    CHECK(count_ranges(&alloc) == 1);
+
+    // Freeing a range that is already free leaves the list untouched
+    CHECK(_nvm_iova_alloc(&alloc, KB(4), KB(4), &iova) == 0);
+    CHECK(iova == 0);
+    _nvm_iova_free(&alloc, KB(4), KB(4));
+    CHECK(count_ranges(&alloc) == 1);
+
+    _nvm_iova_free(&alloc, iova, KB(4));
+    CHECK(count_ranges(&alloc) == 1);
+    CHECK(_nvm_iova_alloc(&alloc, MB(3), KB(4), &iova) == 0);
+    CHECK(iova == 0);
+
+    _nvm_iova_destroy(&alloc);
+    return 0;
+}
+
+
+
+int main()
+{
+    return check_report("IOVA allocator", test_first_fit() != 0 || test_merge() != 0 || test_overlap() != 0);
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Include the implementation itself to test the same code as the library */
+#include "../src/pi.c"
+#include "check.h"
+
+
+
+/*
+ * Calculate the CRC one bit at the time, without lookup tables.
+ */
+static uint16_t crc_bitwise(uint16_t crc, const unsigned char* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc ^= data[i] << 8;
+
+        for (size_t bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ CRC16_T10DIF_POLY : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+
+
+/*
+ * Calculate the CRC one byte at the time, so that only the bytewise path
+ * of nvm_crc16_t10dif() is used.
+ */
+static uint16_t crc_bytewise(const unsigned char* data, size_t size)
+{
+    uint16_t crc = 0;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = nvm_crc16_t10dif(crc, data + i, 1);
+    }
+
+    return crc;
+}
+
+
+
+/*
+ * Check value of the CRC catalogue ("123456789"), which is shorter than
+ * eight bytes plus a tail, so both paths are used.
+ */
+static int test_check_value()
+{
+    const unsigned char* data = (const unsigned char*) "123456789";
+
+    CHECK(crc_bitwise(0, data, 9) == 0xd0db);
+    CHECK(crc_bytewise(data, 9) == 0xd0db);
+    CHECK(nvm_crc16_t10dif(0, data, 9) == 0xd0db);
+    CHECK(nvm_crc16_t10dif(nvm_crc16_t10dif(0, data, 4), data + 4, 5) == 0xd0db);
+
+    return 0;
+}
+
+
+
+/*
+ * Guard of whole 512-byte blocks, which only use the slice-by-8 path.
+ */
+static int test_block()
+{
+    unsigned char data[512];
+
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = (unsigned char) i;
+    }
+
+    CHECK(crc_bitwise(0, data, sizeof(data)) == 0x4f10);
+    CHECK(crc_bytewise(data, sizeof(data)) == 0x4f10);
+    CHECK(nvm_crc16_t10dif(0, data, sizeof(data)) == 0x4f10);
+
+    memset(data, 0xff, sizeof(data));
+    CHECK(crc_bitwise(0, data, sizeof(data)) == 0xe6a1);
+    CHECK(crc_bytewise(data, sizeof(data)) == 0xe6a1);
+    CHECK(nvm_crc16_t10dif(0, data, sizeof(data)) == 0xe6a1);
+
+    return 0;
+}
+
+
+
+/*
+ * Both paths agree for every length and alignment up to a few slices.
+ */
+static int test_lengths()
+{
+    unsigned char data[64];
+
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = (unsigned char) (i * 0x9d + 0x35);
+    }
+
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        for (size_t size = 0; offset + size <= sizeof(data); ++size)
+        {
+            uint16_t expected = crc_bitwise(0, data + offset, size);
+
+            CHECK(crc_bytewise(data + offset, size) == expected);
+            CHECK(nvm_crc16_t10dif(0, data + offset, size) == expected);
+            CHECK(nvm_crc16_t10dif(0x1234, data + offset, size) == crc_bitwise(0x1234, data + offset, size));
+        }
+    }
+
+    return 0;
+}
+
+
+
+int main()
+{
+    return check_report("CRC16 T10-DIF", test_check_value() != 0 || test_block() != 0 || test_lengths() != 0);
+}
@@ -0,0 +1,10 @@
+#ifndef __NVM_TESTS_SHIM_ASM_ERRNO_H__
+#define __NVM_TESTS_SHIM_ASM_ERRNO_H__
+
+/*
+ * The C library's errno.h includes asm/errno.h itself, so take the error
+ * numbers from the generic kernel UAPI header rather than from errno.h.
+ */
+#include <asm-generic/errno.h>
+
+#endif /* __NVM_TESTS_SHIM_ASM_ERRNO_H__ */
@@ -0,0 +1,124 @@
+#ifndef __NVM_TESTS_SHIM_LINUX_RBTREE_H__
+#define __NVM_TESTS_SHIM_LINUX_RBTREE_H__
+
+/*
+ * Userspace stand-in for the kernel's red-black tree interface.
+ *
+ * Nodes are kept in a plain binary search tree without rebalancing. Users
+ * only link nodes at leaves and walk rb_left and rb_right, so the order of
+ * nodes is the same as with the kernel's implementation, only the shape of
+ * the tree differs.
+ */
+#include <stddef.h>
+
+
+struct rb_node
+{
+    struct rb_node*     rb_parent;
+    struct rb_node*     rb_right;
+    struct rb_node*     rb_left;
+};
+
+
+struct rb_root
+{
+    struct rb_node*     rb_node;
+};
+
+
+#define RB_ROOT                 (struct rb_root) { NULL }
+
+#define RB_CLEAR_NODE(node)     ((node)->rb_parent = (node))
+
+#define RB_EMPTY_NODE(node)     ((node)->rb_parent == (node))
+
+#define rb_entry(ptr, type, member) \
+    ((type*) (((char*) (ptr)) - offsetof(type, member)))
+
+
+static inline void rb_link_node(struct rb_node* node, struct rb_node* parent, struct rb_node** link)
+{
+    node->rb_parent = parent;
+    node->rb_left = NULL;
+    node->rb_right = NULL;
+    *link = node;
+}
+
+
+static inline void rb_insert_color(struct rb_node* node, struct rb_root* root)
+{
+    (void) node;
+    (void) root;
+}
+
+
+static inline struct rb_node* rb_first(const struct rb_root* root)
+{
+    struct rb_node* node = root->rb_node;
+
+    while (node != NULL && node->rb_left != NULL)
+    {
+        node = node->rb_left;
+    }
+
+    return node;
+}
+
+
+static inline void __rb_replace(struct rb_node* node, struct rb_node* child, struct rb_root* root)
+{
+    struct rb_node* parent = node->rb_parent;
+
+    if (child != NULL)
+    {
+        child->rb_parent = parent;
+    }
+
+    if (parent == NULL)
+    {
+        root->rb_node = child;
+    }
+    else if (parent->rb_left == node)
+    {
+        parent->rb_left = child;
+    }
+    else
+    {
+        parent->rb_right = child;
+    }
+}
+
+
+static inline void rb_erase(struct rb_node* node, struct rb_root* root)
+{
+    if (node->rb_left == NULL)
+    {
+        __rb_replace(node, node->rb_right, root);
+    }
+    else if (node->rb_right == NULL)
+    {
+        __rb_replace(node, node->rb_left, root);
+    }
+    else
+    {
+        // Replace node with its successor, the leftmost node of the right subtree
+        struct rb_node* next = node->rb_right;
+        while (next->rb_left != NULL)
+        {
+            next = next->rb_left;
+        }
+
+        if (next->rb_parent != node)
+        {
+            __rb_replace(next, next->rb_right, root);
+            next->rb_right = node->rb_right;
+            next->rb_right->rb_parent = next;
+        }
+
+        __rb_replace(node, next, root);
+        next->rb_left = node->rb_left;
+        next->rb_left->rb_parent = next;
+    }
+}
+
+#endif /* __NVM_TESTS_SHIM_LINUX_RBTREE_H__ */
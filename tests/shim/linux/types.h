@@ -0,0 +1,16 @@
+#ifndef __NVM_TESTS_SHIM_LINUX_TYPES_H__
+#define __NVM_TESTS_SHIM_LINUX_TYPES_H__
+
+/*
+ * Userspace stand-in for the kernel's type definitions, so that module
+ * code without other kernel dependencies can be built in tests.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+#endif /* __NVM_TESTS_SHIM_LINUX_TYPES_H__ */
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+#include "check.h"
+
+
+#define N_RANGES        64
+#define RANGE_SIZE      0x2000
+#define RANGE_STRIDE    0x3000
+#define RANGE_BASE      0x10000
+
+
+/*
+ * Node type as used by the module, with the tree node first.
+ */
+struct mapping
+{
+    struct map_tree_node    node;
+    size_t                  idx;
+};
+
+
+static struct mapping ranges[N_RANGES];
+
+
+
+/* Insert ranges in an order that is not sorted by address */
+static size_t scrambled(size_t i)
+{
+    return (i * 37) % N_RANGES;
+}
+
+
+
+static int check_lookup(struct map_tree* tree, const int* inserted)
+{
+    size_t i;
+
+    CHECK(map_tree_find(tree, 0) == NULL);
+    CHECK(map_tree_find(tree, RANGE_BASE - 1) == NULL);
+
+    for (i = 0; i < N_RANGES; ++i)
+    {
+        u64 start = RANGE_BASE + i * RANGE_STRIDE;
+        void* expected = inserted[i] ? &ranges[i] : NULL;
+
+        CHECK(map_tree_find(tree, start) == expected);
+        CHECK(map_tree_find(tree, start + RANGE_SIZE / 2) == expected);
+        CHECK(map_tree_find(tree, start + RANGE_SIZE - 1) == expected);
+
+        // Gap between ranges
+        CHECK(map_tree_find(tree, start + RANGE_SIZE) == NULL);
+        CHECK(map_tree_find(tree, start + RANGE_STRIDE - 1) == NULL);
+    }
+
+    return 0;
+}
+
+
+
+static int test_insert(struct map_tree* tree, int* inserted)
+{
+    struct mapping other;
+    size_t i;
+
+    for (i = 0; i < N_RANGES; ++i)
+    {
+        size_t idx = scrambled(i);
+
+        map_tree_node_init(&ranges[idx], RANGE_BASE + idx * RANGE_STRIDE, RANGE_SIZE);
+        ranges[idx].idx = idx;
+
+        CHECK(map_tree_insert(tree, &ranges[idx]) == 0);
+        CHECK(ranges[idx].node.tree == tree);
+        inserted[idx] = 1;
+    }
+
+    CHECK(tree->count == N_RANGES);
+
+    // Ranges overlapping the start, the end, or all of an existing range
+    map_tree_node_init(&other, RANGE_BASE + RANGE_SIZE - 1, RANGE_SIZE);
+    CHECK(map_tree_insert(tree, &other) == -EEXIST);
+
+    map_tree_node_init(&other, RANGE_BASE + RANGE_STRIDE - 1, 2);
+    CHECK(map_tree_insert(tree, &other) == -EEXIST);
+
+    map_tree_node_init(&other, RANGE_BASE - 1, RANGE_STRIDE);
+    CHECK(map_tree_insert(tree, &other) == -EEXIST);
+
+    map_tree_node_init(&other, RANGE_BASE + RANGE_STRIDE + 1, 1);
+    CHECK(map_tree_insert(tree, &other) == -EEXIST);
+    CHECK(other.node.tree == NULL);
+    CHECK(tree->count == N_RANGES);
+
+    // A range that fills a gap exactly does not overlap
+    map_tree_node_init(&other, RANGE_BASE + RANGE_SIZE, RANGE_STRIDE - RANGE_SIZE);
+    CHECK(map_tree_insert(tree, &other) == 0);
+    CHECK(map_tree_find(tree, RANGE_BASE + RANGE_SIZE) == &other);
+    CHECK(map_tree_find(tree, RANGE_BASE + RANGE_STRIDE) == &ranges[1]);
+    map_tree_remove(&other);
+    CHECK(other.node.tree == NULL);
+    CHECK(tree->count == N_RANGES);
+
+    return check_lookup(tree, inserted);
+}
+
+
+
+static int test_remove(struct map_tree* tree, int* inserted)
+{
+    size_t i;
+
+    // Remove every other range, in a different order than they were inserted
+    for (i = 0; i < N_RANGES; i += 2)
+    {
+        size_t idx = scrambled(N_RANGES - 1 - i);
+
+        map_tree_remove(&ranges[idx]);
+        CHECK(ranges[idx].node.tree == NULL);
+        inserted[idx] = 0;
+
+        // Removing twice is harmless
+        map_tree_remove(&ranges[idx]);
+    }
+
+    CHECK(tree->count == N_RANGES / 2);
+
+    if (check_lookup(tree, inserted) != 0)
+    {
+        return 1;
+    }
+
+    // Insert removed ranges again
+    for (i = 0; i < N_RANGES; ++i)
+    {
+        if (!inserted[i])
+        {
+            CHECK(map_tree_insert(tree, &ranges[i]) == 0);
+            inserted[i] = 1;
+        }
+    }
+
+    CHECK(tree->count == N_RANGES);
+    return check_lookup(tree, inserted);
+}
+
+
+
+static int test_drain(struct map_tree* tree)
+{
+    struct mapping* map;
+    size_t next = 0;
+
+    // Draining the tree as the module does on release visits ranges in order
+    while ((map = map_tree_first(tree)) != NULL)
+    {
+        CHECK(map->idx == next);
+        map_tree_remove(map);
+        ++next;
+    }
+
+    CHECK(next == N_RANGES);
+    CHECK(tree->count == 0);
+    CHECK(map_tree_find(tree, RANGE_BASE) == NULL);
+
+    return 0;
+}
+
+
+
+int main()
+{
+    struct map_tree tree;
+    int inserted[N_RANGES] = { 0 };
+
+    map_tree_init(&tree);
+    if (map_tree_first(&tree) != NULL || tree.count != 0)
+    {
+        fprintf(stderr, "Tree is not empty after initialization\n");
+        return 1;
+    }
+
+    return check_report("Tree", test_insert(&tree, inserted) != 0
+            || test_remove(&tree, inserted) != 0
+            || test_drain(&tree) != 0);
+}